@@ -0,0 +1,200 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "traffic/engine.h"
+
+#include "agentrenderer.h"
+
+#include <cstddef>
+
+using namespace traffic;
+using namespace glm;
+
+// ---- AgentShader ---- //
+
+void AgentShader::initializeUniforms()
+{
+	uniformMVP = uniformLocation("mvp");
+	uniformSize = uniformLocation("size");
+	uniformMaxSpeed = uniformLocation("maxSpeed");
+}
+
+std::vector<char> AgentShader::retrieveVertexShader()
+{
+	return lt::render::toArray(R"(
+	#version 330
+
+	uniform mat4 mvp;
+	uniform float size;
+	uniform float maxSpeed;
+
+	layout (location = 0) in vec2 vVertex;
+	layout (location = 1) in vec2 iPosition;
+	layout (location = 2) in float iHeading;
+	layout (location = 3) in float iSpeed;
+	out vec3 mixedColor;
+
+	void main(void) {
+		// agents that are not driving are moved out of the clip space
+		if (iSpeed < 0.0) {
+			gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+			mixedColor = vec3(0.0);
+			return;
+		}
+		float c = cos(iHeading), s = sin(iHeading);
+		vec2 pos = iPosition + mat2(c, s, -s, c) * vVertex * size;
+		gl_Position = mvp * vec4(pos, 0.0, 1.0);
+
+		// red for standing traffic, yellow to green up to the maximum speed
+		float t = clamp(iSpeed / maxSpeed, 0.0, 1.0);
+		mixedColor = t < 0.5 ?
+			mix(vec3(1.0, 0.0, 0.0), vec3(1.0, 1.0, 0.0), t * 2.0) :
+			mix(vec3(1.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0), t * 2.0 - 1.0);
+	})");
+}
+
+std::vector<char> AgentShader::retrieveFragmentShader()
+{
+	return lt::render::toArray(R"(
+	#version 330
+	in vec3 mixedColor;
+
+	out vec4 color;
+
+	void main() {
+		color = vec4(mixedColor, 1.0);
+	})");
+}
+
+void AgentShader::loadMVP(const glm::mat4& mat) { loadMat4x4(uniformMVP, mat); }
+void AgentShader::loadSize(float size) { loadFloat(uniformSize, size); }
+void AgentShader::loadMaxSpeed(float speed) { loadFloat(uniformMaxSpeed, speed); }
+
+// ---- AgentRenderer ---- //
+
+AgentRenderer::AgentRenderer(size_t capacity)
+{
+	m_shader.create();
+
+	// a triangle of unit length that points along the x axis
+	const vec2 shape[] = { { 0.5f, 0.0f }, { -0.5f, 0.3f }, { -0.5f, -0.3f } };
+	CGL(glGenVertexArrays(1, &m_vao));
+	CGL(glBindVertexArray(m_vao));
+	CGL(glGenBuffers(1, &m_shape));
+	CGL(glBindBuffer(GL_ARRAY_BUFFER, m_shape));
+	CGL(glBufferData(GL_ARRAY_BUFFER, sizeof(shape), shape, GL_STATIC_DRAW));
+	CGL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), nullptr));
+	CGL(glEnableVertexAttribArray(0));
+
+	// the instance attributes advance once per agent
+	for (GLuint attribute = 1; attribute <= 3; attribute++) {
+		CGL(glEnableVertexAttribArray(attribute));
+		CGL(glVertexAttribDivisor(attribute, 1));
+	}
+	CGL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+	CGL(glBindVertexArray(0));
+
+	resize(std::max<size_t>(capacity, 1));
+}
+
+AgentRenderer::~AgentRenderer()
+{
+	m_stream.cleanUp();
+	glDeleteBuffers(1, &m_shape);
+	glDeleteVertexArrays(1, &m_vao);
+}
+
+void AgentRenderer::resize(size_t capacity)
+{
+	// Buffers that are still in use are released by the driver later
+	m_stream.cleanUp();
+	m_stream = lt::GLStreamBuffer(GL_ARRAY_BUFFER,
+		static_cast<GLsizeiptr>(capacity * sizeof(AgentInstance)), 3);
+	m_capacity = capacity;
+}
+
+void AgentRenderer::update(const World& world, vec2 center)
+{
+	m_count = 0;
+	const auto& graph = world.getGraph();
+	if (!graph || !graph->getFastGraph()) return;
+
+	// the projected nodes are only updated if the graph changed
+	const FastGraph* fastGraph = graph->getFastGraph();
+	if (m_instances.getGraph() != fastGraph || m_center != center ||
+		m_instances.countNodes() != fastGraph->countNodes()) {
+		m_instances.setGraph(*fastGraph, center);
+		m_center = center;
+	}
+
+	size_t agents = world.getAgents().size();
+	if (agents == 0) return;
+	if (agents > m_capacity) {
+		size_t capacity = m_capacity;
+		while (capacity < agents) capacity *= 2;
+		resize(capacity);
+	}
+
+	auto* out = static_cast<AgentInstance*>(m_stream.map());
+	if (!out) {
+		m_stream.unbind();
+		return;
+	}
+	m_instances.write(world, out);
+	m_offset = m_stream.unmap();
+	m_count = agents;
+}
+
+void AgentRenderer::render(const glm::mat4& mvp)
+{
+	if (m_count == 0) return;
+	m_shader.bind();
+	m_shader.loadMVP(mvp);
+	m_shader.loadSize(m_size);
+	m_shader.loadMaxSpeed(m_maxSpeed);
+
+	// the instance attributes point to the region of the last update
+	CGL(glBindVertexArray(m_vao));
+	m_stream.bind();
+	auto attribute = [this](GLuint index, GLint size, size_t offset) {
+		CGL(glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, sizeof(AgentInstance),
+			reinterpret_cast<void*>(m_offset + offset)));
+	};
+	attribute(1, 2, offsetof(AgentInstance, position));
+	attribute(2, 1, offsetof(AgentInstance, heading));
+	attribute(3, 1, offsetof(AgentInstance, speed));
+
+	CGL(glDrawArraysInstanced(GL_TRIANGLES, 0, 3, static_cast<GLsizei>(m_count)));
+	lt::render::addDrawCalls(1);
+	m_stream.fence();
+
+	m_stream.unbind();
+	CGL(glBindVertexArray(0));
+	m_shader.release();
+}
+
+void AgentRenderer::setSize(float size) { m_size = size; }
+void AgentRenderer::setMaxSpeed(float speed) { m_maxSpeed = speed; }
+size_t AgentRenderer::countInstances() const { return m_count; }
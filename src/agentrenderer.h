@@ -0,0 +1,102 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef AGENTRENDERER_H
+#define AGENTRENDERER_H
+
+#include "traffic/engine.h"
+#include "engine/shader.hpp"
+#include "engine/glmodel.hpp"
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "traffic/agent.h"
+#include "traffic/osm_mesh.h"
+
+/// <summary>
+/// Draws every agent as a small triangle that points in its driving direction.
+/// The color of an agent is computed from its speed in the vertex shader.
+/// </summary>
+class AgentShader : public lt::render::ShaderBase {
+protected:
+	GLint uniformMVP, uniformSize, uniformMaxSpeed;
+
+public:
+	virtual void initializeUniforms();
+	virtual std::vector<char> retrieveVertexShader();
+	virtual std::vector<char> retrieveFragmentShader();
+
+	void loadMVP(const glm::mat4 &mat);
+	/// <summary>The length of an agent in plane units</summary>
+	void loadSize(float size);
+	/// <summary>The speed that is drawn in full green, slower agents turn red</summary>
+	void loadMaxSpeed(float speed);
+};
+
+/// <summary>
+/// Renders all agents of a world with a single instanced draw call. The agent
+/// data is streamed every frame into a triple buffered instance buffer, the
+/// CPU writes one region while the GPU still reads the previous ones.
+/// </summary>
+class AgentRenderer {
+public:
+	/// <summary>Creates the OpenGL resources, requires an active context</summary>
+	/// <param name="capacity">The initial number of agents per region</param>
+	explicit AgentRenderer(size_t capacity = 1 << 14);
+	~AgentRenderer();
+
+	AgentRenderer(const AgentRenderer&) = delete;
+	AgentRenderer& operator=(const AgentRenderer&) = delete;
+
+	/// <summary>Streams the current state of all agents to the GPU</summary>
+	/// <param name="world">The world whose agents are drawn</param>
+	/// <param name="center">The projection center of the map in (lon, lat) format</param>
+	void update(const traffic::World &world, glm::vec2 center);
+	/// <summary>Draws the agents that were streamed by the last update</summary>
+	void render(const glm::mat4 &mvp);
+
+	void setSize(float size);
+	void setMaxSpeed(float speed);
+	size_t countInstances() const;
+
+protected:
+	void resize(size_t capacity);
+
+	AgentShader m_shader;
+	traffic::AgentInstances m_instances;
+	lt::GLStreamBuffer m_stream;
+	glm::vec2 m_center = glm::vec2(0.0f);
+	size_t m_capacity = 0;
+	size_t m_count = 0;
+	GLintptr m_offset = 0;
+	GLuint m_vao = 0, m_shape = 0;
+	float m_size = 1e-4f;
+	float m_maxSpeed = 13.9f;
+};
+
+#endif
@@ -25,6 +25,9 @@
 
 #include "glmodel.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+
 using namespace lt;
 using namespace lt::resource;
 
@@ -203,16 +206,355 @@ void GLModel::unbind() {
 }
 
 void GLModel::cleanUp() {
+    if (vio) glDeleteBuffers(1, &vio);
 	glDeleteBuffers(1, &vbo);
 	glDeleteVertexArrays(1, &vao);
     vbo = std::numeric_limits<GLuint>::max();
     vao = std::numeric_limits<GLuint>::max();
+    vio = 0;
 }
 
 GLsizei GLModel::getSize() const { return modelSize; }
+GLsizei GLModel::getIndexSize() const { return indexSize; }
+ModelType GLModel::getType() const { return type; }
 GLuint GLModel::getVAO() const { return vao; }
 GLuint GLModel::getVBO() const { return vbo; }
 
+// ---- GLStreamBuffer ---- //
+
+GLStreamBuffer::GLStreamBuffer(GLenum target, GLsizeiptr regionSize, size_t regions) {
+    this->target = target;
+    this->regionSize = regionSize;
+    fences.assign(std::max<size_t>(regions, 1), nullptr);
+    current = fences.size() - 1;
+
+    CGL(glGenBuffers(1, &buffer));
+    CGL(glBindBuffer(target, buffer));
+    CGL(glBufferData(target, regionSize * fences.size(), nullptr, GL_STREAM_DRAW));
+    CGL(glBindBuffer(target, 0));
+}
+
+void* GLStreamBuffer::map() {
+    current = (current + 1) % fences.size();
+    GLsync& sync = fences[current];
+    if (sync) {
+        // the first wait flushes the command queue, later waits do not need to
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(sync, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+            flags = 0;
+        glDeleteSync(sync);
+        sync = nullptr;
+    }
+
+    CGL(glBindBuffer(target, buffer));
+    return glMapBufferRange(target, current * regionSize, regionSize,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+GLintptr GLStreamBuffer::unmap() {
+    CGL(glUnmapBuffer(target));
+    CGL(glBindBuffer(target, 0));
+    return static_cast<GLintptr>(current * regionSize);
+}
+
+void GLStreamBuffer::fence() {
+    if (fences[current]) glDeleteSync(fences[current]);
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void GLStreamBuffer::cleanUp() {
+    for (GLsync& sync : fences) {
+        if (sync) glDeleteSync(sync);
+        sync = nullptr;
+    }
+    if (buffer) glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void GLStreamBuffer::bind() { CGL(glBindBuffer(target, buffer)); }
+void GLStreamBuffer::unbind() { CGL(glBindBuffer(target, 0)); }
+
+GLuint GLStreamBuffer::getBuffer() const { return buffer; }
+GLsizeiptr GLStreamBuffer::getRegionSize() const { return regionSize; }
+size_t GLStreamBuffer::countRegions() const { return fences.size(); }
+
+// ---- GLLineBatch ---- //
+GLLineBatch::GLLineBatch(ModelType type, glm::vec3 color) {
+    if (type != ModelType::LINE_STRIP_INDEXED && type != ModelType::VERTEX2D)
+        throw std::runtime_error("Line batches only support line strips and 2D vertices");
+    this->type = type;
+    this->color = color;
+}
+
+GLLineBatch::~GLLineBatch() { cleanUp(); }
+
+size_t GLLineBatch::allocate(size_t vertices, size_t indices) {
+    if (vertexCount + vertices > vertexCapacity || indexCount + indices > indexCapacity) {
+        // The buffers are compacted and get twice the room of the used data
+        size_t usedVertices = vertexCount - garbageVertices + vertices;
+        size_t usedIndices = indexCount - garbageIndices + indices;
+        relocate(std::max<size_t>(usedVertices * 2, 1024),
+            type == ModelType::VERTEX2D ? 0 : std::max<size_t>(usedIndices * 2, 1024));
+    }
+
+    size_t mesh = meshes.size();
+    if (freeMeshes.empty()) meshes.emplace_back();
+    else {
+        mesh = freeMeshes.back();
+        freeMeshes.pop_back();
+    }
+    Range& range = meshes[mesh];
+    range.firstVertex = static_cast<GLint>(vertexCount);
+    range.vertexCount = static_cast<GLsizei>(vertices);
+    range.firstIndex = indexCount;
+    range.indexCount = static_cast<GLsizei>(indices);
+    range.used = true;
+    vertexCount += vertices;
+    indexCount += indices;
+    return mesh;
+}
+
+void GLLineBatch::relocate(size_t newVertexCapacity, size_t newIndexCapacity) {
+    auto create = [](size_t size) {
+        GLuint buffer = 0;
+        CGL(glGenBuffers(1, &buffer));
+        CGL(glBindBuffer(GL_COPY_WRITE_BUFFER, buffer));
+        CGL(glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW));
+        return buffer;
+    };
+    GLuint newVBO = create(newVertexCapacity * sizeof(glm::vec2));
+    GLuint newCBO = type == ModelType::VERTEX2D ?
+        create(newVertexCapacity * sizeof(glm::vec3)) : 0;
+    GLuint newVIO = type == ModelType::LINE_STRIP_INDEXED ?
+        create(newIndexCapacity * sizeof(uint32_t)) : 0;
+
+    // The used ranges are moved to the front of the new buffers
+    std::vector<Range> moved(meshes);
+    size_t vertex = 0, index = 0;
+    for (Range& range : moved) {
+        if (!range.used) continue;
+        range.firstVertex = static_cast<GLint>(vertex);
+        range.firstIndex = index;
+        vertex += range.vertexCount;
+        index += range.indexCount;
+    }
+    auto copy = [this, &moved](GLuint from, GLuint to, size_t stride, bool indices) {
+        if (!from) return;
+        CGL(glBindBuffer(GL_COPY_READ_BUFFER, from));
+        CGL(glBindBuffer(GL_COPY_WRITE_BUFFER, to));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const Range& src = meshes[i], &dst = moved[i];
+            size_t count = indices ? src.indexCount : src.vertexCount;
+            if (!src.used || count == 0) continue;
+            CGL(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                (indices ? src.firstIndex : src.firstVertex) * stride,
+                (indices ? dst.firstIndex : dst.firstVertex) * stride,
+                count * stride));
+        }
+    };
+    copy(vbo, newVBO, sizeof(glm::vec2), false);
+    copy(cbo, newCBO, sizeof(glm::vec3), false);
+    copy(vio, newVIO, sizeof(uint32_t), true);
+    CGL(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    CGL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+
+    if (vbo) glDeleteBuffers(1, &vbo);
+    if (cbo) glDeleteBuffers(1, &cbo);
+    if (vio) glDeleteBuffers(1, &vio);
+    vbo = newVBO;
+    cbo = newCBO;
+    vio = newVIO;
+    meshes = std::move(moved);
+    vertexCapacity = newVertexCapacity;
+    indexCapacity = newIndexCapacity;
+    vertexCount = vertex;
+    indexCount = index;
+    garbageVertices = 0;
+    garbageIndices = 0;
+
+    // The vertex array refers to the new buffers
+    if (!vao) CGL(glGenVertexArrays(1, &vao));
+    CGL(glBindVertexArray(vao));
+    CGL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+    CGL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), nullptr));
+    CGL(glEnableVertexAttribArray(0));
+    if (cbo) {
+        CGL(glBindBuffer(GL_ARRAY_BUFFER, cbo));
+        CGL(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr));
+        CGL(glEnableVertexAttribArray(1));
+    }
+    if (vio) CGL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vio));
+    CGL(glBindVertexArray(0));
+    CGL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+size_t GLLineBatch::addLines(const std::vector<glm::vec2>& points, const std::vector<glm::vec3>& colors) {
+    if (type != ModelType::VERTEX2D)
+        throw std::runtime_error("Line lists require a VERTEX2D batch");
+    if (points.size() != colors.size())
+        throw std::runtime_error("Every point requires a color");
+    if (points.empty()) return INVALID_MESH;
+
+    size_t mesh = allocate(points.size(), 0);
+    const Range& range = meshes[mesh];
+    CGL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+    CGL(glBufferSubData(GL_ARRAY_BUFFER, range.firstVertex * sizeof(glm::vec2),
+        points.size() * sizeof(glm::vec2), points.data()));
+    CGL(glBindBuffer(GL_ARRAY_BUFFER, cbo));
+    CGL(glBufferSubData(GL_ARRAY_BUFFER, range.firstVertex * sizeof(glm::vec3),
+        colors.size() * sizeof(glm::vec3), colors.data()));
+    CGL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    return mesh;
+}
+
+size_t GLLineBatch::addStrip(const std::vector<glm::vec2>& vertices, const std::vector<uint32_t>& indices) {
+    if (type != ModelType::LINE_STRIP_INDEXED)
+        throw std::runtime_error("Line strips require a LINE_STRIP_INDEXED batch");
+    if (vertices.empty() || indices.empty()) return INVALID_MESH;
+
+    size_t mesh = allocate(vertices.size(), indices.size());
+    const Range& range = meshes[mesh];
+    CGL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+    CGL(glBufferSubData(GL_ARRAY_BUFFER, range.firstVertex * sizeof(glm::vec2),
+        vertices.size() * sizeof(glm::vec2), vertices.data()));
+    CGL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    // The element buffer binding belongs to the vertex array
+    CGL(glBindBuffer(GL_COPY_WRITE_BUFFER, vio));
+    CGL(glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstIndex * sizeof(uint32_t),
+        indices.size() * sizeof(uint32_t), indices.data()));
+    CGL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    return mesh;
+}
+
+void GLLineBatch::remove(size_t mesh) {
+    if (mesh >= meshes.size() || !meshes[mesh].used) return;
+    Range& range = meshes[mesh];
+    garbageVertices += range.vertexCount;
+    garbageIndices += range.indexCount;
+    range = Range();
+    freeMeshes.push_back(mesh);
+}
+
+void GLLineBatch::clear() {
+    meshes.clear();
+    freeMeshes.clear();
+    queued.clear();
+    vertexCount = indexCount = 0;
+    garbageVertices = garbageIndices = 0;
+}
+
+void GLLineBatch::queue(size_t mesh, GLuint transform) {
+    if (mesh < meshes.size() && meshes[mesh].used)
+        queued.emplace_back(transform, mesh);
+}
+
+size_t GLLineBatch::draw(const std::function<void(GLuint)>& selectTransform) {
+    if (queued.empty()) return 0;
+    std::stable_sort(queued.begin(), queued.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    CGL(glBindVertexArray(vao));
+    // strips have no color array, the constant attribute is used
+    if (type == ModelType::LINE_STRIP_INDEXED)
+        CGL(glVertexAttrib3f(1, color.r, color.g, color.b));
+
+    size_t calls = 0;
+    for (size_t begin = 0, end = 0; begin < queued.size(); begin = end) {
+        GLuint transform = queued[begin].first;
+        drawFirsts.clear();
+        drawCounts.clear();
+        drawOffsets.clear();
+        for (end = begin; end < queued.size() && queued[end].first == transform; end++) {
+            const Range& range = meshes[queued[end].second];
+            drawFirsts.push_back(range.firstVertex);
+            if (type == ModelType::LINE_STRIP_INDEXED) {
+                drawCounts.push_back(range.indexCount);
+                drawOffsets.push_back(reinterpret_cast<const void*>(
+                    range.firstIndex * sizeof(uint32_t)));
+            }
+            else drawCounts.push_back(range.vertexCount);
+        }
+
+        selectTransform(transform);
+        GLsizei count = static_cast<GLsizei>(drawCounts.size());
+        if (type == ModelType::LINE_STRIP_INDEXED) {
+            // The strip indices are relative to the first vertex of their mesh
+            CGL(glMultiDrawElementsBaseVertex(GL_LINE_STRIP, drawCounts.data(),
+                GL_UNSIGNED_INT, drawOffsets.data(), count, drawFirsts.data()));
+        }
+        else {
+            CGL(glMultiDrawArrays(GL_LINES, drawFirsts.data(), drawCounts.data(), count));
+        }
+        calls++;
+    }
+    CGL(glBindVertexArray(0));
+    queued.clear();
+    return calls;
+}
+
+void GLLineBatch::cleanUp() {
+    if (vbo) glDeleteBuffers(1, &vbo);
+    if (cbo) glDeleteBuffers(1, &cbo);
+    if (vio) glDeleteBuffers(1, &vio);
+    if (vao) glDeleteVertexArrays(1, &vao);
+    vao = vbo = cbo = vio = 0;
+    vertexCapacity = indexCapacity = 0;
+    clear();
+}
+
+size_t GLLineBatch::countMeshes() const { return meshes.size() - freeMeshes.size(); }
+size_t GLLineBatch::countQueued() const { return queued.size(); }
+GLsizei GLLineBatch::getVertexCount(size_t mesh) const {
+    return mesh < meshes.size() ? meshes[mesh].vertexCount : 0;
+}
+ModelType GLLineBatch::getType() const { return type; }
+glm::vec3 GLLineBatch::getColor() const { return color; }
+
+// ---- GLTransformBuffer ---- //
+GLTransformBuffer::GLTransformBuffer(size_t count) {
+    transforms.assign(count, glm::mat4(1.0f));
+    dirtyBegin = 0;
+    dirtyEnd = count;
+}
+
+GLTransformBuffer::~GLTransformBuffer() { cleanUp(); }
+
+void GLTransformBuffer::set(size_t slot, const glm::mat4& transform) {
+    if (transforms[slot] == transform) return;
+    transforms[slot] = transform;
+    dirtyBegin = std::min(dirtyBegin, slot);
+    dirtyEnd = std::max(dirtyEnd, slot + 1);
+}
+
+const glm::mat4& GLTransformBuffer::get(size_t slot) const { return transforms[slot]; }
+
+void GLTransformBuffer::bindBase(GLuint binding) {
+    if (!buffer) {
+        CGL(glGenBuffers(1, &buffer));
+        CGL(glBindBuffer(GL_UNIFORM_BUFFER, buffer));
+        CGL(glBufferData(GL_UNIFORM_BUFFER, transforms.size() * sizeof(glm::mat4),
+            nullptr, GL_DYNAMIC_DRAW));
+        dirtyBegin = 0;
+        dirtyEnd = transforms.size();
+    }
+    if (dirtyBegin < dirtyEnd) {
+        // std140 arrays of mat4 are tightly packed
+        CGL(glBindBuffer(GL_UNIFORM_BUFFER, buffer));
+        CGL(glBufferSubData(GL_UNIFORM_BUFFER, dirtyBegin * sizeof(glm::mat4),
+            (dirtyEnd - dirtyBegin) * sizeof(glm::mat4), transforms.data() + dirtyBegin));
+        dirtyBegin = transforms.size();
+        dirtyEnd = 0;
+    }
+    CGL(glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer));
+}
+
+void GLTransformBuffer::cleanUp() {
+    if (buffer) glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+size_t GLTransformBuffer::size() const { return transforms.size(); }
+
 // ---- GLTexture2D ---- //
 void GLTexture2D::applyFilters() {
     glGenerateMipmap(GL_TEXTURE_2D);
@@ -33,6 +33,7 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <functional>
 
 #include <glm/glm.hpp>
 
@@ -45,16 +46,19 @@ namespace lt
     enum ModelType {
         VERTEX, POINT_VERTEX, NORMAL_VERTEX,
         VERTEX2D, VERTEX_INDEXED, POINT_VERTEX_INDEXED,
-        NORMAL_VERTEX_INDEXED
+        NORMAL_VERTEX_INDEXED, LINE_STRIP_INDEXED
     };
 
     class GLModel {
     protected:
-        GLuint vao, vbo, vio;
-        GLsizei modelSize, indexSize;
-        ModelType type;
+        GLuint vao = 0, vbo = 0, vio = 0;
+        GLsizei modelSize = 0, indexSize = 0;
+        ModelType type = ModelType::VERTEX;
     
     public:
+        /// <summary>The index that separates two line strips</summary>
+        static constexpr GLuint RESTART_INDEX = 0xFFFFFFFFu;
+
         GLModel(GLsizei modelSize, GLuint vao, GLuint vbo);
         GLModel(const lt::resource::MeshBuilder2D::ExportFile2D &file);
 
@@ -79,10 +83,169 @@ namespace lt
         void unbind();
     
         GLsizei getSize() const;
+        GLsizei getIndexSize() const;
+        ModelType getType() const;
         GLuint getVAO() const;
         GLuint getVBO() const;
     };
 
+    /// <summary>
+    /// A buffer whose content is written again every frame. The buffer is split
+    /// into regions that are written in turn. A fence is placed after the draw
+    /// calls that read a region and the region is only mapped again once the
+    /// GPU passed this fence. Regions are mapped unsynchronized, the driver
+    /// neither stalls nor copies the buffer.
+    /// </summary>
+    class GLStreamBuffer {
+    protected:
+        GLuint buffer = 0;
+        GLenum target = GL_ARRAY_BUFFER;
+        GLsizeiptr regionSize = 0;
+        size_t current = 0;
+        std::vector<GLsync> fences;
+
+    public:
+        GLStreamBuffer() = default;
+        /// <summary>Creates the buffer, requires an active OpenGL context</summary>
+        /// <param name="target">The buffer binding target</param>
+        /// <param name="regionSize">The size of a single region in bytes</param>
+        /// <param name="regions">The number of regions, three allow the CPU to
+        /// write a frame while the GPU still reads the two previous ones</param>
+        GLStreamBuffer(GLenum target, GLsizeiptr regionSize, size_t regions = 3);
+
+        /// <summary>Maps the next region for writing. Waits if the GPU still
+        /// reads the region.</summary>
+        /// <returns>A pointer to the region that is valid until unmap</returns>
+        void* map();
+        /// <summary>Unmaps the current region</summary>
+        /// <returns>The offset of the current region in the buffer</returns>
+        GLintptr unmap();
+        /// <summary>Protects the current region until all commands that
+        /// were issued so far are finished</summary>
+        void fence();
+
+        void cleanUp();
+        void bind();
+        void unbind();
+
+        GLuint getBuffer() const;
+        GLsizeiptr getRegionSize() const;
+        size_t countRegions() const;
+    };
+
+    /// <summary>
+    /// Static line meshes that share one set of GPU buffers. The meshes that are
+    /// queued for a frame are drawn with one glMultiDraw* call per transform
+    /// instead of one buffer bind and draw call per GLModel. A batch either holds
+    /// LINE_STRIP_INDEXED meshes with a constant color or VERTEX2D line lists
+    /// with per vertex colors. Removed meshes leave gaps in the buffers that are
+    /// reclaimed once the buffers have to grow.
+    /// </summary>
+    class GLLineBatch {
+    public:
+        /// <summary>The handle that is returned for empty meshes</summary>
+        static constexpr size_t INVALID_MESH = ~size_t(0);
+
+    protected:
+        struct Range {
+            GLint firstVertex = 0;
+            GLsizei vertexCount = 0;
+            size_t firstIndex = 0;
+            GLsizei indexCount = 0;
+            bool used = false;
+        };
+
+        GLuint vao = 0, vbo = 0, cbo = 0, vio = 0;
+        ModelType type = ModelType::LINE_STRIP_INDEXED;
+        glm::vec3 color = glm::vec3(1.0f);
+        size_t vertexCapacity = 0, indexCapacity = 0;
+        size_t vertexCount = 0, indexCount = 0;
+        size_t garbageVertices = 0, garbageIndices = 0;
+        std::vector<Range> meshes;
+        std::vector<size_t> freeMeshes;
+        // (transform, mesh) pairs of the next draw
+        std::vector<std::pair<GLuint, size_t>> queued;
+        // reused argument arrays of the multi draw calls
+        std::vector<GLint> drawFirsts;
+        std::vector<GLsizei> drawCounts;
+        std::vector<const void*> drawOffsets;
+
+        size_t allocate(size_t vertices, size_t indices);
+        void relocate(size_t vertexCapacity, size_t indexCapacity);
+
+    public:
+        /// <summary>Creates an empty batch, the buffers are created lazily
+        /// once the first mesh is added</summary>
+        /// <param name="type">LINE_STRIP_INDEXED or VERTEX2D</param>
+        /// <param name="color">The color of LINE_STRIP_INDEXED meshes</param>
+        explicit GLLineBatch(ModelType type = ModelType::LINE_STRIP_INDEXED,
+            glm::vec3 color = glm::vec3(1.0f));
+        ~GLLineBatch();
+
+        GLLineBatch(const GLLineBatch&) = delete;
+        GLLineBatch& operator=(const GLLineBatch&) = delete;
+
+        /// <summary>Adds a line list with per vertex colors to a VERTEX2D batch</summary>
+        /// <returns>The handle of the mesh or INVALID_MESH if it is empty</returns>
+        size_t addLines(const std::vector<glm::vec2> &points, const std::vector<glm::vec3> &colors);
+        /// <summary>Adds line strips that are separated by GLModel::RESTART_INDEX
+        /// to a LINE_STRIP_INDEXED batch. The indices are relative to the mesh.</summary>
+        /// <returns>The handle of the mesh or INVALID_MESH if it is empty</returns>
+        size_t addStrip(const std::vector<glm::vec2> &vertices, const std::vector<uint32_t> &indices);
+        /// <summary>Releases a mesh, INVALID_MESH is ignored</summary>
+        void remove(size_t mesh);
+        /// <summary>Removes all meshes but keeps the buffers</summary>
+        void clear();
+
+        /// <summary>Queues a mesh for the next draw, INVALID_MESH is ignored</summary>
+        /// <param name="transform">The transform slot that is used for this mesh</param>
+        void queue(size_t mesh, GLuint transform = 0);
+        /// <summary>
+        /// Draws and clears the queued meshes. Meshes are grouped by their transform,
+        /// selectTransform is called before the draw call of each group. Requires
+        /// a bound shader that reads positions at location 0 and colors at location 1.
+        /// </summary>
+        /// <returns>The number of issued draw calls</returns>
+        size_t draw(const std::function<void(GLuint)> &selectTransform);
+
+        void cleanUp();
+
+        size_t countMeshes() const;
+        size_t countQueued() const;
+        GLsizei getVertexCount(size_t mesh) const;
+        ModelType getType() const;
+        glm::vec3 getColor() const;
+    };
+
+    /// <summary>
+    /// A uniform buffer of transformation matrices that are shared by all meshes
+    /// of a GLLineBatch. Only slots whose matrix changed are uploaded.
+    /// </summary>
+    class GLTransformBuffer {
+    protected:
+        GLuint buffer = 0;
+        std::vector<glm::mat4> transforms;
+        size_t dirtyBegin = 0, dirtyEnd = 0;
+
+    public:
+        /// <summary>Creates a buffer with the given number of identity matrices</summary>
+        explicit GLTransformBuffer(size_t count);
+        ~GLTransformBuffer();
+
+        GLTransformBuffer(const GLTransformBuffer&) = delete;
+        GLTransformBuffer& operator=(const GLTransformBuffer&) = delete;
+
+        void set(size_t slot, const glm::mat4 &transform);
+        const glm::mat4& get(size_t slot) const;
+
+        /// <summary>Uploads the changed slots and binds the buffer to the
+        /// uniform block binding point</summary>
+        void bindBase(GLuint binding);
+
+        void cleanUp();
+        size_t size() const;
+    };
+
 
     class GLTexture2D {
     protected:
@@ -249,6 +249,15 @@ void RenderBatch<EntityType>::remove(const std::shared_ptr<EntityType>& entity)
     map[entity->getTexture()->getTexture()].remove(entity);
 }
 
+// ---- Statistics ---- //
+
+// Draw calls are only issued on the render thread
+static size_t drawCalls = 0;
+
+void lt::render::addDrawCalls(size_t count) { drawCalls += count; }
+void lt::render::resetDrawCalls() { drawCalls = 0; }
+size_t lt::render::countDrawCalls() { return drawCalls; }
+
 // ---- TickerList ---- //
 
 void TickerList::add(const std::shared_ptr<Tickable>& ticker) {
@@ -491,7 +500,7 @@ void PhongShader::loadLightPosition(const glm::vec3& vector) { loadVec3(uniformL
 void PhongShader::loadLightColor(const glm::vec3& vector) { loadVec3(uniformLightColorPhong, vector); }
 void PhongShader::loadTexture(GLint unit) { loadInt(uniformTextureSamplerPhong, unit); }
 
-std::vector<char> toArray(const char* raw) {
+std::vector<char> lt::render::toArray(const char* raw) {
     std::string str(raw);
     std::vector<char> v(str.length() + 1);
     std::copy(str.begin(), str.end(), v.begin());
@@ -721,6 +730,7 @@ void LineShader::render(const LineStageBuffer& stageBuffer)
 
         entity->getModel()->bind();
         CGL(glDrawArrays(GL_LINES, 0, entity->getModel()->getSize()));
+        addDrawCalls(1);
     }
     release();
 }
@@ -757,6 +767,84 @@ std::vector<char> LineMemoryShader::retrieveFragmentShader()
     return toArray(frag);
 }
 
+// ---- LineBatchShader ---- //
+
+LineBatchShader::LineBatchShader()
+    : ShaderBase(true, true) { }
+
+LineBatchShader::LineBatchShader(LineBatchShader&& sh) : ShaderBase(std::move(sh)),
+    uniformTransform(std::exchange(sh.uniformTransform, -1)) { }
+
+LineBatchShader& LineBatchShader::operator=(LineBatchShader&& sh)
+{
+    ShaderBase::operator=(std::move(sh));
+    uniformTransform = std::exchange(sh.uniformTransform, -1);
+    return *this;
+}
+
+void LineBatchShader::initializeUniforms()
+{
+    uniformTransform = uniformLocation("transform");
+    GLuint block = glGetUniformBlockIndex(program, "Transforms");
+    if (block == GL_INVALID_INDEX)
+        throw std::runtime_error("Shader is missing the Transforms block");
+    CGL(glUniformBlockBinding(program, block, TRANSFORM_BINDING));
+}
+
+void LineBatchShader::loadTransform(GLuint slot) { loadInt(uniformTransform, static_cast<int>(slot)); }
+
+void LineBatchShader::render(const LineBatchStageBuffer& stageBuffer)
+{
+    if (!stageBuffer.transforms) return;
+    bind();
+    stageBuffer.transforms->bindBase(TRANSFORM_BINDING);
+    CGL(glEnable(GL_PRIMITIVE_RESTART));
+    CGL(glPrimitiveRestartIndex(GLModel::RESTART_INDEX));
+
+    for (const auto& batch : stageBuffer.batches) {
+        if (!batch) continue;
+        addDrawCalls(batch->draw([this](GLuint slot) { loadTransform(slot); }));
+    }
+    CGL(glDisable(GL_PRIMITIVE_RESTART));
+    release();
+}
+
+std::vector<char> LineBatchMemoryShader::retrieveVertexShader()
+{
+    const char * vert = R"(
+    #version 330
+
+    layout (std140) uniform Transforms {
+        mat4 transforms[16];
+    };
+    uniform int transform;
+
+    layout (location = 0) in vec2 vVertex;
+    layout (location = 1) in vec3 color;
+    out vec3 mixedColor;
+
+    void main(void) {
+	    gl_Position = transforms[transform] * vec4(vVertex, 0.0, 1.0);
+	    mixedColor = color;
+    })";
+    static_assert(MAX_TRANSFORMS == 16, "The transform array size must match the shader");
+    return toArray(vert);
+}
+
+std::vector<char> LineBatchMemoryShader::retrieveFragmentShader()
+{
+    const char * frag = R"(
+    #version 330
+    in vec3 mixedColor;
+
+    out vec4 color;
+
+    void main() {
+        color = vec4(mixedColor, 1.0);
+    })";
+    return toArray(frag);
+}
+
 LineStageBuffer::LineStageBuffer(
     const std::shared_ptr<RenderList<Entity2D>>& list)
     : renderList(list) { }
@@ -48,6 +48,10 @@ namespace lt::render
 		virtual void render() = 0;
 	};
 
+	/// <summary>Converts a shader source to the null terminated format that
+	/// is expected by ShaderBase</summary>
+	std::vector<char> toArray(const char* raw);
+
 
 	/// <summary>
 	/// A general shader that loads its shader sources by invoking callback functions. The constructor identifies
@@ -271,6 +275,15 @@ namespace lt::render
 		void updateAll(float dt);
 	};
 
+	// ---- Statistics ---- //
+
+	/// <summary>Adds to the number of draw calls of the current frame</summary>
+	void addDrawCalls(size_t count);
+	/// <summary>Resets the draw call counter, called at the start of a frame</summary>
+	void resetDrawCalls();
+	/// <summary>The number of draw calls since the last reset</summary>
+	size_t countDrawCalls();
+
 	///////////////////////////////////////////////
 	// ---- Specific ShaderBase Implementations ---- //
 	// LineShader
@@ -320,6 +333,52 @@ namespace lt::render
 		virtual std::vector<char> retrieveFragmentShader();
 	};
 
+	// ---- Line Batch ShaderBase ---- //
+
+	/// <summary>The StageBuffer class for the LineBatchShader object. The batches
+	/// are drawn in order with the transforms of the shared transform buffer.</summary>
+	struct LineBatchStageBuffer {
+		std::vector<std::shared_ptr<GLLineBatch>> batches;
+		std::shared_ptr<GLTransformBuffer> transforms;
+
+		explicit LineBatchStageBuffer() = default;
+	};
+
+	/// <summary>
+	/// This class renders the queued meshes of GLLineBatch objects. The transforms
+	/// are read from a uniform block, a draw call only selects the slot.
+	/// </summary>
+	class LineBatchShader : public ShaderBase {
+	protected:
+		GLint uniformTransform;
+
+	public:
+		/// <summary>The size of the transform array in the uniform block</summary>
+		static constexpr size_t MAX_TRANSFORMS = 16;
+		/// <summary>The binding point of the transform uniform block</summary>
+		static constexpr GLuint TRANSFORM_BINDING = 0;
+
+		explicit LineBatchShader();
+		virtual ~LineBatchShader() = default;
+		LineBatchShader(const LineBatchShader&) = delete;
+		LineBatchShader(LineBatchShader &&sh);
+
+		LineBatchShader& operator=(const LineBatchShader&) = delete;
+		LineBatchShader& operator=(LineBatchShader &&sh);
+
+		virtual void initializeUniforms();
+
+		void loadTransform(GLuint slot);
+
+		void render(const LineBatchStageBuffer &stageBuffer);
+	};
+
+	class LineBatchMemoryShader : public LineBatchShader {
+	public:
+		virtual std::vector<char> retrieveVertexShader();
+		virtual std::vector<char> retrieveFragmentShader();
+	};
+
 	// ---- Triangle ShaderBase ---- //
 
 	class TriangleShader : public ShaderBase {
@@ -0,0 +1,215 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+
+#include "traffic/engine.h"
+
+#include "heatmaprenderer.h"
+
+using namespace traffic;
+using namespace glm;
+
+// ---- HeatmapShader ---- //
+
+void HeatmapShader::initializeUniforms()
+{
+	uniformMVP = uniformLocation("mvp");
+	uniformValues = uniformLocation("values");
+	uniformGradient = uniformLocation("gradient");
+}
+
+std::vector<char> HeatmapShader::retrieveVertexShader()
+{
+	return lt::render::toArray(R"(
+	#version 330
+
+	uniform mat4 mvp;
+	uniform samplerBuffer values;
+	uniform sampler1D gradient;
+
+	layout (location = 0) in vec2 vVertex;
+	out vec3 mixedColor;
+
+	void main(void) {
+		gl_Position = mvp * vec4(vVertex, 0.0, 1.0);
+		// every edge has two vertices, the vertex index implies the edge
+		float value = texelFetch(values, gl_VertexID / 2).r;
+		mixedColor = texture(gradient, value).rgb;
+	})");
+}
+
+std::vector<char> HeatmapShader::retrieveFragmentShader()
+{
+	return lt::render::toArray(R"(
+	#version 330
+	in vec3 mixedColor;
+
+	out vec4 color;
+
+	void main() {
+		color = vec4(mixedColor, 1.0);
+	})");
+}
+
+void HeatmapShader::loadMVP(const glm::mat4& mat) { loadMat4x4(uniformMVP, mat); }
+void HeatmapShader::loadUnits(GLint values, GLint gradient)
+{
+	loadInt(uniformValues, values);
+	loadInt(uniformGradient, gradient);
+}
+
+// ---- HeatmapRenderer ---- //
+
+HeatmapRenderer::HeatmapRenderer()
+{
+	m_shader.create();
+
+	CGL(glGenVertexArrays(1, &m_vao));
+	CGL(glBindVertexArray(m_vao));
+	CGL(glGenBuffers(1, &m_vbo));
+	CGL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+	CGL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), nullptr));
+	CGL(glEnableVertexAttribArray(0));
+	CGL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+	CGL(glBindVertexArray(0));
+
+	// the values are read as single floats from a texture buffer
+	CGL(glGenBuffers(1, &m_valueBuffer));
+	CGL(glGenTextures(1, &m_valueTexture));
+
+	CGL(glGenTextures(1, &m_gradient));
+	CGL(glBindTexture(GL_TEXTURE_1D, m_gradient));
+	CGL(glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+	CGL(glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+	CGL(glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	CGL(glBindTexture(GL_TEXTURE_1D, 0));
+	setGradient({ { 0.0f, 0.8f, 0.0f }, { 1.0f, 1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f } });
+}
+
+HeatmapRenderer::~HeatmapRenderer()
+{
+	glDeleteTextures(1, &m_gradient);
+	glDeleteTextures(1, &m_valueTexture);
+	glDeleteBuffers(1, &m_valueBuffer);
+	glDeleteBuffers(1, &m_vbo);
+	glDeleteVertexArrays(1, &m_vao);
+}
+
+void HeatmapRenderer::update(const World& world, vec2 center)
+{
+	m_uploaded = 0;
+	const auto& graph = world.getGraph();
+	if (!graph || !graph->getFastGraph()) {
+		m_edges = 0;
+		return;
+	}
+
+	// The geometry and the value buffer are only created for a new graph
+	const FastGraph* fastGraph = graph->getFastGraph();
+	if (m_graph != fastGraph || m_center != center || m_edges != fastGraph->countEdges()) {
+		std::vector<vec2> vertices = generateEdgeMesh(*fastGraph, center);
+		CGL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+		CGL(glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec2),
+			vertices.data(), GL_STATIC_DRAW));
+		CGL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+		m_edges = fastGraph->countEdges();
+		CGL(glBindBuffer(GL_TEXTURE_BUFFER, m_valueBuffer));
+		CGL(glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(m_edges, 1) * sizeof(float),
+			nullptr, GL_DYNAMIC_DRAW));
+		CGL(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+		CGL(glBindTexture(GL_TEXTURE_BUFFER, m_valueTexture));
+		CGL(glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, m_valueBuffer));
+		CGL(glBindTexture(GL_TEXTURE_BUFFER, 0));
+
+		m_heatmap.reset(m_edges);
+		m_graph = fastGraph;
+		m_center = center;
+	}
+
+	// Only the ranges of changed edges are uploaded
+	const auto& ranges = m_heatmap.update(world, m_metric);
+	if (ranges.empty()) return;
+	const std::vector<float>& values = m_heatmap.getValues();
+	CGL(glBindBuffer(GL_TEXTURE_BUFFER, m_valueBuffer));
+	for (const auto& range : ranges) {
+		CGL(glBufferSubData(GL_TEXTURE_BUFFER, range.first * sizeof(float),
+			(range.second - range.first) * sizeof(float), values.data() + range.first));
+	}
+	CGL(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+	m_uploaded = m_heatmap.countChanged();
+}
+
+void HeatmapRenderer::render(const glm::mat4& mvp)
+{
+	if (m_edges == 0) return;
+	m_shader.bind();
+	m_shader.loadMVP(mvp);
+	m_shader.loadUnits(0, 1);
+
+	CGL(glActiveTexture(GL_TEXTURE0));
+	CGL(glBindTexture(GL_TEXTURE_BUFFER, m_valueTexture));
+	CGL(glActiveTexture(GL_TEXTURE1));
+	CGL(glBindTexture(GL_TEXTURE_1D, m_gradient));
+
+	CGL(glBindVertexArray(m_vao));
+	CGL(glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(m_edges * 2)));
+	lt::render::addDrawCalls(1);
+	CGL(glBindVertexArray(0));
+
+	CGL(glBindTexture(GL_TEXTURE_1D, 0));
+	CGL(glActiveTexture(GL_TEXTURE0));
+	CGL(glBindTexture(GL_TEXTURE_BUFFER, 0));
+	m_shader.release();
+}
+
+void HeatmapRenderer::setGradient(const std::vector<glm::vec3>& colors)
+{
+	if (colors.empty()) return;
+	// the colors are interpolated to a fixed number of texels
+	std::vector<vec3> texels(GRADIENT_SIZE);
+	for (GLsizei i = 0; i < GRADIENT_SIZE; i++) {
+		float position = static_cast<float>(i) / (GRADIENT_SIZE - 1) * (colors.size() - 1);
+		size_t lower = std::min(static_cast<size_t>(position), colors.size() - 1);
+		size_t upper = std::min(lower + 1, colors.size() - 1);
+		texels[i] = mix(colors[lower], colors[upper], position - lower);
+	}
+	CGL(glBindTexture(GL_TEXTURE_1D, m_gradient));
+	CGL(glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB8, GRADIENT_SIZE, 0,
+		GL_RGB, GL_FLOAT, texels.data()));
+	CGL(glBindTexture(GL_TEXTURE_1D, 0));
+}
+
+void HeatmapRenderer::setMetric(HeatmapMetric metric)
+{
+	if (metric == m_metric) return;
+	m_metric = metric;
+	// all values are uploaded again with the next update
+	m_heatmap.reset(m_edges);
+}
+
+HeatmapMetric HeatmapRenderer::getMetric() const { return m_metric; }
+size_t HeatmapRenderer::countEdges() const { return m_edges; }
+size_t HeatmapRenderer::countUploaded() const { return m_uploaded; }
@@ -0,0 +1,107 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+
+#pragma once
+
+#ifndef HEATMAPRENDERER_H
+#define HEATMAPRENDERER_H
+
+#include "traffic/engine.h"
+#include "engine/shader.hpp"
+#include "engine/glmodel.hpp"
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "traffic/agent.h"
+#include "traffic/osm_mesh.h"
+
+/// <summary>
+/// Draws the graph edges with a color that is looked up from a gradient. The
+/// value of an edge is read from a texture buffer by its vertex index.
+/// </summary>
+class HeatmapShader : public lt::render::ShaderBase {
+protected:
+	GLint uniformMVP, uniformValues, uniformGradient;
+
+public:
+	virtual void initializeUniforms();
+	virtual std::vector<char> retrieveVertexShader();
+	virtual std::vector<char> retrieveFragmentShader();
+
+	void loadMVP(const glm::mat4 &mat);
+	/// <summary>The texture units of the value buffer and the gradient</summary>
+	void loadUnits(GLint values, GLint gradient);
+};
+
+/// <summary>
+/// Renders a per edge heatmap of the traffic on the graph. The edge geometry
+/// is static on the GPU, every update only uploads the values of the edges
+/// that changed since the previous one.
+/// </summary>
+class HeatmapRenderer {
+public:
+	/// <summary>Creates the OpenGL resources, requires an active context</summary>
+	HeatmapRenderer();
+	~HeatmapRenderer();
+
+	HeatmapRenderer(const HeatmapRenderer&) = delete;
+	HeatmapRenderer& operator=(const HeatmapRenderer&) = delete;
+
+	/// <summary>Uploads the values of the edges that changed. The geometry
+	/// is only generated again if the graph changed.</summary>
+	/// <param name="world">The world whose edges are drawn</param>
+	/// <param name="center">The projection center of the map in (lon, lat) format</param>
+	void update(const traffic::World &world, glm::vec2 center);
+	/// <summary>Draws all edges with a single draw call</summary>
+	void render(const glm::mat4 &mvp);
+
+	/// <summary>Sets the colors from free flow to congested, they are
+	/// evenly spaced along the gradient</summary>
+	void setGradient(const std::vector<glm::vec3> &colors);
+	void setMetric(traffic::HeatmapMetric metric);
+	traffic::HeatmapMetric getMetric() const;
+
+	size_t countEdges() const;
+	/// <summary>The number of values that were uploaded by the last update</summary>
+	size_t countUploaded() const;
+
+protected:
+	static constexpr GLsizei GRADIENT_SIZE = 256;
+
+	HeatmapShader m_shader;
+	traffic::EdgeHeatmap m_heatmap;
+	traffic::HeatmapMetric m_metric = traffic::HeatmapMetric::Density;
+	const traffic::FastGraph* m_graph = nullptr;
+	glm::vec2 m_center = glm::vec2(0.0f);
+	size_t m_edges = 0;
+	size_t m_uploaded = 0;
+	GLuint m_vao = 0, m_vbo = 0;
+	GLuint m_valueBuffer = 0, m_valueTexture = 0;
+	GLuint m_gradient = 0;
+};
+
+#endif
@@ -36,6 +36,8 @@
 #include <nanogui/formhelper.h>
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
@@ -47,6 +49,9 @@
 #include "traffic/parser.hpp"
 #include "traffic/render.hpp"
 #include "traffic/agent.h"
+#include "traffic/raster.h"
+#include "traffic/tiles.h"
+#include "traffic/worker.h"
 
 using namespace traffic;
 using namespace glm;
@@ -90,13 +95,196 @@ protected:
 	ref<MapContextDialog> uiContext = nullptr;
 	ref<MapDialogPath> uiPath = nullptr;
 	std::shared_ptr<World> world;
+	// destroyed first, waits for a map that is still loading
+	std::unique_ptr<MapLoader> m_loader;
 };
 
+/// <summary>
+/// Parses the headless command line options. Returns false if the
+/// interactive application should be started instead.
+/// --headless <map> renders frames, --benchmark <map> only measures the
+/// frame rate at 3840x2160. --frames N, --size WxH, --agents N and
+/// --out <pattern> change the defaults. Options without a value are
+/// rejected.
+/// </summary>
+static bool parseHeadless(int argc, char** argv, HeadlessOptions& options)
+{
+	bool headless = false, sized = false;
+	for (int i = 1; i < argc; i += 2) {
+		const char* arg = argv[i];
+		if (i + 1 >= argc)
+			throw std::runtime_error(std::string("Missing value of option ") + arg);
+		const char* value = argv[i + 1];
+		if (std::strcmp(arg, "--headless") == 0) {
+			options.map = value;
+			headless = true;
+		}
+		else if (std::strcmp(arg, "--benchmark") == 0) {
+			options.map = value;
+			options.benchmark = headless = true;
+		}
+		else if (std::strcmp(arg, "--frames") == 0)
+			options.frames = std::strtoul(value, nullptr, 10);
+		else if (std::strcmp(arg, "--agents") == 0)
+			options.agents = std::strtoul(value, nullptr, 10);
+		else if (std::strcmp(arg, "--out") == 0)
+			options.output = value;
+		else if (std::strcmp(arg, "--size") == 0) {
+			unsigned long width, height;
+			if (std::sscanf(value, "%lux%lu", &width, &height) != 2 || width == 0 || height == 0)
+				throw std::runtime_error(std::string("Invalid size ") + value);
+			options.width = width;
+			options.height = height;
+			sized = true;
+		}
+		else throw std::runtime_error(std::string("Unknown option ") + arg);
+	}
+	// the benchmark runs at 4K unless a size is given
+	if (options.benchmark && !sized) {
+		options.width = 3840;
+		options.height = 2160;
+	}
+	return headless;
+}
+
+/// <summary>
+/// Parses the distributed simulation options, --distributed <map> enables
+/// the mode. --workers N, --ticks T, --trips N and --threads N change the
+/// defaults, --balance K runs the LoadBalancer every K ticks and
+/// --domains grid|graph selects the domain split.
+/// </summary>
+static bool parseDistributed(int argc, char** argv, DistributedRun& run)
+{
+	if (argc < 3 || std::strcmp(argv[1], "--distributed") != 0) return false;
+	run.map = argv[2];
+	for (int i = 3; i < argc; i += 2) {
+		const char* arg = argv[i];
+		if (i + 1 >= argc)
+			throw std::runtime_error(std::string("Missing value of option ") + arg);
+		const char* value = argv[i + 1];
+		if (std::strcmp(arg, "--workers") == 0)
+			run.settings.workers = std::strtoul(value, nullptr, 10);
+		else if (std::strcmp(arg, "--ticks") == 0)
+			run.ticks = std::strtoul(value, nullptr, 10);
+		else if (std::strcmp(arg, "--trips") == 0)
+			run.trips = std::strtoul(value, nullptr, 10);
+		else if (std::strcmp(arg, "--threads") == 0)
+			run.settings.threadsPerWorker = std::strtoul(value, nullptr, 10);
+		else if (std::strcmp(arg, "--balance") == 0)
+			run.balanceInterval = std::strtoul(value, nullptr, 10);
+		else if (std::strcmp(arg, "--domains") == 0) {
+			if (std::strcmp(value, "grid") == 0)
+				run.settings.domains = DomainSplit::Grid;
+			else if (std::strcmp(value, "graph") == 0)
+				run.settings.domains = DomainSplit::Graph;
+			else throw std::runtime_error(std::string("Unknown domain split ") + value);
+		}
+		else throw std::runtime_error(std::string("Unknown option ") + arg);
+	}
+	return true;
+}
+
+/// <summary>
+/// Parses the filter benchmark options, --bench-filter <map> enables the
+/// benchmark and --runs N sets the number of runs per filter.
+/// </summary>
+static bool parseBenchFilter(int argc, char** argv, std::string& map, size_t& runs)
+{
+	if (argc < 3 || std::strcmp(argv[1], "--bench-filter") != 0) return false;
+	map = argv[2];
+	for (int i = 3; i < argc; i += 2) {
+		const char* arg = argv[i];
+		if (i + 1 >= argc)
+			throw std::runtime_error(std::string("Missing value of option ") + arg);
+		if (std::strcmp(arg, "--runs") == 0)
+			runs = std::strtoul(argv[i + 1], nullptr, 10);
+		else throw std::runtime_error(std::string("Unknown option ") + arg);
+	}
+	return true;
+}
+
+/// <summary>
+/// Parses the tile export options, --tiles <map> enables the export.
+/// --out <path> is the output directory or a single archive if it ends
+/// with .tsva, --zoom MIN-MAX selects the zoom levels.
+/// </summary>
+static bool parseTiles(int argc, char** argv, TileOptions& options,
+	std::string& map, std::string& output)
+{
+	if (argc < 3 || std::strcmp(argv[1], "--tiles") != 0) return false;
+	map = argv[2];
+	output = "tiles";
+	for (int i = 3; i < argc; i += 2) {
+		const char* arg = argv[i];
+		if (i + 1 >= argc)
+			throw std::runtime_error(std::string("Missing value of option ") + arg);
+		const char* value = argv[i + 1];
+		if (std::strcmp(arg, "--out") == 0)
+			output = value;
+		else if (std::strcmp(arg, "--zoom") == 0) {
+			if (std::sscanf(value, "%u-%u", &options.minZoom, &options.maxZoom) != 2)
+				throw std::runtime_error(std::string("Invalid zoom range ") + value);
+		}
+		else throw std::runtime_error(std::string("Unknown option ") + arg);
+	}
+	return true;
+}
 
 int main(int argc, char** argv)
 {
 	try
 	{
+		// Forks the workers before any thread pool is created
+		DistributedRun distributed;
+		if (parseDistributed(argc, argv, distributed)) {
+			runDistributed(distributed);
+			return 0;
+		}
+
+		std::string benchMap;
+		size_t benchRuns = 5;
+		if (parseBenchFilter(argc, argv, benchMap, benchRuns)) {
+			ParseArguments args;
+			args.file = benchMap;
+			benchmarkFindNodes(parseXMLMap(args), benchRuns);
+			return 0;
+		}
+
+		TileOptions tileOptions;
+		std::string tileMap, tileOutput;
+		if (parseTiles(argc, argv, tileOptions, tileMap, tileOutput)) {
+			ref<ConcurrencyManager> manager = new ConcurrencyManager();
+			World world(manager.get());
+			world.loadMap(tileMap);
+			if (!world.hasMap()) throw std::runtime_error("Could not load map " + tileMap);
+
+			TileGenerator generator(tileOptions, manager.get());
+			generator.addLayer("map", *world.getMap());
+			if (world.getHighwayMap())
+				generator.addLayer("highways", *world.getHighwayMap());
+
+			bool archive = tileOutput.size() >= 5 &&
+				tileOutput.compare(tileOutput.size() - 5, 5, ".tsva") == 0;
+			size_t tiles = 0;
+			if (archive) {
+				TileArchiveWriter writer(tileOutput);
+				tiles = generator.generate(writer);
+			}
+			else {
+				TileDirectoryWriter writer(tileOutput);
+				tiles = generator.generate(writer);
+			}
+			printf("Wrote %zu tiles to %s\n", tiles, tileOutput.c_str());
+			return 0;
+		}
+
+		HeadlessOptions options;
+		if (parseHeadless(argc, argv, options)) {
+			ref<ConcurrencyManager> manager = new ConcurrencyManager();
+			renderHeadless(options, manager.get());
+			return 0;
+		}
+
 		//ref<ConcurrencyManager> manager = new ConcurrencyManager();
 		//auto world = std::make_shared<World>(manager.get());
 		nanogui::init();
@@ -139,6 +327,8 @@ TrafficApplication::TrafficApplication() : nanogui::Screen(
 	world = std::make_shared<World>(manager.get());
 
 	m_canvas = new MapCanvas(this, world->getMap());
+	m_canvas->setManager(manager.get());
+	m_canvas->setWorld(world.get());
 	m_canvas->set_layout(new FullscreenLayout());
 	m_canvas->setActive(true);
 	m_canvas->set_background_color({ 100, 100, 100, 255 });
@@ -148,12 +338,13 @@ TrafficApplication::TrafficApplication() : nanogui::Screen(
 	uiInfo = new MapInfo(this, {10, 340}, world.get(), m_canvas.get());
 	uiPath = new MapDialogPath(this, {10, 10}, world.get(), m_canvas.get(), uiContext.get());
 
+	m_loader = std::make_unique<MapLoader>(world.get(), m_canvas.get());
+	uiInfo->setLoader(m_loader.get());
+
 	// Loads the default map
 	bool loadDefault = true;
 	if (loadDefault) {
-		world->loadMap("maps/warendorf.xmlmap");
-		m_canvas->loadMap(world->getMap());
-		m_canvas->loadHighwayMap(world->getHighwayMap());
+		m_loader->load("maps/warendorf.xmlmap");
 		m_canvas->setActive(true);
 	}
 
@@ -185,6 +376,7 @@ void TrafficApplication::update()
 {
 	double nextTime = glfwGetTime();
 	double dt = nextTime - lastTime;
+	m_loader->update();
 	m_canvas->update(dt);
 	lastTime = nextTime;
 
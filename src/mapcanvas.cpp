@@ -30,6 +30,7 @@
 #include <glm/gtx/matrix_transform_2d.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 #include "traffic/osm_mesh.h"
+#include "traffic/parser.hpp"
 
 using namespace traffic;
 using namespace glm;
@@ -70,20 +71,21 @@ MapCanvas::MapCanvas(Widget* parent,
 	m_min_zoom = 2.0;
 	m_max_zoom = 1000.0;
 
-	// loadMap includes resetView
+	// the view is reset again when the map is uploaded
+	resetView();
 	if (world) loadMap(world);
-	else resetView();
 
 	// custom shader
 	using namespace lt::render;
 	try {
-		l_shader = std::make_shared<LineMemoryShader>();
-		entities = std::make_shared<RenderList<lt::Entity2D>>();
-		l_comp = std::make_shared<RenderComponent< LineStageBuffer, LineMemoryShader>>();
-		
+		l_shader = std::make_shared<LineBatchMemoryShader>();
+		l_transforms = std::make_shared<lt::GLTransformBuffer>(LineBatchShader::MAX_TRANSFORMS);
+		l_comp = std::make_shared<RenderComponent<LineBatchStageBuffer, LineBatchMemoryShader>>();
+		l_batch_routes = std::make_shared<lt::GLLineBatch>(lt::ModelType::VERTEX2D);
+
 		l_shader->create();
 		l_comp->setShader(l_shader);
-		l_comp->stageBuffer().renderList = entities;
+		l_comp->stageBuffer().transforms = l_transforms;
 		l_pipeline.addStage(l_comp);
 		m_success = true;
 	}
@@ -155,20 +157,21 @@ void MapCanvas::setPosition(Vector2d pos)
 {
 	position = pos;
 	cb_map_moved().trigger(getPosition());
-	cb_view_changed().trigger(Rect());
+	cb_view_changed().trigger(getViewRect());
 }
 
 void MapCanvas::setZoom(double zoom)
 {
 	m_zoom = zoom;
 	cb_zoom_changed().trigger(getZoom());
-	cb_view_changed().trigger(Rect());
+	cb_view_changed().trigger(getViewRect());
 }
 
 void MapCanvas::setRotation(double rotation)
 {
 	m_rotation = rotation;
 	cb_rotation_changed().trigger(getRotation());
+	cb_view_changed().trigger(getViewRect());
 }
 
 double MapCanvas::getLatitude() const { return planeToLatitude(position.x(), toGLM(getCenter())); }
@@ -191,47 +194,177 @@ double MapCanvas::getDistance(Vector2d p1, Vector2d p2) const {
 
 Vector2d MapCanvas::getCenter() const
 {
-	if (m_map) {
-		return toView(m_map->getBoundingBox().getCenter().toVec());
-	}
-	else {
-		return Vector2d(0.0, 0.0);
+	// The center is fixed when the map is loaded. Changes of the
+	// map do not move the projection that is used by the meshes.
+	return m_map ? m_center : Vector2d(0.0, 0.0);
+}
+
+void MapCanvas::getViewPlane(dvec2& lower, dvec2& upper) const
+{
+	// The visible area is the bounding box of the rotated view corners
+	lower = dvec2(std::numeric_limits<double>::max());
+	upper = dvec2(std::numeric_limits<double>::lowest());
+	for (Vector2d corner : { Vector2d(-1.0, -1.0), Vector2d(-1.0, 1.0),
+		Vector2d(1.0, -1.0), Vector2d(1.0, 1.0) }) {
+		dvec2 plane = toGLM(viewToPlane(corner));
+		lower = glm::min(lower, plane);
+		upper = glm::max(upper, plane);
 	}
 }
 
+Rect MapCanvas::getViewRect() const
+{
+	if (width() <= 0 || height() <= 0) return Rect();
+	dvec2 lower, upper;
+	getViewPlane(lower, upper);
+	Vector2d p1 = planeToPosition(toView(lower));
+	Vector2d p2 = planeToPosition(toView(upper));
+	return Rect::fromBorders(
+		static_cast<prec_t>(std::min(p1.x(), p2.x())),
+		static_cast<prec_t>(std::max(p1.x(), p2.x())),
+		static_cast<prec_t>(std::min(p1.y(), p2.y())),
+		static_cast<prec_t>(std::max(p1.y(), p2.y())));
+}
+
 void MapCanvas::loadMap(std::shared_ptr<traffic::OSMSegment> map)
 {
-	if (map) {
-		m_map = map;
-		l_mesh_map = genMeshFromMap(*map, { 1.0f, 1.0f, 1.0f});
-		resetView();
-	}
+	if (map) beginLayer(m_pending_map, map, { 1.0f, 1.0f, 1.0f });
 }
 
 void MapCanvas::loadHighwayMap(std::shared_ptr<traffic::OSMSegment> map)
 {
-	if (map) {
-		m_highway_map = map;
-		l_mesh_highway = genMeshFromMap(*map, { 1.0f, 0.0f, 0.0f });
+	if (map) beginLayer(m_pending_highway, map, { 1.0f, 0.0f, 0.0f });
+}
+
+void MapCanvas::loadMap(std::shared_ptr<traffic::OSMSegment> map,
+	std::unique_ptr<traffic::SectionedMesh> sections)
+{
+	if (map) beginLayer(m_pending_map, map, { 1.0f, 1.0f, 1.0f }, std::move(sections));
+}
+
+void MapCanvas::loadHighwayMap(std::shared_ptr<traffic::OSMSegment> map,
+	std::unique_ptr<traffic::SectionedMesh> sections)
+{
+	if (map) beginLayer(m_pending_highway, map, { 1.0f, 0.0f, 0.0f }, std::move(sections));
+}
+
+void MapCanvas::setManager(traffic::ConcurrencyManager* manager) { m_manager = manager; }
+void MapCanvas::setWorld(const traffic::World* world) { m_world = world; }
+void MapCanvas::setHeatmap(bool enabled) { m_render_heatmap = enabled; }
+bool MapCanvas::isHeatmap() const { return m_render_heatmap; }
+void MapCanvas::setHeatmapMetric(traffic::HeatmapMetric metric)
+{
+	m_heatmap_metric = metric;
+	if (m_heatmap) m_heatmap->setMetric(metric);
+}
+traffic::HeatmapMetric MapCanvas::getHeatmapMetric() const { return m_heatmap_metric; }
+bool MapCanvas::isLoading() const { return m_pending_map.map || m_pending_highway.map; }
+void MapCanvas::finishLoading() { processPending(std::numeric_limits<size_t>::max(), true); }
+
+void MapCanvas::beginLayer(PendingLayer& layer, std::shared_ptr<traffic::OSMSegment> map,
+	glm::vec3 color, std::unique_ptr<traffic::SectionedMesh> sections)
+{
+	layer.meshes.clear();
+	layer.batch = std::make_shared<lt::GLLineBatch>(lt::ModelType::LINE_STRIP_INDEXED, color);
+	layer.uploaded = 0;
+	layer.map = map;
+	layer.sections = std::move(sections);
+	if (layer.sections) {
+		layer.future = {};
+		layer.meshes.resize(layer.sections->countSections());
+		return;
+	}
+
+	// the thread holds a reference, the map stays valid if it is replaced
+	traffic::ConcurrencyManager* manager = m_manager;
+	layer.future = std::async(std::launch::async, [map, manager]() {
+		return std::make_unique<SectionedMesh>(*map, manager);
+	});
+}
+
+bool MapCanvas::uploadLayer(PendingLayer& layer, size_t& budget, bool wait)
+{
+	if (!layer.sections) {
+		if (!wait && layer.future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return false;
+		layer.sections = layer.future.get();
+		layer.meshes.resize(layer.sections->countSections());
+	}
+
+	// GPU buffers are created on the render thread, a few sections per frame
+	while (layer.uploaded < layer.meshes.size() && budget > 0) {
+		size_t section = layer.uploaded++;
+		layer.meshes[section] = genMeshFromSection(*layer.batch, *layer.sections, section);
+		size_t vertices = 0;
+		for (size_t level = 0; level < layer.sections->countLevels(); level++)
+			vertices += layer.sections->getSection(section, level).vertices.size();
+		budget -= std::min(budget, vertices);
+	}
+	return layer.uploaded == layer.meshes.size();
+}
+
+void MapCanvas::processPending(size_t budget, bool wait)
+{
+	if (m_pending_map.map && uploadLayer(m_pending_map, budget, wait)) {
+		m_map = std::move(m_pending_map.map);
+		m_sections_map = std::move(m_pending_map.sections);
+		l_mesh_map = std::move(m_pending_map.meshes);
+		l_batch_map = std::move(m_pending_map.batch);
+		m_pending_map = PendingLayer();
+		m_center = toView(m_map->getBoundingBox().getCenter().toVec());
+		resetView();
+	}
+	if (m_pending_highway.map && uploadLayer(m_pending_highway, budget, wait)) {
+		m_highway_map = std::move(m_pending_highway.map);
+		m_sections_highway = std::move(m_pending_highway.sections);
+		l_mesh_highway = std::move(m_pending_highway.meshes);
+		l_batch_highway = std::move(m_pending_highway.batch);
+		m_pending_highway = PendingLayer();
 		resetView();
+	}
+}
+
+void MapCanvas::applyChange(const ChangeReport& mapReport, const ChangeReport& highwayReport)
+{
+	finishLoading();
+	if (m_map && m_sections_map && l_batch_map) {
+		updateSections(*l_batch_map, *m_sections_map, l_mesh_map,
+			m_sections_map->update(*m_map, mapReport));
+	}
+	if (m_highway_map && m_sections_highway && l_batch_highway) {
+		updateSections(*l_batch_highway, *m_sections_highway, l_mesh_highway,
+			m_sections_highway->update(*m_highway_map, highwayReport));
 	}
 }
 
 void MapCanvas::loadRoute(const Route& route, std::shared_ptr<traffic::OSMSegment> map)
 {
 	std::vector<vec2> points = generateRouteMesh(route, *map);
+	if (points.empty() || !l_batch_routes) return;
+	vec2 lower(std::numeric_limits<float>::max()), upper(std::numeric_limits<float>::lowest());
+	for (const vec2& p : points) {
+		lower = glm::min(lower, p);
+		upper = glm::max(upper, p);
+	}
 	std::vector<vec3> colors(points.size(), glm::vec3(0.0f, 0.0f, 1.0f));
-	l_mesh_routes.push_back(genMesh(std::move(points), std::move(colors)));
+	l_mesh_routes.push_back(l_batch_routes->addLines(points, colors));
+	l_route_bounds.push_back(vec4(lower, upper));
 }
 
 void MapCanvas::clearRoutes()
 {
+	if (l_batch_routes) l_batch_routes->clear();
 	l_mesh_routes.clear();
+	l_route_bounds.clear();
 }
 
 
 
 bool MapCanvas::hasMap() const { return m_map.get(); }
+size_t MapCanvas::getRenderedVertices() const { return m_rendered_vertices; }
+size_t MapCanvas::getRenderedAgents() const { return m_rendered_agents; }
+size_t MapCanvas::getDrawCalls() const { return m_draw_calls; }
+size_t MapCanvas::getHeatmapUploads() const { return m_heatmap_uploads; }
 
 bool MapCanvas::mouse_button_event(
 	const Vector2i& p, int button, bool down, int modifiers) {
@@ -317,32 +450,53 @@ void MapCanvas::update(double dt)
 
 // ---- Mesh ---- //
 
-std::shared_ptr<lt::Transformed4DEntity2D> MapCanvas::genMeshFromMap(
-	const OSMSegment& seg, glm::vec3 color)
+std::vector<size_t> MapCanvas::genMeshFromSection(lt::GLLineBatch& batch,
+	const SectionedMesh& sections, size_t section)
 {
-	std::vector<vec2> points = generateMesh(seg);
-	std::vector<vec3> colors(points.size(), color);
-	return genMesh(std::move(points), std::move(colors));
-}
-
-std::shared_ptr<lt::Transformed4DEntity2D> MapCanvas::genMesh(
-	std::vector<glm::vec2>&& points, std::vector<glm::vec3>&& colors)
-{
-	lt::resource::MeshBuilder2D builder;
-	builder.setVertices(std::move(points));
-	builder.setColors(std::move(colors));
-	auto exp = builder.exporter()
-		.addVertex().addColor()
-		.exportData();
+	static_assert(StripMesh::RESTART == lt::GLModel::RESTART_INDEX, "Restart index mismatch");
+	std::vector<size_t> levels(sections.countLevels());
+	for (size_t level = 0; level < levels.size(); level++) {
+		const StripMesh& mesh = sections.getSection(section, level);
+		levels[level] = batch.addStrip(mesh.vertices, mesh.indices);
+	}
+	return levels;
+}
 
-	auto model = std::make_shared<lt::GLModel>(exp);
-	return std::make_shared<lt::Transformed4DEntity2D>(0, model);
+void MapCanvas::updateSections(lt::GLLineBatch& batch, const SectionedMesh& sections,
+	SectionMeshes& meshes, const std::vector<size_t>& updated)
+{
+	for (size_t section : updated) {
+		for (size_t mesh : meshes[section]) batch.remove(mesh);
+		meshes[section] = genMeshFromSection(batch, sections, section);
+	}
+}
+
+size_t MapCanvas::addVisibleSections(const SectionedMesh& sections,
+	const SectionMeshes& meshes, lt::GLLineBatch& batch,
+	dvec2 lower, dvec2 upper)
+{
+	// A pixel spans 2 / (zoom * width) plane units
+	size_t level = sections.selectLevel(static_cast<prec_t>(2.0 / (m_zoom * width())));
+	size_t vertices = 0;
+	for (size_t section : sections.findSections(vec2(lower), vec2(upper))) {
+		size_t mesh = meshes[section][level];
+		if (mesh == lt::GLLineBatch::INVALID_MESH) continue;
+		batch.queue(mesh);
+		vertices += batch.getVertexCount(mesh);
+	}
+	return vertices;
 }
 
 void MapCanvas::clearMesh() {
-	l_mesh_highway = nullptr;
-	l_mesh_map = nullptr;
+	l_mesh_highway.clear();
+	l_mesh_map.clear();
+	l_batch_highway = nullptr;
+	l_batch_map = nullptr;
+	m_sections_highway = nullptr;
+	m_sections_map = nullptr;
+	if (l_batch_routes) l_batch_routes->clear();
 	l_mesh_routes.clear();
+	l_route_bounds.clear();
 }
 
 Vector2d MapCanvas::windowToView(Vector2i vec) const {
@@ -430,6 +584,8 @@ glm::mat3 MapCanvas::transformPlaneToView4DGLM() const {
 void MapCanvas::draw_contents()
 {
 	using namespace nanogui;
+	lt::render::resetDrawCalls();
+	if (m_success) processPending(UPLOAD_BUDGET, false);
 	if (m_active && m_success && hasMap()) {
 		auto transform = transformPlaneToView4D();
 		// Chunk rendering
@@ -439,17 +595,52 @@ void MapCanvas::draw_contents()
 		}
 		
 		
-		entities->clear();
-		for (const auto& t : l_mesh_routes) {
-			t->setTransform4D(toGLM(transform));
-			entities->add(t);
+		// All layers share the view transform, only this slot changes per frame
+		l_transforms->set(0, toGLM(transform));
+		dvec2 lower, upper;
+		getViewPlane(lower, upper);
+		for (size_t i = 0; i < l_mesh_routes.size(); i++) {
+			const vec4& b = l_route_bounds[i];
+			if (b.x > upper.x || b.z < lower.x || b.y > upper.y || b.w < lower.y)
+				continue;
+			l_batch_routes->queue(l_mesh_routes[i]);
 		}
-		l_mesh_map->setTransform4D(toGLM(transform));
-		l_mesh_highway->setTransform4D(toGLM(transform));
-		entities->add(l_mesh_highway);
-		entities->add(l_mesh_map);
+		m_rendered_vertices = 0;
+		bool heatmap = m_render_heatmap && m_world && m_sections_highway;
+		if (m_sections_highway && l_batch_highway && !heatmap)
+			m_rendered_vertices += addVisibleSections(
+				*m_sections_highway, l_mesh_highway, *l_batch_highway, lower, upper);
+		if (m_sections_map && l_batch_map)
+			m_rendered_vertices += addVisibleSections(
+				*m_sections_map, l_mesh_map, *l_batch_map, lower, upper);
+		l_comp->stageBuffer().batches = { l_batch_routes, l_batch_highway, l_batch_map };
 		l_pipeline.render();
+
+		// The heatmap replaces the highway layer, only changed values are uploaded
+		m_heatmap_uploads = 0;
+		if (heatmap) {
+			if (!m_heatmap) {
+				m_heatmap = std::make_unique<HeatmapRenderer>();
+				m_heatmap->setMetric(m_heatmap_metric);
+			}
+			m_heatmap->update(*m_world, m_sections_highway->getCenter());
+			m_heatmap->render(toGLM(transform));
+			m_heatmap_uploads = m_heatmap->countUploaded();
+		}
+
+		// All agents are drawn with a single instanced draw call
+		m_rendered_agents = 0;
+		if (m_world && m_sections_highway && !m_world->getAgents().empty()) {
+			if (!m_agents) m_agents = std::make_unique<AgentRenderer>();
+			// about five meters, but never smaller than a few pixels
+			float pixel = static_cast<float>(2.0 / (m_zoom * std::max(width(), 1)));
+			m_agents->setSize(std::max(4.5e-5f, 8.0f * pixel));
+			m_agents->update(*m_world, m_sections_highway->getCenter());
+			m_agents->render(toGLM(transform));
+			m_rendered_agents = m_agents->countInstances();
+		}
 	}
+	m_draw_calls = lt::render::countDrawCalls();
 }
 
 bool MapCanvas::keyboard_event(int key, int scancode, int action, int modifiers)
@@ -457,6 +648,9 @@ bool MapCanvas::keyboard_event(int key, int scancode, int action, int modifiers)
 	if (key == GLFW_KEY_C && action == GLFW_PRESS) {
 		m_render_chunk = !m_render_chunk;
 	}
+	if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+		m_render_heatmap = !m_render_heatmap;
+	}
 	return true;
 }
 
@@ -553,6 +747,24 @@ MapInfo::MapInfo(nanogui::Screen* parent, Vector2i pos,
 			[this](size_t) {},
 			[this]() { return (m_world && m_world->getMap()) ?
 				m_world->getMap()->getRelationCount() : 0; }, false);
+		add_variable<size_t>("Drawn Vertices",
+			[this](size_t) {},
+			[this]() { return m_canvas ? m_canvas->getRenderedVertices() : 0; }, false);
+		add_variable<size_t>("Drawn Agents",
+			[this](size_t) {},
+			[this]() { return m_canvas ? m_canvas->getRenderedAgents() : 0; }, false);
+		add_variable<size_t>("Draw Calls",
+			[this](size_t) {},
+			[this]() { return m_canvas ? m_canvas->getDrawCalls() : 0; }, false);
+		add_variable<bool>("Heatmap",
+			[this](bool enabled) { if (m_canvas) m_canvas->setHeatmap(enabled); },
+			[this]() { return m_canvas && m_canvas->isHeatmap(); });
+		add_variable<size_t>("Heatmap Uploads",
+			[this](size_t) {},
+			[this]() { return m_canvas ? m_canvas->getHeatmapUploads() : 0; }, false);
+		add_variable<std::string>("Loading",
+			[this](const std::string&) {},
+			[this]() { return m_status; }, false);
 	}
 
 	add_button("Choose File", [this]() {
@@ -562,7 +774,10 @@ MapInfo::MapInfo(nanogui::Screen* parent, Vector2i pos,
 			make_pair<string, string>("osm", "OSM File format"),
 		};
 		string file = nanogui::file_dialog(vect, false);
-		if (m_world) {
+		if (m_loader) {
+			m_loader->load(file);
+		}
+		else if (m_world) {
 			m_world->loadMap(file);
 			if (m_canvas) {
 				m_canvas->loadMap(m_world->getMap());
@@ -571,6 +786,34 @@ MapInfo::MapInfo(nanogui::Screen* parent, Vector2i pos,
 		}
 	});
 
+	add_button("Apply Change", [this]() {
+		using namespace std;
+		vector<pair<string, string>> vect{
+			make_pair<string, string>("osc", "OSM Change format"),
+		};
+		string file = nanogui::file_dialog(vect, false);
+		// the dialog returns an empty path if it was cancelled
+		if (file.empty()) return;
+		// the world must not change while a map is prepared
+		if (m_loader && m_loader->isLoading()) return;
+		if (m_world && m_world->hasMap()) {
+			try {
+				// the meshes must not be generated while the map is changed
+				if (m_canvas) m_canvas->finishLoading();
+				OSMChange change = parseOSMChange(file);
+				change.summary();
+				auto reports = m_world->applyChange(change);
+				reports.first.summary();
+				reports.second.summary();
+				if (m_canvas)
+					m_canvas->applyChange(reports.first, reports.second);
+			}
+			catch (const std::exception& e) {
+				m_status = "Failed";
+				printf("Could not apply change: %s\n", e.what());
+			}
+		}
+	});
 }
 
 traffic::World* MapInfo::getWorld() const noexcept
@@ -587,6 +830,20 @@ MapCanvas* MapInfo::getCanvas() const noexcept { return m_canvas; }
 
 void MapInfo::setCanvas(MapCanvas* canvas) { m_canvas = canvas; }
 
+void MapInfo::setLoader(MapLoader* loader)
+{
+	m_loader = loader;
+	if (m_loader) {
+		m_loader->cb_progress().listen([this](LoadStage stage) {
+			m_status = getStageName(stage);
+		});
+		m_loader->cb_failed().listen([this](std::string error) {
+			m_status = "Failed";
+			printf("Could not load map: %s\n", error.c_str());
+		});
+	}
+}
+
 MapDialogPath::MapDialogPath(
 	nanogui::Screen* parent, Vector2i pos, World *world, MapCanvas* canvas, MapContextDialog *contextMenu)
 	: nanogui::FormHelper(parent)
@@ -702,3 +959,68 @@ void MapContextDialog::addContextButton(
 
 Listener<void()>& MapContextDialog::openListener() { return k_listener_open; }
 Listener<void()>& MapContextDialog::closeListener() { return k_listener_close; }
+
+// ---- MapLoader ---- //
+
+MapLoader::MapLoader(traffic::World* world, MapCanvas* canvas)
+	: m_world(world), m_canvas(canvas),
+	m_stage(LoadStage::Done), m_reported(LoadStage::Done) { }
+
+bool MapLoader::load(const std::string& file)
+{
+	if (m_loading || !m_world) return false;
+	m_loading = true;
+	m_stage = LoadStage::Parse;
+	m_reported = LoadStage::Done;
+
+	// The stages use the thread pool of the world. They are driven by their
+	// own thread, a pool thread waiting for its own pool could block it.
+	traffic::World* world = m_world;
+	m_future = std::async(std::launch::async, [this, world, file]() {
+		auto progress = [this](LoadStage stage) { m_stage = stage; };
+		Result result;
+		result.prepared = world->prepareMap(file, progress);
+		progress(LoadStage::Mesh);
+		result.mapSections = std::make_unique<SectionedMesh>(
+			*result.prepared.map, world->getManager());
+		result.highwaySections = std::make_unique<SectionedMesh>(
+			*result.prepared.highwayMap, world->getManager());
+		progress(LoadStage::Done);
+		return result;
+	});
+	return true;
+}
+
+bool MapLoader::isLoading() const { return m_loading; }
+
+void MapLoader::update()
+{
+	if (!m_loading) return;
+	LoadStage stage = m_stage;
+	if (stage != m_reported) {
+		m_reported = stage;
+		m_cb_progress.trigger(stage);
+	}
+	if (m_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
+
+	m_loading = false;
+	try {
+		Result result = m_future.get();
+		auto map = result.prepared.map;
+		auto highwayMap = result.prepared.highwayMap;
+		m_world->installMap(std::move(result.prepared));
+		if (m_canvas) {
+			// the meshes are uploaded over the next frames
+			m_canvas->loadMap(map, std::move(result.mapSections));
+			m_canvas->loadHighwayMap(highwayMap, std::move(result.highwaySections));
+		}
+		if (m_reported != LoadStage::Done) {
+			m_reported = LoadStage::Done;
+			m_cb_progress.trigger(LoadStage::Done);
+		}
+	}
+	catch (const std::exception& e) {
+		m_cb_failed.trigger(std::string(e.what()));
+	}
+}
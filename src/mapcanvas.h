@@ -37,10 +37,16 @@
 #include <GLFW/glfw3.h>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <future>
+#include <atomic>
+
 #include "traffic/agent.h"
 #include "traffic/osm.h"
+#include "traffic/osm_mesh.h"
 
 #include "listener.h"
+#include "agentrenderer.h"
+#include "heatmaprenderer.h"
 
 using nanogui::Vector2i;
 using nanogui::Shader;
@@ -63,6 +69,7 @@ using Vector4d = nanogui::Array<double, 4>;
 class MapForm;
 class MapInfo;
 class MapCanvas;
+class MapLoader;
 
 // ---- View to GLM transform ---- //
 
@@ -142,9 +149,15 @@ public:
 	MapCanvas* getCanvas() const noexcept;
 	void setCanvas(MapCanvas *canvas);
 
+	/// <summary>Sets the loader that loads chosen files in the background.
+	/// Files are loaded synchronously if no loader is set.</summary>
+	void setLoader(MapLoader *loader);
+
 protected:
 	traffic::World* m_world = nullptr;
 	MapCanvas* m_canvas = nullptr;
+	MapLoader* m_loader = nullptr;
+	std::string m_status = "Idle";
 	nanogui::ref<nanogui::Window> m_window = nullptr;
 };
 
@@ -206,13 +219,58 @@ public:
 
 	Vector2d getCenter() const;
 
+	/// <summary>The visible area in (lat, lon) coordinates. The view corners
+	/// are rotated, the rectangle therefore encloses the whole view.</summary>
+	traffic::Rect getViewRect() const;
+	/// <summary>The visible area in plane coordinates</summary>
+	void getViewPlane(glm::dvec2 &lower, glm::dvec2 &upper) const;
+
+	/// <summary>Generates the mesh of the map on a background thread. The
+	/// previous map stays visible until the new mesh is uploaded.</summary>
 	void loadMap(std::shared_ptr<traffic::OSMSegment> map);
 	void loadHighwayMap(std::shared_ptr<traffic::OSMSegment> map);
+	/// <summary>Uploads an already generated mesh of the map</summary>
+	void loadMap(std::shared_ptr<traffic::OSMSegment> map,
+		std::unique_ptr<traffic::SectionedMesh> sections);
+	void loadHighwayMap(std::shared_ptr<traffic::OSMSegment> map,
+		std::unique_ptr<traffic::SectionedMesh> sections);
+
+	/// <summary>Sets the thread pool that is used to generate the meshes</summary>
+	void setManager(traffic::ConcurrencyManager *manager);
+	/// <summary>Sets the world whose agents are drawn on top of the map</summary>
+	void setWorld(const traffic::World *world);
+	/// <summary>Colors the edges by their congestion instead of drawing the
+	/// highway layer in a single color</summary>
+	void setHeatmap(bool enabled);
+	bool isHeatmap() const;
+	void setHeatmapMetric(traffic::HeatmapMetric metric);
+	traffic::HeatmapMetric getHeatmapMetric() const;
+	/// <summary>Whether a mesh is still generated or uploaded</summary>
+	bool isLoading() const;
+	/// <summary>Blocks until all pending meshes are generated and uploaded.
+	/// Must be called on the render thread.</summary>
+	void finishLoading();
+
+	/// <summary>
+	/// Regenerates the mesh sections that were modified by a change of the
+	/// map and the highway map. The view and the projection stay unchanged.
+	/// </summary>
+	void applyChange(const traffic::ChangeReport &mapReport,
+		const traffic::ChangeReport &highwayReport);
 	void loadRoute(const traffic::Route &route, std::shared_ptr<traffic::OSMSegment> map);
 	void clearRoutes();
 
 	bool hasMap() const;
 
+	/// <summary>The number of map vertices that were drawn in the last frame</summary>
+	size_t getRenderedVertices() const;
+	/// <summary>The number of agents that were drawn in the last frame</summary>
+	size_t getRenderedAgents() const;
+	/// <summary>The number of draw calls that were issued in the last frame</summary>
+	size_t getDrawCalls() const;
+	/// <summary>The number of heatmap values that were uploaded in the last frame</summary>
+	size_t getHeatmapUploads() const;
+
 	// ---- Events ---- //
 
 	virtual bool mouse_button_event(
@@ -274,14 +332,52 @@ protected:
 	// ---- Mesh access ---- //
 	void clearMesh();
 
-	std::shared_ptr<lt::Transformed4DEntity2D> genMeshFromMap(
-		const traffic::OSMSegment &seg, glm::vec3 color);
-	std::shared_ptr<lt::Transformed4DEntity2D> genMesh(
-		std::vector<glm::vec2> &&points, std::vector<glm::vec3> &&colors);
+	// batch mesh handles per section and detail level
+	using SectionMeshes = std::vector<std::vector<size_t>>;
+
+	/// <summary>Adds all detail levels of a section to the batch</summary>
+	std::vector<size_t> genMeshFromSection(lt::GLLineBatch &batch,
+		const traffic::SectionedMesh &sections, size_t section);
+	/// <summary>Replaces the meshes of the given sections with their current version</summary>
+	void updateSections(lt::GLLineBatch &batch, const traffic::SectionedMesh &sections,
+		SectionMeshes &meshes, const std::vector<size_t> &updated);
+
+	/// <summary>Queues the sections that are visible in the current view with
+	/// the level of detail that matches the current zoom</summary>
+	/// <returns>The number of vertices that were queued</returns>
+	size_t addVisibleSections(const traffic::SectionedMesh &sections,
+		const SectionMeshes &meshes, lt::GLLineBatch &batch,
+		glm::dvec2 lower, glm::dvec2 upper);
 
 	void setChunkMesh(
 		const std::vector<glm::vec2>& points);
 
+	/// <summary>
+	/// A map layer whose mesh is generated on a background thread. The sections
+	/// are uploaded on the render thread with a limited number of vertices per
+	/// frame, the current layer is drawn until the upload is complete.
+	/// </summary>
+	struct PendingLayer {
+		std::shared_ptr<traffic::OSMSegment> map;
+		std::future<std::unique_ptr<traffic::SectionedMesh>> future;
+		std::unique_ptr<traffic::SectionedMesh> sections;
+		SectionMeshes meshes;
+		std::shared_ptr<lt::GLLineBatch> batch;
+		size_t uploaded = 0;
+	};
+
+	/// <summary>Starts to upload a layer, the mesh is generated on a
+	/// background thread if no sections are given</summary>
+	void beginLayer(PendingLayer &layer, std::shared_ptr<traffic::OSMSegment> map,
+		glm::vec3 color, std::unique_ptr<traffic::SectionedMesh> sections = nullptr);
+	/// <summary>Uploads sections of the layer until the budget is used</summary>
+	/// <param name="budget">The remaining number of vertices in this frame</param>
+	/// <param name="wait">Whether to block until the mesh is generated</param>
+	/// <returns>True if the layer is completely uploaded</returns>
+	bool uploadLayer(PendingLayer &layer, size_t &budget, bool wait);
+	/// <summary>Uploads pending layers and replaces the completed ones</summary>
+	void processPending(size_t budget, bool wait);
+
 	// ---- Callbacks ---- //
 	template<typename Type, typename CBType>
 	CallbackReturn<CBType> addCallback(const Type& function, std::vector<CallbackForm<CBType>> &callbacks) {
@@ -305,24 +401,46 @@ protected:
 	Listener<void(double)> m_cb_rotation_changed;
 
 
-	std::shared_ptr<lt::Transformed4DEntity2D> l_mesh_map, l_mesh_highway;
-	std::vector<std::shared_ptr<lt::Transformed4DEntity2D>> l_mesh_routes;
-
-	std::shared_ptr<lt::render::LineMemoryShader> l_shader;
-	std::shared_ptr<lt::render::RenderList<lt::Entity2D>> entities;
+	// one mesh per section and detail level, empty ones are INVALID_MESH
+	SectionMeshes l_mesh_map, l_mesh_highway;
+	std::unique_ptr<traffic::SectionedMesh> m_sections_map, m_sections_highway;
+	// every layer shares one set of buffers and is drawn with a single call
+	std::shared_ptr<lt::GLLineBatch> l_batch_map, l_batch_highway, l_batch_routes;
+	std::vector<size_t> l_mesh_routes;
+	std::vector<glm::vec4> l_route_bounds; // (minX, minY, maxX, maxY) per route
+	PendingLayer m_pending_map, m_pending_highway;
+	traffic::ConcurrencyManager* m_manager = nullptr;
+	const traffic::World* m_world = nullptr;
+	// created on the first frame that has agents to draw
+	std::unique_ptr<AgentRenderer> m_agents;
+	// created on the first frame that shows the heatmap
+	std::unique_ptr<HeatmapRenderer> m_heatmap;
+	traffic::HeatmapMetric m_heatmap_metric = traffic::HeatmapMetric::Density;
+	// the number of vertices that are uploaded per frame
+	static constexpr size_t UPLOAD_BUDGET = 1 << 18;
+
+	// the view transform is stored in slot 0
+	std::shared_ptr<lt::GLTransformBuffer> l_transforms;
+	std::shared_ptr<lt::render::LineBatchMemoryShader> l_shader;
 	std::shared_ptr<lt::render::RenderComponent<
-		lt::render::LineStageBuffer,
-		lt::render::LineMemoryShader>> l_comp;
+		lt::render::LineBatchStageBuffer,
+		lt::render::LineBatchMemoryShader>> l_comp;
 	lt::render::RenderPipeline l_pipeline;
 
 	std::shared_ptr<traffic::OSMSegment> m_map;
 	std::shared_ptr<traffic::OSMSegment> m_highway_map;
+	Vector2d m_center;
 
 	bool m_active;
 	bool m_success;
 	bool m_render_chunk;
+	bool m_render_heatmap = false;
 	bool m_mark_update;
 	bool m_update_view;
+	size_t m_rendered_vertices = 0;
+	size_t m_rendered_agents = 0;
+	size_t m_draw_calls = 0;
+	size_t m_heatmap_uploads = 0;
 
 	Vector2d position;
 	Vector2d cursor;
@@ -334,3 +452,44 @@ protected:
 
 };
 
+/// <summary>
+/// Loads maps in the background. The stages of World::prepareMap and the mesh
+/// generation run on a separate thread that uses the thread pool of the world.
+/// Progress is reported through listeners that are triggered by update on the
+/// GUI thread. A finished map is installed in the world and the canvas by
+/// update, the previous map stays visible until its mesh is uploaded.
+/// </summary>
+class MapLoader {
+public:
+	MapLoader(traffic::World *world, MapCanvas *canvas);
+
+	/// <summary>Starts to load a map file</summary>
+	/// <returns>False if another map is still loading</returns>
+	bool load(const std::string &file);
+	bool isLoading() const;
+
+	/// <summary>Reports the progress and installs a finished map.
+	/// Must be called on the GUI thread once per frame.</summary>
+	void update();
+
+	Listener<void(traffic::LoadStage)>& cb_progress() { return m_cb_progress; }
+	Listener<void(std::string)>& cb_failed() { return m_cb_failed; }
+
+protected:
+	struct Result {
+		traffic::PreparedMap prepared;
+		std::unique_ptr<traffic::SectionedMesh> mapSections;
+		std::unique_ptr<traffic::SectionedMesh> highwaySections;
+	};
+
+	traffic::World* m_world;
+	MapCanvas* m_canvas;
+	std::future<Result> m_future;
+	// written by the loading thread, read by update
+	std::atomic<traffic::LoadStage> m_stage;
+	traffic::LoadStage m_reported;
+	bool m_loading = false;
+
+	Listener<void(traffic::LoadStage)> m_cb_progress;
+	Listener<void(std::string)> m_cb_failed;
+};
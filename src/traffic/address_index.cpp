@@ -0,0 +1,211 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "address_index.h"
+
+#include <limits>
+#include <algorithm>
+
+using namespace traffic;
+using namespace std;
+
+namespace
+{
+	const string ADDRESS_KEYS[4] = {
+		"addr:city", "addr:postcode", "addr:street", "addr:housenumber"
+	};
+}
+
+traffic::AddressIndex::AddressIndex(const OSMSegment& segment)
+	: m_nodes(segment.getNodes())
+{
+	m_strings[string()] = MISSING;
+	vector<uint32_t> values[4];
+	for (const OSMNode& nd : *m_nodes) {
+		if (!nd.getData()) continue;
+		bool hasAddress = false;
+		for (size_t i = 0; i < 4; i++)
+			values[i].clear();
+		for (const auto& tag : *nd.getData()) {
+			if (tag.first.compare(0, 5, "addr:") != 0) continue;
+			for (size_t i = 0; i < 4; i++) {
+				if (tag.first == ADDRESS_KEYS[i]) {
+					values[i].push_back(intern(tag.second));
+					hasAddress = true;
+				}
+			}
+		}
+		if (!hasAddress) continue;
+
+		// Every value of a repeated key is indexed, like hasTagValue matches
+		// any of them. A node gets one record per combination of values.
+		for (size_t i = 0; i < 4; i++)
+			if (values[i].empty()) values[i].push_back(MISSING);
+		for (uint32_t city : values[0])
+			for (uint32_t postcode : values[1])
+				for (uint32_t street : values[2])
+					for (uint32_t housenumber : values[3])
+						m_records.push_back(Record{ { city, postcode, street, housenumber }, nd.getID() });
+	}
+
+	for (size_t o = 0; o < ORDER_COUNT; o++) {
+		const auto& fields = ORDERS[o];
+		vector<uint32_t>& order = m_orders[o];
+		order.resize(m_records.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = static_cast<uint32_t>(i);
+		// Records are in node order, the stable sort keeps it for equal keys
+		stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			for (uint8_t field : fields) {
+				if (m_records[a].key[field] != m_records[b].key[field])
+					return m_records[a].key[field] < m_records[b].key[field];
+			}
+			return false;
+		});
+	}
+}
+
+const array<array<uint8_t, 4>, AddressIndex::ORDER_COUNT> AddressIndex::ORDERS = { {
+	{ 0, 1, 2, 3 },	// city, postcode, street, housenumber
+	{ 1, 2, 3, 0 },	// postcode, street, housenumber, city
+	{ 2, 3, 0, 1 }	// street, housenumber, city, postcode
+} };
+
+uint32_t traffic::AddressIndex::intern(const string& value)
+{
+	auto it = m_strings.find(value);
+	if (it != m_strings.end()) return it->second;
+	uint32_t id = static_cast<uint32_t>(m_strings.size());
+	m_strings[value] = id;
+	return id;
+}
+
+uint32_t traffic::AddressIndex::lookup(const string& value) const
+{
+	auto it = m_strings.find(value);
+	return it == m_strings.end() ? UNKNOWN : it->second;
+}
+
+void traffic::AddressIndex::find(const Key& key, size_t order,
+	size_t prefix, vector<int64_t>& result) const
+{
+	const auto& fields = ORDERS[order];
+	const vector<uint32_t>& indices = m_orders[order];
+	// Compares the prefix of a record with the prefix of the query
+	auto compare = [&](uint32_t record) {
+		for (size_t i = 0; i < prefix; i++) {
+			uint32_t value = m_records[record].key[fields[i]];
+			if (value != key[fields[i]]) return value < key[fields[i]] ? -1 : 1;
+		}
+		return 0;
+	};
+
+	auto lower = lower_bound(indices.begin(), indices.end(), 0,
+		[&](uint32_t record, int) { return compare(record) < 0; });
+	auto upper = upper_bound(lower, indices.end(), 0,
+		[&](int, uint32_t record) { return compare(record) > 0; });
+
+	vector<uint32_t> matches;
+	for (auto it = lower; it != upper; ++it) {
+		const Record& record = m_records[*it];
+		bool match = true;
+		for (size_t i = prefix; i < 4 && match; i++)
+			match = key[fields[i]] == MISSING || record.key[fields[i]] == key[fields[i]];
+		if (match) matches.push_back(*it);
+	}
+
+	// The matches of a partial key span several keys. Records are
+	// in node order, sorting their indices restores the node order.
+	// The records of a node are adjacent, a node is reported once.
+	sort(matches.begin(), matches.end());
+	result.reserve(result.size() + matches.size());
+	for (size_t i = 0; i < matches.size(); i++) {
+		if (i > 0 && m_records[matches[i]].node == m_records[matches[i - 1]].node) continue;
+		result.push_back(m_records[matches[i]].node);
+	}
+}
+
+vector<int64_t> traffic::AddressIndex::find(const string& city, const string& postcode,
+	const string& street, const string& housenumber) const
+{
+	vector<int64_t> result;
+	const string* values[4] = { &city, &postcode, &street, &housenumber };
+
+	Key key;
+	for (size_t i = 0; i < 4; i++) {
+		key[i] = values[i]->empty() ? MISSING : lookup(*values[i]);
+		if (key[i] == UNKNOWN) return result; // the value does not exist
+	}
+
+	// Nodes without any address tag only match the empty query
+	if (key == Key{ MISSING, MISSING, MISSING, MISSING }) {
+		result.reserve(m_nodes->size());
+		for (const OSMNode& nd : *m_nodes)
+			result.push_back(nd.getID());
+		return result;
+	}
+
+	// Picks the order in which the most leading fields are set
+	size_t bestOrder = 0, bestPrefix = 0;
+	for (size_t o = 0; o < ORDER_COUNT; o++) {
+		size_t prefix = 0;
+		while (prefix < 4 && key[ORDERS[o][prefix]] != MISSING) prefix++;
+		if (prefix > bestPrefix) {
+			bestOrder = o;
+			bestPrefix = prefix;
+		}
+	}
+	find(key, bestOrder, bestPrefix, result);
+	return result;
+}
+
+vector<int64_t> traffic::AddressIndex::find(const Address& address) const
+{
+	return find(address.city, address.postcode, address.street, address.housenumber);
+}
+
+vector<vector<int64_t>> traffic::AddressIndex::find(const vector<Address>& addresses) const
+{
+	vector<vector<int64_t>> result;
+	result.reserve(addresses.size());
+	for (const Address& address : addresses)
+		result.push_back(find(address));
+	return result;
+}
+
+size_t traffic::AddressIndex::getAddressCount() const noexcept { return m_records.size(); }
+size_t traffic::AddressIndex::getStringCount() const noexcept { return m_strings.size(); }
+
+size_t traffic::AddressIndex::getManagedSize() const
+{
+	size_t size = m_records.capacity() * sizeof(Record);
+	for (const vector<uint32_t>& order : m_orders)
+		size += order.capacity() * sizeof(uint32_t);
+	size += m_strings.calcNumBytesTotal(m_strings.mask() + 1);
+	for (const auto& entry : m_strings)
+		size += entry.first.capacity();
+	return size;
+}
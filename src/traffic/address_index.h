@@ -0,0 +1,107 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef ADDRESS_INDEX_H
+#define ADDRESS_INDEX_H
+
+#include "engine.h"
+
+#include <array>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "osm.h"
+
+namespace traffic
+{
+	/// <summary>Address query. Empty fields match every value.</summary>
+	struct Address {
+		std::string city;
+		std::string postcode;
+		std::string street;
+		std::string housenumber;
+	};
+
+	/// <summary>
+	/// Index over the addr:* tags of all nodes in a segment. Every tag value
+	/// is interned once, repeated keys are indexed with all of their values
+	/// like OSMMapObject::hasTagValue matches them. The addresses are sorted by (city, postcode, street,
+	/// housenumber), which forms a flattened city -> postcode -> street ->
+	/// housenumber tree. Two more orders start with the postcode and with
+	/// the street, for queries that leave the leading fields empty. A query
+	/// uses the order with the longest prefix of set fields, resolves the
+	/// prefix with a binary search and only compares the interned values of
+	/// the remaining fields.
+	/// </summary>
+	class AddressIndex
+	{
+	public:
+		explicit AddressIndex(const OSMSegment& segment);
+
+		/// <summary>
+		/// (1) Returns the IDs of all nodes that match the address. This
+		///     returns the same nodes as OSMSegment::findAdress.
+		/// (2) Resolves a batch of addresses, one result per address.
+		/// </summary>
+		std::vector<int64_t> find(const std::string& city, const std::string& postcode,
+			const std::string& street, const std::string& housenumber) const;
+		std::vector<int64_t> find(const Address& address) const;
+		std::vector<std::vector<int64_t>> find(const std::vector<Address>& addresses) const;
+
+		/// (1) Returns the number of nodes that have at least one address tag
+		/// (2) Returns the number of distinct interned values
+		size_t getAddressCount() const noexcept;
+		size_t getStringCount() const noexcept;
+		size_t getManagedSize() const;
+
+	protected:
+		using Key = std::array<uint32_t, 4>;
+		struct Record {
+			Key key;
+			int64_t node;
+		};
+
+		static constexpr uint32_t MISSING = 0;	// Value of tags that are not set
+		static constexpr uint32_t UNKNOWN = std::numeric_limits<uint32_t>::max();
+		static constexpr size_t ORDER_COUNT = 3;
+		static const std::array<std::array<uint8_t, 4>, ORDER_COUNT> ORDERS;
+
+		uint32_t intern(const std::string& value);
+		uint32_t lookup(const std::string& value) const;
+		void find(const Key& key, size_t order, size_t prefix, std::vector<int64_t>& result) const;
+
+		robin_hood::unordered_map<std::string, uint32_t> m_strings;
+		std::vector<Record> m_records;
+		// Record indices sorted by the field order of ORDERS
+		std::array<std::vector<uint32_t>, ORDER_COUNT> m_orders;
+		std::shared_ptr<std::vector<OSMNode>> m_nodes;
+	};
+}
+
+#endif
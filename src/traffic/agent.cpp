@@ -27,7 +27,11 @@
 
 #include "agent.h"
 #include "parser.hpp"
+#include "demand.h"
+#include "osm_mesh.h"
 #include <thread>
+#include <future>
+#include <algorithm>
 
 using namespace traffic;
 using namespace glm;
@@ -39,11 +43,100 @@ bool Entity::isAlive() const { return alive; }
 
 // ---- Agent ---- //
 
+Agent::Agent(World *world, int64_t startID, int64_t goalID)
+    : world(world), startID(startID), goalID(goalID),
+    lastVisited(startID), nextVisited(startID) { }
+
 void Agent::setGoal(int64_t newGoal) { goalID = newGoal; }
 int64_t Agent::getGoal() const { return goalID; }
+int64_t Agent::getStart() const { return startID; }
+
+bool Agent::isPlanned() const { return planned; }
+bool Agent::hasRoute() const { return route != InvalidRoute; }
+void Agent::setRoute(RouteHandle newRoute) {
+    route = newRoute;
+    planned = true;
+}
+RouteHandle Agent::getRoute() const { return route; }
+void Agent::resetRoute() {
+    route = InvalidRoute;
+    position = InvalidRoute;
+    state = AgentState::Waiting;
+    planned = false;
+}
+
+double Agent::getDepartureTime() const { return departureTime; }
+void Agent::setDepartureTime(double time) { departureTime = time; }
+int64_t Agent::getTag() const { return tag; }
+void Agent::setTag(int64_t newTag) { tag = newTag; }
+
+AgentState Agent::getState() const { return state; }
+RouteHandle Agent::getPosition() const { return position; }
+double Agent::getEdgeProgress() const { return edgeProgress; }
+
+void Agent::update(double dt) {
+    if (!planned || state == AgentState::Arrived)
+        return;
+    // Agents without a route can not reach their goal
+    if (route == InvalidRoute) {
+        state = AgentState::Arrived;
+        return;
+    }
 
-void Agent::update() {
+    RouteCache *cache = world->getRouteCache();
+    IntersectionSystem *signals = world->getIntersections();
+    EdgeStatistics &stats = world->getEdgeStatistics();
+    if (state == AgentState::Waiting) {
+        position = route;
+        edgeProgress = 0.0;
+        edgeEnterTime = world->getTime() - dt;
+        state = AgentState::Driving;
+        if (!cache->isFinished(position))
+            stats.enter(cache->getEdge(position));
+    }
+
+    // Follows the route until the time of this step is used up
+    double timeLeft = dt;
+    while (timeLeft > 0.0) {
+        if (cache->isFinished(position)) {
+            state = AgentState::Arrived;
+            lastVisited = goalID;
+            nextVisited = goalID;
+            break;
+        }
+
+        size_t edge = cache->getEdge(position);
+        double speed = world->getEdgeSpeed(edge);
+        double remaining = world->getEdgeLength(edge) - edgeProgress;
+        if (speed * timeLeft < remaining) {
+            edgeProgress += speed * timeLeft;
+            // Vehicles close to the stop line are detected by actuated signals
+            if (signals && remaining - speed * timeLeft < 30.0)
+                signals->registerDemand(edge);
+            timeLeft = 0.0;
+        }
+        else {
+            // Waits at the stop line if the intersection at the end of the
+            // edge is red. The goal itself is reached without crossing it.
+            RouteHandle next = cache->getNext(position);
+            if (signals && !cache->isFinished(next) && !signals->isGreen(edge)) {
+                edgeProgress = world->getEdgeLength(edge);
+                signals->registerDemand(edge);
+                break;
+            }
+            timeLeft -= remaining / speed;
+            edgeProgress = 0.0;
+            position = next;
 
+            // The time of the transition is the end of this step
+            // minus the time that is still left in this step.
+            double now = world->getTime() - timeLeft;
+            stats.leave(edge, now - edgeEnterTime);
+            edgeEnterTime = now;
+            if (!cache->isFinished(position))
+                stats.enter(cache->getEdge(position));
+        }
+    }
 }
 
 void Agent::makeGreedyChoice() {
@@ -78,6 +171,55 @@ void Agent::makeGreedyChoice() {
     }
 }
 
+// ---- EdgeStatistics ---- //
+
+void traffic::EdgeStatistics::resize(size_t edges)
+{
+    m_size = edges;
+    m_occupancy = std::make_unique<std::atomic<uint32_t>[]>(edges);
+    m_exits = std::make_unique<std::atomic<uint32_t>[]>(edges);
+    m_travelTime = std::make_unique<std::atomic<uint64_t>[]>(edges);
+    clear();
+}
+
+void traffic::EdgeStatistics::clear()
+{
+    for (size_t i = 0; i < m_size; i++) {
+        m_occupancy[i].store(0, std::memory_order_relaxed);
+        m_exits[i].store(0, std::memory_order_relaxed);
+        m_travelTime[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void traffic::EdgeStatistics::enter(size_t edge) noexcept
+{
+    m_occupancy[edge].fetch_add(1, std::memory_order_relaxed);
+}
+
+void traffic::EdgeStatistics::leave(size_t edge, double travelTime) noexcept
+{
+    m_occupancy[edge].fetch_sub(1, std::memory_order_relaxed);
+    m_exits[edge].fetch_add(1, std::memory_order_relaxed);
+    m_travelTime[edge].fetch_add(static_cast<uint64_t>(
+        std::max(travelTime, 0.0) * 1000.0), std::memory_order_relaxed);
+}
+
+void traffic::EdgeStatistics::cancel(size_t edge) noexcept
+{
+    m_occupancy[edge].fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t traffic::EdgeStatistics::size() const noexcept { return m_size; }
+uint32_t traffic::EdgeStatistics::getOccupancy(size_t edge) const noexcept { return m_occupancy[edge].load(std::memory_order_relaxed); }
+uint32_t traffic::EdgeStatistics::getExitCount(size_t edge) const noexcept { return m_exits[edge].load(std::memory_order_relaxed); }
+
+double traffic::EdgeStatistics::getMeanTravelTime(size_t edge) const noexcept
+{
+    uint32_t exits = getExitCount(edge);
+    if (exits == 0) return -1.0;
+    return m_travelTime[edge].load(std::memory_order_relaxed) / (1000.0 * exits);
+}
+
 // ---- WorldChunk ---- //
 
 int eraseFast(std::vector<int64_t>& vector, int64_t val)
@@ -106,41 +248,168 @@ bool contains(const std::vector<int64_t>& vector, int64_t id)
 
 // ---- Word ---- //
 
+const char* traffic::getStageName(LoadStage stage)
+{
+    switch (stage) {
+    case LoadStage::Parse: return "Parsing";
+    case LoadStage::Filter: return "Filtering";
+    case LoadStage::Graph: return "Building graph";
+    case LoadStage::Mesh: return "Generating mesh";
+    case LoadStage::Done: return "Done";
+    }
+    return "Unknown";
+}
 
 traffic::World::World(ConcurrencyManager* manager)
+    : m_arenas(manager->getPool().size())
 {
     m_manager = manager;
 }
 
 traffic::World::World(ConcurrencyManager* manager, const std::shared_ptr<OSMSegment>& map)
+    : m_arenas(manager->getPool().size())
 {
     m_manager = manager;
     loadMap(map);
 }
 
+traffic::World::~World()
+{
+    // Agents live inside of the pool and must be destroyed explicitly
+    for (Agent* agent : m_agents)
+        m_agentPool.destroy(agent);
+}
+
 void traffic::World::loadMap(const std::shared_ptr<OSMSegment>& map)
 {
-    m_map = make_shared<OSMSegment>(map->findNodes(
+    installMap(prepareMap(map));
+}
+
+PreparedMap traffic::World::prepareMap(const std::shared_ptr<OSMSegment>& map,
+    const std::function<void(LoadStage)>& progress) const
+{
+    auto report = [&progress](LoadStage stage) { if (progress) progress(stage); };
+
+    // Both maps are split from the source in a single parallel pass
+    report(LoadStage::Filter);
+    vector<OSMSegment> split = map->findNodes({
         OSMFinder()
             .setNodeAccept([](const OSMNode &node) { return !node.hasTag("highway"); })
             .setWayAccept([](const OSMWay& way) { return !way.hasTag("highway"); })
-            .setRelationAccept([](const OSMRelation& rl) { return !rl.hasTag("highway"); })
-    ));
-    k_highway_map = make_shared<OSMSegment>(map->findNodes(
+            .setRelationAccept([](const OSMRelation& rl) { return !rl.hasTag("highway"); }),
         OSMFinder()
             .setWayAccept([](const OSMWay& way) { return way.hasTag("highway"); })
             .setRelationAccept([](const OSMRelation&) { return false; }) // relations are not needed
-    ));
+    }, m_manager);
+    PreparedMap prepared;
+    prepared.map = make_shared<OSMSegment>(move(split[0]));
+    prepared.highwayMap = make_shared<OSMSegment>(move(split[1]));
+
+    prepared.map->summary();
+    prepared.highwayMap->summary();
+
+    report(LoadStage::Graph);
+    prepared.graph = make_shared<Graph>(prepared.highwayMap);
+    prepared.graph->checkConsistency();
+    prepared.graph->optimize();
+    return prepared;
+}
+
+void traffic::World::installMap(PreparedMap&& prepared)
+{
+    m_map = move(prepared.map);
+    k_highway_map = move(prepared.highwayMap);
+    m_graph = move(prepared.graph);
+    rebuildRouting();
+}
+
+std::pair<ChangeReport, ChangeReport> traffic::World::applyChange(const OSMChange& change)
+{
+    // The change is split like the map itself. Objects that gain or lose the
+    // highway tag are deleted from the map they do not belong to anymore.
+    OSMChange mapChange, highwayChange;
+    auto isHighway = [](const OSMMapObject& object) { return object.hasTag("highway"); };
+
+    highwayChange.createdNodes = change.createdNodes;
+    highwayChange.modifiedNodes = change.modifiedNodes;
+    highwayChange.deletedNodes = change.deletedNodes;
+    for (const OSMNode& node : change.createdNodes)
+        if (!isHighway(node)) mapChange.createdNodes.push_back(node);
+    for (const OSMNode& node : change.modifiedNodes) {
+        if (isHighway(node)) mapChange.deletedNodes.push_back(node.getID());
+        else mapChange.modifiedNodes.push_back(node);
+    }
+    mapChange.deletedNodes.insert(mapChange.deletedNodes.end(),
+        change.deletedNodes.begin(), change.deletedNodes.end());
+
+    for (const OSMWay& way : change.createdWays)
+        (isHighway(way) ? highwayChange : mapChange).createdWays.push_back(way);
+    for (const OSMWay& way : change.modifiedWays) {
+        if (isHighway(way)) {
+            highwayChange.modifiedWays.push_back(way);
+            mapChange.deletedWays.push_back(way.getID());
+        } else {
+            mapChange.modifiedWays.push_back(way);
+            highwayChange.deletedWays.push_back(way.getID());
+        }
+    }
+    highwayChange.deletedWays.insert(highwayChange.deletedWays.end(),
+        change.deletedWays.begin(), change.deletedWays.end());
+    mapChange.deletedWays.insert(mapChange.deletedWays.end(),
+        change.deletedWays.begin(), change.deletedWays.end());
+
+    // relations are not part of the highway map
+    for (const OSMRelation& rl : change.createdRelations)
+        if (!isHighway(rl)) mapChange.createdRelations.push_back(rl);
+    for (const OSMRelation& rl : change.modifiedRelations) {
+        if (isHighway(rl)) mapChange.deletedRelations.push_back(rl.getID());
+        else mapChange.modifiedRelations.push_back(rl);
+    }
+    mapChange.deletedRelations.insert(mapChange.deletedRelations.end(),
+        change.deletedRelations.begin(), change.deletedRelations.end());
+
+    ChangeReport mapReport = m_map->applyChange(mapChange);
+    ChangeReport highwayReport = k_highway_map->applyChange(highwayChange);
 
-    m_map->summary();
-    k_highway_map->summary();
+    // The graph is updated incrementally, the FastGraph and everything
+    // that depends on its indices is derived again.
+    m_graph->applyChange(highwayReport);
+    if (!m_graph->getFastGraph()) m_graph->optimize();
+    rebuildRouting();
+    return { std::move(mapReport), std::move(highwayReport) };
+}
+
+void traffic::World::rebuildRouting()
+{
+    // Routes of the old graph are not valid anymore
+    for (Agent* agent : m_agents) {
+        if (m_routeCache) m_routeCache->release(agent->getRoute());
+        agent->resetRoute();
+    }
 
-    m_graph = make_shared<Graph>(k_highway_map);
-    m_graph->checkConsistency();
-    m_graph->optimize();
+    m_routeCache = std::make_unique<RouteCache>(m_graph->getFastGraph());
+    m_intersections = std::make_unique<IntersectionSystem>(*m_graph->getFastGraph());
+
+    // Calculates the length of every edge in meters
+    const FastGraph* fastGraph = m_graph->getFastGraph();
+    m_edgeLengths.resize(fastGraph->countEdges());
+    for (size_t i = 0; i < m_edgeLengths.size(); i++) {
+        const FastGraphNode& source = fastGraph->getNode(fastGraph->getEdgeSource(i));
+        const FastGraphNode& goal = fastGraph->getNode(fastGraph->getEdgeGoal(i));
+        double length = traffic::distance(dvec2(source.lat, source.lon),
+            dvec2(goal.lat, goal.lon)) * 1000.0;
+        m_edgeLengths[i] = static_cast<float>(std::max(length, 0.1));
+    }
+    m_edgeStats.resize(m_edgeLengths.size());
 }
 
 void traffic::World::loadMap(const std::string& file)
+{
+    installMap(prepareMap(file));
+}
+
+PreparedMap traffic::World::prepareMap(const std::string& file,
+    const std::function<void(LoadStage)>& progress) const
 {
     // Groningen coordinates
     // tl,tr [53.265301,6.465842][53.265301,6.675939]
@@ -159,17 +428,188 @@ void traffic::World::loadMap(const std::string& file)
     args.pool = &m_manager->getPool();
     args.timings = &timings;
     
+    if (progress) progress(LoadStage::Parse);
     auto newMap = std::make_shared<OSMSegment>(parseXMLMap(args));
     timings.summary();
 
-    loadMap(newMap);
+    return prepareMap(newMap, progress);
+}
+
+Agent* traffic::World::spawnAgent(int64_t startID, int64_t goalID)
+{
+    Agent* agent = m_agentPool.create(this, startID, goalID);
+    agent->departureTime = m_time;
+    m_agents.push_back(agent);
+    return agent;
+}
+
+Agent* traffic::World::spawnAgent(int64_t startID, int64_t goalID, RouteHandle route)
+{
+    Agent* agent = spawnAgent(startID, goalID);
+    if (m_routeCache)
+        m_routeCache->acquire(route);
+    agent->setRoute(route);
+    return agent;
+}
+
+void traffic::World::resetSimulation()
+{
+    for (Agent* agent : m_agents) {
+        if (m_routeCache)
+            m_routeCache->release(agent->getRoute());
+        m_agentPool.destroy(agent);
+    }
+    m_agents.clear();
+    m_edgeStats.clear();
+    m_time = 0.0;
+    m_arrived = 0;
+}
+
+void traffic::World::despawnAgent(Agent* agent)
+{
+    auto it = std::find(m_agents.begin(), m_agents.end(), agent);
+    if (it == m_agents.end()) return;
+    // Swaps the agent to the back to avoid shifting the whole buffer
+    *it = m_agents.back();
+    m_agents.pop_back();
+
+    // The agent leaves its edge without finishing it
+    if (m_routeCache && agent->getState() == AgentState::Driving &&
+        !m_routeCache->isFinished(agent->getPosition()))
+        m_edgeStats.cancel(m_routeCache->getEdge(agent->getPosition()));
+    if (m_routeCache)
+        m_routeCache->release(agent->getRoute());
+    m_agentPool.destroy(agent);
+}
+
+Route traffic::World::findRoute(int64_t start, int64_t goal, int threadID)
+{
+    RoutingBuffers buffers;
+    buffers.arena = &m_arenas.getArena(threadID);
+    buffers.routes = &m_routePool;
+    return m_graph->findRoute(start, goal, buffers);
+}
+
+RouteHandle traffic::World::findCachedRoute(int64_t start, int64_t goal, int threadID)
+{
+    int64_t startIndex = m_graph->findNodeIndex(start);
+    int64_t goalIndex = m_graph->findNodeIndex(goal);
+    if (!m_routeCache || startIndex == -1 || goalIndex == -1)
+        return InvalidRoute;
+
+    RoutingBuffers buffers;
+    buffers.arena = &m_arenas.getArena(threadID);
+    return m_routeCache->findRoute(startIndex, goalIndex, buffers);
 }
 
+void traffic::World::releaseRoute(Route&& route)
+{
+    m_routePool.release(std::move(route.nodes));
+}
+
+void traffic::World::update(double dt)
+{
+    // Transient memory of the last tick is released
+    m_arenas.resetAll();
+    m_time += dt;
+
+    if (m_demand && m_routeCache)
+        m_demand->spawn(*this, m_time);
+
+    // Plans the routes of all agents that were spawned since the last tick.
+    // Each thread uses its own arena for the search buffers.
+    if (m_routeCache) {
+        std::vector<Agent*> planning;
+        for (Agent* agent : m_agents)
+            if (!agent->isPlanned()) planning.push_back(agent);
+
+        m_manager->parallelFor(planning.size(), 64,
+            [this, &planning](int threadID, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                Agent* agent = planning[i];
+                agent->setRoute(findCachedRoute(agent->getStart(), agent->getGoal(), threadID));
+            }
+        });
+    }
+
+    // Signals are switched before any vehicle moves
+    if (m_intersections)
+        m_intersections->update(dt, m_manager);
+
+    m_manager->parallelFor(m_agents.size(), 1024,
+        [this, dt](int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            m_agents[i]->update(dt);
+    });
+
+    // Removes all agents that reached their goal
+    size_t alive = 0;
+    for (size_t i = 0; i < m_agents.size(); i++) {
+        Agent* agent = m_agents[i];
+        if (agent->getState() == AgentState::Arrived) {
+            if (m_arrivalCallback)
+                m_arrivalCallback(*agent);
+            if (m_routeCache)
+                m_routeCache->release(agent->getRoute());
+            m_agentPool.destroy(agent);
+            m_arrived++;
+        }
+        else {
+            m_agents[alive++] = agent;
+        }
+    }
+    m_agents.resize(alive);
+
+    // Collects the allocation statistics of this tick
+    m_report = AllocationReport();
+    m_arenas.collect(m_report);
+    m_report.poolAllocations = m_agentPool.getAllocationCount() + m_routePool.getAllocationCount();
+    m_report.poolDeallocations = m_agentPool.getDeallocationCount() + m_routePool.getDeallocationCount();
+    m_report.poolLive = m_agentPool.size();
+    m_report.poolCapacity = m_agentPool.capacity();
+    m_report.heapAllocations += m_agentPool.getHeapAllocationCount() + m_routePool.getHeapAllocationCount();
+    m_agentPool.resetCounters();
+    m_routePool.resetCounters();
+
+    if (m_reportStatistics) {
+        m_report.summary();
+        if (m_routeCache)
+            m_routeCache->getStats().summary();
+    }
+}
+
+void traffic::World::setDemand(const std::shared_ptr<DemandStream>& demand) { m_demand = demand; }
+const std::shared_ptr<DemandStream>& traffic::World::getDemand() const { return m_demand; }
+double traffic::World::getTime() const noexcept { return m_time; }
+void traffic::World::setTime(double time) noexcept { m_time = time; }
+double traffic::World::getEdgeLength(size_t edge) const { return m_edgeLengths[edge]; }
+double traffic::World::getEdgeSpeed(size_t edge) const
+{
+    // Greenshields model: the speed drops linearly with the density. Every
+    // vehicle occupies 7.5 meters of a single lane.
+    double density = m_edgeStats.getOccupancy(edge) * 7.5 / m_edgeLengths[edge];
+    return m_freeFlowSpeed * std::max(0.1, 1.0 - density);
+}
+void traffic::World::setFreeFlowSpeed(double speed) noexcept { m_freeFlowSpeed = speed; }
+double traffic::World::getFreeFlowSpeed() const noexcept { return m_freeFlowSpeed; }
+size_t traffic::World::getArrivedCount() const noexcept { return m_arrived; }
+void traffic::World::setArrivalCallback(const std::function<void(const Agent&)>& callback) { m_arrivalCallback = callback; }
+EdgeStatistics& traffic::World::getEdgeStatistics() { return m_edgeStats; }
+const EdgeStatistics& traffic::World::getEdgeStatistics() const { return m_edgeStats; }
+
+void traffic::World::setStatisticsReporting(bool enabled) { m_reportStatistics = enabled; }
+const AllocationReport& traffic::World::getAllocationReport() const { return m_report; }
+RouteCache* traffic::World::getRouteCache() const { return m_routeCache.get(); }
+IntersectionSystem* traffic::World::getIntersections() const { return m_intersections.get(); }
+ArenaManager& traffic::World::getArenas() { return m_arenas; }
+ConcurrencyManager* traffic::World::getManager() const { return m_manager; }
+
 bool traffic::World::hasMap() const noexcept { return m_map.get(); }
+
 const std::shared_ptr<OSMSegment>& traffic::World::getMap() const { return m_map; }
 const std::shared_ptr<OSMSegment>& traffic::World::getHighwayMap() const { return k_highway_map; }
 const std::shared_ptr<Graph>& World::getGraph() const { return m_graph; }
-const std::vector<Agent>& World::getAgents() const { return m_agents; }
+const std::vector<Agent*>& World::getAgents() const { return m_agents; }
 
 traffic::ConcurrencyManager::ConcurrencyManager()
 {
@@ -178,4 +618,31 @@ traffic::ConcurrencyManager::ConcurrencyManager()
     m_pool.resize(size);
 }
 
+traffic::ConcurrencyManager::ConcurrencyManager(size_t threads)
+{
+    m_pool.resize(static_cast<int>(std::max<size_t>(threads, 1)));
+}
+
 ctpl::thread_pool& traffic::ConcurrencyManager::getPool() { return m_pool; }
+
+void traffic::ConcurrencyManager::parallelFor(size_t count, size_t batchSize,
+    const std::function<void(int, size_t, size_t)>& func)
+{
+    if (count == 0) return;
+    batchSize = std::max<size_t>(batchSize, 1);
+
+    std::vector<std::future<void>> futures;
+    futures.reserve((count + batchSize - 1) / batchSize);
+    for (size_t begin = 0; begin < count; begin += batchSize) {
+        size_t end = std::min(begin + batchSize, count);
+        futures.push_back(m_pool.push([&func, begin, end](int threadID) {
+            func(threadID, begin, end);
+        }));
+    }
+    // Every batch references func, all of them must finish before
+    // an exception may leave this function
+    for (auto& future : futures)
+        future.wait();
+    for (auto& future : futures)
+        future.get();
+}
@@ -36,11 +36,40 @@
 #include "osm.h"
 #include "osm_graph.h"
 #include "geom.h"
+#include "allocator.h"
+#include "route_cache.h"
+#include "intersection.h"
 
 namespace traffic
 {
     class Agent; // A single agent that takes part in the world
     class World; // The world the agent takes part of
+    class DemandStream; // Spawns agents from travel demand
+
+    /// <summary>The states an agent passes during its trip</summary>
+    enum class AgentState {
+        Waiting, // The agent waits for its route
+        Driving, // The agent follows its route
+        Arrived  // The agent reached its goal or has no route
+    };
+
+    /// <summary>The stages of loading a map, in the order they are executed</summary>
+    enum class LoadStage {
+        Parse,  // The file is parsed
+        Filter, // The map is split into the map and the highway map
+        Graph,  // The graph is built and optimized
+        Mesh,   // The mesh data of both maps is generated
+        Done    // The map is ready to be installed
+    };
+
+    const char* getStageName(LoadStage stage);
+
+    /// <summary>A map that is prepared for a world, including its graph</summary>
+    struct PreparedMap {
+        std::shared_ptr<OSMSegment> map;
+        std::shared_ptr<OSMSegment> highwayMap;
+        std::shared_ptr<Graph> graph;
+    };
 
     class Entity
     {
@@ -63,6 +92,7 @@ namespace traffic
     {
     public:
         // ---- Constructors ---- //
+        Agent(World *world, int64_t startID, int64_t goalID);
         Agent(const Agent&) = delete;
         Agent(Agent&&) = delete;
 
@@ -75,24 +105,102 @@ namespace traffic
 
         void setGoal(int64_t newGoal);
         int64_t getGoal() const;
+        int64_t getStart() const;
+
+        /// <summary>Whether the route of this agent was planned already.
+        /// Agents with an unreachable goal are planned but have no route.</summary>
+        bool isPlanned() const;
+        bool hasRoute() const;
+        void setRoute(RouteHandle route);
+        RouteHandle getRoute() const;
+        /// <summary>Marks the route as outdated without releasing it</summary>
+        void resetRoute();
+
+        AgentState getState() const;
+        /// <summary>The edge the agent is currently driving on or
+        /// InvalidRoute if the agent is not driving</summary>
+        RouteHandle getPosition() const;
+        /// <summary>The distance driven on the current edge in meters</summary>
+        double getEdgeProgress() const;
+
+        /// <summary>The simulation time the agent was spawned at</summary>
+        double getDepartureTime() const;
+        void setDepartureTime(double time);
+
+        /// <summary>User defined value that identifies the agent, for
+        /// example the index of the trip it was spawned for</summary>
+        int64_t getTag() const;
+        void setTag(int64_t tag);
 
-        virtual void update();
+        /// <summary>Moves the agent along its route</summary>
+        /// <param name="dt">The time step in seconds</param>
+        virtual void update(double dt);
         void makeGreedyChoice();
 
     protected:
+        friend class World;
+
         // ---- Member definitions ---- //
-        std::shared_ptr<World> world;
+        World *world;
+        int64_t startID;
         int64_t goalID;
+        RouteHandle route = InvalidRoute;
+        RouteHandle position = InvalidRoute;
+        double edgeProgress = 0.0;
+        double edgeEnterTime = 0.0;
+        double departureTime = 0.0;
+        int64_t tag = -1;
+        AgentState state = AgentState::Waiting;
+        bool planned = false;
 
         int64_t lastVisited;
         int64_t nextVisited;
     };
 
+    /// <summary>
+    /// Collects the number of vehicles on each edge and the travel times of
+    /// all vehicles that left an edge. The counters are atomic so they can be
+    /// updated by agents that are moved in parallel.
+    /// </summary>
+    class EdgeStatistics
+    {
+    public:
+        EdgeStatistics() = default;
+
+        void resize(size_t edges);
+        void clear();
+
+        void enter(size_t edge) noexcept;
+        void leave(size_t edge, double travelTime) noexcept;
+        /// <summary>Removes a vehicle from an edge without recording a travel time</summary>
+        void cancel(size_t edge) noexcept;
+
+        size_t size() const noexcept;
+        uint32_t getOccupancy(size_t edge) const noexcept;
+        uint32_t getExitCount(size_t edge) const noexcept;
+        /// <summary>Returns the mean travel time of all vehicles that left
+        /// the edge or a negative value if no vehicle left it yet.</summary>
+        double getMeanTravelTime(size_t edge) const noexcept;
+
+    protected:
+        size_t m_size = 0;
+        std::unique_ptr<std::atomic<uint32_t>[]> m_occupancy;
+        std::unique_ptr<std::atomic<uint32_t>[]> m_exits;
+        std::unique_ptr<std::atomic<uint64_t>[]> m_travelTime; // milliseconds
+    };
+
     class ConcurrencyManager {
     public:
         ConcurrencyManager();
+        explicit ConcurrencyManager(size_t threads);
         ctpl::thread_pool& getPool();
 
+        /// <summary>Splits the range [0, count) in batches and executes them on
+        /// the thread pool. The function is called with the thread ID and the
+        /// batch range. Blocks until all batches are finished.</summary>
+        void parallelFor(size_t count, size_t batchSize,
+            const std::function<void(int, size_t, size_t)> &func);
+
     protected:
         ctpl::thread_pool m_pool;
     };
@@ -104,27 +212,134 @@ namespace traffic
         World(ConcurrencyManager *manager);
         World(ConcurrencyManager* manager, const std::shared_ptr<OSMSegment> &map);
 
-        virtual ~World() = default;
+        World(const World&) = delete;
+        World& operator=(const World&) = delete;
+
+        virtual ~World();
 
         // ---- Functions ---- //
         bool hasMap() const noexcept;
         
         void loadMap(const std::shared_ptr<OSMSegment>& map);
         void loadMap(const std::string &file);
+
+        /// <summary>Parses a map file and prepares it without modifying the
+        /// world. The world may be used on another thread in the meantime.</summary>
+        /// <param name="file">The map file</param>
+        /// <param name="progress">Optional function that is called when a stage begins</param>
+        PreparedMap prepareMap(const std::string &file,
+            const std::function<void(LoadStage)> &progress = nullptr) const;
+        /// <summary>Splits the map and builds its graph without modifying the world</summary>
+        PreparedMap prepareMap(const std::shared_ptr<OSMSegment> &map,
+            const std::function<void(LoadStage)> &progress = nullptr) const;
+        /// <summary>Replaces the maps and the graph of the world and rebuilds
+        /// the routing data. Planned routes are reset.</summary>
+        void installMap(PreparedMap &&prepared);
+
+        /// <summary>Applies an OSM change to the map and the highway map. The
+        /// graph is updated incrementally, planned routes are reset.</summary>
+        /// <param name="change">The change that is applied</param>
+        /// <returns>The reports of the map and the highway map</returns>
+        std::pair<ChangeReport, ChangeReport> applyChange(const OSMChange& change);
+
+        /// <summary>Creates a new agent in the agent pool. The route of the
+        /// agent is planned during the next update.</summary>
+        /// <param name="startID">The node ID where the agent starts</param>
+        /// <param name="goalID">The node ID the agent wants to reach</param>
+        /// <returns>The agent, owned by this world</returns>
+        Agent* spawnAgent(int64_t startID, int64_t goalID);
+
+        /// <summary>Creates a new agent that follows an already planned route.
+        /// An additional reference to the route is acquired.</summary>
+        Agent* spawnAgent(int64_t startID, int64_t goalID, RouteHandle route);
+
+        /// <summary>Removes all agents and resets the time and the edge
+        /// statistics to start a new simulation run</summary>
+        void resetSimulation();
+
+        /// <summary>Removes an agent from this world and releases its memory</summary>
+        void despawnAgent(Agent *agent);
+
+        /// <summary>Finds a route using the memory resources of the given
+        /// thread. A thread ID of -1 refers to the calling thread.</summary>
+        Route findRoute(int64_t start, int64_t goal, int threadID = -1);
+
+        /// <summary>Finds a route through the route cache. The returned handle
+        /// must be released through the route cache.</summary>
+        RouteHandle findCachedRoute(int64_t start, int64_t goal, int threadID = -1);
+
+        /// <summary>Returns the storage of a route to the route pool</summary>
+        void releaseRoute(Route &&route);
+
+        /// <summary>Advances the world by a single tick. Transient memory of
+        /// the last tick is released at the beginning of the tick.</summary>
+        /// <param name="dt">The time step in seconds</param>
+        void update(double dt);
+
+        /// <summary>Sets the travel demand that spawns agents during the updates</summary>
+        void setDemand(const std::shared_ptr<DemandStream> &demand);
+        const std::shared_ptr<DemandStream>& getDemand() const;
+
+        /// <summary>The simulated time in seconds</summary>
+        double getTime() const noexcept;
+        void setTime(double time) noexcept;
+
+        /// <summary>The length of a FastGraph edge in meters</summary>
+        double getEdgeLength(size_t edge) const;
+        /// <summary>The current speed on a FastGraph edge in meters per second</summary>
+        double getEdgeSpeed(size_t edge) const;
+        void setFreeFlowSpeed(double speed) noexcept;
+        double getFreeFlowSpeed() const noexcept;
+
+        size_t getArrivedCount() const noexcept;
+
+        /// <summary>Called for every agent that reached its goal right
+        /// before it is removed from the world</summary>
+        void setArrivalCallback(const std::function<void(const Agent&)> &callback);
+
+        EdgeStatistics& getEdgeStatistics();
+        const EdgeStatistics& getEdgeStatistics() const;
+
+        /// <summary>Prints allocation and route cache statistics after every tick</summary>
+        void setStatisticsReporting(bool enabled);
+        const AllocationReport& getAllocationReport() const;
+        RouteCache* getRouteCache() const;
+        IntersectionSystem* getIntersections() const;
+        ArenaManager& getArenas();
+        ConcurrencyManager* getManager() const;
         
         const std::shared_ptr<OSMSegment>& getMap() const;
         const std::shared_ptr<OSMSegment>& getHighwayMap() const;
         const std::shared_ptr<Graph>& getGraph() const;
-        const std::vector<Agent>& getAgents() const;
+        const std::vector<Agent*>& getAgents() const;
 
     protected:
+        /// <summary>Recreates the route cache, the intersections and the edge
+        /// data from the optimized graph</summary>
+        void rebuildRouting();
+
         // ---- Member definitions ---- //
         ConcurrencyManager *m_manager;
         std::shared_ptr<OSMSegment> m_map;
         std::shared_ptr<OSMSegment> k_highway_map;
 
         std::shared_ptr<Graph> m_graph;
-        std::vector<Agent> m_agents;
+        std::unique_ptr<RouteCache> m_routeCache;
+        std::unique_ptr<IntersectionSystem> m_intersections;
+        std::vector<Agent*> m_agents;
+        std::shared_ptr<DemandStream> m_demand;
+        std::vector<float> m_edgeLengths;
+        double m_freeFlowSpeed = 13.9;
+        double m_time = 0.0;
+        size_t m_arrived = 0;
+        EdgeStatistics m_edgeStats;
+        std::function<void(const Agent&)> m_arrivalCallback;
+
+        ObjectPool<Agent> m_agentPool;
+        VectorPool<int64_t> m_routePool;
+        ArenaManager m_arenas;
+        AllocationReport m_report;
+        bool m_reportStatistics = false;
     }; 
 } // namespace traffic
 
@@ -0,0 +1,167 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "allocator.h"
+
+#include <cstdio>
+#include <algorithm>
+
+using namespace traffic;
+using namespace std;
+
+// ---- AllocationReport ---- //
+
+void traffic::AllocationReport::summary() const
+{
+	printf("Allocations: Arena %zu (%zu/%zu bytes) Pool %zu/%zu (live %zu/%zu) Heap %zu\n",
+		arenaAllocations, arenaBytes, arenaCapacity,
+		poolAllocations, poolDeallocations, poolLive, poolCapacity,
+		heapAllocations);
+}
+
+// ---- BumpArena ---- //
+
+traffic::BumpArena::BumpArena(size_t blockSize)
+	: m_blockSize(blockSize) { }
+
+void* traffic::BumpArena::allocate(size_t size, size_t alignment)
+{
+	m_allocations++;
+	while (true) {
+		if (m_current < m_blocks.size()) {
+			Block &block = m_blocks[m_current];
+			uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+			uintptr_t aligned = (base + m_offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			size_t newOffset = (aligned - base) + size;
+			if (newOffset <= block.size) {
+				m_used += newOffset - m_offset;
+				m_offset = newOffset;
+				return reinterpret_cast<void*>(aligned);
+			}
+			// The current block is exhausted, continues with the next one
+			m_current++;
+			m_offset = 0;
+		}
+		else {
+			addBlock(size + alignment);
+		}
+	}
+}
+
+void traffic::BumpArena::addBlock(size_t minSize)
+{
+	size_t size = std::max(minSize, m_blockSize);
+	m_blocks.push_back(Block{ std::make_unique<char[]>(size), size });
+	m_heapAllocations++;
+}
+
+void traffic::BumpArena::reset()
+{
+	if (m_blocks.size() > 1) {
+		// Merges all blocks into one that fits a whole cycle
+		size_t total = 0;
+		for (const Block& block : m_blocks)
+			total += block.size;
+		m_blocks.clear();
+		addBlock(total);
+	}
+	m_current = 0;
+	m_offset = 0;
+	m_used = 0;
+}
+
+void traffic::BumpArena::resetCounters() noexcept
+{
+	m_allocations = 0;
+	m_heapAllocations = 0;
+}
+
+traffic::BumpArena::Scope::Scope(BumpArena* arena)
+	: m_arena(arena)
+{
+	if (m_arena) {
+		m_current = m_arena->m_current;
+		m_offset = m_arena->m_offset;
+		m_used = m_arena->m_used;
+	}
+}
+
+traffic::BumpArena::Scope::~Scope()
+{
+	if (m_arena) {
+		m_arena->m_current = m_current;
+		m_arena->m_offset = m_offset;
+		m_arena->m_used = m_used;
+	}
+}
+
+size_t traffic::BumpArena::getAllocationCount() const noexcept { return m_allocations; }
+size_t traffic::BumpArena::getUsedBytes() const noexcept { return m_used; }
+size_t traffic::BumpArena::getHeapAllocationCount() const noexcept { return m_heapAllocations; }
+size_t traffic::BumpArena::getCapacity() const noexcept
+{
+	size_t total = 0;
+	for (const Block& block : m_blocks)
+		total += block.size;
+	return total;
+}
+
+// ---- ArenaManager ---- //
+
+traffic::ArenaManager::ArenaManager(size_t threads, size_t blockSize)
+{
+	// The last arena is reserved for the main thread
+	m_arenas.reserve(threads + 1);
+	for (size_t i = 0; i < threads + 1; i++)
+		m_arenas.push_back(std::make_unique<BumpArena>(blockSize));
+}
+
+BumpArena& traffic::ArenaManager::getArena(int threadID)
+{
+	if (threadID < 0 || static_cast<size_t>(threadID) + 1 >= m_arenas.size())
+		return getMainArena();
+	return *m_arenas[threadID];
+}
+
+BumpArena& traffic::ArenaManager::getMainArena() { return *m_arenas.back(); }
+size_t traffic::ArenaManager::getThreadCount() const noexcept { return m_arenas.size() - 1; }
+
+void traffic::ArenaManager::resetAll()
+{
+	for (auto& arena : m_arenas)
+		arena->reset();
+}
+
+void traffic::ArenaManager::collect(AllocationReport& report)
+{
+	for (auto& arena : m_arenas) {
+		report.arenaAllocations += arena->getAllocationCount();
+		report.arenaBytes += arena->getUsedBytes();
+		report.arenaCapacity += arena->getCapacity();
+		report.heapAllocations += arena->getHeapAllocationCount();
+		arena->resetCounters();
+	}
+}
@@ -0,0 +1,361 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include "engine.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <mutex>
+
+namespace traffic
+{
+	class BumpArena; // Linear allocator for short lived, transient data
+	template<typename T> class ArenaAllocator; // STL adapter for BumpArena
+	template<typename T, size_t SlabSize> class ObjectPool; // Slab allocator for objects
+	template<typename T> class VectorPool; // Recycles the storage of vectors
+	class ArenaManager; // Owns one BumpArena per worker thread
+
+	/// <summary>
+	/// Stores the number of allocation events that occurred during a single tick.
+	/// Heap allocations count the blocks and slabs that had to be requested from
+	/// the general purpose allocator. They should drop to zero once the pools
+	/// have warmed up.
+	/// </summary>
+	struct AllocationReport
+	{
+		size_t arenaAllocations = 0;
+		size_t arenaBytes = 0;
+		size_t arenaCapacity = 0;
+		size_t poolAllocations = 0;
+		size_t poolDeallocations = 0;
+		size_t poolLive = 0;
+		size_t poolCapacity = 0;
+		size_t heapAllocations = 0;
+
+		void summary() const;
+	};
+
+	/// <summary>
+	/// A bump (linear) allocator that hands out memory by advancing an offset in
+	/// a list of large blocks. Single allocations can not be freed, instead the
+	/// whole arena is reset at once. Arenas are not thread safe and are meant to
+	/// be used by exactly one thread at a time.
+	/// </summary>
+	class BumpArena
+	{
+	public:
+		/// <summary>Creates an empty arena</summary>
+		/// <param name="blockSize">The minimum size of each block in bytes</param>
+		explicit BumpArena(size_t blockSize = 1 << 20);
+
+		BumpArena(const BumpArena&) = delete;
+		BumpArena(BumpArena&&) = delete;
+		BumpArena& operator=(const BumpArena&) = delete;
+		BumpArena& operator=(BumpArena&&) = delete;
+
+		/// <summary>Allocates a chunk of memory from this arena</summary>
+		/// <param name="size">The number of bytes that are requested</param>
+		/// <param name="alignment">The alignment of the memory, must be a power of two</param>
+		/// <returns>A pointer that stays valid until the next reset</returns>
+		void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+		/// <summary>Allocates an uninitialized array of objects</summary>
+		template<typename T> T* allocateArray(size_t count) {
+			return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+		}
+
+		/// <summary>Releases all allocations at once. Memory blocks are kept. If
+		/// the last cycle needed more than one block, the blocks are merged into a
+		/// single one that is large enough for the whole cycle.</summary>
+		void reset();
+
+		/// <summary>Resets the allocation counters without touching the memory</summary>
+		void resetCounters() noexcept;
+
+		/// <summary>
+		/// Releases all allocations that were made during the lifetime of the
+		/// scope. This allows repeated transient work (like path searches) to
+		/// reuse the same memory within a single cycle.
+		/// </summary>
+		class Scope
+		{
+		public:
+			explicit Scope(BumpArena *arena);
+			~Scope();
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+		protected:
+			BumpArena *m_arena;
+			size_t m_current, m_offset, m_used;
+		};
+
+		size_t getAllocationCount() const noexcept;
+		size_t getUsedBytes() const noexcept;
+		size_t getCapacity() const noexcept;
+		size_t getHeapAllocationCount() const noexcept;
+
+	protected:
+		struct Block
+		{
+			std::unique_ptr<char[]> data;
+			size_t size;
+		};
+
+		void addBlock(size_t minSize);
+
+		std::vector<Block> m_blocks;
+		size_t m_blockSize;
+		size_t m_current = 0;
+		size_t m_offset = 0;
+		size_t m_used = 0;
+		size_t m_allocations = 0;
+		size_t m_heapAllocations = 0;
+	};
+
+	/// <summary>
+	/// STL compatible allocator that draws its memory from a BumpArena. Memory is
+	/// never returned to the arena on deallocation. An allocator without arena
+	/// falls back to the general heap which allows the same container type to be
+	/// used in code paths that have no arena available.
+	/// </summary>
+	template<typename T>
+	class ArenaAllocator
+	{
+	public:
+		using value_type = T;
+
+		ArenaAllocator() noexcept : arena(nullptr) { }
+		ArenaAllocator(BumpArena *arena) noexcept : arena(arena) { }
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) { }
+
+		T* allocate(size_t count) {
+			if (arena) return arena->allocateArray<T>(count);
+			return static_cast<T*>(::operator new(count * sizeof(T)));
+		}
+
+		void deallocate(T* ptr, size_t) noexcept {
+			if (!arena) ::operator delete(ptr);
+		}
+
+		template<typename U>
+		bool operator==(const ArenaAllocator<U>& other) const noexcept { return arena == other.arena; }
+		template<typename U>
+		bool operator!=(const ArenaAllocator<U>& other) const noexcept { return arena != other.arena; }
+
+		// ---- Member definitions ---- //
+		BumpArena *arena;
+	};
+
+	template<typename T>
+	using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+	/// <summary>
+	/// A slab allocator for objects of a single type. Objects are constructed in
+	/// slots inside of large slabs, freed slots are kept in an intrusive free list
+	/// and are reused by the next allocation. Object addresses are stable for the
+	/// whole lifetime of the object. Creating and destroying objects is guarded by
+	/// a spin lock, so the pool may be shared by multiple threads.
+	/// </summary>
+	template<typename T, size_t SlabSize = 1024>
+	class ObjectPool
+	{
+	public:
+		ObjectPool() = default;
+		ObjectPool(const ObjectPool&) = delete;
+		ObjectPool(ObjectPool&&) = delete;
+		ObjectPool& operator=(const ObjectPool&) = delete;
+		ObjectPool& operator=(ObjectPool&&) = delete;
+
+		~ObjectPool() {
+			// Objects that are still alive are not destroyed here. The owner of
+			// the pool is responsible to destroy all objects before.
+		}
+
+		/// <summary>Constructs a new object inside of the pool</summary>
+		template<typename... Args>
+		T* create(Args&&... args) {
+			Slot *slot;
+			{
+				std::lock_guard<AtomicLock> guard(m_lock);
+				if (!m_free) addSlab();
+				slot = m_free;
+				m_free = slot->next;
+				m_live++;
+				m_allocations++;
+			}
+			return new (slot->storage) T(std::forward<Args>(args)...);
+		}
+
+		/// <summary>Destroys an object that was created by this pool</summary>
+		void destroy(T* object) {
+			if (!object) return;
+			object->~T();
+			Slot *slot = reinterpret_cast<Slot*>(object);
+			std::lock_guard<AtomicLock> guard(m_lock);
+			slot->next = m_free;
+			m_free = slot;
+			m_live--;
+			m_deallocations++;
+		}
+
+		size_t size() const noexcept { return m_live; }
+		size_t capacity() const noexcept { return m_slabs.size() * SlabSize; }
+		size_t getAllocationCount() const noexcept { return m_allocations; }
+		size_t getDeallocationCount() const noexcept { return m_deallocations; }
+		size_t getHeapAllocationCount() const noexcept { return m_heapAllocations; }
+
+		void resetCounters() noexcept {
+			m_allocations = 0;
+			m_deallocations = 0;
+			m_heapAllocations = 0;
+		}
+
+	protected:
+		union Slot
+		{
+			Slot *next;
+			alignas(T) unsigned char storage[sizeof(T)];
+		};
+
+		void addSlab() {
+			m_slabs.push_back(std::make_unique<Slot[]>(SlabSize));
+			Slot *slab = m_slabs.back().get();
+			// Links the new slots in reverse order so that
+			// they are handed out in ascending address order.
+			for (size_t i = SlabSize; i > 0; i--) {
+				slab[i - 1].next = m_free;
+				m_free = &slab[i - 1];
+			}
+			m_heapAllocations++;
+		}
+
+		std::vector<std::unique_ptr<Slot[]>> m_slabs;
+		Slot *m_free = nullptr;
+		AtomicLock m_lock;
+		size_t m_live = 0;
+		size_t m_allocations = 0;
+		size_t m_deallocations = 0;
+		size_t m_heapAllocations = 0;
+	};
+
+	/// <summary>
+	/// Keeps the buffers of released vectors alive so that the next vector that
+	/// is requested can reuse an already allocated buffer instead of going to the
+	/// heap. The number of cached buffers is bounded.
+	/// </summary>
+	template<typename T>
+	class VectorPool
+	{
+	public:
+		explicit VectorPool(size_t maxCached = 4096) : m_maxCached(maxCached) { }
+
+		/// <summary>Returns an empty vector, reusing a cached buffer if possible</summary>
+		std::vector<T> acquire() {
+			std::lock_guard<AtomicLock> guard(m_lock);
+			m_allocations++;
+			if (m_cache.empty()) {
+				m_heapAllocations++;
+				return std::vector<T>();
+			}
+			std::vector<T> vec = std::move(m_cache.back());
+			m_cache.pop_back();
+			return vec;
+		}
+
+		/// <summary>Gives the buffer of a vector back to the pool</summary>
+		void release(std::vector<T> &&vec) {
+			if (vec.capacity() == 0) return;
+			vec.clear();
+			std::lock_guard<AtomicLock> guard(m_lock);
+			m_deallocations++;
+			if (m_cache.size() < m_maxCached)
+				m_cache.push_back(std::move(vec));
+		}
+
+		size_t getCachedCount() const noexcept { return m_cache.size(); }
+		size_t getAllocationCount() const noexcept { return m_allocations; }
+		size_t getDeallocationCount() const noexcept { return m_deallocations; }
+		size_t getHeapAllocationCount() const noexcept { return m_heapAllocations; }
+
+		void resetCounters() noexcept {
+			m_allocations = 0;
+			m_deallocations = 0;
+			m_heapAllocations = 0;
+		}
+
+	protected:
+		std::vector<std::vector<T>> m_cache;
+		size_t m_maxCached;
+		AtomicLock m_lock;
+		size_t m_allocations = 0;
+		size_t m_deallocations = 0;
+		size_t m_heapAllocations = 0;
+	};
+
+	/// <summary>
+	/// Owns one BumpArena per thread of a thread pool plus an additional arena
+	/// that is used by the calling (main) thread. Threads of the pool access
+	/// their arena by the thread ID that is passed to every pool task.
+	/// </summary>
+	class ArenaManager
+	{
+	public:
+		/// <summary>Creates the arenas</summary>
+		/// <param name="threads">The number of threads in the pool</param>
+		/// <param name="blockSize">The initial block size of each arena</param>
+		explicit ArenaManager(size_t threads, size_t blockSize = 1 << 20);
+
+		/// <summary>Returns the arena of the given thread. An ID of -1 refers
+		/// to the arena of the main thread.</summary>
+		BumpArena& getArena(int threadID);
+		BumpArena& getMainArena();
+
+		size_t getThreadCount() const noexcept;
+
+		/// <summary>Resets all arenas. Must not be called while any thread
+		/// is still using its arena.</summary>
+		void resetAll();
+
+		/// <summary>Accumulates the arena statistics in the given report and
+		/// resets the counters of all arenas.</summary>
+		void collect(AllocationReport &report);
+
+	protected:
+		std::vector<std::unique_ptr<BumpArena>> m_arenas;
+	};
+}
+
+#endif
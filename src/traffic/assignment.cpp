@@ -0,0 +1,239 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "assignment.h"
+
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+using namespace traffic;
+using namespace std;
+
+// ---- AssignmentResult ---- //
+
+void traffic::AssignmentIteration::summary() const
+{
+	printf("Assignment iteration %zu: gap %.5f experienced %.0fs shortest %.0fs arrived %zu rerouted %zu\n",
+		iteration, relativeGap, experiencedTime, shortestTime, arrived, rerouted);
+	printf("    Simulation %.3fs Routing %.3fs Total %.3fs\n",
+		simulationSeconds, routingSeconds, wallSeconds);
+}
+
+void traffic::AssignmentResult::summary() const
+{
+	printf("Assignment %s after %zu iterations\n",
+		converged ? "converged" : "did not converge", iterations.size());
+	for (const AssignmentIteration& iteration : iterations)
+		iteration.summary();
+}
+
+// ---- DynamicAssignment ---- //
+
+traffic::DynamicAssignment::DynamicAssignment(World* world, const std::vector<Trip>& trips)
+	: m_world(world), m_trips(trips)
+{
+	std::stable_sort(m_trips.begin(), m_trips.end(), [](const Trip& a, const Trip& b) {
+		return a.departure < b.departure;
+	});
+
+	const std::shared_ptr<Graph>& graph = m_world->getGraph();
+	m_startIndex.resize(m_trips.size());
+	m_goalIndex.resize(m_trips.size());
+	for (size_t i = 0; i < m_trips.size(); i++) {
+		m_startIndex[i] = static_cast<size_t>(graph->findNodeIndex(m_trips[i].startID));
+		m_goalIndex[i] = static_cast<size_t>(graph->findNodeIndex(m_trips[i].goalID));
+	}
+}
+
+traffic::DynamicAssignment::~DynamicAssignment()
+{
+	releaseRoutes(m_routes);
+}
+
+AssignmentResult traffic::DynamicAssignment::run(const AssignmentSettings& settings)
+{
+	FastGraph* fastGraph = m_world->getGraph()->getFastGraph();
+	// The graph is shared with the world, its weights and search limit are
+	// restored once the assignment is finished.
+	std::vector<prec_t> originalWeights(fastGraph->countEdges());
+	for (size_t e = 0; e < originalWeights.size(); e++)
+		originalWeights[e] = fastGraph->getWeight(e);
+	prec_t originalLimit = fastGraph->getSearchLimit();
+	// Travel times may exceed the direct distance by far under congestion
+	fastGraph->setSearchLimit(0.0f);
+
+	// Starts with the free flow travel times
+	m_weights.resize(fastGraph->countEdges());
+	for (size_t e = 0; e < m_weights.size(); e++)
+		m_weights[e] = static_cast<prec_t>(m_world->getEdgeLength(e) / m_world->getFreeFlowSpeed());
+	fastGraph->setWeights(m_weights);
+	releaseRoutes(m_routes);
+	findShortestRoutes(m_routes);
+
+	// The demand of the world would interfere with the assigned trips
+	std::shared_ptr<DemandStream> demand = m_world->getDemand();
+	m_world->setDemand(nullptr);
+
+	AssignmentResult result;
+	std::vector<double> experienced;
+	std::vector<RouteHandle> shortest;
+	SplitMix64 rng(settings.seed);
+	for (size_t k = 0; k < settings.maxIterations; k++) {
+		auto begin = std::chrono::steady_clock::now();
+		size_t arrived = simulate(settings, experienced);
+		updateWeights(settings.smoothing);
+		auto simulated = std::chrono::steady_clock::now();
+
+		findShortestRoutes(shortest);
+		auto routed = std::chrono::steady_clock::now();
+
+		// Relative gap between the experienced and the best travel times
+		AssignmentIteration iteration{};
+		iteration.iteration = k;
+		iteration.arrived = arrived;
+		for (size_t i = 0; i < m_trips.size(); i++) {
+			if (m_routes[i] == InvalidRoute || shortest[i] == InvalidRoute) continue;
+			iteration.experiencedTime += experienced[i];
+			iteration.shortestTime += getRouteCost(shortest[i]);
+		}
+		iteration.relativeGap = iteration.experiencedTime > 0.0 ?
+			(iteration.experiencedTime - iteration.shortestTime) / iteration.experiencedTime : 0.0;
+
+		bool converged = iteration.relativeGap < settings.targetGap;
+		if (!converged) {
+			// A deterministic sample of the trips switches to the shortest route
+			for (size_t i = 0; i < m_trips.size(); i++) {
+				if (shortest[i] != m_routes[i] && rng.uniform() < settings.rerouteFraction) {
+					std::swap(shortest[i], m_routes[i]);
+					iteration.rerouted++;
+				}
+			}
+		}
+		releaseRoutes(shortest);
+
+		auto end = std::chrono::steady_clock::now();
+		iteration.simulationSeconds = std::chrono::duration<double>(simulated - begin).count();
+		iteration.routingSeconds = std::chrono::duration<double>(routed - simulated).count();
+		iteration.wallSeconds = std::chrono::duration<double>(end - begin).count();
+		if (settings.verbose)
+			iteration.summary();
+		result.iterations.push_back(iteration);
+
+		if (converged) {
+			result.converged = true;
+			break;
+		}
+	}
+
+	m_world->setDemand(demand);
+	fastGraph->setWeights(originalWeights);
+	fastGraph->setSearchLimit(originalLimit);
+	return result;
+}
+
+size_t traffic::DynamicAssignment::simulate(
+	const AssignmentSettings& settings, std::vector<double>& experienced)
+{
+	m_world->resetSimulation();
+	experienced.assign(m_trips.size(), 0.0);
+	size_t arrived = 0;
+	m_world->setArrivalCallback([this, &experienced, &arrived](const Agent& agent) {
+		experienced[agent.getTag()] = m_world->getTime() - agent.getDepartureTime();
+		arrived++;
+	});
+
+	double end = (m_trips.empty() ? 0.0 : m_trips.back().departure) + settings.horizon;
+	size_t cursor = 0;
+	while (m_world->getTime() < end) {
+		while (cursor < m_trips.size() && m_trips[cursor].departure <= m_world->getTime()) {
+			Agent* agent = m_world->spawnAgent(m_trips[cursor].startID,
+				m_trips[cursor].goalID, m_routes[cursor]);
+			agent->setTag(static_cast<int64_t>(cursor));
+			cursor++;
+		}
+		if (cursor == m_trips.size() && m_world->getAgents().empty())
+			break;
+		m_world->update(settings.timeStep);
+	}
+
+	// Trips that did not arrive count with the time they spent so far
+	for (const Agent* agent : m_world->getAgents())
+		experienced[agent->getTag()] = m_world->getTime() - agent->getDepartureTime();
+	m_world->setArrivalCallback(nullptr);
+	return arrived;
+}
+
+void traffic::DynamicAssignment::updateWeights(double smoothing)
+{
+	// Blends the measured travel times into the current weights. Edges
+	// without any measurement fall back to their free flow travel time.
+	const EdgeStatistics& stats = m_world->getEdgeStatistics();
+	for (size_t e = 0; e < m_weights.size(); e++) {
+		double measured = stats.getMeanTravelTime(e);
+		if (measured < 0.0)
+			measured = m_world->getEdgeLength(e) / m_world->getFreeFlowSpeed();
+		m_weights[e] = static_cast<prec_t>((1.0 - smoothing) * m_weights[e] + smoothing * measured);
+	}
+	m_world->getGraph()->getFastGraph()->setWeights(m_weights);
+	m_world->resetSimulation();
+}
+
+void traffic::DynamicAssignment::findShortestRoutes(std::vector<RouteHandle>& routes)
+{
+	routes.assign(m_trips.size(), InvalidRoute);
+	RouteCache* cache = m_world->getRouteCache();
+	size_t nodes = m_world->getGraph()->countNodes();
+	m_world->getManager()->parallelFor(m_trips.size(), 256,
+		[&](int threadID, size_t begin, size_t end) {
+		RoutingBuffers buffers;
+		buffers.arena = &m_world->getArenas().getArena(threadID);
+		for (size_t i = begin; i < end; i++) {
+			if (m_startIndex[i] >= nodes || m_goalIndex[i] >= nodes) continue;
+			routes[i] = cache->findRoute(m_startIndex[i], m_goalIndex[i], buffers);
+		}
+	});
+}
+
+double traffic::DynamicAssignment::getRouteCost(RouteHandle route) const
+{
+	const RouteCache* cache = m_world->getRouteCache();
+	const FastGraph* fastGraph = m_world->getGraph()->getFastGraph();
+	double cost = 0.0;
+	for (; !cache->isFinished(route); route = cache->getNext(route))
+		cost += fastGraph->getWeight(cache->getEdge(route));
+	return cost;
+}
+
+void traffic::DynamicAssignment::releaseRoutes(std::vector<RouteHandle>& routes)
+{
+	RouteCache* cache = m_world->getRouteCache();
+	for (RouteHandle route : routes)
+		if (cache) cache->release(route);
+	routes.clear();
+}
+
+const std::vector<RouteHandle>& traffic::DynamicAssignment::getRoutes() const { return m_routes; }
@@ -0,0 +1,128 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef ASSIGNMENT_H
+#define ASSIGNMENT_H
+
+#include "engine.h"
+
+#include <vector>
+#include <cstdint>
+
+#include "agent.h"
+#include "demand.h"
+#include "route_cache.h"
+
+namespace traffic
+{
+	/// <summary>Parameters of the dynamic traffic assignment</summary>
+	struct AssignmentSettings
+	{
+		/// <summary>Share of the trips that switch to the current shortest
+		/// route after each iteration</summary>
+		double rerouteFraction = 0.1;
+		/// <summary>The assignment stops once the relative gap drops below this value</summary>
+		double targetGap = 0.01;
+		size_t maxIterations = 20;
+		/// <summary>The simulation time step in seconds</summary>
+		double timeStep = 1.0;
+		/// <summary>Simulated time after the last departure in seconds</summary>
+		double horizon = 7200.0;
+		/// <summary>Weight of the measured travel times when the edge weights
+		/// are updated. Smaller values damp oscillations.</summary>
+		double smoothing = 0.5;
+		uint64_t seed = 1;
+		bool verbose = true;
+	};
+
+	/// <summary>Statistics of a single assignment iteration</summary>
+	struct AssignmentIteration
+	{
+		size_t iteration;
+		double relativeGap;
+		double experiencedTime; // Sum of all experienced travel times
+		double shortestTime; // Sum of all shortest path travel times
+		size_t arrived;
+		size_t rerouted;
+		double simulationSeconds;
+		double routingSeconds;
+		double wallSeconds;
+
+		void summary() const;
+	};
+
+	struct AssignmentResult
+	{
+		bool converged = false;
+		std::vector<AssignmentIteration> iterations;
+
+		void summary() const;
+	};
+
+	/// <summary>
+	/// Iterative dynamic traffic assignment. Every iteration simulates all trips
+	/// on their current routes and measures the mean travel time of every edge.
+	/// The edge weights of the FastGraph are replaced by the smoothed travel
+	/// times, the shortest routes are recomputed in parallel and a fraction of
+	/// the trips switches to them. The iteration stops once the relative gap
+	/// between experienced and shortest travel times converges.
+	/// </summary>
+	class DynamicAssignment
+	{
+	public:
+		/// <summary>Creates an assignment for a fixed set of trips</summary>
+		/// <param name="world">The world with a loaded map that is simulated</param>
+		/// <param name="trips">The trips that are assigned</param>
+		DynamicAssignment(World *world, const std::vector<Trip> &trips);
+		~DynamicAssignment();
+
+		DynamicAssignment(const DynamicAssignment&) = delete;
+		DynamicAssignment& operator=(const DynamicAssignment&) = delete;
+
+		/// <summary>Runs the assignment until it converges</summary>
+		AssignmentResult run(const AssignmentSettings &settings);
+
+		/// <summary>The current route of each trip</summary>
+		const std::vector<RouteHandle>& getRoutes() const;
+
+	protected:
+		/// <summary>Simulates all trips on their current routes and returns the number of arrivals</summary>
+		size_t simulate(const AssignmentSettings &settings, std::vector<double> &experienced);
+		void updateWeights(double smoothing);
+		void findShortestRoutes(std::vector<RouteHandle> &routes);
+		double getRouteCost(RouteHandle route) const;
+		void releaseRoutes(std::vector<RouteHandle> &routes);
+
+		World *m_world;
+		std::vector<Trip> m_trips;
+		std::vector<size_t> m_startIndex, m_goalIndex;
+		std::vector<RouteHandle> m_routes;
+		std::vector<prec_t> m_weights;
+	};
+}
+
+#endif
@@ -0,0 +1,141 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "balancer.h"
+
+#include <cstdio>
+#include <numeric>
+#include <algorithm>
+
+using namespace traffic;
+using namespace std;
+
+void traffic::BalanceReport::summary() const
+{
+	printf("LoadBalancer: imbalance %.3f -> %.3f, %zu chunks moved%s\n",
+		imbalanceBefore, imbalanceAfter, movedChunks, rebalanced ? "" : " (below threshold)");
+	for (size_t i = 0; i < workerCost.size(); i++)
+		printf("    Worker %zu: %.3fms per tick\n", i, workerCost[i] * 1000.0);
+}
+
+traffic::LoadBalancer::LoadBalancer(Coordinator& coordinator, double threshold)
+	: m_coordinator(coordinator), m_threshold(threshold)
+{
+	m_order = m_coordinator.getChunks().getCurveOrder();
+}
+
+BalanceReport traffic::LoadBalancer::balance()
+{
+	BalanceReport report;
+	std::vector<LoadReport> loads = m_coordinator.requestLoad();
+	const std::vector<uint32_t>& owners = m_coordinator.getChunkOwners();
+	size_t workers = m_coordinator.getWorkerCount();
+
+	// Sums the agent ticks of every chunk, agents that were about to be
+	// transferred may be reported by a worker that does not own the chunk.
+	std::vector<double> agentTicks(owners.size(), 0.0);
+	report.workerCost.assign(workers, 0.0);
+	for (const LoadReport& load : loads) {
+		if (load.worker < workers && load.ticks > 0)
+			report.workerCost[load.worker] = load.busySeconds / load.ticks;
+		for (const ChunkLoad& chunk : load.chunks)
+			if (chunk.chunk < agentTicks.size())
+				agentTicks[chunk.chunk] += static_cast<double>(chunk.agentTicks);
+	}
+	report.imbalanceBefore = imbalance(report.workerCost);
+	report.imbalanceAfter = report.imbalanceBefore;
+
+	// Distributes the measured time of each worker to its chunks. A small
+	// base cost keeps chunks without agents from being free.
+	std::vector<double> workerTicks(workers, 0.0);
+	for (size_t c = 0; c < owners.size(); c++)
+		workerTicks[owners[c]] += agentTicks[c];
+	std::vector<size_t> workerChunks(workers, 0);
+	for (uint32_t owner : owners)
+		workerChunks[owner]++;
+
+	std::vector<double> cost(owners.size(), 0.0);
+	for (size_t c = 0; c < owners.size(); c++) {
+		uint32_t owner = owners[c];
+		double base = 0.01 * workerTicks[owner] / std::max<size_t>(workerChunks[owner], 1) + 1e-9;
+		double share = (agentTicks[c] + base) /
+			(workerTicks[owner] + base * workerChunks[owner]);
+		cost[c] = report.workerCost[owner] * share;
+	}
+
+	if (report.imbalanceBefore <= m_threshold)
+		return report;
+
+	std::vector<uint32_t> proposal = partition(m_order, cost, workers);
+	std::vector<double> predicted(workers, 0.0);
+	for (size_t c = 0; c < proposal.size(); c++)
+		predicted[proposal[c]] += cost[c];
+	double after = imbalance(predicted);
+	if (after >= report.imbalanceBefore)
+		return report;
+
+	report.imbalanceAfter = after;
+	report.movedChunks = m_coordinator.assignOwners(proposal);
+	report.rebalanced = true;
+	return report;
+}
+
+void traffic::LoadBalancer::setThreshold(double threshold) noexcept { m_threshold = threshold; }
+double traffic::LoadBalancer::getThreshold() const noexcept { return m_threshold; }
+
+double traffic::LoadBalancer::imbalance(const std::vector<double>& loads)
+{
+	if (loads.empty()) return 1.0;
+	double sum = std::accumulate(loads.begin(), loads.end(), 0.0);
+	double mean = sum / loads.size();
+	if (mean <= 0.0) return 1.0;
+	return *std::max_element(loads.begin(), loads.end()) / mean;
+}
+
+std::vector<uint32_t> traffic::LoadBalancer::partition(const std::vector<size_t>& order,
+	const std::vector<double>& cost, size_t parts)
+{
+	std::vector<uint32_t> owners(cost.size(), 0);
+	double total = 0.0;
+	for (size_t chunk : order)
+		total += cost[chunk];
+	if (parts <= 1 || total <= 0.0)
+		return owners;
+
+	// A range is closed once its cost passes the next ideal cut. The chunk
+	// at the cut goes to the range whose total ends closer to the cut.
+	double prefix = 0.0;
+	uint32_t part = 0;
+	for (size_t chunk : order) {
+		double cut = total * (part + 1) / parts;
+		if (part + 1 < parts && prefix + cost[chunk] > cut &&
+			cut - prefix < prefix + cost[chunk] - cut)
+			part++;
+		owners[chunk] = part;
+		prefix += cost[chunk];
+	}
+	return owners;
+}
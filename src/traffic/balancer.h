@@ -0,0 +1,96 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef BALANCER_H
+#define BALANCER_H
+
+#include "engine.h"
+
+#include <vector>
+#include <cstdint>
+
+#include "worker.h"
+
+namespace traffic
+{
+	/// <summary>Result of a single balancing step</summary>
+	struct BalanceReport {
+		/// <summary>Measured busy time of each worker per tick in seconds</summary>
+		std::vector<double> workerCost;
+		/// <summary>Maximum divided by mean worker cost of the last interval</summary>
+		double imbalanceBefore = 1.0;
+		/// <summary>Expected imbalance with the new chunk assignment</summary>
+		double imbalanceAfter = 1.0;
+		size_t movedChunks = 0;
+		bool rebalanced = false;
+
+		void summary() const;
+	};
+
+	/// <summary>
+	/// Moves chunks between the workers of a Coordinator so that every worker
+	/// spends a similar time per tick. The busy time a worker measured is
+	/// split between its chunks proportionally to the number of agents in
+	/// them. The chunks are then cut into contiguous ranges along the Hilbert
+	/// curve with equal cost, which keeps every partition compact and the
+	/// border short. Agents in moved chunks follow at the end of the next tick.
+	/// Only grid domains can be balanced, graph domains are fixed.
+	/// </summary>
+	class LoadBalancer
+	{
+	public:
+		/// <summary>Creates a balancer for a started coordinator</summary>
+		/// <param name="coordinator">The coordinator whose chunks are moved</param>
+		/// <param name="threshold">Imbalance that triggers a repartition</param>
+		LoadBalancer(Coordinator& coordinator, double threshold = 1.1);
+
+		/// <summary>Measures the load since the last call and moves chunks if
+		/// the imbalance exceeds the threshold</summary>
+		BalanceReport balance();
+
+		void setThreshold(double threshold) noexcept;
+		double getThreshold() const noexcept;
+
+		/// <summary>Returns the maximum divided by the mean of the values</summary>
+		static double imbalance(const std::vector<double>& loads);
+
+		/// <summary>Cuts the order into contiguous ranges of similar cost</summary>
+		/// <param name="order">The chunks in curve order</param>
+		/// <param name="cost">The cost of each chunk</param>
+		/// <param name="parts">The number of ranges</param>
+		/// <returns>The range index of every chunk</returns>
+		static std::vector<uint32_t> partition(const std::vector<size_t>& order,
+			const std::vector<double>& cost, size_t parts);
+
+	protected:
+		Coordinator& m_coordinator;
+		std::vector<size_t> m_order;
+		double m_threshold;
+	};
+}
+
+#endif
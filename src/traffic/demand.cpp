@@ -0,0 +1,260 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "demand.h"
+#include "agent.h"
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace traffic;
+using namespace glm;
+using namespace std;
+
+// ---- Zone ---- //
+
+Zone traffic::Zone::fromPolygon(const std::string& name, const std::vector<glm::vec2>& polygon)
+{
+	Zone zone;
+	zone.name = name;
+	zone.polygon = polygon;
+	return zone;
+}
+
+Zone traffic::Zone::fromNodes(const std::string& name, const std::vector<int64_t>& nodes)
+{
+	Zone zone;
+	zone.name = name;
+	zone.nodes = nodes;
+	return zone;
+}
+
+bool traffic::Zone::contains(glm::vec2 p) const
+{
+	// Ray casting along the latitude axis
+	bool inside = false;
+	for (size_t i = 0, k = polygon.size() - 1; i < polygon.size(); k = i++) {
+		const vec2& a = polygon[i];
+		const vec2& b = polygon[k];
+		if ((a.y > p.y) != (b.y > p.y) &&
+			p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+			inside = !inside;
+	}
+	return inside;
+}
+
+// ---- DepartureProfile ---- //
+
+traffic::DepartureProfile::DepartureProfile()
+	: m_binLength(86400.0), m_shares{ 1.0 } { }
+
+traffic::DepartureProfile::DepartureProfile(double binLength, const std::vector<double>& weights)
+	: m_binLength(binLength), m_shares(weights)
+{
+	double total = 0.0;
+	for (double weight : weights) total += weight;
+	for (double& share : m_shares)
+		share = total > 0.0 ? share / total : 0.0;
+}
+
+size_t traffic::DepartureProfile::getBinCount() const noexcept { return m_shares.size(); }
+double traffic::DepartureProfile::getBinLength() const noexcept { return m_binLength; }
+double traffic::DepartureProfile::getDuration() const noexcept { return m_binLength * m_shares.size(); }
+double traffic::DepartureProfile::getShare(size_t bin) const { return m_shares[bin]; }
+
+// ---- ODMatrix ---- //
+
+traffic::ODMatrix::ODMatrix(size_t zones)
+	: m_zones(zones), m_trips(zones * zones, 0.0) { }
+
+double& traffic::ODMatrix::at(size_t origin, size_t destination) { return m_trips[origin * m_zones + destination]; }
+double traffic::ODMatrix::get(size_t origin, size_t destination) const { return m_trips[origin * m_zones + destination]; }
+size_t traffic::ODMatrix::getZoneCount() const noexcept { return m_zones; }
+
+double traffic::ODMatrix::getTotalTrips() const
+{
+	double total = 0.0;
+	for (double trips : m_trips) total += trips;
+	return total;
+}
+
+// ---- DemandGenerator ---- //
+
+traffic::DemandGenerator::DemandGenerator(const Graph& graph, const std::vector<Zone>& zones,
+	const ODMatrix& matrix, const DepartureProfile& profile, uint64_t seed)
+	: m_matrix(matrix), m_profile(profile), m_seed(seed)
+{
+	if (matrix.getZoneCount() != zones.size())
+		throw std::runtime_error("OD matrix does not match the number of zones");
+
+	// Resolves all zones to the graph nodes that are part of them
+	const std::vector<GraphNode>& nodes = graph.getBuffer();
+	m_zoneNodes.resize(zones.size());
+	for (size_t i = 0; i < zones.size(); i++) {
+		const Zone& zone = zones[i];
+		std::vector<int64_t>& resolved = m_zoneNodes[i];
+		for (int64_t id : zone.nodes) {
+			if (graph.findNodeIndex(id) != -1)
+				resolved.push_back(id);
+		}
+
+		if (zone.polygon.size() >= 3) {
+			vec2 lower = zone.polygon[0], upper = zone.polygon[0];
+			for (const vec2& p : zone.polygon) {
+				lower = glm::min(lower, p);
+				upper = glm::max(upper, p);
+			}
+			for (const GraphNode& node : nodes) {
+				vec2 p = node.getPosition();
+				if (p.x >= lower.x && p.x <= upper.x && p.y >= lower.y &&
+					p.y <= upper.y && zone.contains(p))
+					resolved.push_back(node.nodeID);
+			}
+		}
+	}
+}
+
+std::vector<Trip> traffic::DemandGenerator::generate(
+	double begin, double end, ConcurrencyManager* manager) const
+{
+	double binLength = m_profile.getBinLength();
+	size_t firstBin = static_cast<size_t>(std::max(0.0, std::floor(begin / binLength)));
+	size_t lastBin = std::min(m_profile.getBinCount(),
+		static_cast<size_t>(std::max(0.0, std::ceil(end / binLength))));
+	if (firstBin >= lastBin) return {};
+
+	// Every origin zone is generated into its own buffer, the buffers
+	// are concatenated in zone order which keeps the output deterministic.
+	size_t zones = m_zoneNodes.size();
+	std::vector<std::vector<Trip>> rows(zones);
+	auto task = [&](int, size_t rowBegin, size_t rowEnd) {
+		for (size_t origin = rowBegin; origin < rowEnd; origin++)
+			generateRow(origin, firstBin, lastBin, begin, end, rows[origin]);
+	};
+
+	if (manager) {
+		size_t threads = std::max<size_t>(manager->getPool().size(), 1);
+		manager->parallelFor(zones, std::max<size_t>(zones / (threads * 4), 1), task);
+	}
+	else {
+		task(-1, 0, zones);
+	}
+
+	size_t total = 0;
+	for (const auto& row : rows) total += row.size();
+	std::vector<Trip> trips;
+	trips.reserve(total);
+	for (auto& row : rows) {
+		trips.insert(trips.end(), row.begin(), row.end());
+		std::vector<Trip>().swap(row);
+	}
+
+	std::stable_sort(trips.begin(), trips.end(), [](const Trip& a, const Trip& b) {
+		return a.departure < b.departure;
+	});
+	return trips;
+}
+
+void traffic::DemandGenerator::generateRow(size_t origin, size_t firstBin, size_t lastBin,
+	double begin, double end, std::vector<Trip>& trips) const
+{
+	const std::vector<int64_t>& starts = m_zoneNodes[origin];
+	if (starts.empty()) return;
+
+	double binLength = m_profile.getBinLength();
+	for (size_t destination = 0; destination < m_zoneNodes.size(); destination++) {
+		const std::vector<int64_t>& goals = m_zoneNodes[destination];
+		double daily = m_matrix.get(origin, destination);
+		if (goals.empty() || daily <= 0.0) continue;
+
+		for (size_t bin = firstBin; bin < lastBin; bin++) {
+			double expected = daily * m_profile.getShare(bin);
+			if (expected <= 0.0) continue;
+
+			// Derives an independent random stream for this cell
+			SplitMix64 rng(m_seed
+				^ (origin * 0x9e3779b97f4a7c15ull)
+				^ (destination * 0xc2b2ae3d27d4eb4full)
+				^ (bin * 0x165667b19e3779f9ull));
+			rng.next();
+
+			double whole = std::floor(expected);
+			size_t count = static_cast<size_t>(whole) + (rng.uniform() < expected - whole ? 1 : 0);
+			for (size_t i = 0; i < count; i++) {
+				Trip trip;
+				trip.departure = (bin + rng.uniform()) * binLength;
+				trip.startID = starts[rng.index(starts.size())];
+				trip.goalID = goals[rng.index(goals.size())];
+				// Trips inside of the same zone should not start at their goal
+				for (int retry = 0; retry < 4 && trip.goalID == trip.startID; retry++)
+					trip.goalID = goals[rng.index(goals.size())];
+
+				if (trip.departure >= begin && trip.departure < end && trip.startID != trip.goalID)
+					trips.push_back(trip);
+			}
+		}
+	}
+}
+
+double traffic::DemandGenerator::getDuration() const noexcept { return m_profile.getDuration(); }
+size_t traffic::DemandGenerator::getZoneNodeCount(size_t zone) const { return m_zoneNodes[zone].size(); }
+
+// ---- DemandStream ---- //
+
+traffic::DemandStream::DemandStream(
+	const std::shared_ptr<DemandGenerator>& generator, double windowLength)
+	: m_generator(generator), m_windowLength(windowLength) { }
+
+size_t traffic::DemandStream::spawn(World& world, double time)
+{
+	size_t spawned = 0;
+	while (true) {
+		// Spawns all pending trips that are due
+		while (m_cursor < m_pending.size() && m_pending[m_cursor].departure <= time) {
+			const Trip& trip = m_pending[m_cursor++];
+			world.spawnAgent(trip.startID, trip.goalID);
+			spawned++;
+		}
+
+		// Generates the next window once the current one is exhausted
+		if (m_cursor < m_pending.size() || m_windowEnd > time || isFinished())
+			break;
+		double windowBegin = m_windowEnd;
+		m_windowEnd += m_windowLength;
+		m_pending = m_generator->generate(windowBegin, m_windowEnd, world.getManager());
+		m_cursor = 0;
+	}
+	m_spawned += spawned;
+	return spawned;
+}
+
+bool traffic::DemandStream::isFinished() const noexcept
+{
+	return m_cursor >= m_pending.size() && m_windowEnd >= m_generator->getDuration();
+}
+
+size_t traffic::DemandStream::getSpawnedCount() const noexcept { return m_spawned; }
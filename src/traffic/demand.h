@@ -0,0 +1,202 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef DEMAND_H
+#define DEMAND_H
+
+#include "engine.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "osm_graph.h"
+
+namespace traffic
+{
+	class World;
+	class ConcurrencyManager;
+
+	/// <summary>
+	/// Small and fast pseudo random number generator (SplitMix64). It is cheap
+	/// to seed which allows every generation task to use its own deterministic
+	/// stream of random numbers.
+	/// </summary>
+	struct SplitMix64
+	{
+		uint64_t state;
+
+		explicit SplitMix64(uint64_t seed) : state(seed) { }
+
+		uint64_t next() noexcept {
+			uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			return z ^ (z >> 31);
+		}
+
+		/// <summary>Returns a uniform number in [0, 1)</summary>
+		double uniform() noexcept { return (next() >> 11) * 0x1.0p-53; }
+		/// <summary>Returns a uniform integer in [0, bound)</summary>
+		size_t index(size_t bound) noexcept { return static_cast<size_t>(uniform() * bound); }
+	};
+
+	/// <summary>
+	/// A zone is an area in which trips start or end. Zones are either defined
+	/// by a polygon in (lat, lon) coordinates or by an explicit set of node IDs.
+	/// </summary>
+	struct Zone
+	{
+		std::string name;
+		std::vector<glm::vec2> polygon;
+		std::vector<int64_t> nodes;
+
+		static Zone fromPolygon(const std::string &name, const std::vector<glm::vec2> &polygon);
+		static Zone fromNodes(const std::string &name, const std::vector<int64_t> &nodes);
+
+		bool contains(glm::vec2 latLon) const;
+	};
+
+	/// <summary>
+	/// Describes how the trips of a day are distributed over time. The day is
+	/// split into bins of equal length, each bin holds a relative weight.
+	/// </summary>
+	class DepartureProfile
+	{
+	public:
+		/// <summary>Creates a profile that distributes all trips uniformly over a day</summary>
+		DepartureProfile();
+		/// <summary>Creates a profile from bin weights</summary>
+		/// <param name="binLength">The length of each bin in seconds</param>
+		/// <param name="weights">The relative weight of each bin</param>
+		DepartureProfile(double binLength, const std::vector<double> &weights);
+
+		size_t getBinCount() const noexcept;
+		double getBinLength() const noexcept;
+		double getDuration() const noexcept;
+		/// <summary>Returns the share of all trips that depart in a bin</summary>
+		double getShare(size_t bin) const;
+
+	protected:
+		double m_binLength;
+		std::vector<double> m_shares;
+	};
+
+	/// <summary>
+	/// Origin destination matrix that stores the number of trips per day between
+	/// each pair of zones.
+	/// </summary>
+	class ODMatrix
+	{
+	public:
+		explicit ODMatrix(size_t zones = 0);
+
+		double& at(size_t origin, size_t destination);
+		double get(size_t origin, size_t destination) const;
+		size_t getZoneCount() const noexcept;
+		double getTotalTrips() const;
+
+	protected:
+		size_t m_zones;
+		std::vector<double> m_trips;
+	};
+
+	/// <summary>A single trip between two graph nodes</summary>
+	struct Trip
+	{
+		int64_t startID;
+		int64_t goalID;
+		double departure;
+	};
+
+	/// <summary>
+	/// Generates trips from an OD matrix and a departure profile. The zones are
+	/// resolved to graph nodes once, trip end points are sampled uniformly from
+	/// the nodes of their zone. Generation is deterministic: every combination
+	/// of origin, destination and profile bin uses its own random stream that
+	/// is derived from the seed. The result does therefore not depend on the
+	/// number of threads or on how the day is split into windows.
+	/// </summary>
+	class DemandGenerator
+	{
+	public:
+		DemandGenerator(const Graph &graph, const std::vector<Zone> &zones,
+			const ODMatrix &matrix, const DepartureProfile &profile, uint64_t seed);
+
+		/// <summary>Generates all trips that depart in [begin, end)</summary>
+		/// <param name="begin">The begin of the time window in seconds</param>
+		/// <param name="end">The end of the time window in seconds</param>
+		/// <param name="manager">The thread pool that is used, may be nullptr</param>
+		/// <returns>The trips sorted by departure time</returns>
+		std::vector<Trip> generate(double begin, double end, ConcurrencyManager *manager) const;
+
+		double getDuration() const noexcept;
+		size_t getZoneNodeCount(size_t zone) const;
+
+	protected:
+		void generateRow(size_t origin, size_t firstBin, size_t lastBin,
+			double begin, double end, std::vector<Trip> &trips) const;
+
+		std::vector<std::vector<int64_t>> m_zoneNodes;
+		ODMatrix m_matrix;
+		DepartureProfile m_profile;
+		uint64_t m_seed;
+	};
+
+	/// <summary>
+	/// Feeds the trips of a DemandGenerator into a World. Trips are generated
+	/// window by window, so only the trips of a single window are kept in
+	/// memory at any time.
+	/// </summary>
+	class DemandStream
+	{
+	public:
+		/// <summary>Creates a new stream</summary>
+		/// <param name="generator">The generator that creates the trips</param>
+		/// <param name="windowLength">The length of each generation window in seconds</param>
+		DemandStream(const std::shared_ptr<DemandGenerator> &generator, double windowLength = 900.0);
+
+		/// <summary>Spawns all agents that depart until the given time</summary>
+		/// <returns>The number of spawned agents</returns>
+		size_t spawn(World &world, double time);
+
+		bool isFinished() const noexcept;
+		size_t getSpawnedCount() const noexcept;
+
+	protected:
+		std::shared_ptr<DemandGenerator> m_generator;
+		std::vector<Trip> m_pending;
+		size_t m_cursor = 0;
+		double m_windowLength;
+		double m_windowEnd = 0.0;
+		size_t m_spawned = 0;
+	};
+}
+
+#endif
@@ -275,8 +275,8 @@ Circle Circle::scale(prec_t scale) const { return Circle(center, radiusLat * sca
 
 bool Circle::contains(const Point& p) const {
 	Point dist = p - Distance(center);
-	return (dist.getLatitude() * dist.getLatitude()) / radiusLat +
-		(dist.getLongitude() * dist.getLongitude()) / radiusLon <= 1;
+	return (dist.getLatitude() * dist.getLatitude()) / (radiusLat * radiusLat) +
+		(dist.getLongitude() * dist.getLongitude()) / (radiusLon * radiusLon) <= 1;
 }
 
 Point Circle::getCenter() const { return center; }
@@ -0,0 +1,249 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "intersection.h"
+#include "agent.h"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+using namespace traffic;
+using namespace std;
+
+constexpr double Pi = 3.141592653589793238462643383279502;
+
+traffic::IntersectionSystem::IntersectionSystem(const FastGraph& graph, SignalControl control)
+{
+	size_t nodeCount = graph.countNodes();
+	size_t edgeCount = graph.countEdges();
+
+	// Groups the incoming edges of every node. The position of an edge in
+	// the list of its goal node is its approach at this node.
+	std::vector<size_t> approachOffset(nodeCount + 1, 0);
+	for (size_t e = 0; e < edgeCount; e++)
+		approachOffset[graph.getEdgeGoal(e) + 1]++;
+	for (size_t i = 0; i < nodeCount; i++)
+		approachOffset[i + 1] += approachOffset[i];
+	std::vector<size_t> approaches(edgeCount);
+	std::vector<size_t> fill(approachOffset.begin(), approachOffset.end() - 1);
+	for (size_t e = 0; e < edgeCount; e++)
+		approaches[fill[graph.getEdgeGoal(e)]++] = e;
+
+	// Every node with more than two connections is an intersection
+	m_nodeController.resize(nodeCount, NoController);
+	m_edgeApproach.resize(edgeCount, NoApproach);
+	m_edgeController.resize(edgeCount, NoController);
+	std::vector<SignalPhase> phases;
+	uint32_t controllers = 0;
+	size_t skipped = 0;
+	for (size_t i = 0; i < nodeCount; i++) {
+		if (graph.getNode(i).connections.size() <= 2) continue;
+		const size_t* incoming = approaches.data() + approachOffset[i];
+		size_t count = approachOffset[i + 1] - approachOffset[i];
+		if (count == 0) continue;
+		// The green masks hold 32 approaches. Larger nodes stay unsignalized
+		// instead of leaving a part of their approaches green forever.
+		if (count > 32) {
+			skipped++;
+			continue;
+		}
+
+		uint32_t controller = controllers++;
+		m_nodeController[i] = controller;
+		for (size_t k = 0; k < count; k++) {
+			m_edgeApproach[incoming[k]] = static_cast<uint8_t>(k);
+			m_edgeController[incoming[k]] = controller;
+		}
+
+		phases.clear();
+		createDefaultPlan(graph, i, incoming, count, control, phases);
+		m_phaseOffset.push_back(static_cast<uint32_t>(m_phases.size()));
+		m_phaseCount.push_back(static_cast<uint8_t>(phases.size()));
+		m_control.push_back(control);
+		m_phases.insert(m_phases.end(), phases.begin(), phases.end());
+	}
+	if (skipped > 0)
+		printf("Left %zu intersections with more than 32 approaches unsignalized\n", skipped);
+
+	m_phase.resize(controllers, 0);
+	m_clearing.resize(controllers, 0);
+	m_elapsed.resize(controllers, 0.0f);
+	m_green.resize(controllers);
+	m_demand = std::make_unique<std::atomic<uint32_t>[]>(controllers);
+	for (uint32_t c = 0; c < controllers; c++) {
+		m_green[c] = m_phases[m_phaseOffset[c]].greenMask;
+		m_demand[c].store(0, std::memory_order_relaxed);
+	}
+}
+
+void traffic::IntersectionSystem::createDefaultPlan(const FastGraph& graph, size_t node,
+	const size_t* approaches, size_t count,
+	SignalControl control, std::vector<SignalPhase>& phases) const
+{
+	// Groups the approaches by their axis. Approaches that are roughly
+	// parallel to the first approach share the first phase.
+	const FastGraphNode& center = graph.getNode(node);
+	double scale = std::cos(center.lat * Pi / 180.0);
+
+	uint32_t first = 0, second = 0;
+	double reference = 0.0;
+	for (size_t k = 0; k < count; k++) {
+		const FastGraphNode& other = graph.getNode(graph.getEdgeSource(approaches[k]));
+		double angle = std::atan2(other.lat - center.lat, (other.lon - center.lon) * scale);
+		double axis = std::fmod(angle + Pi, Pi);
+		if (k == 0) reference = axis;
+
+		double difference = std::fabs(axis - reference);
+		difference = std::min(difference, Pi - difference);
+		if (difference <= Pi / 4.0) first |= 1u << k;
+		else second |= 1u << k;
+	}
+
+	float minGreen = control == SignalControl::FixedTime ? 30.0f : 5.0f;
+	float maxGreen = control == SignalControl::FixedTime ? 30.0f : 45.0f;
+	phases.push_back(SignalPhase{ first, minGreen, maxGreen });
+	if (second != 0)
+		phases.push_back(SignalPhase{ second, minGreen, maxGreen });
+}
+
+void traffic::IntersectionSystem::update(double dt, ConcurrencyManager* manager)
+{
+	size_t controllers = m_phase.size();
+	// Splitting only pays off for very large networks
+	if (manager && controllers >= 65536) {
+		manager->parallelFor(controllers, 16384, [this, dt](int, size_t begin, size_t end) {
+			updateRange(static_cast<float>(dt), begin, end);
+		});
+	}
+	else {
+		updateRange(static_cast<float>(dt), 0, controllers);
+	}
+}
+
+void traffic::IntersectionSystem::updateRange(float dt, size_t begin, size_t end) noexcept
+{
+	for (size_t c = begin; c < end; c++) {
+		float elapsed = m_elapsed[c] + dt;
+		const SignalPhase* plan = &m_phases[m_phaseOffset[c]];
+		uint32_t demand = m_demand[c].exchange(0, std::memory_order_relaxed);
+
+		if (m_clearing[c]) {
+			// All approaches are red until the intersection is cleared
+			if (elapsed >= m_clearance) {
+				m_clearing[c] = 0;
+				m_green[c] = plan[m_phase[c]].greenMask;
+				elapsed = 0.0f;
+			}
+			m_elapsed[c] = elapsed;
+			continue;
+		}
+
+		const SignalPhase& phase = plan[m_phase[c]];
+		bool next;
+		if (m_control[c] == SignalControl::FixedTime) {
+			next = elapsed >= phase.minGreen;
+		}
+		else {
+			// Actuated control keeps the phase green while vehicles are served
+			// and switches early if only other approaches are waiting.
+			bool served = (demand & phase.greenMask) != 0;
+			bool waiting = (demand & ~phase.greenMask) != 0;
+			next = elapsed >= phase.maxGreen ||
+				(elapsed >= phase.minGreen && !served && waiting);
+		}
+
+		if (next && m_phaseCount[c] > 1) {
+			m_phase[c] = static_cast<uint8_t>((m_phase[c] + 1) % m_phaseCount[c]);
+			elapsed = 0.0f;
+			if (m_clearance > 0.0f) {
+				m_clearing[c] = 1;
+				m_green[c] = 0;
+			}
+			else {
+				m_green[c] = plan[m_phase[c]].greenMask;
+			}
+		}
+		m_elapsed[c] = elapsed;
+	}
+}
+
+bool traffic::IntersectionSystem::isGreen(size_t edge) const noexcept
+{
+	uint32_t controller = m_edgeController[edge];
+	if (controller == NoController) return true;
+	return (m_green[controller] >> m_edgeApproach[edge]) & 1u;
+}
+
+void traffic::IntersectionSystem::registerDemand(size_t edge) noexcept
+{
+	uint32_t controller = m_edgeController[edge];
+	if (controller == NoController) return;
+	m_demand[controller].fetch_or(1u << m_edgeApproach[edge], std::memory_order_relaxed);
+}
+
+void traffic::IntersectionSystem::setPlan(size_t node,
+	SignalControl control, const std::vector<SignalPhase>& phases)
+{
+	uint32_t c = m_nodeController[node];
+	if (c == NoController || phases.empty()) return;
+
+	// Reuses the old table entries if the new plan fits into them
+	if (phases.size() > m_phaseCount[c]) {
+		m_phaseOffset[c] = static_cast<uint32_t>(m_phases.size());
+		m_phases.insert(m_phases.end(), phases.begin(), phases.end());
+	}
+	else {
+		std::copy(phases.begin(), phases.end(), m_phases.begin() + m_phaseOffset[c]);
+	}
+	m_phaseCount[c] = static_cast<uint8_t>(std::min<size_t>(phases.size(), 255));
+	m_control[c] = control;
+	m_phase[c] = 0;
+	m_clearing[c] = 0;
+	m_elapsed[c] = 0.0f;
+	m_green[c] = phases[0].greenMask;
+}
+
+void traffic::IntersectionSystem::setClearanceTime(float clearance) noexcept { m_clearance = clearance; }
+size_t traffic::IntersectionSystem::countIntersections() const noexcept { return m_phase.size(); }
+uint32_t traffic::IntersectionSystem::getController(size_t node) const noexcept { return m_nodeController[node]; }
+uint8_t traffic::IntersectionSystem::getApproach(size_t edge) const noexcept { return m_edgeApproach[edge]; }
+uint32_t traffic::IntersectionSystem::getGreenMask(uint32_t controller) const noexcept { return m_green[controller]; }
+
+size_t traffic::IntersectionSystem::getMemoryUsage() const noexcept
+{
+	size_t controllers = m_phase.size();
+	return m_nodeController.capacity() * sizeof(uint32_t)
+		+ m_edgeApproach.capacity() * sizeof(uint8_t)
+		+ m_edgeController.capacity() * sizeof(uint32_t)
+		+ m_phases.capacity() * sizeof(SignalPhase)
+		+ m_phaseOffset.capacity() * sizeof(uint32_t)
+		+ m_phaseCount.capacity() + m_control.capacity()
+		+ m_phase.capacity() + m_clearing.capacity()
+		+ m_elapsed.capacity() * sizeof(float)
+		+ m_green.capacity() * sizeof(uint32_t)
+		+ controllers * sizeof(std::atomic<uint32_t>);
+}
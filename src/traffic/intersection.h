@@ -0,0 +1,149 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef INTERSECTION_H
+#define INTERSECTION_H
+
+#include "engine.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "osm_graph.h"
+
+namespace traffic
+{
+	class ConcurrencyManager;
+
+	/// <summary>The control strategy of a signalized intersection</summary>
+	enum class SignalControl : uint8_t {
+		FixedTime, // Every phase is green for a fixed duration
+		Actuated   // Phases are extended while vehicles are waiting
+	};
+
+	/// <summary>
+	/// A single phase of a signal plan. All approaches whose bit is set in the
+	/// green mask may cross the intersection during this phase. Fixed time
+	/// plans use the minimum green time as the phase duration.
+	/// </summary>
+	struct SignalPhase
+	{
+		uint32_t greenMask;
+		float minGreen;
+		float maxGreen;
+	};
+
+	/// <summary>
+	/// Controls the traffic signals of all intersections of a FastGraph. Every
+	/// node with more than two connections is treated as a signalized
+	/// intersection. Each incoming edge of such a node is an approach. The
+	/// approaches are identified by the position of the edge among the
+	/// incoming edges of the node. Intersections with more than 32 approaches
+	/// are left unsignalized.
+	/// 
+	/// The controller state is stored in flat arrays that are updated in one
+	/// batched pass per tick. The signal plans of all controllers are stored
+	/// in one shared phase table. Querying the signal state of an edge is a
+	/// constant time lookup.
+	/// </summary>
+	class IntersectionSystem
+	{
+	public:
+		static constexpr uint32_t NoController = 0xFFFFFFFF;
+		static constexpr uint8_t NoApproach = 0xFF;
+
+		/// <summary>Creates a controller for every intersection of the graph.
+		/// The default plan groups the approaches in two phases by their
+		/// direction.</summary>
+		/// <param name="graph">The graph the intersections are part of</param>
+		/// <param name="control">The initial control strategy of all intersections</param>
+		IntersectionSystem(const FastGraph &graph,
+			SignalControl control = SignalControl::FixedTime);
+
+		IntersectionSystem(const IntersectionSystem&) = delete;
+		IntersectionSystem& operator=(const IntersectionSystem&) = delete;
+
+		/// <summary>Advances all controllers in a single pass</summary>
+		/// <param name="dt">The time step in seconds</param>
+		/// <param name="manager">Optional thread pool that is used for very
+		/// large numbers of intersections</param>
+		void update(double dt, ConcurrencyManager *manager = nullptr);
+
+		/// <summary>Returns whether vehicles on the given edge may cross the
+		/// intersection at the end of the edge. Edges that lead to unsignalized
+		/// nodes are always green.</summary>
+		bool isGreen(size_t edge) const noexcept;
+
+		/// <summary>Signals that a vehicle is waiting at the end of an edge. This
+		/// function is thread safe and is used by actuated controllers.</summary>
+		void registerDemand(size_t edge) noexcept;
+
+		/// <summary>Replaces the plan of a single intersection</summary>
+		/// <param name="node">The node index of the intersection</param>
+		/// <param name="control">The control strategy</param>
+		/// <param name="phases">The phases that are cycled</param>
+		void setPlan(size_t node, SignalControl control, const std::vector<SignalPhase> &phases);
+
+		/// <summary>Sets the all red time between two phases in seconds</summary>
+		void setClearanceTime(float clearance) noexcept;
+
+		size_t countIntersections() const noexcept;
+		uint32_t getController(size_t node) const noexcept;
+		uint8_t getApproach(size_t edge) const noexcept;
+		uint32_t getGreenMask(uint32_t controller) const noexcept;
+		size_t getMemoryUsage() const noexcept;
+
+	protected:
+		void createDefaultPlan(const FastGraph &graph, size_t node,
+			const size_t *approaches, size_t count, SignalControl control, std::vector<SignalPhase> &phases) const;
+		void updateRange(float dt, size_t begin, size_t end) noexcept;
+
+		// ---- Graph lookup tables ---- //
+		std::vector<uint32_t> m_nodeController; // node -> controller
+		std::vector<uint8_t> m_edgeApproach; // edge -> approach at its goal node
+		std::vector<uint32_t> m_edgeController; // edge -> controller at its goal node
+
+		// ---- Plan table ---- //
+		std::vector<SignalPhase> m_phases;
+		std::vector<uint32_t> m_phaseOffset;
+		std::vector<uint8_t> m_phaseCount;
+		std::vector<SignalControl> m_control;
+
+		// ---- Controller state ---- //
+		std::vector<uint8_t> m_phase;
+		std::vector<uint8_t> m_clearing;
+		std::vector<float> m_elapsed;
+		std::vector<uint32_t> m_green;
+		std::unique_ptr<std::atomic<uint32_t>[]> m_demand;
+
+		float m_clearance = 3.0f;
+	};
+}
+
+#endif
@@ -30,8 +30,15 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <chrono>
+#include <string_view>
 
 #include "osm.h"
+#include "agent.h"
+#include "spatial_index.h"
+#include "address_index.h"
 
 using namespace std;
 using namespace traffic;
@@ -290,6 +297,48 @@ const string& RelationMember::getType() const { return type; }
 int32_t traffic::OSMRelation::getSubIndex() const { return subIndex; }
 void traffic::OSMRelation::setSubIndex(int32_t subIndex) { this->subIndex = subIndex; }
 
+// ---- OSMChange ---- //
+
+size_t OSMChange::size() const noexcept {
+	return createdNodes.size() + modifiedNodes.size() + deletedNodes.size() +
+		createdWays.size() + modifiedWays.size() + deletedWays.size() +
+		createdRelations.size() + modifiedRelations.size() + deletedRelations.size();
+}
+
+bool OSMChange::empty() const noexcept { return size() == 0; }
+
+void OSMChange::summary() const
+{
+	printf("OSMChange summary:\n");
+	printf("    Nodes:     %zu created, %zu modified, %zu deleted\n",
+		createdNodes.size(), modifiedNodes.size(), deletedNodes.size());
+	printf("    Ways:      %zu created, %zu modified, %zu deleted\n",
+		createdWays.size(), modifiedWays.size(), deletedWays.size());
+	printf("    Relations: %zu created, %zu modified, %zu deleted\n",
+		createdRelations.size(), modifiedRelations.size(), deletedRelations.size());
+}
+
+bool ChangeReport::empty() const noexcept {
+	return nodesCreated + nodesModified + nodesDeleted +
+		waysCreated + waysModified + waysDeleted +
+		relationsCreated + relationsModified + relationsDeleted == 0;
+}
+
+void ChangeReport::summary() const
+{
+	printf("ChangeReport summary:\n");
+	printf("    Nodes:     %zu created, %zu modified, %zu deleted\n",
+		nodesCreated, nodesModified, nodesDeleted);
+	printf("    Ways:      %zu created, %zu modified, %zu deleted\n",
+		waysCreated, waysModified, waysDeleted);
+	printf("    Relations: %zu created, %zu modified, %zu deleted\n",
+		relationsCreated, relationsModified, relationsDeleted);
+	printf("    Skipped: %zu\n", skipped);
+	printf("    Moved nodes: %zu\n", movedNodes.size());
+	printf("    Affected ways: %zu\n", affectedWays.size());
+	printf("    Dirty regions: %zu\n", dirty.size());
+}
+
 // ---- OSMMap ---- //
 
 OSMSegment::OSMSegment() {
@@ -359,6 +408,8 @@ void traffic::OSMSegment::reindexMap(bool merge)
 	if (!wayMap) wayMap = make_shared<mapid_t<vector<size_t>>>();
 	if (!relationMap) relationMap = make_shared<mapid_t<vector<size_t>>>();
 
+	spatialIndex.reset();
+	atomic_store(&addressIndex, shared_ptr<AddressIndex>());
 	if (!merge) {
 		nodeMap->clear();
 		wayMap->clear();
@@ -385,15 +436,15 @@ void OSMSegment::recalculateBoundaries() {
 		upperLon = 180.0;
 	}
 	else {
-		float latMax = numeric_limits<float>::min();
+		float latMax = numeric_limits<float>::lowest();
 		float latMin = numeric_limits<float>::max();
-		float lonMax = numeric_limits<float>::min();
+		float lonMax = numeric_limits<float>::lowest();
 		float lonMin = numeric_limits<float>::max();
 		for (const auto& nd : *nodeList) {
-			if (nd.getLat() > latMax) latMax = nd.getLat();
-			else if (nd.getLat() < latMin) latMin = nd.getLat();
-			if (nd.getLon() > lonMax) lonMax = nd.getLon();
-			else if (nd.getLon() < lonMin) lonMin = nd.getLon();
+			latMax = std::max(latMax, nd.getLat());
+			latMin = std::min(latMin, nd.getLat());
+			lonMax = std::max(lonMax, nd.getLon());
+			lonMin = std::min(lonMin, nd.getLon());
 		}
 		lowerLat = latMin;
 		upperLat = latMax;
@@ -416,58 +467,45 @@ bool OSMSegment::hasWays() const noexcept { return wayList && !wayList->empty();
 bool OSMSegment::hasRelations() const noexcept { return relationList && !relationList->empty(); }
 bool OSMSegment::empty() const noexcept { return !hasNodes() && !hasWays() && !hasRelations(); }
 
-template<typename Type>
-unordered_map<string, int32_t> createTTagList(const Type& data, unordered_map<string, int32_t>& map) {
-	for (const OSMMapObject& nd : data) {
-		for (const pair<string, string> tag : (*nd.getData())) {
-			auto it = map.find(tag.first);
-			if (it == map.end()) {
-				map[tag.first] = 1;
-			}
-			else {
-				map[tag.first]++;
-			}
-		}
-	}
-	return map;
-}
-
 vector<int64_t> OSMSegment::findAdress(
 	const string& city, const string& postcode,
 	const string& street, const string& housenumber
 ) const {
-	vector<int64_t> nodes;
-	for (const OSMNode& nd : (*nodeList)) {
-		if ((city.empty() || nd.hasTagValue("addr:city", city)) &&
-			(postcode.empty() || nd.hasTagValue("addr:postcode", postcode)) &&
-			(street.empty() || nd.hasTagValue("addr:street", street)) &&
-			(housenumber.empty() || nd.hasTagValue("addr:housenumber", housenumber))) {
-			nodes.push_back(nd.getID());
-		}
-	}
-	return nodes;
+	return getAddressIndex().find(city, postcode, street, housenumber);
+}
+
+vector<vector<int64_t>> OSMSegment::findAdresses(const vector<Address>& addresses) const {
+	return getAddressIndex().find(addresses);
 }
 
-unordered_map<string, int32_t> OSMSegment::createNodeTagList() const
+const AddressIndex& OSMSegment::getAddressIndex() const {
+	shared_ptr<AddressIndex> index = atomic_load(&addressIndex);
+	if (index) return *index;
+
+	// The first index that is stored wins, the others are discarded
+	shared_ptr<AddressIndex> built = make_shared<AddressIndex>(*this);
+	if (atomic_compare_exchange_strong(&addressIndex, &index, built))
+		return *built;
+	return *index;
+}
+
+void OSMSegment::buildAddressIndex() {
+	atomic_store(&addressIndex, make_shared<AddressIndex>(*this));
+}
+
+unordered_map<string, int32_t> OSMSegment::createNodeTagList(ConcurrencyManager* manager) const
 {
-	unordered_map<string, int32_t> map;
-	createTTagList(*nodeList, map);
-	return map;
+	return TagStatistics(*this, manager, true, false, false, false).toKeyMap();
 }
 
-unordered_map<string, int32_t> OSMSegment::createWayTagList() const
+unordered_map<string, int32_t> OSMSegment::createWayTagList(ConcurrencyManager* manager) const
 {
-	unordered_map<string, int32_t> map;
-	createTTagList(*wayList, map);
-	return map;
+	return TagStatistics(*this, manager, false, true, false, false).toKeyMap();
 }
 
-unordered_map<string, int32_t> OSMSegment::createTagList() const
+unordered_map<string, int32_t> OSMSegment::createTagList(ConcurrencyManager* manager) const
 {
-	unordered_map<string, int32_t> map;
-	createTTagList(*nodeList, map);
-	createTTagList(*wayList, map);
-	return map;
+	return TagStatistics(*this, manager, true, true, false, false).toKeyMap();
 }
 
 size_t OSMSegment::getNodeIndex(int64_t id) const {
@@ -503,6 +541,8 @@ bool OSMSegment::addNode(const OSMNode& nd)
 {
 	auto it = nodeMap->find(nd.getID());
 	if (it != nodeMap->end()) return false; // node already exists
+	spatialIndex.reset();
+	atomic_store(&addressIndex, shared_ptr<AddressIndex>());
 
 	// indexes the new node
 	(*nodeMap)[nd.getID()] = nodeList->size();
@@ -528,6 +568,8 @@ bool OSMSegment::addWay(const OSMWay& wd) {
 		}
 	}
 	// the batch does not contain this way, it is added to the list and indexed
+	spatialIndex.reset();
+	atomic_store(&addressIndex, shared_ptr<AddressIndex>());
 	(*wayMap)[wd.getID()].push_back(wayList->size());
 	wayList->push_back(wd);
 
@@ -547,6 +589,8 @@ bool OSMSegment::addRelation(const OSMRelation& re) {
 		}
 	}
 	// the batch does not contain this way, it is added to the list and indexed
+	spatialIndex.reset();
+	atomic_store(&addressIndex, shared_ptr<AddressIndex>());
 	(*relationMap)[re.getID()].push_back(relationList->size());
 	relationList->push_back(re);
 
@@ -577,6 +621,228 @@ bool traffic::OSMSegment::addRelationRecursive(const OSMRelation& re, const OSMS
 	return true;
 }
 
+/// <summary>
+/// Removes the object at the given index by moving the last object of the
+/// list into its place. The index of the moved object is updated in the map.
+/// </summary>
+template<typename Type>
+static void swapRemove(vector<Type>& list, mapid_t<vector<size_t>>& map, size_t index)
+{
+	size_t last = list.size() - 1;
+	if (index != last) {
+		list[index] = std::move(list[last]);
+		vector<size_t>& moved = map[list[index].getID()];
+		replace(moved.begin(), moved.end(), last, index);
+	}
+	list.pop_back();
+}
+
+/// <summary>
+/// Removes all pieces of the object with the given ID. Returns the number
+/// of removed pieces. Removed objects are appended to the removed list.
+/// </summary>
+template<typename Type>
+static size_t removeAll(vector<Type>& list, mapid_t<vector<size_t>>& map,
+	int64_t id, vector<Type>* removed)
+{
+	auto it = map.find(id);
+	if (it == map.end()) return 0;
+	vector<size_t> indices = std::move(it->second);
+	map.erase(it);
+	// descending order guarantees that no pending index is moved
+	sort(indices.begin(), indices.end(), greater<size_t>());
+	for (size_t index : indices) {
+		if (removed) removed->push_back(list[index]);
+		swapRemove(list, map, index);
+	}
+	return indices.size();
+}
+
+static bool wayBounds(const OSMSegment& seg, const OSMWay& wd, Rect& rect)
+{
+	float latMin = numeric_limits<float>::max(), latMax = numeric_limits<float>::lowest();
+	float lonMin = numeric_limits<float>::max(), lonMax = numeric_limits<float>::lowest();
+	bool found = false;
+	for (int64_t id : wd.getNodes()) {
+		size_t index = seg.getNodeIndex(id);
+		if (index == numeric_limits<size_t>::max()) continue;
+		const OSMNode& nd = (*seg.getNodes())[index];
+		latMin = std::min(latMin, nd.getLat()); latMax = std::max(latMax, nd.getLat());
+		lonMin = std::min(lonMin, nd.getLon()); lonMax = std::max(lonMax, nd.getLon());
+		found = true;
+	}
+	if (found) rect = Rect::fromBorders(latMin, latMax, lonMin, lonMax);
+	return found;
+}
+
+static Rect nodeBounds(const OSMNode& nd) {
+	return Rect::fromBorders(nd.getLat(), nd.getLat(), nd.getLon(), nd.getLon());
+}
+
+ChangeReport traffic::OSMSegment::applyChange(const OSMChange& change)
+{
+	ChangeReport report;
+	spatialIndex.reset();
+	atomic_store(&addressIndex, shared_ptr<AddressIndex>());
+
+	// Ways may be touched several times by one change. Only the version that
+	// existed before the change is reported as previous way.
+	robin_hood::unordered_flat_set<int64_t> touchedWays;
+	auto removeWay = [&](int64_t id) {
+		bool first = touchedWays.insert(id).second;
+		size_t previous = report.previousWays.size();
+		size_t removed = removeAll(*wayList, *wayMap, id, first ? &report.previousWays : nullptr);
+		for (size_t i = previous; i < report.previousWays.size(); i++) {
+			Rect rect;
+			if (wayBounds(*this, report.previousWays[i], rect)) report.dirty.push_back(rect);
+		}
+		return removed > 0;
+	};
+
+	// ---- nodes ---- //
+	auto upsertNode = [&](const OSMNode& nd) {
+		auto it = nodeMap->find(nd.getID());
+		if (it == nodeMap->end()) {
+			(*nodeMap)[nd.getID()] = nodeList->size();
+			nodeList->push_back(nd);
+			report.dirty.push_back(nodeBounds(nd));
+			report.nodesCreated++;
+			return;
+		}
+		OSMNode& old = (*nodeList)[it->second];
+		if (old.getLat() != nd.getLat() || old.getLon() != nd.getLon()) {
+			report.movedNodes.push_back(nd.getID());
+			report.dirty.push_back(nodeBounds(old));
+			report.dirty.push_back(nodeBounds(nd));
+		}
+		old = nd;
+		report.nodesModified++;
+	};
+	for (const OSMNode& nd : change.createdNodes) upsertNode(nd);
+	for (const OSMNode& nd : change.modifiedNodes) upsertNode(nd);
+
+	// ---- ways ---- //
+	auto upsertWay = [&](const OSMWay& wd) {
+		bool existed = removeWay(wd.getID());
+
+		// references to unknown nodes are dropped, node lists may be shared
+		// between ways and are therefore never modified in place
+		auto nodes = make_shared<vector<int64_t>>();
+		nodes->reserve(wd.getNodes().size());
+		for (int64_t id : wd.getNodes())
+			if (hasNodeIndex(id)) nodes->push_back(id);
+		if (nodes->empty()) {
+			report.skipped++;
+			if (existed) report.waysDeleted++;
+			return;
+		}
+
+		OSMWay clipped(wd.getID(), wd.getVer(), std::move(nodes), wd.getData());
+		Rect rect;
+		if (wayBounds(*this, clipped, rect)) report.dirty.push_back(rect);
+		(*wayMap)[clipped.getID()].push_back(wayList->size());
+		wayList->push_back(std::move(clipped));
+		report.changedWays.push_back(wd.getID());
+		existed ? report.waysModified++ : report.waysCreated++;
+	};
+	for (const OSMWay& wd : change.createdWays) upsertWay(wd);
+	for (const OSMWay& wd : change.modifiedWays) upsertWay(wd);
+
+	// ---- relations ---- //
+	auto upsertRelation = [&](const OSMRelation& re) {
+		bool existed = removeAll<OSMRelation>(*relationList, *relationMap, re.getID(), nullptr) > 0;
+		(*relationMap)[re.getID()].push_back(relationList->size());
+		relationList->push_back(re);
+		existed ? report.relationsModified++ : report.relationsCreated++;
+	};
+	for (const OSMRelation& re : change.createdRelations) upsertRelation(re);
+	for (const OSMRelation& re : change.modifiedRelations) upsertRelation(re);
+
+	// ---- deletions ---- //
+	for (int64_t id : change.deletedRelations) {
+		if (removeAll<OSMRelation>(*relationList, *relationMap, id, nullptr) > 0)
+			report.relationsDeleted++;
+		else report.skipped++;
+	}
+
+	for (int64_t id : change.deletedWays) {
+		if (removeWay(id)) report.waysDeleted++;
+		else report.skipped++;
+	}
+
+	robin_hood::unordered_flat_set<int64_t> deletedNodes;
+	for (int64_t id : change.deletedNodes) {
+		auto it = nodeMap->find(id);
+		if (it == nodeMap->end()) {
+			report.skipped++;
+			continue;
+		}
+		size_t index = it->second, last = nodeList->size() - 1;
+		report.dirty.push_back(nodeBounds((*nodeList)[index]));
+		nodeMap->erase(it);
+		if (index != last) {
+			(*nodeList)[index] = std::move((*nodeList)[last]);
+			(*nodeMap)[(*nodeList)[index].getID()] = index;
+		}
+		nodeList->pop_back();
+		deletedNodes.insert(id);
+		report.nodesDeleted++;
+	}
+
+	// Ways that reference moved or deleted nodes are affected as well. Dangling
+	// references of deleted nodes are removed from the remaining ways.
+	robin_hood::unordered_flat_set<int64_t> movedWays;
+	if (!report.movedNodes.empty() || !deletedNodes.empty()) {
+		robin_hood::unordered_flat_set<int64_t> moved(
+			report.movedNodes.begin(), report.movedNodes.end());
+		vector<size_t> emptied;
+		for (size_t i = 0; i < wayList->size(); i++) {
+			OSMWay& wd = (*wayList)[i];
+			bool isMoved = false, isDeleted = false;
+			for (int64_t id : wd.getNodes()) {
+				isMoved = isMoved || moved.count(id);
+				isDeleted = isDeleted || deletedNodes.count(id);
+			}
+			if (isMoved) movedWays.insert(wd.getID());
+			if (!isDeleted) continue;
+
+			if (touchedWays.insert(wd.getID()).second)
+				report.previousWays.push_back(wd);
+			auto nodes = make_shared<vector<int64_t>>();
+			for (int64_t id : wd.getNodes())
+				if (!deletedNodes.count(id)) nodes->push_back(id);
+			int32_t subIndex = wd.getSubIndex();
+			wd = OSMWay(wd.getID(), wd.getVer(), std::move(nodes), wd.getData());
+			wd.setSubIndex(subIndex);
+			if (wd.getNodes().empty()) emptied.push_back(i);
+			else report.changedWays.push_back(wd.getID());
+		}
+		// ways without any remaining node are removed, emptied is ascending
+		for (auto it = emptied.rbegin(); it != emptied.rend(); ++it) {
+			int64_t id = (*wayList)[*it].getID();
+			vector<size_t>& pieces = (*wayMap)[id];
+			pieces.erase(find(pieces.begin(), pieces.end(), *it));
+			if (pieces.empty()) {
+				wayMap->erase(id);
+				report.waysDeleted++;
+			}
+			swapRemove(*wayList, *wayMap, *it);
+		}
+	}
+
+	// every way is reported once, ways that were touched by the change
+	// itself may appear several times in the lists above
+	sort(report.changedWays.begin(), report.changedWays.end());
+	report.changedWays.erase(unique(report.changedWays.begin(),
+		report.changedWays.end()), report.changedWays.end());
+	report.affectedWays.assign(touchedWays.begin(), touchedWays.end());
+	for (int64_t id : movedWays)
+		if (!touchedWays.count(id)) report.affectedWays.push_back(id);
+
+	recalculateBoundaries();
+	return report;
+}
+
 const OSMNode& OSMSegment::getNode(int64_t id) const { return (*nodeList)[getNodeIndex(id)]; }
 const OSMWay& OSMSegment::getWay(int64_t id) const { return (*wayList)[getWayIndex(id)]; }
 const OSMRelation& OSMSegment::getRelation(int64_t id) const { return (*relationList)[getRelationIndex(id)]; }
@@ -615,34 +881,42 @@ size_t OSMSegment::getSize() const {
 }
 
 OSMSegment OSMSegment::findSquareNodes(const Rect& r) const {
-
+	if (spatialIndex) return spatialIndex->extract(r);
 	return findNodes(
-		OSMFinder()
-			.setNodeAccept([r](const OSMNode& nd) { return r.contains(Point(nd.getLat(), nd.getLon())); })
+		OSMFilter<>()
+			.setNodeAccept([&r](const OSMNode& nd) { return r.contains(Point(nd.getLat(), nd.getLon())); })
 	);
 }
 
 OSMSegment OSMSegment::findTagNodes(const string& tag) const {
 	return findNodes(
-		OSMFinder()
+		OSMFilter<>()
 			.setNodeAccept([&tag](const OSMNode& nd) { return nd.hasTag(tag); })
 	);
 }
 
 OSMSegment OSMSegment::findTagWays(const string& tag) const {
 	return findNodes(
-		OSMFinder()
+		OSMFilter<>()
 			.setWayAccept([&tag](const OSMWay& wd) { return wd.hasTag(tag); })
 	);
 }
 
 OSMSegment OSMSegment::findCircleNode(const Circle& circle) const {
+	if (spatialIndex) return spatialIndex->extract(circle);
 	return findNodes(
-		OSMFinder()
-			.setNodeAccept([circle](const OSMNode& nd) { return circle.contains(Point(nd.getLat(), nd.getLon())); })
+		OSMFilter<>()
+			.setNodeAccept([&circle](const OSMNode& nd) { return circle.contains(Point(nd.getLat(), nd.getLon())); })
 	);
 }
 
+void OSMSegment::buildSpatialIndex(size_t nodesPerCell) {
+	spatialIndex = make_shared<SpatialIndex>(*this, nodesPerCell);
+}
+
+bool OSMSegment::hasSpatialIndex() const noexcept { return spatialIndex != nullptr; }
+const shared_ptr<SpatialIndex>& OSMSegment::getSpatialIndex() const noexcept { return spatialIndex; }
+
 void OSMSegment::summary() const {
 	printf("OSMSegment summary:\n");
 	printf("    Lat: %f-%f\n", lowerLat, upperLat);
@@ -669,74 +943,68 @@ int64_t OSMSegment::findClosestNode(float lat, float lon) const {
 }
 
 OSMSegment OSMSegment::findNodes(const OSMFinder &finder) const {
-	OSMSegment newSeg; // new segment
-	// Adds all nodes that fullfill the requirements
-	for (const OSMNode &nd : (*nodeList)) {
-		if (finder.acceptNode(nd)) {
-			newSeg.addNode(nd);
-		}
-	}
-
-	// Adds all ways that fullfill the requirements
-	for (const OSMWay &wd : (*wayList)) {
-		if (finder.acceptWay(wd)) { // way is accepeted
-			std::vector<int64_t> wayNodes;
-			for (int64_t id : wd.getNodes()) {
-				// iterates through the list of nodes and adds all nodes
-				// that meet the sub-requirements.
-				if (finder.acceptWayNodes(wd, getNode(id)) && newSeg.hasNodeIndex(id)) {
-					wayNodes.push_back(id);
-				}
-			}
+	return findNodes(OSMFilter<>()
+		.setNodeAccept(std::cref(finder.acceptNode))
+		.setWayAccept(std::cref(finder.acceptWay))
+		.setRelationAccept(std::cref(finder.acceptRelation))
+		.setWayNodeAccept(std::cref(finder.acceptWayNodes))
+		.setRelationNodeAccept(std::cref(finder.acceptRelationNodes))
+		.setRelationWayAccept(std::cref(finder.acceptRelationWays))
+		.setRelationRelationAccept(std::cref(finder.acceptRelationRelations))
+	);
+}
 
-			// creates a new way from all accepted nodes. The way and
-			// all children nodes are merged into the new map
-			if (!wayNodes.empty()) {
-				newSeg.addWayRecursive(OSMWay(
-					wd.getID(), wd.getVer(),
-					make_shared<vector<int64_t>>(move(wayNodes)),
-					wd.getData()
-				), *this);
-			}
-		}
+/// <summary>Runs a filter several times and prints its throughput</summary>
+template<typename Func>
+static size_t benchmarkFilter(const char* name, const OSMSegment& segment, size_t iterations, Func&& func)
+{
+	size_t objects = segment.getNodeCount() + segment.getWayCount() + segment.getRelationCount();
+	size_t found = 0;
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		OSMSegment result = func();
+		found = result.getNodeCount() + result.getWayCount() + result.getRelationCount();
 	}
-	for (const OSMRelation &rl : (*relationList)) {
-		if (finder.acceptRelation(rl)) {
-			std::vector<RelationMember> nodeRefs;
-			std::vector<RelationMember> wayRefs;
-			std::vector<RelationMember> relationRefs;
-
-			for (const RelationMember &member : *rl.getNodes()) {
-				if (newSeg.hasNodeIndex(member.getIndex()) &&
-					finder.acceptRelationNodes(rl, newSeg.getNode(member.getIndex()))) {
-					nodeRefs.push_back(RelationMember(member));
-				}
-			}
-
-			for (const RelationMember &member : *rl.getWays()) {
-				if (newSeg.hasWayIndex(member.getIndex()) &&
-					finder.acceptRelationWays(rl, newSeg.getWay(member.getIndex()))) {
-					wayRefs.push_back(RelationMember(member));
-				}
-			}
-
-			for (const RelationMember &member : *rl.getRelations()) {
-				if (newSeg.hasRelationIndex(member.getIndex()) &&
-					finder.acceptRelationRelations(rl, newSeg.getRelation(member.getIndex()))) {
-					relationRefs.push_back(RelationMember(member));
-				}
-			}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	seconds /= std::max<size_t>(iterations, 1);
+	printf("    %-24s %8.2fms %8.2fM objects/s (%zu found)\n", name,
+		seconds * 1000.0, seconds > 0.0 ? objects / seconds / 1e6 : 0.0, found);
+	return found;
+}
 
-			newSeg.addRelationRecursive(OSMRelation(
-				rl.getID(), rl.getVer(), rl.getData(),
-				make_shared<vector<RelationMember>>(move(nodeRefs)),
-				make_shared<vector<RelationMember>>(move(wayRefs)),
-				make_shared<vector<RelationMember>>(move(relationRefs))
-			), *this);
-		}
-	}
-	newSeg.recalculateBoundaries();
-	return newSeg;
+void traffic::benchmarkFindNodes(const OSMSegment& segment, size_t iterations)
+{
+	printf("findNodes benchmark (%zu nodes, %zu ways, %zu relations, %zu runs)\n",
+		segment.getNodeCount(), segment.getWayCount(), segment.getRelationCount(), iterations);
+
+	size_t a = benchmarkFilter("accept all (function)", segment, iterations,
+		[&] { return segment.findNodes(OSMFinder()); });
+	size_t b = benchmarkFilter("accept all (template)", segment, iterations,
+		[&] { return segment.findNodes(OSMFilter<>()); });
+
+	size_t c = benchmarkFilter("highway (function)", segment, iterations, [&] {
+		return segment.findNodes(OSMFinder()
+			.setWayAccept([](const OSMWay& way) { return way.hasTag("highway"); })
+			.setRelationAccept([](const OSMRelation&) { return false; }));
+	});
+	size_t d = benchmarkFilter("highway (template)", segment, iterations, [&] {
+		return segment.findNodes(OSMFilter<>()
+			.setWayAccept([](const OSMWay& way) { return way.hasTag("highway"); })
+			.setRelationAccept(RejectAll()));
+	});
+
+	Rect rect = segment.getBoundingBox().scale(0.5f);
+	size_t e = benchmarkFilter("rect (function)", segment, iterations, [&] {
+		return segment.findNodes(OSMFinder()
+			.setNodeAccept([&rect](const OSMNode& nd) { return rect.contains(Point(nd.getLat(), nd.getLon())); }));
+	});
+	size_t f = benchmarkFilter("rect (template)", segment, iterations, [&] {
+		return segment.findNodes(OSMFilter<>()
+			.setNodeAccept([&rect](const OSMNode& nd) { return rect.contains(Point(nd.getLat(), nd.getLon())); }));
+	});
+
+	if (a != b || c != d || e != f)
+		printf("    Warning: function and template filters returned different results\n");
 }
 
 const shared_ptr<vector<OSMNode>>& OSMSegment::getNodes() const noexcept { return nodeList; }
@@ -765,8 +1033,8 @@ void traffic::OSMSegment::setBoundingBox(const Rect& rect) noexcept
 
 
 // TODO
-void debugTags(const OSMSegment& map) {
-	unordered_map<string, int32_t> tagMap = map.createTagList();
+void debugTags(const OSMSegment& map, ConcurrencyManager* manager) {
+	unordered_map<string, int32_t> tagMap = map.createTagList(manager);
 	vector<pair<string, int32_t>> tagVec(tagMap.begin(), tagMap.end());
 	sort(tagVec.begin(), tagVec.end(), [](auto& a, auto& b) { return a.second > b.second; });
 
@@ -775,20 +1043,519 @@ void debugTags(const OSMSegment& map) {
 	}
 }
 
-OSMMap::OSMMap(const std::shared_ptr<OSMSegment>& map, prec_t chunkSize)
+// ---- Parallel helpers ---- //
+
+/// <summary>Runs the function on the thread pool if one is given</summary>
+static void runParallel(ConcurrencyManager* manager, size_t count, size_t batchSize,
+	const std::function<void(int, size_t, size_t)>& func)
+{
+	if (count == 0) return;
+	if (manager) manager->parallelFor(count, batchSize, func);
+	else func(-1, 0, count);
+}
+
+/// <summary>Splits the range [0, count) into a fixed number of batches that
+/// write into their own result. The results are returned in range order
+/// which keeps the output independent of the thread scheduling.</summary>
+template<typename Result, typename Func>
+static vector<Result> runBatches(ConcurrencyManager* manager, size_t count, Func&& func)
+{
+	size_t threads = manager ? std::max<size_t>(manager->getPool().size(), 1) : 1;
+	size_t batches = std::min<size_t>(count, threads * 4);
+	vector<Result> results(batches);
+	runParallel(manager, batches, 1, [&](int, size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++)
+			func(count * k / batches, count * (k + 1) / batches, results[k]);
+	});
+	return results;
+}
+
+OSMSegment OSMSegment::findNodes(const OSMFinder& finder, ConcurrencyManager* manager) const
+{
+	vector<OSMSegment> result = findNodes(vector<OSMFinder>{ finder }, manager);
+	return move(result[0]);
+}
+
+/// <summary>Copies the per batch results of every finder to their final
+/// position. The offsets are the prefix sum of the batch sizes.</summary>
+template<typename Type>
+static vector<shared_ptr<vector<Type>>> mergeBatches(ConcurrencyManager* manager,
+	vector<vector<vector<Type>>>& batches, size_t finderCount)
+{
+	vector<shared_ptr<vector<Type>>> result(finderCount);
+	vector<vector<size_t>> offsets(finderCount, vector<size_t>(batches.size() + 1, 0));
+	for (size_t f = 0; f < finderCount; f++) {
+		for (size_t b = 0; b < batches.size(); b++)
+			offsets[f][b + 1] = offsets[f][b] + batches[b][f].size();
+		result[f] = make_shared<vector<Type>>(offsets[f][batches.size()]);
+	}
+	runParallel(manager, batches.size(), 1, [&](int, size_t begin, size_t end) {
+		for (size_t b = begin; b < end; b++)
+			for (size_t f = 0; f < finderCount; f++)
+				std::move(batches[b][f].begin(), batches[b][f].end(),
+					result[f]->begin() + offsets[f][b]);
+	});
+	return result;
+}
+
+vector<OSMSegment> OSMSegment::findNodes(const vector<OSMFinder>& finders, ConcurrencyManager* manager) const
+{
+	const size_t finderCount = finders.size();
+	const vector<OSMNode>& nodes = *nodeList;
+	const vector<OSMWay>& ways = *wayList;
+	const vector<OSMRelation>& relations = *relationList;
+
+	// (1) Nodes. The accepted flags are stored per node and finder so that
+	// the way filter needs a single index lookup for all finders.
+	vector<uint8_t> nodeAccepted(nodes.size() * finderCount, 0);
+	auto nodeBatches = runBatches<vector<vector<OSMNode>>>(manager, nodes.size(),
+		[&](size_t begin, size_t end, vector<vector<OSMNode>>& out) {
+		out.resize(finderCount);
+		for (size_t i = begin; i < end; i++) {
+			for (size_t f = 0; f < finderCount; f++) {
+				if (finders[f].acceptNode(nodes[i])) {
+					nodeAccepted[i * finderCount + f] = 1;
+					out[f].push_back(nodes[i]);
+				}
+			}
+		}
+	});
+	auto newNodes = mergeBatches(manager, nodeBatches, finderCount);
+	nodeBatches.clear();
+
+	vector<shared_ptr<map_t>> newNodeMaps(finderCount);
+	runParallel(manager, finderCount, 1, [&](int, size_t begin, size_t end) {
+		for (size_t f = begin; f < end; f++) {
+			newNodeMaps[f] = make_shared<map_t>();
+			newNodeMaps[f]->reserve(newNodes[f]->size());
+			for (size_t i = 0; i < newNodes[f]->size(); i++)
+				(*newNodeMaps[f])[(*newNodes[f])[i].getID()] = i;
+		}
+	});
+
+	// (2) Ways are cut down to the nodes that are accepted by the same finder
+	auto wayBatches = runBatches<vector<vector<OSMWay>>>(manager, ways.size(),
+		[&](size_t begin, size_t end, vector<vector<OSMWay>>& out) {
+		out.resize(finderCount);
+		vector<size_t> indices;
+		for (size_t i = begin; i < end; i++) {
+			const OSMWay& wd = ways[i];
+			indices.clear();
+			for (int64_t id : wd.getNodes()) {
+				auto it = nodeMap->find(id);
+				indices.push_back(it == nodeMap->end() ? numeric_limits<size_t>::max() : it->second);
+			}
+
+			for (size_t f = 0; f < finderCount; f++) {
+				if (!finders[f].acceptWay(wd)) continue;
+				auto wayNodes = make_shared<vector<int64_t>>();
+				for (size_t k = 0; k < indices.size(); k++) {
+					size_t index = indices[k];
+					if (index != numeric_limits<size_t>::max() &&
+						nodeAccepted[index * finderCount + f] &&
+						finders[f].acceptWayNodes(wd, nodes[index])) {
+						wayNodes->push_back(wd.getNodes()[k]);
+					}
+				}
+				if (wayNodes->empty()) continue;
+				out[f].push_back(OSMWay(wd.getID(), wd.getVer(), move(wayNodes), wd.getData()));
+				out[f].back().setSubIndex(wd.getSubIndex());
+			}
+		}
+	});
+	auto newWays = mergeBatches(manager, wayBatches, finderCount);
+	wayBatches.clear();
+
+	vector<shared_ptr<mapid_t<vector<size_t>>>> newWayMaps(finderCount);
+	runParallel(manager, finderCount, 1, [&](int, size_t begin, size_t end) {
+		for (size_t f = begin; f < end; f++) {
+			newWayMaps[f] = make_shared<mapid_t<vector<size_t>>>();
+			newWayMaps[f]->reserve(newWays[f]->size());
+			for (size_t i = 0; i < newWays[f]->size(); i++)
+				(*newWayMaps[f])[(*newWays[f])[i].getID()].push_back(i);
+		}
+	});
+
+	// (3) Relations. The node and way members are filtered in parallel, the
+	// relation members depend on the previous relations in the list and are
+	// resolved in order afterwards.
+	using RelationSource = pair<OSMRelation, size_t>;
+	auto relationBatches = runBatches<vector<vector<RelationSource>>>(manager, relations.size(),
+		[&](size_t begin, size_t end, vector<vector<RelationSource>>& out) {
+		out.resize(finderCount);
+		for (size_t i = begin; i < end; i++) {
+			const OSMRelation& rl = relations[i];
+			for (size_t f = 0; f < finderCount; f++) {
+				if (!finders[f].acceptRelation(rl)) continue;
+				auto nodeRefs = make_shared<vector<RelationMember>>();
+				auto wayRefs = make_shared<vector<RelationMember>>();
+
+				for (const RelationMember& member : *rl.getNodes()) {
+					auto it = newNodeMaps[f]->find(member.getIndex());
+					if (it != newNodeMaps[f]->end() &&
+						finders[f].acceptRelationNodes(rl, (*newNodes[f])[it->second]))
+						nodeRefs->push_back(member);
+				}
+				for (const RelationMember& member : *rl.getWays()) {
+					auto it = newWayMaps[f]->find(member.getIndex());
+					if (it != newWayMaps[f]->end() &&
+						finders[f].acceptRelationWays(rl, (*newWays[f])[it->second[0]]))
+						wayRefs->push_back(member);
+				}
+
+				out[f].push_back(RelationSource(OSMRelation(
+					rl.getID(), rl.getVer(), rl.getData(), move(nodeRefs), move(wayRefs),
+					make_shared<vector<RelationMember>>()), i));
+				out[f].back().first.setSubIndex(rl.getSubIndex());
+			}
+		}
+	});
+	auto relationSources = mergeBatches(manager, relationBatches, finderCount);
+	relationBatches.clear();
+
+	vector<shared_ptr<vector<OSMRelation>>> newRelations(finderCount);
+	vector<shared_ptr<mapid_t<vector<size_t>>>> newRelationMaps(finderCount);
+	runParallel(manager, finderCount, 1, [&](int, size_t begin, size_t end) {
+		for (size_t f = begin; f < end; f++) {
+			vector<RelationSource>& sources = *relationSources[f];
+			newRelations[f] = make_shared<vector<OSMRelation>>();
+			newRelationMaps[f] = make_shared<mapid_t<vector<size_t>>>();
+			newRelations[f]->reserve(sources.size());
+			newRelationMaps[f]->reserve(sources.size());
+			for (RelationSource& source : sources) {
+				const OSMRelation& rl = relations[source.second];
+				vector<RelationMember>& relationRefs = *source.first.getRelations();
+				for (const RelationMember& member : *rl.getRelations()) {
+					auto it = newRelationMaps[f]->find(member.getIndex());
+					if (it != newRelationMaps[f]->end() &&
+						finders[f].acceptRelationRelations(rl, (*newRelations[f])[it->second[0]]))
+						relationRefs.push_back(member);
+				}
+				(*newRelationMaps[f])[rl.getID()].push_back(newRelations[f]->size());
+				newRelations[f]->push_back(move(source.first));
+			}
+		}
+	});
+
+	vector<OSMSegment> result;
+	result.reserve(finderCount);
+	for (size_t f = 0; f < finderCount; f++) {
+		result.emplace_back(newNodes[f], newWays[f], newRelations[f],
+			newNodeMaps[f], newWayMaps[f], newRelationMaps[f]);
+	}
+	return result;
+}
+
+// ---- TagStatistics ---- //
+
+namespace
+{
+	struct ViewHash {
+		size_t operator()(string_view view) const noexcept {
+			return robin_hood::hash_bytes(view.data(), view.size());
+		}
+	};
+
+	template<typename Value>
+	using view_map_t = robin_hood::unordered_flat_map<string_view, Value, ViewHash>;
+
+	/// <summary>Tag counts of a batch of objects. The views point into the
+	/// tag strings of the analysed segment.</summary>
+	struct LocalTagCounts {
+		struct Key {
+			string_view key;
+			int64_t count;
+			view_map_t<int64_t> values;
+		};
+		view_map_t<size_t> index;
+		vector<Key> keys;
+		int64_t objects = 0;
+		int64_t tags = 0;
+		bool countValues = true;
+
+		void add(const OSMMapObject& object) {
+			objects++;
+			if (!object.getData()) return;
+			for (const auto& tag : *object.getData()) {
+				auto it = index.find(string_view(tag.first));
+				size_t keyIndex;
+				if (it == index.end()) {
+					keyIndex = keys.size();
+					index[string_view(tag.first)] = keyIndex;
+					keys.push_back(Key{ tag.first, 0, view_map_t<int64_t>() });
+				}
+				else keyIndex = it->second;
+				keys[keyIndex].count++;
+				if (countValues) keys[keyIndex].values[string_view(tag.second)]++;
+				tags++;
+			}
+		}
+	};
+
+	/// <summary>Selects the k largest entries ordered by count and name</summary>
+	vector<TagCount> selectTop(vector<TagCount> counts, size_t k)
+	{
+		auto compare = [](const TagCount& a, const TagCount& b) {
+			if (a.count != b.count) return a.count > b.count;
+			if (a.key != b.key) return a.key < b.key;
+			return a.value < b.value;
+		};
+		k = std::min(k, counts.size());
+		partial_sort(counts.begin(), counts.begin() + k, counts.end(), compare);
+		counts.resize(k);
+		return counts;
+	}
+}
+
+traffic::TagStatistics::TagStatistics(const OSMSegment& segment, ConcurrencyManager* manager,
+	bool nodes, bool ways, bool relations, bool values)
+{
+	const vector<OSMNode>& nodeList = *segment.getNodes();
+	const vector<OSMWay>& wayList = *segment.getWays();
+	const vector<OSMRelation>& relationList = *segment.getRelations();
+	size_t nodeCount = nodes ? nodeList.size() : 0;
+	size_t wayCount = ways ? wayList.size() : 0;
+	size_t relationCount = relations ? relationList.size() : 0;
+
+	// (1) Counts the tags of every batch, the range is [nodes, ways, relations)
+	vector<LocalTagCounts> batches = runBatches<LocalTagCounts>(manager,
+		nodeCount + wayCount + relationCount,
+		[&](size_t begin, size_t end, LocalTagCounts& out) {
+		out.countValues = values;
+		for (size_t i = begin; i < end; i++) {
+			if (i < nodeCount) out.add(nodeList[i]);
+			else if (i < nodeCount + wayCount) out.add(wayList[i - nodeCount]);
+			else out.add(relationList[i - nodeCount - wayCount]);
+		}
+	});
+
+	// (2) Merges the batches while the views are still valid
+	LocalTagCounts merged;
+	for (LocalTagCounts& batch : batches) {
+		merged.objects += batch.objects;
+		merged.tags += batch.tags;
+		for (LocalTagCounts::Key& key : batch.keys) {
+			auto it = merged.index.find(key.key);
+			if (it == merged.index.end()) {
+				merged.index[key.key] = merged.keys.size();
+				merged.keys.push_back(move(key));
+				continue;
+			}
+			LocalTagCounts::Key& target = merged.keys[it->second];
+			target.count += key.count;
+			for (const auto& value : key.values)
+				target.values[value.first] += value.second;
+		}
+		batch = LocalTagCounts();
+	}
+
+	// (3) Copies every distinct string once
+	m_objects = merged.objects;
+	m_tags = merged.tags;
+	m_pairs = 0;
+	m_keys.resize(merged.keys.size());
+	m_keyIndex.reserve(merged.keys.size());
+	runParallel(manager, merged.keys.size(), 16, [&](int, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const LocalTagCounts::Key& source = merged.keys[i];
+			KeyEntry& entry = m_keys[i];
+			entry.key = string(source.key);
+			entry.count = source.count;
+			entry.values.reserve(source.values.size());
+			for (const auto& value : source.values)
+				entry.values[string(value.first)] = value.second;
+		}
+	});
+	for (size_t i = 0; i < m_keys.size(); i++) {
+		m_keyIndex[m_keys[i].key] = i;
+		m_pairs += m_keys[i].values.size();
+	}
+}
+
+int64_t traffic::TagStatistics::getObjectCount() const noexcept { return m_objects; }
+int64_t traffic::TagStatistics::getTagCount() const noexcept { return m_tags; }
+size_t traffic::TagStatistics::getKeyCount() const noexcept { return m_keys.size(); }
+size_t traffic::TagStatistics::getPairCount() const noexcept { return m_pairs; }
+
+int64_t traffic::TagStatistics::count(const string& key) const
+{
+	auto it = m_keyIndex.find(key);
+	return it == m_keyIndex.end() ? 0 : m_keys[it->second].count;
+}
+
+int64_t traffic::TagStatistics::count(const string& key, const string& value) const
+{
+	auto it = m_keyIndex.find(key);
+	if (it == m_keyIndex.end()) return 0;
+	auto valueIt = m_keys[it->second].values.find(value);
+	return valueIt == m_keys[it->second].values.end() ? 0 : valueIt->second;
+}
+
+vector<TagCount> traffic::TagStatistics::topKeys(size_t k) const
+{
+	vector<TagCount> counts;
+	counts.reserve(m_keys.size());
+	for (const KeyEntry& entry : m_keys)
+		counts.push_back(TagCount{ entry.key, string(), entry.count });
+	return selectTop(move(counts), k);
+}
+
+vector<TagCount> traffic::TagStatistics::topValues(const string& key, size_t k) const
+{
+	vector<TagCount> counts;
+	auto it = m_keyIndex.find(key);
+	if (it == m_keyIndex.end()) return counts;
+	const KeyEntry& entry = m_keys[it->second];
+	counts.reserve(entry.values.size());
+	for (const auto& value : entry.values)
+		counts.push_back(TagCount{ entry.key, value.first, value.second });
+	return selectTop(move(counts), k);
+}
+
+vector<TagCount> traffic::TagStatistics::topPairs(size_t k) const
+{
+	// Only the k largest pairs of every key can be part of the result
+	vector<TagCount> counts;
+	for (const KeyEntry& entry : m_keys) {
+		vector<TagCount> values = topValues(entry.key, k);
+		counts.insert(counts.end(), values.begin(), values.end());
+	}
+	return selectTop(move(counts), k);
+}
+
+unordered_map<string, int32_t> traffic::TagStatistics::toKeyMap() const
+{
+	unordered_map<string, int32_t> map;
+	map.reserve(m_keys.size());
+	for (const KeyEntry& entry : m_keys)
+		map[entry.key] = static_cast<int32_t>(entry.count);
+	return map;
+}
+
+void traffic::TagStatistics::summary(size_t k) const
+{
+	printf("TagStatistics summary:\n");
+	printf("    Objects: %lld\n", static_cast<long long>(m_objects));
+	printf("    Tags: %lld\n", static_cast<long long>(m_tags));
+	printf("    Distinct keys: %zu\n", m_keys.size());
+	printf("    Distinct pairs: %zu\n", m_pairs);
+	printf("    Top keys:\n");
+	for (const TagCount& count : topKeys(k))
+		printf("        %-32s %lld\n", count.key.c_str(), static_cast<long long>(count.count));
+	printf("    Top pairs:\n");
+	for (const TagCount& count : topPairs(k))
+		printf("        %s=%s %lld\n", count.key.c_str(), count.value.c_str(),
+			static_cast<long long>(count.count));
+}
+
+// ---- OSMMap ---- //
+
+OSMMap::OSMMap(const std::shared_ptr<OSMSegment>& map, prec_t chunkSize, ConcurrencyManager* manager)
 {
 	this->m_chunkSize = chunkSize;
 	boundingBox = map->getBoundingBox();
 	recalculateChunks();
-	insertSegment(*map);
+	insertSegment(*map, manager);
 }
 
-void traffic::OSMMap::insertSegment(const OSMSegment& segment)
+void traffic::OSMMap::insertSegment(const OSMSegment& segment, ConcurrencyManager* manager)
 {
-	for (const OSMNode& node : *segment.getNodes())
-		addNode(node);
-	//for (const OSMWay &way : *segment.getWays())
-	//	addWayRecursive(way, segment.get);
+	const vector<OSMNode>& nodes = *segment.getNodes();
+	const vector<OSMWay>& ways = *segment.getWays();
+	const vector<OSMRelation>& relations = *segment.getRelations();
+
+	// (1) Assigns every new node to the chunk it is located in
+	vector<size_t> nodeChunk(nodes.size());
+	runParallel(manager, nodes.size(), 4096, [&](int, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			nodeChunk[i] = m_nodemap.find(nodes[i].getID()) == m_nodemap.end() ?
+				getSegmentIndex(nodes[i].getLat(), nodes[i].getLon()) :
+				numeric_limits<size_t>::max();
+		}
+	});
+
+	// (2) Splits all new ways at the chunk borders
+	struct WayBatch {
+		vector<WayPiece> pieces;
+		vector<int64_t> nodes;
+	};
+	vector<WayBatch> wayBatches = runBatches<WayBatch>(manager, ways.size(),
+		[&](size_t begin, size_t end, WayBatch& batch) {
+		for (size_t i = begin; i < end; i++) {
+			if (m_waymap.find(ways[i].getID()) == m_waymap.end())
+				splitWay(ways[i], i, segment, batch.pieces, batch.nodes);
+		}
+	});
+
+	// (3) Finds the chunks that contain the members of each relation
+	struct RelationEntry {
+		size_t chunk;
+		size_t relation;
+		int32_t subIndex;
+	};
+	vector<vector<RelationEntry>> relationBatches = runBatches<vector<RelationEntry>>(
+		manager, relations.size(), [&](size_t begin, size_t end, vector<RelationEntry>& batch) {
+		vector<size_t> chunks;
+		for (size_t i = begin; i < end; i++) {
+			if (m_relationmap.find(relations[i].getID()) != m_relationmap.end()) continue;
+			chunks.clear();
+			findRelationChunks(relations[i], segment, chunks);
+			for (size_t k = 0; k < chunks.size(); k++)
+				batch.push_back({ chunks[k], i, static_cast<int32_t>(k) });
+		}
+	});
+
+	// (4) Sorts the work into buckets, one for each chunk
+	struct ChunkBucket {
+		vector<size_t> nodes;
+		vector<pair<size_t, size_t>> pieces; // batch and piece index
+		vector<const RelationEntry*> relations;
+	};
+	vector<ChunkBucket> buckets(m_chunks.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+		if (nodeChunk[i] != numeric_limits<size_t>::max())
+			buckets[nodeChunk[i]].nodes.push_back(i);
+	for (size_t b = 0; b < wayBatches.size(); b++)
+		for (size_t p = 0; p < wayBatches[b].pieces.size(); p++)
+			buckets[wayBatches[b].pieces[p].chunk].pieces.push_back({ b, p });
+	for (const auto& batch : relationBatches)
+		for (const RelationEntry& entry : batch)
+			buckets[entry.chunk].relations.push_back(&entry);
+
+	// (5) Builds the chunks in parallel. Every chunk is only touched by one task.
+	runParallel(manager, m_chunks.size(), 16, [&](int, size_t begin, size_t end) {
+		for (size_t c = begin; c < end; c++) {
+			OSMSegment& chunk = m_chunks[c];
+			const ChunkBucket& bucket = buckets[c];
+			for (size_t i : bucket.nodes)
+				chunk.addNode(nodes[i]);
+			for (const auto& ref : bucket.pieces) {
+				const WayBatch& batch = wayBatches[ref.first];
+				const WayPiece& piece = batch.pieces[ref.second];
+				// Adds the copies of the border nodes
+				for (size_t k = piece.offset; k < piece.offset + piece.count; k++)
+					chunk.addNode(segment.getNode(batch.nodes[k]));
+				chunk.addWay(createPiece(ways[piece.way], piece, batch.nodes));
+			}
+			for (const RelationEntry* entry : bucket.relations) {
+				OSMRelation relation = relations[entry->relation];
+				relation.setSubIndex(entry->subIndex);
+				chunk.addRelation(relation);
+			}
+		}
+	});
+
+	// (6) Updates the global indices
+	m_nodemap.reserve(m_nodemap.size() + nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+		if (nodeChunk[i] != numeric_limits<size_t>::max())
+			m_nodemap.emplace(nodes[i].getID(), nodeChunk[i]);
+	for (const WayBatch& batch : wayBatches)
+		for (const WayPiece& piece : batch.pieces)
+			m_waymap[ways[piece.way].getID()].push_back(piece.chunk);
+	for (const auto& batch : relationBatches)
+		for (const RelationEntry& entry : batch)
+			m_relationmap[relations[entry.relation].getID()].push_back(entry.chunk);
 }
 
 void traffic::OSMMap::recalculateChunks()
@@ -799,25 +1566,12 @@ void traffic::OSMMap::recalculateChunks()
 	m_latChunks = latCoordToGlobal(boundingBox.upperLatBorder()) - m_latOffset + 1;
 	m_lonChunks = lonCoordToGlobal(boundingBox.upperLonBorder()) - m_lonOffset + 1;
 	m_chunks = std::vector<OSMSegment>(m_latChunks * m_lonChunks);
-	for (size_t lat = 0; lat < m_latChunks; lat++)
-	{
-		for (size_t lon = 0; lon < m_lonChunks; lon++)
-		{
-			Rect rect = Rect::fromLength(
-				latLocalToCoord(lat), lonLocalToCoord(lon),
-				m_chunkSize, m_chunkSize
-			);
-			m_chunks[toStore(lat, lon)].setBoundingBox(rect);
-		}
-	}
+	for (size_t i = 0; i < m_chunks.size(); i++)
+		m_chunks[i].setBoundingBox(getChunkRect(i));
 
-	/*
-	for (const OSMNode& nd : *(m_map->getNodes()))
-	{
-		size_t location = toStore(nd.getLat(), nd.getLon());
-		m_chunks[location].addNode(nd.getID());
-	}
-	*/
+	m_nodemap.clear();
+	m_waymap.clear();
+	m_relationmap.clear();
 }
 
 const OSMSegment& traffic::OSMMap::getSegmentByNode(int64_t id) const
@@ -837,12 +1591,50 @@ const OSMNode& traffic::OSMMap::getNode(int64_t nodeID) const
 
 const OSMWay& traffic::OSMMap::getWay(int64_t wayID) const
 {
-	return getSegmentByNode(wayID).getWay(wayID);
+	return getWay(wayID, 0);
+}
+
+const OSMWay& traffic::OSMMap::getWay(int64_t wayID, int32_t subIndex) const
+{
+	const vector<size_t>& chunks = getSegmentIndexByWay(wayID);
+	if (subIndex < 0 || static_cast<size_t>(subIndex) >= chunks.size())
+		throw runtime_error("Could not find key!");
+
+	const OSMSegment& chunk = m_chunks[chunks[subIndex]];
+	for (size_t index : chunk.getWayIndices(wayID)) {
+		const OSMWay& way = (*chunk.getWays())[index];
+		if (way.getSubIndex() == subIndex) return way;
+	}
+	throw runtime_error("Could not find key!");
 }
 
 const OSMRelation& traffic::OSMMap::getRelation(int64_t relationID) const
 {
-	return getSegmentByNode(relationID).getRelation(relationID);
+	const vector<size_t>& chunks = getSegmentIndexByRelation(relationID);
+	if (chunks.empty()) throw runtime_error("Could not find key!");
+	return m_chunks[chunks.front()].getRelation(relationID);
+}
+
+size_t traffic::OSMMap::getWayPieceCount(int64_t wayID) const
+{
+	return getSegmentIndexByWay(wayID).size();
+}
+
+OSMWay traffic::OSMMap::assembleWay(int64_t wayID) const
+{
+	size_t pieces = getWayPieceCount(wayID);
+	if (pieces == 0) throw runtime_error("Could not find key!");
+
+	const OSMWay& first = getWay(wayID, 0);
+	OSMWay way(first.getID(), first.getVer(),
+		make_shared<vector<int64_t>>(first.getNodes()), first.getData());
+	for (size_t i = 1; i < pieces; i++) {
+		// Each piece starts with the border node the previous piece ended with
+		const vector<int64_t>& nodes = getWay(wayID, static_cast<int32_t>(i)).getNodes();
+		for (size_t k = 1; k < nodes.size(); k++)
+			way.addNode(nodes[k]);
+	}
+	return way;
 }
 
 // ---- Index functions ---- //
@@ -870,72 +1662,258 @@ const vector<size_t>& traffic::OSMMap::getSegmentIndexByRelation(int64_t relatio
 
 size_t traffic::OSMMap::getSegmentIndex(prec_t lat, prec_t lon) const
 {
-	size_t index = toStore(lat, lon);
-	if (index < 0 || index >= m_chunks.size()) return numeric_limits<size_t>::max();
-	return index;
+	// Coordinates below the offset would wrap around
+	size_t globalLat = latCoordToGlobal(lat);
+	size_t globalLon = lonCoordToGlobal(lon);
+	if (globalLat < m_latOffset || globalLon < m_lonOffset)
+		return numeric_limits<size_t>::max();
+
+	size_t localLat = latGlobalToLocal(globalLat);
+	size_t localLon = lonGlobalToLocal(globalLon);
+	if (localLat >= m_latChunks || localLon >= m_lonChunks)
+		return numeric_limits<size_t>::max();
+	return toStore(localLat, localLon);
 }
 
 bool traffic::OSMMap::addNode(const OSMNode& nd)
 {
 	size_t index = getSegmentIndex(nd.getLat(), nd.getLon());
 	if (index == numeric_limits<size_t>::max()) return false;
-	m_chunks[index].addNode(nd);
+	if (!m_chunks[index].addNode(nd)) return false;
 	
-	if (m_nodemap.find(nd.getID()) == m_nodemap.end())
-		m_nodemap[nd.getID()] = index;
+	m_nodemap.emplace(nd.getID(), index);
 	return true;
 }
 
 bool traffic::OSMMap::addWayRecursive(const OSMWay& way, const OSMSegment& lookup)
 {
-	size_t lastIndex = numeric_limits<size_t>::max();
+	if (m_waymap.find(way.getID()) != m_waymap.end()) return false;
+
+	vector<WayPiece> pieces;
+	vector<int64_t> nodes;
+	splitWay(way, 0, lookup, pieces, nodes);
+	if (pieces.empty()) return false;
+
+	vector<size_t>& chunks = m_waymap[way.getID()];
+	for (const WayPiece& piece : pieces) {
+		for (size_t k = piece.offset; k < piece.offset + piece.count; k++) {
+			const OSMNode& nd = lookup.getNode(nodes[k]);
+			if (m_chunks[piece.chunk].addNode(nd) && getSegmentIndex(nd.getLat(), nd.getLon()) == piece.chunk)
+				m_nodemap.emplace(nd.getID(), piece.chunk);
+		}
+		m_chunks[piece.chunk].addWay(createPiece(way, piece, nodes));
+		chunks.push_back(piece.chunk);
+	}
+	return true;
+}
+
+bool traffic::OSMMap::addRelationRecursive(const OSMRelation& re, const OSMSegment& lookup)
+{
+	if (m_relationmap.find(re.getID()) != m_relationmap.end()) return false;
+
+	for (const RelationMember& node : *re.getNodes()) {
+		size_t index = lookup.getNodeIndex(node.getIndex());
+		if (index != numeric_limits<size_t>::max())
+			addNode((*lookup.getNodes())[index]);
+	}
+	for (const RelationMember& way : *re.getWays()) {
+		size_t index = lookup.getWayIndex(way.getIndex());
+		if (index != numeric_limits<size_t>::max())
+			addWayRecursive((*lookup.getWays())[index], lookup);
+	}
+
+	vector<size_t> chunks;
+	findRelationChunks(re, lookup, chunks);
+	if (chunks.empty()) return false;
+
+	vector<size_t>& indices = m_relationmap[re.getID()];
+	for (size_t k = 0; k < chunks.size(); k++) {
+		OSMRelation relation = re;
+		relation.setSubIndex(static_cast<int32_t>(k));
+		m_chunks[chunks[k]].addRelation(relation);
+		indices.push_back(chunks[k]);
+	}
+	return true;
+}
+
+void traffic::OSMMap::splitWay(const OSMWay& way, size_t wayIndex, const OSMSegment& lookup,
+	vector<WayPiece>& pieces, vector<int64_t>& nodes) const
+{
+	size_t current = numeric_limits<size_t>::max();
 	int32_t subIndex = 0;
-	OSMWay currentWay;
 	for (const int64_t nodeID : way.getNodes())
 	{
-		// finds the node reference and the fitting chunk.
 		// continues with the next node if the node does not exist
-		const OSMNode& nd = lookup.getNode(nodeID);
-		size_t index = getSegmentIndex(nd.getLat(), nd.getLon());
+		size_t index = lookup.getNodeIndex(nodeID);
 		if (index == numeric_limits<size_t>::max()) continue;
-
-		if (lastIndex == index && lastIndex != numeric_limits<size_t>::max()) {
-			// adds the node to the child segment and continues the way.
-			// This happens when the current node is in the same chunk as the
-			// previous one or if it is generally the first node of the way.
-			if (m_chunks[index].addNode(nd)) {
-				m_nodemap[nd.getID()] = index;
-				currentWay.addNode(nd.getID());
+		const OSMNode& nd = (*lookup.getNodes())[index];
+		size_t chunk = getSegmentIndex(nd.getLat(), nd.getLon());
+		if (chunk == numeric_limits<size_t>::max()) continue;
+
+		if (chunk != current) {
+			// The current piece ends with the first node of the next chunk
+			if (current != numeric_limits<size_t>::max()) {
+				nodes.push_back(nodeID);
+				pieces.back().count++;
 			}
+			pieces.push_back({ chunk, wayIndex, subIndex++, nodes.size(), 0 });
+			current = chunk;
 		}
-		else {
-			// stops the way and stores a reference where to continue the way
-			//m_nodemap[currentWay]
-			currentWay.setSubIndex(subIndex);
-			m_chunks[index].addWay(currentWay);
-		}
-		lastIndex = index;
+		nodes.push_back(nodeID);
+		pieces.back().count++;
+	}
+}
+
+void traffic::OSMMap::findRelationChunks(const OSMRelation& re, const OSMSegment& lookup,
+	vector<size_t>& chunks) const
+{
+	// Nested relations are not followed, the relation graph of OSM may contain cycles
+	auto addNodeChunk = [&](int64_t nodeID) {
+		size_t index = lookup.getNodeIndex(nodeID);
+		if (index == numeric_limits<size_t>::max()) return;
+		const OSMNode& nd = (*lookup.getNodes())[index];
+		size_t chunk = getSegmentIndex(nd.getLat(), nd.getLon());
+		if (chunk != numeric_limits<size_t>::max())
+			chunks.push_back(chunk);
+	};
+
+	for (const RelationMember& node : *re.getNodes())
+		addNodeChunk(node.getIndex());
+	for (const RelationMember& member : *re.getWays()) {
+		size_t index = lookup.getWayIndex(member.getIndex());
+		if (index == numeric_limits<size_t>::max()) continue;
+		for (int64_t nodeID : (*lookup.getWays())[index].getNodes())
+			addNodeChunk(nodeID);
 	}
 
-	/*
-	// constructs the ways
-	for (auto it = buffer.begin(); it != buffer.end(); ++it) {
-		OSMWay newWay;
-		for (const OSMNode& node : it->second) {
-			newWay
+	std::sort(chunks.begin(), chunks.end());
+	chunks.erase(std::unique(chunks.begin(), chunks.end()), chunks.end());
+}
+
+OSMWay traffic::OSMMap::createPiece(const OSMWay& way, const WayPiece& piece,
+	const vector<int64_t>& nodes) const
+{
+	OSMWay result(way.getID(), way.getVer(),
+		make_shared<vector<int64_t>>(nodes.begin() + piece.offset,
+			nodes.begin() + piece.offset + piece.count),
+		way.getData());
+	result.setSubIndex(piece.subIndex);
+	return result;
+}
+
+// ---- Region queries ---- //
+
+std::vector<size_t> traffic::OSMMap::findChunks(const Rect& rect) const
+{
+	vector<size_t> chunks;
+	if (m_chunks.empty()) return chunks;
+
+	// Converts the borders to local chunk coordinates clamped to the map
+	auto toLocal = [this](prec_t coord, prec_t origin, size_t offset, size_t count) {
+		prec_t local = (coord + origin) / m_chunkSize - static_cast<prec_t>(offset);
+		if (local < 0.0f) return static_cast<int64_t>(-1);
+		return std::min(static_cast<int64_t>(local), static_cast<int64_t>(count));
+	};
+	int64_t latBegin = toLocal(rect.lowerLatBorder(), 90.0f, m_latOffset, m_latChunks);
+	int64_t latEnd = toLocal(rect.upperLatBorder(), 90.0f, m_latOffset, m_latChunks);
+	int64_t lonBegin = toLocal(rect.lowerLonBorder(), 180.0f, m_lonOffset, m_lonChunks);
+	int64_t lonEnd = toLocal(rect.upperLonBorder(), 180.0f, m_lonOffset, m_lonChunks);
+	if (latEnd < 0 || lonEnd < 0 ||
+		latBegin >= static_cast<int64_t>(m_latChunks) ||
+		lonBegin >= static_cast<int64_t>(m_lonChunks))
+		return chunks;
+
+	latBegin = std::max<int64_t>(latBegin, 0);
+	lonBegin = std::max<int64_t>(lonBegin, 0);
+	latEnd = std::min<int64_t>(latEnd, m_latChunks - 1);
+	lonEnd = std::min<int64_t>(lonEnd, m_lonChunks - 1);
+	chunks.reserve((latEnd - latBegin + 1) * (lonEnd - lonBegin + 1));
+	for (int64_t lon = lonBegin; lon <= lonEnd; lon++)
+		for (int64_t lat = latBegin; lat <= latEnd; lat++)
+			chunks.push_back(toStore(static_cast<size_t>(lat), static_cast<size_t>(lon)));
+	return chunks;
+}
+
+OSMSegment traffic::OSMMap::findSquareNodes(const Rect& rect) const
+{
+	OSMSegment result;
+	for (size_t c : findChunks(rect)) {
+		for (const OSMNode& nd : *m_chunks[c].getNodes()) {
+			// Skips the copies of border nodes, they are found in their own chunk
+			if (rect.contains(Point(nd.getLat(), nd.getLon())) &&
+				getSegmentIndex(nd.getLat(), nd.getLon()) == c)
+				result.addNode(nd);
 		}
 	}
-	*/
-	return false;
+	return result;
 }
 
-bool traffic::OSMMap::addRelationRecursive(const OSMRelation& re, const OSMSegment& lookup)
+OSMSegment traffic::OSMMap::findSquareWays(const Rect& rect) const
 {
-	return false;
+	OSMSegment result;
+	for (size_t c : findChunks(rect)) {
+		const OSMSegment& chunk = m_chunks[c];
+		for (const OSMWay& way : *chunk.getWays()) {
+			bool inside = false;
+			for (int64_t nodeID : way.getNodes()) {
+				const OSMNode& nd = chunk.getNode(nodeID);
+				if (rect.contains(Point(nd.getLat(), nd.getLon()))) {
+					inside = true;
+					break;
+				}
+			}
+			if (!inside || !result.addWay(way)) continue;
+			for (int64_t nodeID : way.getNodes())
+				result.addNode(chunk.getNode(nodeID));
+		}
+	}
+	return result;
 }
 
 const std::vector<OSMSegment>& traffic::OSMMap::getChunks() const { return m_chunks; }
 
+Rect traffic::OSMMap::getChunkRect(size_t index) const
+{
+	return Rect::fromLength(
+		latLocalToCoord(index % m_latChunks), lonLocalToCoord(index / m_latChunks),
+		m_chunkSize, m_chunkSize
+	);
+}
+
+size_t traffic::OSMMap::getLatChunks() const noexcept { return m_latChunks; }
+size_t traffic::OSMMap::getLonChunks() const noexcept { return m_lonChunks; }
+
+std::vector<size_t> traffic::OSMMap::getCurveOrder() const
+{
+	// The curve covers the smallest power of two square containing the grid
+	size_t side = 1;
+	while (side < m_latChunks || side < m_lonChunks) side *= 2;
+
+	vector<size_t> order;
+	order.reserve(m_chunks.size());
+	for (size_t d = 0; d < side * side; d++) {
+		// Converts the distance on the curve to grid coordinates
+		size_t x = 0, y = 0, t = d;
+		for (size_t s = 1; s < side; s *= 2) {
+			size_t rx = 1 & (t / 2);
+			size_t ry = 1 & (t ^ rx);
+			if (ry == 0) {
+				if (rx == 1) {
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				std::swap(x, y);
+			}
+			x += s * rx;
+			y += s * ry;
+			t /= 4;
+		}
+		if (x < m_latChunks && y < m_lonChunks)
+			order.push_back(toStore(x, y));
+	}
+	return order;
+}
+
 size_t traffic::OSMMap::keyCheck(size_t index) const
 {
 	if (index == numeric_limits<size_t>::max())
@@ -943,6 +1921,21 @@ size_t traffic::OSMMap::keyCheck(size_t index) const
 	return index;
 }
 
+void traffic::OSMMap::summary() const
+{
+	size_t nodes = 0, ways = 0, relations = 0;
+	for (const OSMSegment& chunk : m_chunks) {
+		nodes += chunk.getNodeCount();
+		ways += chunk.getWayCount();
+		relations += chunk.getRelationCount();
+	}
+	printf("OSMMap summary:\n");
+	printf("    Chunks: %zu (%zu x %zu) of %f degrees\n", m_chunks.size(), m_latChunks, m_lonChunks, m_chunkSize);
+	printf("    Nodes: %zu (%zu including border copies)\n", m_nodemap.size(), nodes);
+	printf("    Ways: %zu split into %zu pieces\n", m_waymap.size(), ways);
+	printf("    Relations: %zu stored in %zu chunks\n", m_relationmap.size(), relations);
+}
+
 size_t traffic::OSMMap::latCoordToGlobal(prec_t coord) const
 {
 	return (size_t)((coord + 90.0f) / m_chunkSize);
@@ -34,6 +34,8 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <functional>
+#include <type_traits>
 #include <glm/glm.hpp>
 
 #include "geom.h"
@@ -50,6 +52,10 @@ namespace traffic
 	class OSMRelation;		// OpenStreetmap relation definition
 	class OSMNode;			// OpenStreetMap node definition
 	class OSMWay;			// OpenStreetMap way definition
+	class ConcurrencyManager;	// Thread pool defined in agent.h
+	class SpatialIndex;		// Grid index over a segment defined in spatial_index.h
+	class AddressIndex;		// Address lookup table defined in address_index.h
+	struct Address;			// Address query defined in address_index.h
 
 	/// <summary>
 	/// class OSMMapObject
@@ -441,6 +447,120 @@ namespace traffic
 		OSMFinder& setRelationRelationAccept(std::function<bool(const OSMRelation &, const OSMRelation&)> accept);
 	};
 
+	/// <summary>Predicate that accepts every object. Filter stages that use
+	/// it are skipped at compile time.</summary>
+	struct AcceptAll {
+		template<typename... Args>
+		constexpr bool operator()(const Args&...) const noexcept { return true; }
+	};
+
+	/// <summary>Predicate that rejects every object. Filter stages that use
+	/// it are skipped at compile time.</summary>
+	struct RejectAll {
+		template<typename... Args>
+		constexpr bool operator()(const Args&...) const noexcept { return false; }
+	};
+
+	/// <summary>
+	/// Compile time version of OSMFinder. The predicates are stored by value
+	/// and are inlined by OSMSegment::findNodes. Every setter returns a new
+	/// filter type, stages that are not set default to AcceptAll.
+	/// auto filter = OSMFilter<>()
+	///		.setWayAccept([](const OSMWay& way) { return way.hasTag("highway"); })
+	///		.setRelationAccept(RejectAll());
+	/// </summary>
+	template<typename NodePred = AcceptAll, typename WayPred = AcceptAll,
+		typename RelationPred = AcceptAll, typename WayNodePred = AcceptAll,
+		typename RelationNodePred = AcceptAll, typename RelationWayPred = AcceptAll,
+		typename RelationRelationPred = AcceptAll>
+	struct OSMFilter {
+		NodePred acceptNode;
+		WayPred acceptWay;
+		RelationPred acceptRelation;
+		WayNodePred acceptWayNodes;
+		RelationNodePred acceptRelationNodes;
+		RelationWayPred acceptRelationWays;
+		RelationRelationPred acceptRelationRelations;
+
+		template<typename Pred>
+		OSMFilter<Pred, WayPred, RelationPred, WayNodePred, RelationNodePred, RelationWayPred, RelationRelationPred>
+		setNodeAccept(Pred pred) const {
+			return { pred, acceptWay, acceptRelation, acceptWayNodes,
+				acceptRelationNodes, acceptRelationWays, acceptRelationRelations };
+		}
+		template<typename Pred>
+		OSMFilter<NodePred, Pred, RelationPred, WayNodePred, RelationNodePred, RelationWayPred, RelationRelationPred>
+		setWayAccept(Pred pred) const {
+			return { acceptNode, pred, acceptRelation, acceptWayNodes,
+				acceptRelationNodes, acceptRelationWays, acceptRelationRelations };
+		}
+		template<typename Pred>
+		OSMFilter<NodePred, WayPred, Pred, WayNodePred, RelationNodePred, RelationWayPred, RelationRelationPred>
+		setRelationAccept(Pred pred) const {
+			return { acceptNode, acceptWay, pred, acceptWayNodes,
+				acceptRelationNodes, acceptRelationWays, acceptRelationRelations };
+		}
+		template<typename Pred>
+		OSMFilter<NodePred, WayPred, RelationPred, Pred, RelationNodePred, RelationWayPred, RelationRelationPred>
+		setWayNodeAccept(Pred pred) const {
+			return { acceptNode, acceptWay, acceptRelation, pred,
+				acceptRelationNodes, acceptRelationWays, acceptRelationRelations };
+		}
+		template<typename Pred>
+		OSMFilter<NodePred, WayPred, RelationPred, WayNodePred, Pred, RelationWayPred, RelationRelationPred>
+		setRelationNodeAccept(Pred pred) const {
+			return { acceptNode, acceptWay, acceptRelation, acceptWayNodes,
+				pred, acceptRelationWays, acceptRelationRelations };
+		}
+		template<typename Pred>
+		OSMFilter<NodePred, WayPred, RelationPred, WayNodePred, RelationNodePred, Pred, RelationRelationPred>
+		setRelationWayAccept(Pred pred) const {
+			return { acceptNode, acceptWay, acceptRelation, acceptWayNodes,
+				acceptRelationNodes, pred, acceptRelationRelations };
+		}
+		template<typename Pred>
+		OSMFilter<NodePred, WayPred, RelationPred, WayNodePred, RelationNodePred, RelationWayPred, Pred>
+		setRelationRelationAccept(Pred pred) const {
+			return { acceptNode, acceptWay, acceptRelation, acceptWayNodes,
+				acceptRelationNodes, acceptRelationWays, pred };
+		}
+	};
+
+	/// <summary>
+	/// Contents of an OSM change file (osmChange). Created and modified objects
+	/// carry their full new version, deleted objects are only given by their ID.
+	/// </summary>
+	struct OSMChange {
+		std::vector<OSMNode> createdNodes, modifiedNodes;
+		std::vector<OSMWay> createdWays, modifiedWays;
+		std::vector<OSMRelation> createdRelations, modifiedRelations;
+		std::vector<int64_t> deletedNodes, deletedWays, deletedRelations;
+
+		size_t size() const noexcept;
+		bool empty() const noexcept;
+		void summary() const;
+	};
+
+	/// <summary>
+	/// Describes what OSMSegment::applyChange modified. Derived structures like
+	/// the graph and the map meshes use it to update only the affected parts.
+	/// </summary>
+	struct ChangeReport {
+		size_t nodesCreated = 0, nodesModified = 0, nodesDeleted = 0;
+		size_t waysCreated = 0, waysModified = 0, waysDeleted = 0;
+		size_t relationsCreated = 0, relationsModified = 0, relationsDeleted = 0;
+		size_t skipped = 0; // Deletions of unknown objects and empty ways
+
+		std::vector<int64_t> movedNodes;		// Nodes whose position changed
+		std::vector<OSMWay> previousWays;		// Modified and deleted ways before the change
+		std::vector<int64_t> changedWays;		// Created and modified ways
+		std::vector<int64_t> affectedWays;		// All ways whose geometry changed
+		std::vector<Rect> dirty;				// Old and new bounds of the changed geometry
+
+		bool empty() const noexcept;
+		void summary() const;
+	};
+
 	/// This class represents a MapStructure. It combines all
 	/// values stored in the OpenStreetMap XML format.
 	/// nodeList		All nodes stored in the OSMSegment section
@@ -473,6 +593,14 @@ namespace traffic
 		std::shared_ptr<mapid_t<std::vector<size_t>>> wayMap;
 		std::shared_ptr<mapid_t<std::vector<size_t>>> relationMap;
 
+		// optional index that accelerates region queries. It is dropped
+		// whenever the segment is modified.
+		std::shared_ptr<SpatialIndex> spatialIndex;
+		// address index that is built by the first address query. It is
+		// only accessed through atomic operations because concurrent const
+		// queries may build it at the same time.
+		mutable std::shared_ptr<AddressIndex> addressIndex;
+
 	public:
 		//// ---- Constructors ---- ////
 		/// Creates a map that does not hold any data 
@@ -547,6 +675,19 @@ namespace traffic
 		bool addWay(const OSMWay& wd);
 		bool addRelation(const OSMRelation& re);
 
+		/// <summary>
+		/// Applies an OSM change to this segment. Objects are created and modified
+		/// before deletions are processed, nodes before ways before relations.
+		/// Modifications of unknown objects create them, deletions of unknown
+		/// objects are skipped. Way references to nodes that are not part of this
+		/// segment are dropped, like they are by findNodes. Deleted objects are
+		/// replaced by the last object of their list, the order of the lists is
+		/// therefore not preserved.
+		/// </summary>
+		/// <param name="change">The change that is applied</param>
+		/// <returns>The objects and regions that were modified</returns>
+		ChangeReport applyChange(const OSMChange& change);
+
 		bool addWayRecursive(const OSMWay &way, const OSMSegment& lookup);
 		bool addRelationRecursive(const OSMRelation &re, const OSMSegment& lookup);
 
@@ -557,16 +698,67 @@ namespace traffic
 		///		that marks whether this way is accepted
 		OSMSegment findNodes(const OSMFinder &finder) const;
 
+		/// <summary>
+		/// Finds all objects that satisfy the predicates of the filter. The
+		/// predicates are inlined, node stages that use AcceptAll copy the
+		/// node list and index in bulk and stages that use RejectAll are
+		/// skipped. findNodes(const OSMFinder&) is implemented using this
+		/// function and returns the same result.
+		/// </summary>
+		template<typename... Preds>
+		OSMSegment findNodes(const OSMFilter<Preds...>& filter) const;
+
+		/// <summary>
+		/// Parallel version of findNodes(const OSMFinder&). The segment is
+		/// processed in batches on the thread pool, every batch writes to its
+		/// own buffers that are merged in batch order. The output does not
+		/// depend on the thread scheduling. The search runs sequentially if no
+		/// manager is given.
+		/// 
+		/// Relations only keep the members that are part of the result. Member
+		/// nodes and ways that were rejected by the node and way filters are
+		/// dropped and no longer pulled into the result. A relation can only
+		/// reference relations that come earlier in the list.
+		/// </summary>
+		/// <param name="finder">The finder that is evaluated</param>
+		/// <param name="manager">The thread pool that is used, may be null</param>
+		OSMSegment findNodes(const OSMFinder &finder, ConcurrencyManager* manager) const;
+
+		/// <summary>
+		/// Evaluates several finders in a single pass over the segment. Every
+		/// finder produces the same segment as findNodes(const OSMFinder&,
+		/// ConcurrencyManager*) would.
+		/// </summary>
+		/// <param name="finders">The finders, one segment is returned per finder</param>
+		/// <param name="manager">The thread pool that is used, may be null</param>
+		std::vector<OSMSegment> findNodes(const std::vector<OSMFinder> &finders,
+			ConcurrencyManager* manager) const;
+
+		/// <summary>
+		/// (1) Finds all nodes that match the given address, empty values match
+		///     every node. The address index is built by the first call.
+		/// (2) Resolves a batch of addresses, one result per address
+		/// </summary>
 		std::vector<int64_t> findAdress(
 			const std::string& city, const std::string& postcode,
 			const std::string& street, const std::string& housenumber) const;
+		std::vector<std::vector<int64_t>> findAdresses(const std::vector<Address>& addresses) const;
+
+		/// Returns the address index and builds it if it does not exist yet.
+		/// The index is dropped whenever the segment is modified. Concurrent
+		/// first calls are safe but may build the index more than once, call
+		/// buildAddressIndex before queries are issued from multiple threads.
+		const AddressIndex& getAddressIndex() const;
+		/// Builds the address index, see getAddressIndex
+		void buildAddressIndex();
 
 		/// (1) Creates a tag list that contains all tags of nodes
 		/// (2) Creates a way list that contains all tags of ways
 		/// (3) Creates a tag list of all entities
-		std::unordered_map<std::string, int32_t> createNodeTagList() const;
-		std::unordered_map<std::string, int32_t> createWayTagList() const;
-		std::unordered_map<std::string, int32_t> createTagList() const;
+		/// The lists are counted in parallel if a thread pool is given.
+		std::unordered_map<std::string, int32_t> createNodeTagList(ConcurrencyManager *manager = nullptr) const;
+		std::unordered_map<std::string, int32_t> createWayTagList(ConcurrencyManager *manager = nullptr) const;
+		std::unordered_map<std::string, int32_t> createTagList(ConcurrencyManager *manager = nullptr) const;
 
 		/// (1) Finds all nodes that are located in a given rectangle
 		/// (2) Finds all nodes that are located in a given rectangle
@@ -579,6 +771,17 @@ namespace traffic
 
 		OSMSegment findCircleNode(const Circle& circle) const;
 
+		/// <summary>
+		/// Builds a spatial index over this segment. findSquareNodes and
+		/// findCircleNode use the index until the segment is modified. Indexed
+		/// queries only keep relations that have node or way members inside
+		/// of the region.
+		/// </summary>
+		/// <param name="nodesPerCell">The average number of nodes per grid cell</param>
+		void buildSpatialIndex(size_t nodesPerCell = 16);
+		bool hasSpatialIndex() const noexcept;
+		const std::shared_ptr<SpatialIndex>& getSpatialIndex() const noexcept;
+
 		/// (1) Returns the (const) node list
 		/// (2) Returns the (const) way list
 		/// (3) Returns the (const) relation list
@@ -602,24 +805,223 @@ namespace traffic
 		void setBoundingBox(const Rect &r) noexcept;
 	};
 
+	template<typename... Preds>
+	OSMSegment OSMSegment::findNodes(const OSMFilter<Preds...>& filter) const
+	{
+		using Filter = OSMFilter<Preds...>;
+		using IndexMap = mapid_t<std::vector<size_t>>;
+		constexpr bool allNodes = std::is_same<decltype(Filter::acceptNode), AcceptAll>::value;
+		constexpr bool allWayNodes = std::is_same<decltype(Filter::acceptWayNodes), AcceptAll>::value;
+		constexpr bool noWays = std::is_same<decltype(Filter::acceptWay), RejectAll>::value;
+		constexpr bool noRelations = std::is_same<decltype(Filter::acceptRelation), RejectAll>::value;
+
+		// Objects that are already part of the output are not added twice
+		auto contains = [](const IndexMap& map, const auto& list, int64_t id, int32_t subIndex) {
+			auto it = map.find(id);
+			if (it == map.end()) return false;
+			for (size_t index : it->second)
+				if (list[index].getSubIndex() == subIndex) return true;
+			return false;
+		};
+
+		auto nodes = std::make_shared<std::vector<OSMNode>>();
+		auto ways = std::make_shared<std::vector<OSMWay>>();
+		auto relations = std::make_shared<std::vector<OSMRelation>>();
+		auto newNodeMap = std::make_shared<map_t>();
+		auto newWayMap = std::make_shared<IndexMap>();
+		auto newRelationMap = std::make_shared<IndexMap>();
+
+		if constexpr (allNodes) {
+			*nodes = *nodeList;
+			*newNodeMap = *nodeMap;
+		}
+		else {
+			for (const OSMNode& nd : *nodeList) {
+				if (filter.acceptNode(nd) && newNodeMap->emplace(nd.getID(), nodes->size()).second)
+					nodes->push_back(nd);
+			}
+		}
+
+		if constexpr (!noWays) {
+			for (const OSMWay& wd : *wayList) {
+				if (!filter.acceptWay(wd)) continue;
+				auto wayNodes = std::make_shared<std::vector<int64_t>>();
+				wayNodes->reserve(wd.getNodes().size());
+				for (int64_t id : wd.getNodes()) {
+					auto it = newNodeMap->find(id);
+					if (it == newNodeMap->end()) continue;
+					if constexpr (!allWayNodes) {
+						if (!filter.acceptWayNodes(wd, (*nodes)[it->second])) continue;
+					}
+					wayNodes->push_back(id);
+				}
+				if (wayNodes->empty() || contains(*newWayMap, *ways, wd.getID(), wd.getSubIndex()))
+					continue;
+
+				(*newWayMap)[wd.getID()].push_back(ways->size());
+				ways->push_back(OSMWay(wd.getID(), wd.getVer(), std::move(wayNodes), wd.getData()));
+				ways->back().setSubIndex(wd.getSubIndex());
+			}
+		}
+
+		if constexpr (!noRelations) {
+			for (const OSMRelation& rl : *relationList) {
+				if (!filter.acceptRelation(rl) ||
+					contains(*newRelationMap, *relations, rl.getID(), rl.getSubIndex()))
+					continue;
+				auto nodeRefs = std::make_shared<std::vector<RelationMember>>();
+				auto wayRefs = std::make_shared<std::vector<RelationMember>>();
+				auto relationRefs = std::make_shared<std::vector<RelationMember>>();
+
+				for (const RelationMember& member : *rl.getNodes()) {
+					auto it = newNodeMap->find(member.getIndex());
+					if (it != newNodeMap->end() &&
+						filter.acceptRelationNodes(rl, (*nodes)[it->second]))
+						nodeRefs->push_back(member);
+				}
+				for (const RelationMember& member : *rl.getWays()) {
+					auto it = newWayMap->find(member.getIndex());
+					if (it != newWayMap->end() &&
+						filter.acceptRelationWays(rl, (*ways)[it->second[0]]))
+						wayRefs->push_back(member);
+				}
+				// Only relations that come earlier in the list can be referenced
+				for (const RelationMember& member : *rl.getRelations()) {
+					auto it = newRelationMap->find(member.getIndex());
+					if (it != newRelationMap->end() &&
+						filter.acceptRelationRelations(rl, (*relations)[it->second[0]]))
+						relationRefs->push_back(member);
+				}
+
+				(*newRelationMap)[rl.getID()].push_back(relations->size());
+				relations->push_back(OSMRelation(rl.getID(), rl.getVer(), rl.getData(),
+					std::move(nodeRefs), std::move(wayRefs), std::move(relationRefs)));
+				relations->back().setSubIndex(rl.getSubIndex());
+			}
+		}
+
+		return OSMSegment(nodes, ways, relations, newNodeMap, newWayMap, newRelationMap);
+	}
+
+	/// <summary>
+	/// Measures the filtering throughput of findNodes. Every filter runs
+	/// once as a std::function based OSMFinder and once as an inlined
+	/// OSMFilter. The results are printed to the standard output.
+	/// </summary>
+	/// <param name="segment">The segment that is filtered</param>
+	/// <param name="iterations">The number of runs per filter</param>
+	void benchmarkFindNodes(const OSMSegment& segment, size_t iterations = 5);
+
+	/// <summary>Number of occurrences of a tag key or key/value pair</summary>
+	struct TagCount {
+		std::string key;
+		std::string value;	// Empty for key histograms
+		int64_t count;
+	};
+
+	/// <summary>
+	/// Key and key/value histograms of the tags in a segment. The objects
+	/// are counted in batches on the thread pool. Every batch interns the
+	/// tag strings as views into the segment and counts them locally, the
+	/// batches are merged in order at the end. Strings are only copied once
+	/// per distinct key or value.
+	/// </summary>
+	class TagStatistics
+	{
+	public:
+		/// <summary>Counts the tags of a segment</summary>
+		/// <param name="segment">The segment that is analysed</param>
+		/// <param name="manager">The thread pool that is used, may be null</param>
+		/// <param name="nodes">Whether the tags of nodes are counted</param>
+		/// <param name="ways">Whether the tags of ways are counted</param>
+		/// <param name="relations">Whether the tags of relations are counted</param>
+		/// <param name="values">Whether the values of every key are counted</param>
+		explicit TagStatistics(const OSMSegment& segment, ConcurrencyManager* manager = nullptr,
+			bool nodes = true, bool ways = true, bool relations = false, bool values = true);
+
+		/// (1) Returns the number of objects that were analysed
+		/// (2) Returns the total number of tags
+		/// (3) Returns the number of distinct keys
+		/// (4) Returns the number of distinct key/value pairs
+		int64_t getObjectCount() const noexcept;
+		int64_t getTagCount() const noexcept;
+		size_t getKeyCount() const noexcept;
+		size_t getPairCount() const noexcept;
+
+		/// (1) Returns how often the key occurs
+		/// (2) Returns how often the key/value pair occurs
+		int64_t count(const std::string& key) const;
+		int64_t count(const std::string& key, const std::string& value) const;
+
+		/// (1) Returns the k most frequent keys
+		/// (2) Returns the k most frequent values of a key
+		/// (3) Returns the k most frequent key/value pairs
+		/// Entries are sorted by their count, ties are sorted by name.
+		std::vector<TagCount> topKeys(size_t k) const;
+		std::vector<TagCount> topValues(const std::string& key, size_t k) const;
+		std::vector<TagCount> topPairs(size_t k) const;
+
+		/// Returns the key histogram in the format of OSMSegment::createTagList
+		std::unordered_map<std::string, int32_t> toKeyMap() const;
+		void summary(size_t k = 10) const;
+
+	protected:
+		struct KeyEntry {
+			std::string key;
+			int64_t count;
+			robin_hood::unordered_map<std::string, int64_t> values;
+		};
+
+		robin_hood::unordered_map<std::string, size_t> m_keyIndex;
+		std::vector<KeyEntry> m_keys;
+		int64_t m_objects, m_tags;
+		size_t m_pairs;
+	};
+
 	struct OSMMapBuffer {
 		uint32_t chunk;
 	};
 
+	/// <summary>
+	/// class OSMMap
+	/// Spatial partition of a map into a regular grid of chunks. Each chunk is
+	/// an OSMSegment that owns the nodes located in its cell. Ways are split at
+	/// the chunk borders, every piece keeps the ID of the original way and is
+	/// numbered by its subIndex. A piece ends with the first node of the next
+	/// chunk, which is stored as a copy in the chunk of the piece. The chunks of
+	/// all pieces are indexed in subIndex order, the piece with subIndex i + 1
+	/// continues the piece with subIndex i. Relations are copied to every chunk
+	/// that contains one of their members.
+	/// </summary>
 	class OSMMap
 	{
 	public:
-		explicit OSMMap(const std::shared_ptr<OSMSegment>& map, prec_t chunkSize = 0.005);
+		/// <summary>Creates a chunked map from a segment</summary>
+		/// <param name="map">The segment that is partitioned</param>
+		/// <param name="chunkSize">The side length of a chunk in degrees</param>
+		/// <param name="manager">Optional thread pool that builds the chunks</param>
+		explicit OSMMap(const std::shared_ptr<OSMSegment>& map, prec_t chunkSize = 0.005,
+			ConcurrencyManager *manager = nullptr);
 		
-		void insertSegment(const OSMSegment &segment);
+		/// <summary>Distributes all objects of a segment to the chunks. Objects
+		/// that are already stored and nodes outside of the map are skipped.</summary>
+		void insertSegment(const OSMSegment &segment, ConcurrencyManager *manager = nullptr);
 		void recalculateChunks();
 
 		const OSMSegment& getSegmentByNode(int64_t id) const;
 		const OSMSegment& getSegment(prec_t lat, prec_t lon) const;
 		const OSMNode& getNode(int64_t nodeID) const;
+		/// (1) Returns the first piece of a way
+		/// (2) Returns the piece with the given subIndex
 		const OSMWay& getWay(int64_t wayID) const;
+		const OSMWay& getWay(int64_t wayID, int32_t subIndex) const;
 		const OSMRelation& getRelation(int64_t relationID) const;
 
+		/// <summary>Returns the number of pieces a way was split into</summary>
+		size_t getWayPieceCount(int64_t wayID) const;
+		/// <summary>Joins all pieces of a way to the original way</summary>
+		OSMWay assembleWay(int64_t wayID) const;
+
 		size_t getSegmentIndexByNode(int64_t nodeID) const;
 		const std::vector<size_t>& getSegmentIndexByWay(int64_t wayID) const;
 		const std::vector<size_t>& getSegmentIndexByRelation(int64_t nodeID) const;
@@ -632,6 +1034,15 @@ namespace traffic
 		bool addWayRecursive(const OSMWay& way, const OSMSegment& lookup);
 		bool addRelationRecursive(const OSMRelation& re, const OSMSegment& lookup);
 
+		// ---- Region queries ---- //
+
+		/// <summary>Returns the indices of all chunks that intersect the rect</summary>
+		std::vector<size_t> findChunks(const Rect& rect) const;
+		/// (1) Finds all nodes that are located in the rect
+		/// (2) Finds all way pieces with at least one node in the rect
+		OSMSegment findSquareNodes(const Rect& rect) const;
+		OSMSegment findSquareWays(const Rect& rect) const;
+
 		// ---- Coordinate transformation ---- //
 		size_t latCoordToGlobal(prec_t coord) const;
 		prec_t latGlobalToCoord(size_t global) const;
@@ -652,9 +1063,34 @@ namespace traffic
 		size_t toStore(size_t localLat, size_t localLon) const;
 
 		const std::vector<OSMSegment>& getChunks() const;
+		Rect getChunkRect(size_t index) const;
+		size_t getLatChunks() const noexcept;
+		size_t getLonChunks() const noexcept;
+
+		/// <summary>Returns all chunk indices ordered along a Hilbert curve.
+		/// Consecutive ranges of this order form compact regions.</summary>
+		std::vector<size_t> getCurveOrder() const;
 		size_t keyCheck(size_t index) const;
 
+		void summary() const;
+
 	protected:
+		/// <summary>A piece of a way that is located in a single chunk. The
+		/// node IDs are stored in a shared buffer.</summary>
+		struct WayPiece {
+			size_t chunk;
+			size_t way;
+			int32_t subIndex;
+			size_t offset, count;
+		};
+
+		void splitWay(const OSMWay& way, size_t wayIndex, const OSMSegment& lookup,
+			std::vector<WayPiece>& pieces, std::vector<int64_t>& nodes) const;
+		void findRelationChunks(const OSMRelation& re, const OSMSegment& lookup,
+			std::vector<size_t>& chunks) const;
+		OSMWay createPiece(const OSMWay& way, const WayPiece& piece,
+			const std::vector<int64_t>& nodes) const;
+
 		// ---- Member definitions ---- //
 		mapid_t<size_t> m_nodemap;
 		mapid_t<std::vector<size_t>> m_waymap;
@@ -673,44 +1109,6 @@ namespace traffic
 // Experimental !!
 namespace traffic
 {
-	struct StatusRequest {
-
-	};
-
-	struct AgentTransfer {
-
-	};
-
-	struct BorderChange {
-
-	};
-
-	struct DataTransfer {
-
-	};
-
-	class WorkerInterface {
-		/// Checks the status of the Worker. The function will return
-		/// true if this worker is active and successfully connected to
-		/// the network. Returns false otherwise.
-		virtual bool requestStatus(const StatusRequest& req) = 0;
-
-		/// Requests to transfer an agent from the current worker to
-		/// this worker. Returns true if the transfer was successfully.
-		/// Returns false if the transfer failed.
-		virtual bool requestAgentTransfer(const AgentTransfer& req) = 0;
-
-		/// Requests to change the position of a border node. This cannot
-		/// be done by the worker on its own because the coordination of
-		/// both workers is needed to change it. Returns true if the change
-		/// was successfully. Returns false otherwise.
-		virtual bool requestBorderChange(const BorderChange& req) = 0;
-
-		/// Requests to transfer data to this worker. This function may
-		/// be used to transfer arbitrary data between the workers.
-		virtual bool requestDataTransfer(const DataTransfer& rqeq) = 0;
-	};
-
 	class GlobalXMLMap {
 	protected:
 		std::vector<OSMSegment> childMaps;
@@ -732,7 +1130,7 @@ namespace traffic
 	inline void to_json(json& j, const OSMMapObject& map) { map.toJson(j); }
 	inline void from_json(const json& j, OSMMapObject& map) { map = OSMMapObject(j); }
 
-	void debugTags(const OSMSegment& map);
+	void debugTags(const OSMSegment& map, ConcurrencyManager *manager = nullptr);
 } // namespace traffic
 
 #endif
\ No newline at end of file
@@ -31,6 +31,7 @@
 #include <chrono>
 #include <limits>
 #include <queue>
+#include <algorithm>
 
 using namespace traffic;
 using namespace glm;
@@ -57,6 +58,7 @@ public:
 	BufferedNode<ParentType>* previous;
 	prec_t distance;
 	prec_t heuristic;
+	size_t edge;
 	bool visited;
 };
 
@@ -121,54 +123,96 @@ void Route::addNode(int64_t nodeID) {
 Graph::Graph(const shared_ptr<OSMSegment>& xmlmap)
 {
 	this->xmlmap = xmlmap;
-	// Iterates throught the whole list of ways, and nodes for each way. The algorithm checks
-	// constantly if the node already exists in the map. It connects the nodes by creating
-	// a new edge.
-
 	for (const OSMWay& way : (*xmlmap->getWays()))
+		addWay(way);
+}
+
+void traffic::Graph::addWay(const OSMWay& way)
+{
+	// Iterates throught the list of nodes of this way. The algorithm checks
+	// constantly if the node already exists in the map. It connects the nodes
+	// by creating a new edge.
+	int64_t lastID = -1;
+	for (const int64_t& currentID : way.getNodes())
 	{
-		int64_t lastID = -1;
+		// Checks whether the ID was found before
+		auto indexIt = graphMap.find(currentID);
+		if (indexIt == graphMap.end())
+		{
+			// (1) Inserts the value in the buffer
+			// (2) Creates a new map entry
+			graphMap[currentID] = graphBuffer.size();
+			graphBuffer.push_back(GraphNode(xmlmap->getNode(currentID)));
+		}
 
-		for (const int64_t& currentID : way.getNodes())
+		// Connect the points together if there is
+		// a valid last point that can be connected.
+		if (lastID != -1)
 		{
-			// Checks whether the ID was found before
-			auto indexIt = graphMap.find(currentID);
-			if (indexIt == graphMap.end())
-			{
-				size_t currentIndex = graphBuffer.size();
-				// (1) Inserts the value in the buffer
-				// (2) Creates a new map entry
-				graphBuffer.push_back(GraphNode(xmlmap->getNode(currentID)));
-				graphMap[currentID] = currentIndex;
-
-				if (lastID != -1)
-				{
-					size_t lastIndex = graphMap[lastID];
-					prec_t distance = (prec_t)simpleDistance(
-						xmlmap->getNode(lastID).asVector(),
-						xmlmap->getNode(currentID).asVector());
-					graphBuffer[currentIndex].connections.push_back(GraphEdge(lastID, distance));
-					graphBuffer[lastIndex].connections.push_back(GraphEdge(currentID, distance));
-				}
-			}
-			else
-			{
-				// Connect the points together if there is
-				// a valid last point that can be connected.
-				if (lastID != -1)
-				{
-					size_t currentIndex = graphMap[currentID];
-					size_t lastIndex = graphMap[lastID];
-					prec_t distance = (prec_t)simpleDistance(
-						xmlmap->getNode(lastID).asVector(),
-						xmlmap->getNode(currentID).asVector());
-					graphBuffer[currentIndex].connections.push_back(GraphEdge(lastID, distance));
-					graphBuffer[lastIndex].connections.push_back(GraphEdge(currentID, distance));
-				}
-			}
-			lastID = currentID;
+			size_t currentIndex = graphMap[currentID];
+			size_t lastIndex = graphMap[lastID];
+			prec_t distance = (prec_t)simpleDistance(
+				xmlmap->getNode(lastID).asVector(),
+				xmlmap->getNode(currentID).asVector());
+			graphBuffer[currentIndex].connections.push_back(GraphEdge(lastID, distance));
+			graphBuffer[lastIndex].connections.push_back(GraphEdge(currentID, distance));
+		}
+		lastID = currentID;
+	}
+}
+
+void traffic::Graph::removeWay(const OSMWay& way)
+{
+	// Removes exactly one edge per direction and segment. Segments that are
+	// shared by several ways are stored once for every way.
+	auto removeEdge = [this](int64_t from, int64_t to) {
+		auto it = graphMap.find(from);
+		if (it == graphMap.end()) return;
+		vector<GraphEdge>& connections = graphBuffer[it->second].connections;
+		auto edge = find_if(connections.begin(), connections.end(),
+			[to](const GraphEdge& e) { return e.goal == to; });
+		if (edge != connections.end()) connections.erase(edge);
+	};
+
+	const vector<int64_t>& nodes = way.getNodes();
+	for (size_t i = 1; i < nodes.size(); i++) {
+		removeEdge(nodes[i - 1], nodes[i]);
+		removeEdge(nodes[i], nodes[i - 1]);
+	}
+}
+
+void traffic::Graph::applyChange(const ChangeReport& report)
+{
+	for (const OSMWay& way : report.previousWays)
+		removeWay(way);
+	for (int64_t wayID : report.changedWays) {
+		for (size_t index : xmlmap->getWayIndices(wayID))
+			addWay((*xmlmap->getWays())[index]);
+	}
+
+	// Moved nodes take their new position, all edges leading to
+	// or coming from these nodes are reweighted.
+	for (int64_t nodeID : report.movedNodes) {
+		auto it = graphMap.find(nodeID);
+		if (it == graphMap.end() || !xmlmap->hasNodeIndex(nodeID)) continue;
+		GraphNode& node = graphBuffer[it->second];
+		const OSMNode& osmNode = xmlmap->getNode(nodeID);
+		node.lat = osmNode.getLat();
+		node.lon = osmNode.getLon();
+
+		for (GraphEdge& edge : node.connections) {
+			auto goalIt = graphMap.find(edge.goal);
+			if (goalIt == graphMap.end() || !xmlmap->hasNodeIndex(edge.goal)) continue;
+			GraphNode& goal = graphBuffer[goalIt->second];
+			edge.weight = (prec_t)simpleDistance(
+				osmNode.asVector(), xmlmap->getNode(edge.goal).asVector());
+			for (GraphEdge& reverse : goal.connections)
+				if (reverse.goal == nodeID) reverse.weight = edge.weight;
 		}
 	}
+
+	// The index based graph is derived from the updated graph
+	if (fastGraph) optimize();
 }
 
 void traffic::Graph::optimize()
@@ -176,21 +220,28 @@ void traffic::Graph::optimize()
 	fastGraph = std::make_unique<FastGraph>(*this);
 }
 
-Route Graph::findRoute(int64_t start, int64_t goal)
+FastGraph* traffic::Graph::getFastGraph() { return fastGraph.get(); }
+const FastGraph* traffic::Graph::getFastGraph() const { return fastGraph.get(); }
+
+Route Graph::findRoute(int64_t start, int64_t goal, const RoutingBuffers &buffers)
 {
 	int64_t startIndex = findNodeIndex(start);
 	int64_t stopIndex = findNodeIndex(goal);
 	if (startIndex == -1 || stopIndex == -1) {
 		printf("Could not find start/goal indices\n");
+		return Route();
 	}
 
 	if (fastGraph) {
-		return fastGraph->findRoute(startIndex, stopIndex);
+		return fastGraph->findRoute(startIndex, stopIndex, buffers);
 	}
 
-	// Initializes the buffered data using an empty list
+	// Initializes the buffered data using an empty list. The buffers
+	// are released again as soon as the search is finished.
 	size_t nodeCount = graphBuffer.size();
-	vector<BufferedGraphNode> nodes(nodeCount);
+	BumpArena::Scope scope(buffers.arena);
+	ArenaVector<BufferedGraphNode> nodes(nodeCount,
+		BufferedGraphNode(), ArenaAllocator<BufferedGraphNode>(buffers.arena));
 	for (size_t i = 0; i < nodeCount; i++) {
 		nodes[i].distance = std::numeric_limits<double>::max();
 		nodes[i].visited = false;
@@ -202,7 +253,8 @@ Route Graph::findRoute(int64_t start, int64_t goal)
 	auto cmp = [](const BufferedGraphNode* left, const BufferedGraphNode* right)
 		{ return left->distance > right->distance; };
 	priority_queue<BufferedGraphNode*,
-		vector<BufferedGraphNode*>, decltype(cmp)> queue(cmp);
+		ArenaVector<BufferedGraphNode*>, decltype(cmp)> queue(cmp,
+			ArenaVector<BufferedGraphNode*>(ArenaAllocator<BufferedGraphNode*>(buffers.arena)));
 
 	//size_t startIndex = graphMap[start];
 	nodes[startIndex].distance = 0;
@@ -219,6 +271,10 @@ Route Graph::findRoute(int64_t start, int64_t goal)
 		BufferedGraphNode* currentNode = queue.top();
 		queue.pop();
 
+		// Nodes may be queued multiple times, only the first one is expanded
+		if (currentNode->visited)
+			continue;
+
 
 		// Checks the goal condition. Starts the backpropagation
 		// algorithm if the goal was found to output the shortest
@@ -226,6 +282,8 @@ Route Graph::findRoute(int64_t start, int64_t goal)
 		if (currentNode->node->nodeID == goal)
 		{
 			Route route;
+			if (buffers.routes)
+				route.nodes = buffers.routes->acquire();
 			do {
 				route.addNode(currentNode->node->nodeID);
 				currentNode = currentNode->previous;
@@ -249,12 +307,12 @@ Route Graph::findRoute(int64_t start, int64_t goal)
 			{
 				nextNode->distance = newDistance;
 				nextNode->previous = currentNode;
-			}
 
-			// Adds the node to the list of nodes that need to
-			// be visited. The node will be visited in one of the
-			// next iterations
-			queue.push(nextNode);
+				// Adds the node to the list of nodes that need to
+				// be visited. The node will be visited in one of the
+				// next iterations
+				queue.push(nextNode);
+			}
 		}
 
 		currentNode->visited = true;
@@ -413,21 +471,66 @@ FastGraph::FastGraph(const Graph& graph)
 		}
 		graphBuffer[i] = std::move(node);
 	}
+
+	// Assigns a global index to every edge
+	edgeOffsets.resize(graphBuffer.size() + 1);
+	size_t edgeCount = 0;
+	for (size_t i = 0; i < graphBuffer.size(); i++) {
+		edgeOffsets[i] = edgeCount;
+		edgeCount += graphBuffer[i].connections.size();
+	}
+	edgeOffsets[graphBuffer.size()] = edgeCount;
+
+	edgeSources.resize(edgeCount);
+	for (size_t i = 0; i < graphBuffer.size(); i++)
+		std::fill(edgeSources.begin() + edgeOffsets[i],
+			edgeSources.begin() + edgeOffsets[i + 1], i);
 }
 
-Route traffic::FastGraph::findRoute(size_t start, size_t goal)
+Route traffic::FastGraph::findRoute(size_t start, size_t goal, const RoutingBuffers &buffers)
 {
 	auto begin = std::chrono::steady_clock::now();
 
-	// Initializes the buffered data using an empty list
+	std::vector<size_t> path;
+	if (!findEdgePath(start, goal, path, buffers))
+		return Route();
+
+	// Routes store the node IDs in reverse order starting at the goal
+	Route route;
+	if (buffers.routes)
+		route.nodes = buffers.routes->acquire();
+	route.nodes.reserve(path.size());
+	for (size_t i = path.size(); i > 0; i--)
+		route.addNode(graphBuffer[getEdgeGoal(path[i - 1])].nodeID);
+
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "Time difference = " << std::chrono::duration_cast<
+		std::chrono::nanoseconds>(end - begin).count() << "[ns]" << std::endl;
+	return route;
+}
+
+bool traffic::FastGraph::findEdgePath(size_t start, size_t goal,
+	std::vector<size_t>& edges, const RoutingBuffers& buffers)
+{
+	edges.clear();
 	size_t nodeCount = graphBuffer.size();
-	vector<BufferedFastNode> nodes(nodeCount);
+	if (start >= nodeCount || goal >= nodeCount)
+		return false;
+	if (start == goal)
+		return true;
+
+	// Initializes the buffered data using an empty list. The search
+	// buffers are drawn from the arena if one is available and are
+	// released again as soon as the search is finished.
+	BumpArena::Scope scope(buffers.arena);
+	ArenaVector<BufferedFastNode> nodes(nodeCount,
+		BufferedFastNode(), ArenaAllocator<BufferedFastNode>(buffers.arena));
 	for (size_t i = 0; i < nodeCount; i++) {
 		nodes[i].distance = std::numeric_limits<double>::max();
 		nodes[i].visited = false;
 		nodes[i].previous = nullptr;
 		nodes[i].node = &(graphBuffer[i]);
-		nodes[i].heuristic = simpleDistance(
+		nodes[i].heuristic = heuristicScale * simpleDistance(
 			glm::dvec2(graphBuffer[i].lat, graphBuffer[i].lon),
 			glm::dvec2(graphBuffer[goal].lat, graphBuffer[goal].lon));
 	}
@@ -435,10 +538,12 @@ Route traffic::FastGraph::findRoute(size_t start, size_t goal)
 	// Defines a min priority queue
 	auto cmp = [](const BufferedFastNode* left, const BufferedFastNode* right)
 	{ return left->distance + left->heuristic > right->distance + right->heuristic; };
-	priority_queue<BufferedFastNode*, vector<BufferedFastNode*>,
-		decltype(cmp)> queue(cmp);
+	priority_queue<BufferedFastNode*, ArenaVector<BufferedFastNode*>,
+		decltype(cmp)> queue(cmp, ArenaVector<BufferedFastNode*>(
+			ArenaAllocator<BufferedFastNode*>(buffers.arena)));
 
-	prec_t maxDistance = nodes[start].heuristic * 3;
+	prec_t maxDistance = searchLimit > 0.0f ? nodes[start].heuristic * searchLimit
+		: std::numeric_limits<prec_t>::max();
 	// Adds the starting node to the queue.
 	nodes[start].distance = 0;
 	queue.push(&(nodes[start]));
@@ -447,29 +552,30 @@ Route traffic::FastGraph::findRoute(size_t start, size_t goal)
 		// All possible connections where searched and the goal was not found.
 		// This means that there is not a possible way to reach the destination node.
 		if (queue.empty())
-			return Route();
+			return false;
 
 		// Takes the element with the highest priority from the queue
 		BufferedFastNode* currentNode = queue.top();
 		if (currentNode->distance > maxDistance)
-			return Route();
+			return false;
 		queue.pop();
 
+		// Nodes may be queued multiple times, only the first one is expanded
+		if (currentNode->visited)
+			continue;
+
 		// Checks the goal condition. Starts the backpropagation
 		// algorithm if the goal was found to output the shortest route.
-		if (currentNode->node->nodeID == graphBuffer[goal].nodeID) {
-			Route route;
-			do {
-				route.addNode(currentNode->node->nodeID);
+		if (currentNode == &(nodes[goal])) {
+			while (currentNode->previous) {
+				edges.push_back(currentNode->edge);
 				currentNode = currentNode->previous;
-			} while (currentNode->node->nodeID != graphBuffer[start].nodeID);
-
-			auto end = std::chrono::steady_clock::now();
-			std::cout << "Time difference = " << std::chrono::duration_cast<
-				std::chrono::nanoseconds>(end - begin).count() << "[ns]" << std::endl;
-			return route;
+			}
+			std::reverse(edges.begin(), edges.end());
+			return true;
 		}
 
+		size_t currentIndex = static_cast<size_t>(currentNode - nodes.data());
 		auto& connections = currentNode->node->connections;
 		for (size_t i = 0; i < connections.size(); i++) {
 			// Checks if the node was already visited
@@ -480,11 +586,12 @@ Route traffic::FastGraph::findRoute(size_t start, size_t goal)
 				if (newDistance < nextNode->distance) {
 					nextNode->distance = newDistance;
 					nextNode->previous = currentNode;
-				}
+					nextNode->edge = edgeOffsets[currentIndex] + i;
 
-				// Adds the node to the list of nodes that need to be visited.
-				// The node will be visited in one of the next iterations
-				queue.push(nextNode);
+					// Adds the node to the list of nodes that need to be visited.
+					// The node will be visited in one of the next iterations
+					queue.push(nextNode);
+				}
 			}
 		}
 
@@ -492,6 +599,50 @@ Route traffic::FastGraph::findRoute(size_t start, size_t goal)
 	}
 }
 
+size_t traffic::FastGraph::countNodes() const noexcept { return graphBuffer.size(); }
+size_t traffic::FastGraph::countEdges() const noexcept { return edgeSources.size(); }
+
+const FastGraphNode& traffic::FastGraph::getNode(size_t index) const { return graphBuffer[index]; }
+const FastGraphEdge& traffic::FastGraph::getEdge(size_t edgeIndex) const
+{
+	size_t source = edgeSources[edgeIndex];
+	return graphBuffer[source].connections[edgeIndex - edgeOffsets[source]];
+}
+
+size_t traffic::FastGraph::getEdgeIndex(size_t nodeIndex, size_t connection) const
+{
+	return edgeOffsets[nodeIndex] + connection;
+}
+
+size_t traffic::FastGraph::getEdgeSource(size_t edgeIndex) const { return edgeSources[edgeIndex]; }
+size_t traffic::FastGraph::getEdgeGoal(size_t edgeIndex) const { return getEdge(edgeIndex).goal; }
+uint64_t traffic::FastGraph::getWeightVersion() const noexcept { return weightVersion; }
+
+void traffic::FastGraph::setWeights(const std::vector<prec_t>& weights)
+{
+	// The heuristic is the direct distance scaled by the smallest ratio
+	// between weight and distance, so it never overestimates the cost.
+	double scale = std::numeric_limits<double>::max();
+	for (size_t e = 0; e < edgeSources.size(); e++) {
+		FastGraphNode& source = graphBuffer[edgeSources[e]];
+		FastGraphEdge& edge = source.connections[e - edgeOffsets[edgeSources[e]]];
+		edge.weight = weights[e];
+
+		const FastGraphNode& goal = graphBuffer[edge.goal];
+		double length = simpleDistance(glm::dvec2(source.lat, source.lon),
+			glm::dvec2(goal.lat, goal.lon));
+		if (length > 0.0)
+			scale = std::min(scale, static_cast<double>(weights[e]) / length);
+	}
+	heuristicScale = scale == std::numeric_limits<double>::max() ?
+		0.0f : static_cast<prec_t>(scale);
+	weightVersion++;
+}
+
+prec_t traffic::FastGraph::getWeight(size_t edgeIndex) const { return getEdge(edgeIndex).weight; }
+void traffic::FastGraph::setSearchLimit(prec_t factor) noexcept { searchLimit = factor; }
+prec_t traffic::FastGraph::getSearchLimit() const noexcept { return searchLimit; }
+
 FastGraphEdge::FastGraphEdge(size_t goal, prec_t weight)
 	: goal(goal), weight(weight) { }
 
@@ -36,6 +36,7 @@
 #include <glm/glm.hpp>
 
 #include "osm.h"
+#include "allocator.h"
 
 using graphmap_t = robin_hood::unordered_node_map<int64_t, size_t>;
 
@@ -50,6 +51,17 @@ namespace traffic
 	struct FastGraphEdge;
 	struct FastGraphNode;
 
+	/// <summary>
+	/// Optional memory resources that are used by the path finding algorithms.
+	/// Transient search buffers are taken from the arena, the node list of the
+	/// resulting route is taken from the route pool. Both fall back to the
+	/// general heap if they are not set.
+	/// </summary>
+	struct RoutingBuffers {
+		BumpArena *arena = nullptr;
+		VectorPool<int64_t> *routes = nullptr;
+	};
+
 	struct FastGraphEdge {
 		size_t goal;
 		prec_t weight;
@@ -68,14 +80,60 @@ namespace traffic
 		FastGraphNode(int64_t nodeID, prec_t lat, prec_t lon);
 	};
 
+	/// <summary>
+	/// Index based representation of a Graph that is used for path finding. Nodes
+	/// are addressed by their index in the node buffer. Every edge additionally
+	/// has a global edge index that is given by the node's edge offset plus the
+	/// position of the edge in the node's connection list.
+	/// </summary>
 	class FastGraph {
 	public:
 		FastGraph(const Graph& graph);
 
-		Route findRoute(size_t start, size_t goal);
+		Route findRoute(size_t start, size_t goal,
+			const RoutingBuffers &buffers = RoutingBuffers());
+
+		/// <summary>Applies the A* path finding algorithm and outputs the
+		/// global edge indices of the shortest path in forward order</summary>
+		/// <param name="start">The starting node index</param>
+		/// <param name="goal">The destination node index</param>
+		/// <param name="edges">Receives the edges, cleared before the search</param>
+		/// <param name="buffers">Memory resources used by the search</param>
+		/// <returns>Whether a path was found</returns>
+		bool findEdgePath(size_t start, size_t goal, std::vector<size_t> &edges,
+			const RoutingBuffers &buffers = RoutingBuffers());
+
+		size_t countNodes() const noexcept;
+		size_t countEdges() const noexcept;
+
+		const FastGraphNode& getNode(size_t index) const;
+		const FastGraphEdge& getEdge(size_t edgeIndex) const;
+		size_t getEdgeIndex(size_t nodeIndex, size_t connection) const;
+		size_t getEdgeSource(size_t edgeIndex) const;
+		size_t getEdgeGoal(size_t edgeIndex) const;
+
+		/// <summary>The weight version is incremented whenever edge weights
+		/// change. It is used to invalidate cached routes.</summary>
+		uint64_t getWeightVersion() const noexcept;
+
+		/// <summary>Replaces the weights of all edges, for example with travel
+		/// times. The A* heuristic is rescaled so that it stays admissible.</summary>
+		/// <param name="weights">One weight per global edge index</param>
+		void setWeights(const std::vector<prec_t> &weights);
+		prec_t getWeight(size_t edgeIndex) const;
+
+		/// <summary>Searches give up once the explored distance exceeds the
+		/// direct distance times this factor. A factor of 0 disables the limit.</summary>
+		void setSearchLimit(prec_t factor) noexcept;
+		prec_t getSearchLimit() const noexcept;
 
 	protected:
 		std::vector<FastGraphNode> graphBuffer;
+		std::vector<size_t> edgeOffsets;
+		std::vector<size_t> edgeSources;
+		uint64_t weightVersion = 0;
+		prec_t heuristicScale = 1.0f;
+		prec_t searchLimit = 3.0f;
 	};
 
 
@@ -165,11 +223,24 @@ namespace traffic
 
 		void optimize();
 
+		/// <summary>Updates the graph after a change was applied to the underlying
+		/// map. Edges of previous ways are removed, edges of changed ways are added
+		/// and edges of moved nodes are reweighted. Nodes that lose all their edges
+		/// stay part of the graph. The optimized graph is recreated if it exists.</summary>
+		/// <param name="report">The report returned by OSMSegment::applyChange</param>
+		void applyChange(const ChangeReport& report);
+
+		/// <summary>Returns the optimized graph or nullptr if optimize was not called</summary>
+		FastGraph* getFastGraph();
+		const FastGraph* getFastGraph() const;
+
 		/// <summary>Applies the AStar (A*) path finding algorithm on the graph</summary>
 		/// <param name="start">The starting node ID</param>
 		/// <param name="goal">The destination node ID</param>
+		/// <param name="buffers">Memory resources used by the search</param>
 		/// <returns>The shortest route between start and goal</returns>
-		Route findRoute(int64_t start, int64_t goal);
+		Route findRoute(int64_t start, int64_t goal,
+			const RoutingBuffers &buffers = RoutingBuffers());
 
 		/// <summary>Finds a node by its index in the sequential node array</summary>
 		/// <param name="index">The node's index</param>
@@ -212,6 +283,9 @@ namespace traffic
 		virtual size_t getSize() const;
 
 	protected:
+		void addWay(const OSMWay& way);
+		void removeWay(const OSMWay& way);
+
 		std::vector<GraphNode> graphBuffer;
 		graphmap_t graphMap;
 
@@ -27,6 +27,12 @@
 
 #include <vector>
 #include <limits>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <atomic>
+#include <memory>
+#include <functional>
 
 #include <glm/glm.hpp>
 
@@ -126,41 +132,232 @@ double traffic::simpleDistanceSquared(glm::dvec2 p1, glm::dvec2 p2)
 
 // ---- Mesh Generation ---- //
 
-void applyNodes(const std::vector<int64_t> nds, const OSMSegment& map,
-	std::vector<glm::vec2> &points)
+/// <summary>Writes two vertices per segment of the node list to out</summary>
+/// <returns>The end of the written range</returns>
+static vec2* writeNodes(const std::vector<int64_t>& nds, const OSMSegment& map,
+	vec2 center, vec2* out)
 {
-	if (nds.empty()) return;
-	Point centerP = map.getBoundingBox().getCenter();
-	vec2 center(centerP.getLongitude(), centerP.getLatitude());
+	if (nds.empty()) return out;
 	auto& nodeList = *(map.getNodes());
 
-	int64_t lastNode = nds[0];
+	// every node is looked up and projected once
+	auto project = [&](int64_t id) {
+		const OSMNode& nd = nodeList[map.getNodeIndex(id)];
+		return vec2(sphereToPlane(vec2(
+			static_cast<float>(nd.getLon()),
+			static_cast<float>(nd.getLat())), center));
+	};
+	vec2 last = project(nds[0]);
 	for (size_t i = 1; i < nds.size(); i++)
 	{
-		size_t lastNodeID = map.getNodeIndex(lastNode);
-		size_t currentNodeID = map.getNodeIndex(nds[i]);
-		vec2 pos1(
-			static_cast<float>(nodeList[lastNodeID].getLon()),
-			static_cast<float>(nodeList[lastNodeID].getLat()));
-		vec2 pos2(
-			static_cast<float>(nodeList[currentNodeID].getLon()),
-			static_cast<float>(nodeList[currentNodeID].getLat()));
-
-		points.push_back(sphereToPlane(pos1, center));
-		points.push_back(sphereToPlane(pos2, center));
-		lastNode = nds[i];
+		vec2 current = project(nds[i]);
+		*out++ = last;
+		*out++ = current;
+		last = current;
 	}
+	return out;
 }
 
-std::vector<vec2> traffic::generateMesh(const OSMSegment& map)
+static size_t countSegmentVertices(const std::vector<int64_t>& nds)
 {
-	std::vector<vec2> points;
-	for (const OSMWay& wd : (*map.getWays()))
-		applyNodes(wd.getNodes(), map, points);
+	return nds.size() > 1 ? 2 * (nds.size() - 1) : 0;
+}
+
+void applyNodes(const std::vector<int64_t>& nds, const OSMSegment& map,
+	vec2 center, std::vector<glm::vec2> &points)
+{
+	size_t offset = points.size();
+	points.resize(offset + countSegmentVertices(nds));
+	writeNodes(nds, map, center, points.data() + offset);
+}
+
+vec2 mapCenter(const OSMSegment& map)
+{
+	Point centerP = map.getBoundingBox().getCenter();
+	return vec2(centerP.getLongitude(), centerP.getLatitude());
+}
+
+void applyNodes(const std::vector<int64_t> nds, const OSMSegment& map,
+	std::vector<glm::vec2> &points)
+{
+	applyNodes(nds, map, mapCenter(map), points);
+}
+
+// ---- Parallel helpers ---- //
+
+/// <summary>The number of batches that [0, count) is split into. Every
+/// thread receives a few batches to balance ways of different length.</summary>
+static size_t countBatches(ConcurrencyManager* manager, size_t count)
+{
+	size_t threads = manager ? std::max<size_t>(manager->getPool().size(), 1) : 1;
+	return std::min<size_t>(count, manager ? threads * 4 : 1);
+}
+
+/// <summary>Runs the function for every batch of [0, count). The function
+/// receives the batch number and its range. Blocks until all batches are
+/// finished, the batches run on the calling thread without a manager.</summary>
+static void forBatches(ConcurrencyManager* manager, size_t count, size_t batches,
+	const std::function<void(size_t, size_t, size_t)>& func)
+{
+	auto task = [&](int, size_t first, size_t last) {
+		for (size_t k = first; k < last; k++)
+			func(k, count * k / batches, count * (k + 1) / batches);
+	};
+	if (batches == 0) return;
+	if (manager) manager->parallelFor(batches, 1, task);
+	else task(-1, 0, batches);
+}
+
+/// <summary>Converts batch sizes stored at offsets[batch + 1] to the
+/// offsets of the batches in the output. The last entry is the total.</summary>
+static size_t prefixSum(std::vector<size_t>& offsets)
+{
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	return offsets.back();
+}
+
+std::vector<vec2> traffic::generateMesh(const OSMSegment& map, ConcurrencyManager* manager)
+{
+	const std::vector<OSMWay>& ways = *map.getWays();
+	vec2 center = mapCenter(map);
+	size_t batches = countBatches(manager, ways.size());
+
+	// every batch writes into its own range of one preallocated buffer
+	std::vector<size_t> offsets(batches + 1, 0);
+	forBatches(manager, ways.size(), batches, [&](size_t batch, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			offsets[batch + 1] += countSegmentVertices(ways[i].getNodes());
+	});
+	std::vector<vec2> points(prefixSum(offsets));
+	forBatches(manager, ways.size(), batches, [&](size_t batch, size_t begin, size_t end) {
+		vec2* out = points.data() + offsets[batch];
+		for (size_t i = begin; i < end; i++)
+			out = writeNodes(ways[i].getNodes(), map, center, out);
+	});
+	return points;
+}
+
+// ---- StripMesh ---- //
 
+void traffic::StripMesh::clear() noexcept
+{
+	vertices.clear();
+	indices.clear();
+}
+
+bool traffic::StripMesh::empty() const noexcept { return indices.empty(); }
+
+size_t traffic::StripMesh::countSegments() const noexcept
+{
+	size_t count = 0;
+	for (size_t i = 1; i < indices.size(); i++)
+		if (indices[i] != RESTART && indices[i - 1] != RESTART) count++;
+	return count;
+}
+
+void traffic::StripMesh::append(const StripMesh& mesh)
+{
+	if (mesh.empty()) return;
+	uint32_t offset = static_cast<uint32_t>(vertices.size());
+	if (!indices.empty()) indices.push_back(RESTART);
+	indices.reserve(indices.size() + mesh.indices.size());
+	for (uint32_t index : mesh.indices)
+		indices.push_back(index == RESTART ? RESTART : index + offset);
+	vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+}
+
+std::vector<vec2> traffic::StripMesh::toLines() const
+{
+	std::vector<vec2> points;
+	points.reserve(countSegments() * 2);
+	for (size_t i = 1; i < indices.size(); i++) {
+		if (indices[i] == RESTART || indices[i - 1] == RESTART) continue;
+		points.push_back(vertices[indices[i - 1]]);
+		points.push_back(vertices[indices[i]]);
+	}
 	return points;
 }
 
+/// <summary>Appends a strip of count vertices to the mesh. The vertex
+/// function returns the mesh index of the i-th vertex of the strip.</summary>
+template<typename VertexFunction>
+static void appendStrip(StripMesh& mesh, size_t count, VertexFunction vertex)
+{
+	if (count < 2) return;
+	if (!mesh.indices.empty()) mesh.indices.push_back(StripMesh::RESTART);
+	for (size_t i = 0; i < count; i++)
+		mesh.indices.push_back(vertex(i));
+}
+
+StripMesh traffic::generateStripMesh(const OSMSegment& map, ConcurrencyManager* manager)
+{
+	StripMesh mesh;
+	vec2 center = mapCenter(map);
+	auto& nodeList = *(map.getNodes());
+	const std::vector<OSMWay>& ways = *map.getWays();
+	size_t wayBatches = countBatches(manager, ways.size());
+	size_t nodeBatches = countBatches(manager, nodeList.size());
+	auto stripSize = [&](size_t way) {
+		size_t count = ways[way].getNodes().size();
+		return count > 1 ? count + 1 : 0; // including the restart index
+	};
+
+	// The index buffer is filled with node indices first, every node
+	// is looked up once. Used nodes are marked for the vertex buffer.
+	std::vector<size_t> indexOffsets(wayBatches + 1, 0);
+	forBatches(manager, ways.size(), wayBatches, [&](size_t batch, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			indexOffsets[batch + 1] += stripSize(i);
+	});
+	mesh.indices.resize(prefixSum(indexOffsets));
+
+	auto vertexOf = std::make_unique<std::atomic<uint32_t>[]>(nodeList.size());
+	forBatches(manager, nodeList.size(), nodeBatches, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			vertexOf[i].store(0, std::memory_order_relaxed);
+	});
+	forBatches(manager, ways.size(), wayBatches, [&](size_t batch, size_t begin, size_t end) {
+		uint32_t* out = mesh.indices.data() + indexOffsets[batch];
+		for (size_t i = begin; i < end; i++) {
+			if (stripSize(i) == 0) continue;
+			for (int64_t id : ways[i].getNodes()) {
+				size_t index = map.getNodeIndex(id);
+				vertexOf[index].store(1, std::memory_order_relaxed);
+				*out++ = static_cast<uint32_t>(index);
+			}
+			*out++ = StripMesh::RESTART;
+		}
+	});
+
+	// Used nodes receive consecutive vertices in node order
+	std::vector<size_t> vertexOffsets(nodeBatches + 1, 0);
+	forBatches(manager, nodeList.size(), nodeBatches, [&](size_t batch, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			vertexOffsets[batch + 1] += vertexOf[i].load(std::memory_order_relaxed);
+	});
+	mesh.vertices.resize(prefixSum(vertexOffsets));
+	forBatches(manager, nodeList.size(), nodeBatches, [&](size_t batch, size_t begin, size_t end) {
+		uint32_t vertex = static_cast<uint32_t>(vertexOffsets[batch]);
+		for (size_t i = begin; i < end; i++) {
+			if (!vertexOf[i].load(std::memory_order_relaxed)) continue;
+			mesh.vertices[vertex] = sphereToPlane(vec2(
+				static_cast<float>(nodeList[i].getLon()),
+				static_cast<float>(nodeList[i].getLat())), center);
+			vertexOf[i].store(vertex++, std::memory_order_relaxed);
+		}
+	});
+
+	forBatches(manager, ways.size(), wayBatches, [&](size_t batch, size_t, size_t) {
+		uint32_t* first = mesh.indices.data() + indexOffsets[batch];
+		uint32_t* last = mesh.indices.data() + indexOffsets[batch + 1];
+		for (uint32_t* it = first; it != last; it++)
+			if (*it != StripMesh::RESTART) *it = vertexOf[*it].load(std::memory_order_relaxed);
+	});
+	// the last strip does not need a restart
+	if (!mesh.indices.empty()) mesh.indices.pop_back();
+	return mesh;
+}
+
 std::vector<vec2> traffic::generateChunkMesh(const World& world)
 {
 	std::vector<vec2> positions;
@@ -213,6 +410,374 @@ void traffic::unify(std::vector<vec2>& points)
 	}
 }
 
+// ---- SectionedMesh ---- //
+
+void traffic::simplifyLine(const std::vector<vec2>& line,
+	prec_t tolerance, std::vector<size_t>& kept)
+{
+	if (line.size() < 2) return;
+	const prec_t tolerance2 = tolerance * tolerance;
+	std::vector<bool> keep(line.size(), false);
+	keep.front() = keep.back() = true;
+
+	// iterative version of the recursive subdivision
+	std::vector<std::pair<size_t, size_t>> stack{ { 0, line.size() - 1 } };
+	while (!stack.empty()) {
+		auto [first, last] = stack.back();
+		stack.pop_back();
+		if (last <= first + 1) continue;
+
+		vec2 a = line[first], ab = line[last] - a;
+		prec_t length2 = dot(ab, ab);
+		prec_t maxDistance = -1.0f;
+		size_t maxIndex = first;
+		for (size_t i = first + 1; i < last; i++) {
+			vec2 ap = line[i] - a;
+			// closed lines have a degenerated base segment
+			prec_t t = length2 > 0.0f ? std::clamp(dot(ap, ab) / length2, 0.0f, 1.0f) : 0.0f;
+			vec2 d = ap - ab * t;
+			prec_t distance = dot(d, d);
+			if (distance > maxDistance) {
+				maxDistance = distance;
+				maxIndex = i;
+			}
+		}
+		if (maxDistance > tolerance2) {
+			keep[maxIndex] = true;
+			stack.push_back({ first, maxIndex });
+			stack.push_back({ maxIndex, last });
+		}
+	}
+
+	for (size_t i = 0; i < line.size(); i++)
+		if (keep[i]) kept.push_back(i);
+}
+
+/// <summary>Returns the grid cell of a coordinate, clamped to the grid</summary>
+static size_t gridCell(prec_t value, prec_t lower, prec_t size, size_t count)
+{
+	prec_t pos = std::floor((value - lower) / size);
+	return static_cast<size_t>(std::clamp<prec_t>(pos, 0, static_cast<prec_t>(count - 1)));
+}
+
+traffic::SectionedMesh::SectionedMesh(const OSMSegment& map, ConcurrencyManager* manager,
+	prec_t sectionSize, size_t levels, prec_t tolerance)
+{
+	Rect box = map.getBoundingBox();
+	m_center = mapCenter(map);
+	m_lowerLat = box.lowerLatBorder();
+	m_lowerLon = box.lowerLonBorder();
+	m_tolerance = tolerance;
+	m_levels = std::max<size_t>(1, levels);
+	m_planeScale = static_cast<prec_t>(latitudeToPlane(1.0, m_center));
+	// the grid is limited to 256x256 sections, larger maps use larger sections
+	auto count = [sectionSize](prec_t length) {
+		return std::clamp<size_t>(static_cast<size_t>(std::ceil(length / sectionSize)), 1, 256);
+	};
+	m_rows = count(box.latDistance());
+	m_cols = count(box.lonDistance());
+	m_latSize = std::max(box.latDistance() / m_rows, sectionSize);
+	m_lonSize = std::max(box.lonDistance() / m_cols, sectionSize);
+	m_sections.resize(m_rows * m_cols, std::vector<StripMesh>(m_levels));
+	m_bounds.resize(m_rows * m_cols);
+	m_sectionWays.resize(m_rows * m_cols);
+
+	m_waySection.reserve(map.getWays()->size());
+	for (const OSMWay& wd : *map.getWays()) {
+		if (m_waySection.count(wd.getID())) continue; // multiple pieces
+		size_t section = findSection(map, wd.getID());
+		m_waySection[wd.getID()] = section;
+		m_sectionWays[section].push_back(wd.getID());
+	}
+	// sections are independent and generated in parallel
+	forBatches(manager, m_sections.size(), countBatches(manager, m_sections.size()),
+		[&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				generateSection(map, i);
+		});
+	for (size_t i = 0; i < m_sections.size(); i++)
+		updateOverhang(i);
+}
+
+size_t traffic::SectionedMesh::findSection(const OSMSegment& map, int64_t wayID) const
+{
+	const OSMWay& wd = map.getWay(wayID);
+	if (wd.getNodes().empty() || !map.hasNodeIndex(wd.getNodes().front())) return 0;
+	const OSMNode& nd = map.getNode(wd.getNodes().front());
+	// nodes that moved out of the original bounding box are clamped to the border
+	return gridCell(nd.getLat(), m_lowerLat, m_latSize, m_rows) * m_cols +
+		gridCell(nd.getLon(), m_lowerLon, m_lonSize, m_cols);
+}
+
+void traffic::SectionedMesh::generateSection(const OSMSegment& map, size_t section)
+{
+	std::vector<StripMesh>& levels = m_sections[section];
+	for (auto& level : levels) level.clear();
+	vec4 bounds(
+		std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+		std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+
+	// nodes that are shared by ways are stored once per level
+	std::vector<robin_hood::unordered_flat_map<size_t, uint32_t>> vertexOf(m_levels);
+	std::vector<size_t> nodeIndices, kept;
+	std::vector<vec2> line;
+	auto& nodeList = *(map.getNodes());
+	auto vertex = [&](size_t level, size_t i) {
+		StripMesh& mesh = levels[level];
+		auto it = vertexOf[level].find(nodeIndices[i]);
+		if (it != vertexOf[level].end()) return it->second;
+		uint32_t index = static_cast<uint32_t>(mesh.vertices.size());
+		vertexOf[level][nodeIndices[i]] = index;
+		mesh.vertices.push_back(line[i]);
+		return index;
+	};
+
+	for (int64_t wayID : m_sectionWays[section]) {
+		for (size_t index : map.getWayIndices(wayID)) {
+			const std::vector<int64_t>& nodes = (*map.getWays())[index].getNodes();
+
+			// the polyline is projected once and simplified for every level
+			nodeIndices.clear();
+			line.clear();
+			vec2 lower(std::numeric_limits<float>::max()), upper(std::numeric_limits<float>::lowest());
+			for (int64_t id : nodes) {
+				size_t nodeIndex = map.getNodeIndex(id);
+				const OSMNode& nd = nodeList[nodeIndex];
+				vec2 pos = sphereToPlane(dvec2(nd.getLon(), nd.getLat()), m_center);
+				lower = glm::min(lower, pos);
+				upper = glm::max(upper, pos);
+				nodeIndices.push_back(nodeIndex);
+				line.push_back(pos);
+			}
+			if (line.empty()) continue;
+			bounds = vec4(glm::min(vec2(bounds), lower), glm::max(vec2(bounds.z, bounds.w), upper));
+			appendStrip(levels[0], line.size(), [&](size_t i) { return vertex(0, i); });
+
+			for (size_t level = 1; level < m_levels; level++) {
+				// ways that are smaller than the tolerance are not visible
+				prec_t tolerance = getTolerance(level);
+				vec2 extent = upper - lower;
+				if (extent.x < tolerance && extent.y < tolerance) break;
+				kept.clear();
+				simplifyLine(line, tolerance, kept);
+				appendStrip(levels[level], kept.size(), [&](size_t i) { return vertex(level, kept[i]); });
+			}
+		}
+	}
+	m_bounds[section] = bounds;
+}
+
+void traffic::SectionedMesh::updateOverhang(size_t section)
+{
+	// Ways may leave the cell of their first node. The largest overhang
+	// widens the cell range that is visited by findSections.
+	const vec4& bounds = m_bounds[section];
+	if (bounds.x <= bounds.z) {
+		size_t row = section / m_cols, col = section % m_cols;
+		vec2 cellLower(
+			(m_lowerLon + col * m_lonSize) * m_planeScale,
+			m_lowerLat + row * m_latSize);
+		vec2 cellUpper = cellLower + vec2(m_lonSize * m_planeScale, m_latSize);
+		m_overhang = glm::max(m_overhang, glm::max(
+			cellLower - vec2(bounds), vec2(bounds.z, bounds.w) - cellUpper));
+	}
+}
+
+std::vector<size_t> traffic::SectionedMesh::update(const OSMSegment& map, const ChangeReport& report)
+{
+	std::vector<size_t> dirty;
+	for (int64_t wayID : report.affectedWays) {
+		auto it = m_waySection.find(wayID);
+		if (it != m_waySection.end()) {
+			std::vector<int64_t>& ways = m_sectionWays[it->second];
+			ways.erase(std::find(ways.begin(), ways.end(), wayID));
+			dirty.push_back(it->second);
+			m_waySection.erase(it);
+		}
+		if (map.hasWayIndex(wayID)) {
+			size_t section = findSection(map, wayID);
+			m_waySection[wayID] = section;
+			m_sectionWays[section].push_back(wayID);
+			dirty.push_back(section);
+		}
+	}
+
+	std::sort(dirty.begin(), dirty.end());
+	dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+	for (size_t section : dirty) {
+		generateSection(map, section);
+		updateOverhang(section);
+	}
+	return dirty;
+}
+
+size_t traffic::SectionedMesh::countSections() const noexcept { return m_sections.size(); }
+size_t traffic::SectionedMesh::countLevels() const noexcept { return m_levels; }
+
+size_t traffic::SectionedMesh::countVertices(size_t level) const noexcept
+{
+	size_t count = 0;
+	for (const auto& section : m_sections) count += section[level].vertices.size();
+	return count;
+}
+
+const StripMesh& traffic::SectionedMesh::getSection(size_t section, size_t level) const
+{
+	return m_sections[section][level];
+}
+
+vec4 traffic::SectionedMesh::getSectionBounds(size_t section) const { return m_bounds[section]; }
+
+std::vector<size_t> traffic::SectionedMesh::findSections(vec2 lower, vec2 upper) const
+{
+	vec2 l = lower - m_overhang, u = upper + m_overhang;
+	size_t rowL = gridCell(l.y, m_lowerLat, m_latSize, m_rows);
+	size_t rowU = gridCell(u.y, m_lowerLat, m_latSize, m_rows);
+	size_t colL = gridCell(l.x / m_planeScale, m_lowerLon, m_lonSize, m_cols);
+	size_t colU = gridCell(u.x / m_planeScale, m_lowerLon, m_lonSize, m_cols);
+
+	std::vector<size_t> sections;
+	for (size_t row = rowL; row <= rowU; row++) {
+		for (size_t col = colL; col <= colU; col++) {
+			size_t i = row * m_cols + col;
+			const vec4& b = m_bounds[i];
+			if (b.x <= upper.x && b.z >= lower.x && b.y <= upper.y && b.w >= lower.y)
+				sections.push_back(i);
+		}
+	}
+	return sections;
+}
+
+prec_t traffic::SectionedMesh::getTolerance(size_t level) const
+{
+	return level == 0 ? 0.0f : m_tolerance * std::pow(4.0f, static_cast<prec_t>(level - 1));
+}
+
+size_t traffic::SectionedMesh::selectLevel(prec_t pixelSize) const
+{
+	size_t level = 0;
+	while (level + 1 < m_levels && getTolerance(level + 1) <= pixelSize) level++;
+	return level;
+}
+
+StripMesh traffic::SectionedMesh::merge(size_t level) const
+{
+	StripMesh mesh;
+	mesh.vertices.reserve(countVertices(level));
+	for (const auto& section : m_sections)
+		mesh.append(section[level]);
+	return mesh;
+}
+
+vec2 traffic::SectionedMesh::getCenter() const noexcept { return m_center; }
+
+// ---- AgentInstances ---- //
+
+void traffic::AgentInstances::setGraph(const FastGraph& graph, vec2 center)
+{
+	m_graph = &graph;
+	m_nodes.resize(graph.countNodes());
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		const FastGraphNode& node = graph.getNode(i);
+		m_nodes[i] = sphereToPlane(dvec2(node.lon, node.lat), center);
+	}
+}
+
+const FastGraph* traffic::AgentInstances::getGraph() const noexcept { return m_graph; }
+size_t traffic::AgentInstances::countNodes() const noexcept { return m_nodes.size(); }
+
+void traffic::AgentInstances::write(const World& world, AgentInstance* out) const
+{
+	const std::vector<Agent*>& agents = world.getAgents();
+	ConcurrencyManager* manager = world.getManager();
+	forBatches(manager, agents.size(), countBatches(manager, agents.size()),
+		[&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const Agent& agent = *agents[i];
+				RouteHandle edge = agent.getPosition();
+				AgentInstance& instance = out[i];
+				if (!m_graph || agent.getState() != AgentState::Driving ||
+					edge == InvalidRoute || edge >= m_graph->countEdges()) {
+					instance = { vec2(0.0f), 0.0f, -1.0f };
+					continue;
+				}
+
+				vec2 source = m_nodes[m_graph->getEdgeSource(edge)];
+				vec2 direction = m_nodes[m_graph->getEdgeGoal(edge)] - source;
+				float t = static_cast<float>(std::min(
+					agent.getEdgeProgress() / world.getEdgeLength(edge), 1.0));
+				instance.position = source + direction * t;
+				instance.heading = std::atan2(direction.y, direction.x);
+				instance.speed = static_cast<float>(world.getEdgeSpeed(edge));
+			}
+		});
+}
+
+// ---- EdgeHeatmap ---- //
+
+std::vector<vec2> traffic::generateEdgeMesh(const FastGraph& graph, vec2 center)
+{
+	std::vector<vec2> nodes(graph.countNodes());
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const FastGraphNode& node = graph.getNode(i);
+		nodes[i] = sphereToPlane(dvec2(node.lon, node.lat), center);
+	}
+	std::vector<vec2> vertices(graph.countEdges() * 2);
+	for (size_t edge = 0; edge < graph.countEdges(); edge++) {
+		vertices[edge * 2] = nodes[graph.getEdgeSource(edge)];
+		vertices[edge * 2 + 1] = nodes[graph.getEdgeGoal(edge)];
+	}
+	return vertices;
+}
+
+void traffic::EdgeHeatmap::reset(size_t edges)
+{
+	m_values.assign(edges, 0.0f);
+	m_changed.assign(edges, 0);
+	m_ranges.clear();
+	m_changedCount = 0;
+	m_full = true;
+}
+
+const std::vector<std::pair<size_t, size_t>>& traffic::EdgeHeatmap::update(
+	const World& world, HeatmapMetric metric)
+{
+	const EdgeStatistics& stats = world.getEdgeStatistics();
+	double freeFlow = world.getFreeFlowSpeed();
+	size_t edges = std::min(m_values.size(), stats.size());
+	ConcurrencyManager* manager = world.getManager();
+	forBatches(manager, edges, countBatches(manager, edges),
+		[&](size_t, size_t begin, size_t end) {
+			for (size_t edge = begin; edge < end; edge++) {
+				double value = metric == HeatmapMetric::Density ?
+					stats.getOccupancy(edge) * 7.5 / world.getEdgeLength(edge) :
+					1.0 - world.getEdgeSpeed(edge) / freeFlow;
+				float clamped = static_cast<float>(std::clamp(value, 0.0, 1.0));
+				// The stored value is the one on the GPU, small drifts add up
+				bool changed = m_full || std::abs(clamped - m_values[edge]) >= THRESHOLD;
+				if (changed) m_values[edge] = clamped;
+				m_changed[edge] = changed;
+			}
+		});
+
+	m_ranges.clear();
+	m_changedCount = 0;
+	for (size_t edge = 0; edge < edges; edge++) {
+		if (!m_changed[edge]) continue;
+		if (!m_ranges.empty() && edge - m_ranges.back().second <= MERGE_GAP)
+			m_ranges.back().second = edge + 1;
+		else
+			m_ranges.emplace_back(edge, edge + 1);
+	}
+	for (const auto& range : m_ranges)
+		m_changedCount += range.second - range.first;
+	m_full = false;
+	return m_ranges;
+}
+
+const std::vector<float>& traffic::EdgeHeatmap::getValues() const noexcept { return m_values; }
+size_t traffic::EdgeHeatmap::countChanged() const noexcept { return m_changedCount; }
+
 // ---- Shaders ---- //
 const char * lineVert = R"(
 #version 330
@@ -39,6 +39,9 @@ namespace traffic
     class OSMSegment;
     class World;
     class Route;
+    class ConcurrencyManager;
+    class FastGraph;
+    struct ChangeReport;
 
     // ---- Plane to Sphere ---- //
 
@@ -85,12 +88,210 @@ namespace traffic
     glm::dvec2 sphereToPlane(glm::dvec2 latLon);
 
     // ---- Mesh Generation ---- //
-    std::vector<glm::vec2> generateMesh(const OSMSegment& map);
+
+    /// <summary>
+    /// An indexed line mesh that stores every node only once. The index
+    /// buffer describes line strips that are separated by the RESTART
+    /// index and can be drawn as GL_LINE_STRIP with primitive restart.
+    /// </summary>
+    struct StripMesh
+    {
+        static constexpr uint32_t RESTART = 0xFFFFFFFFu;
+
+        std::vector<glm::vec2> vertices;
+        std::vector<uint32_t> indices;
+
+        void clear() noexcept;
+        bool empty() const noexcept;
+        size_t countSegments() const noexcept;
+        /// <summary>Appends another mesh, its strips stay separated</summary>
+        void append(const StripMesh& mesh);
+        /// <summary>Expands the strips to line segments (two vertices per segment)</summary>
+        std::vector<glm::vec2> toLines() const;
+    };
+
+    /// <summary>
+    /// Generates a line mesh with two vertices per segment. The ways are split
+    /// in batches that run on the thread pool if a manager is given. Every
+    /// batch writes into its own range of a single preallocated buffer.
+    /// </summary>
+    std::vector<glm::vec2> generateMesh(const OSMSegment& map,
+        ConcurrencyManager* manager = nullptr);
+    /// <summary>Generates a strip mesh of all ways with one vertex per node.
+    /// The vertices are ordered like the nodes of the map.</summary>
+    StripMesh generateStripMesh(const OSMSegment& map,
+        ConcurrencyManager* manager = nullptr);
     std::vector<glm::vec2> generateChunkMesh(const World& world);
     std::vector<glm::vec2> generateRouteMesh(const Route route, const OSMSegment &map);
 
     void unify(std::vector<glm::vec2> &points);
 
+    /// <summary>
+    /// Simplifies a polyline using the Douglas-Peucker algorithm. Points that
+    /// are closer than the tolerance to the simplified line are removed.
+    /// </summary>
+    /// <param name="line">The polyline in plane coordinates</param>
+    /// <param name="tolerance">The maximum allowed deviation</param>
+    /// <param name="kept">Receives the indices of the remaining points in order</param>
+    void simplifyLine(const std::vector<glm::vec2>& line,
+        prec_t tolerance, std::vector<size_t>& kept);
+
+    /// <summary>
+    /// A line mesh of a map that is split into a grid of sections. Each way
+    /// belongs to the section that contains its first node. The projection
+    /// center is fixed at construction, a change of the map therefore only
+    /// requires the sections of the affected ways to be generated again.
+    /// Every section stores a pyramid of detail levels. Level 0 contains
+    /// all segments, every further level is simplified with a tolerance
+    /// that is four times larger than the one of the previous level.
+    /// Sections are stored as strip meshes, nodes that are shared by
+    /// multiple ways of a section are stored once per level.
+    /// </summary>
+    class SectionedMesh
+    {
+    public:
+        /// <summary>Creates the sections and generates all of them</summary>
+        /// <param name="map">The map that is converted</param>
+        /// <param name="manager">Optional thread pool that generates the sections</param>
+        /// <param name="sectionSize">Minimum side length of a section in degrees</param>
+        /// <param name="levels">The number of detail levels</param>
+        /// <param name="tolerance">Simplification tolerance of level 1 in plane units</param>
+        SectionedMesh(const OSMSegment& map, ConcurrencyManager* manager = nullptr,
+            prec_t sectionSize = 0.01f, size_t levels = 5, prec_t tolerance = 2e-5f);
+
+        /// <summary>Regenerates all sections that contain or contained one
+        /// of the affected ways of the report.</summary>
+        /// <param name="map">The map after the change was applied</param>
+        /// <param name="report">The report returned by OSMSegment::applyChange</param>
+        /// <returns>The indices of the regenerated sections</returns>
+        std::vector<size_t> update(const OSMSegment& map, const ChangeReport& report);
+
+        size_t countSections() const noexcept;
+        size_t countLevels() const noexcept;
+        size_t countVertices(size_t level = 0) const noexcept;
+        const StripMesh& getSection(size_t section, size_t level = 0) const;
+
+        /// <summary>The bounds of a section in plane coordinates given as
+        /// (minX, minY, maxX, maxY). Empty sections have inverted bounds.</summary>
+        glm::vec4 getSectionBounds(size_t section) const;
+
+        /// <summary>Finds all non empty sections that intersect the given
+        /// rectangle in plane coordinates. Only the grid cells that overlap
+        /// the rectangle are visited, the cost does not depend on the total
+        /// number of sections.</summary>
+        std::vector<size_t> findSections(glm::vec2 lower, glm::vec2 upper) const;
+
+        /// <summary>The simplification tolerance of a level in plane units</summary>
+        prec_t getTolerance(size_t level) const;
+
+        /// <summary>Selects the coarsest level whose tolerance does not exceed
+        /// the given size, usually the size of a pixel in plane units</summary>
+        size_t selectLevel(prec_t pixelSize) const;
+
+        /// <summary>Combines all sections to a single line mesh</summary>
+        StripMesh merge(size_t level = 0) const;
+
+        /// <summary>The projection center in (lon, lat) format</summary>
+        glm::vec2 getCenter() const noexcept;
+
+    protected:
+        size_t findSection(const OSMSegment& map, int64_t wayID) const;
+        void generateSection(const OSMSegment& map, size_t section);
+        void updateOverhang(size_t section);
+
+        glm::vec2 m_center;
+        prec_t m_lowerLat, m_lowerLon, m_latSize, m_lonSize;
+        prec_t m_tolerance;
+        // plane x per degree longitude and the maximum distance in plane
+        // units that a section's bounds exceed its grid cell
+        prec_t m_planeScale;
+        glm::vec2 m_overhang = glm::vec2(0.0f);
+        size_t m_rows, m_cols, m_levels;
+
+        // vertices are stored by section and level
+        std::vector<std::vector<StripMesh>> m_sections;
+        std::vector<glm::vec4> m_bounds;
+        std::vector<std::vector<int64_t>> m_sectionWays;
+        robin_hood::unordered_flat_map<int64_t, size_t> m_waySection;
+    };
+
+    // ---- Agents ---- //
+
+    /// <summary>The data of a single agent that is drawn as an instance</summary>
+    struct AgentInstance {
+        glm::vec2 position; // plane coordinates
+        float heading;      // radians, counter clockwise from the x axis
+        float speed;        // meters per second, negative if the agent is not driving
+    };
+
+    /// <summary>
+    /// Converts the agents of a world to instance data. The graph nodes are
+    /// projected once, every agent is interpolated along its current edge.
+    /// </summary>
+    class AgentInstances
+    {
+    public:
+        /// <summary>Projects the nodes of the graph to the plane</summary>
+        /// <param name="graph">The graph the agents drive on</param>
+        /// <param name="center">The projection center in (lon, lat) format</param>
+        void setGraph(const FastGraph& graph, glm::vec2 center);
+        const FastGraph* getGraph() const noexcept;
+        size_t countNodes() const noexcept;
+
+        /// <summary>Writes one instance per agent in the order of World::getAgents.
+        /// The agents are converted in parallel on the thread pool of the world.</summary>
+        /// <param name="out">Receives the instances, must hold all agents</param>
+        void write(const World& world, AgentInstance* out) const;
+
+    protected:
+        const FastGraph* m_graph = nullptr;
+        std::vector<glm::vec2> m_nodes;
+    };
+
+    /// <summary>
+    /// Generates one line segment per graph edge in edge order. The vertices
+    /// 2 * i and 2 * i + 1 belong to the edge i.
+    /// </summary>
+    /// <param name="graph">The graph whose edges are converted</param>
+    /// <param name="center">The projection center in (lon, lat) format</param>
+    std::vector<glm::vec2> generateEdgeMesh(const FastGraph& graph, glm::vec2 center);
+
+    /// <summary>The value that is shown per edge, 0 is free flow and 1 congested</summary>
+    enum class HeatmapMetric { Density, Speed };
+
+    /// <summary>
+    /// The per edge values of a heatmap. Every update recomputes the values and
+    /// compares them against the previous ones. Only the ranges of edges whose
+    /// value changed are reported, which keeps the uploads proportional to
+    /// the number of changed edges.
+    /// </summary>
+    class EdgeHeatmap
+    {
+    public:
+        /// <summary>Changes below this threshold are not reported</summary>
+        static constexpr float THRESHOLD = 1.0f / 256.0f;
+        /// <summary>Ranges that are separated by fewer unchanged edges are merged</summary>
+        static constexpr size_t MERGE_GAP = 16;
+
+        /// <summary>Resets the values, the next update reports every edge</summary>
+        void reset(size_t edges);
+        /// <summary>Recomputes the values on the thread pool of the world</summary>
+        /// <returns>The ranges [begin, end) of edges whose value changed</returns>
+        const std::vector<std::pair<size_t, size_t>>& update(
+            const World& world, HeatmapMetric metric);
+
+        const std::vector<float>& getValues() const noexcept;
+        /// <summary>The number of edges in the ranges of the last update</summary>
+        size_t countChanged() const noexcept;
+
+    protected:
+        std::vector<float> m_values;
+        std::vector<uint8_t> m_changed;
+        std::vector<std::pair<size_t, size_t>> m_ranges;
+        size_t m_changedCount = 0;
+        bool m_full = true;
+    };
+
     // ---- Shaders ---- //
 
     const char * getLineVertex();
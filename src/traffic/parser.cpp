@@ -121,6 +121,12 @@ struct LocalParseInfo
 	int start, stride;
 };
 
+// The element parsers are shared by the map and the change file parser
+static bool readNode(xml_node<char>* singleNode, OSMNode& out);
+static bool readWay(xml_node<char>* singleNode, OSMWay& out);
+static bool readRelation(xml_node<char>* singleNode, OSMRelation& out);
+static bool readTag(xml_node<char>* node, shared_ptr<vector<pair<string, string>>> &tagList);
+
 class ParseTask
 {
 public:
@@ -131,8 +137,6 @@ public:
 	bool parseWay(xml_node<char>* singleNode, int id);
 	bool parseRelation(xml_node<char>* singleNode, int id);
 
-	bool parseTag(xml_node<char>* node, shared_ptr<vector<pair<string, string>>> &tagList);
-
 protected:
 	// Global parse data //
 	ParseInfo* info;
@@ -184,6 +188,13 @@ bool ParseTask::operator()(int id)
 }
 
 bool ParseTask::parseNode(xml_node<char>* singleNode, int pos)
+{ return readNode(singleNode, info->nodeList[pos]); }
+bool ParseTask::parseWay(xml_node<char>* singleNode, int pos)
+{ return readWay(singleNode, info->wayList[pos]); }
+bool ParseTask::parseRelation(xml_node<char>* singleNode, int pos)
+{ return readRelation(singleNode, info->relationList[pos]); }
+
+bool readNode(xml_node<char>* singleNode, OSMNode& out)
 {
 	// Tries parsing the basic node attributes.
 	// The parser must find all of the following attributes to continue parsing.
@@ -225,7 +236,7 @@ bool ParseTask::parseNode(xml_node<char>* singleNode, int pos)
 	{
 		char *tagNodeName = tagNode->name();
 		if (strncmp(tagNodeName, "tag", 3) == 0) {
-			parseTag(tagNode, tags);
+			readTag(tagNode, tags);
 		}
 		else {
 			printf("Unknown tag in node %.*s, skipping tag entry\n",
@@ -238,11 +249,11 @@ bool ParseTask::parseNode(xml_node<char>* singleNode, int pos)
 
 	// Successfully parsed the whole node. The node will be added to the node list.
 	// A reference to the index will be saved inside the dictionary at a later point.
-	info->nodeList[pos] = OSMNode(id, ver, tags, lat, lon);;
+	out = OSMNode(id, ver, tags, lat, lon);
 	return true;
 }
 
-bool ParseTask::parseWay(xml_node<char>* singleNode, int pos)
+bool readWay(xml_node<char>* singleNode, OSMWay& out)
 {
 	// Tries parsing the basic way attributes.
 	// The parser must find all of the following attributes to continue parsing.
@@ -301,7 +312,7 @@ bool ParseTask::parseWay(xml_node<char>* singleNode, int pos)
 		// Tries parsing a tag. A tag needs to have a key and
 		// value defined by 'k' and 'v'.
 		else if (strncmp(wayNodeName, "tag", 3) == 0) {
-			parseTag(wayNode, tags);
+			readTag(wayNode, tags);
 		}
 		// Could not parse the way child node.
 		else {
@@ -314,11 +325,11 @@ bool ParseTask::parseWay(xml_node<char>* singleNode, int pos)
 		vector<pair<string, string>>(*tags).swap(*tags);
 
 	vector<int64_t>(*wayInfo).swap(*wayInfo);
-	info->wayList[pos] = OSMWay(id, ver, move(wayInfo), tags);
+	out = OSMWay(id, ver, move(wayInfo), tags);
 	return true;
 }
 
-bool ParseTask::parseRelation(xml_node<char>* singleNode, int pos)
+bool readRelation(xml_node<char>* singleNode, OSMRelation& out)
 {
 	// Tries parsing the basic attributes.
 			// The parser must find all attributes to continue.
@@ -403,7 +414,7 @@ bool ParseTask::parseRelation(xml_node<char>* singleNode, int pos)
 			}
 		}
 		else if (strncmp(childNodeName, "tag", 3) == 0) {
-			parseTag(childNode, tags);
+			readTag(childNode, tags);
 		}
 		else {
 			printf("Unknown relation tag %.*s\n",
@@ -418,12 +429,12 @@ bool ParseTask::parseRelation(xml_node<char>* singleNode, int pos)
 	if (tags)
 		vector<pair<string, string>>(*tags).swap(*tags);
 
-	info->relationList[pos] = OSMRelation(id, ver,
+	out = OSMRelation(id, ver,
 		tags, nodeRel, wayRel, relationRel);
 	return true;
 }
 
-bool ParseTask::parseTag(xml_node<char>* node,
+bool readTag(xml_node<char>* node,
 	std::shared_ptr<vector<pair<string, string>>>& tagList)
 {
 	xml_attribute<char>* kAtt = node->first_attribute("k");
@@ -536,6 +547,104 @@ OSMSegment traffic::parseXMLMap(const ParseArguments &args)
 	);
 }
 
+/// <summary>Parses all elements of a create or modify block</summary>
+static void readChangeBlock(xml_node<char>* block,
+	vector<OSMNode>& nodes, vector<OSMWay>& ways, vector<OSMRelation>& relations)
+{
+	for (xml_node<char>* element = block->first_node();
+		element; element = element->next_sibling())
+	{
+		char *name = element->name();
+		if (strncmp(name, "node", 4) == 0) {
+			nodes.emplace_back();
+			if (!readNode(element, nodes.back())) nodes.pop_back();
+		}
+		else if (strncmp(name, "way", 3) == 0) {
+			ways.emplace_back();
+			if (!readWay(element, ways.back())) ways.pop_back();
+		}
+		else if (strncmp(name, "relation", 8) == 0) {
+			relations.emplace_back();
+			if (!readRelation(element, relations.back())) relations.pop_back();
+		}
+		else {
+			printf("Unknown change element: %.*s\n",
+				(int)element->name_size(), name);
+		}
+	}
+}
+
+/// <summary>Parses the IDs of all elements of a delete block</summary>
+static void readDeleteBlock(xml_node<char>* block, OSMChange& change)
+{
+	for (xml_node<char>* element = block->first_node();
+		element; element = element->next_sibling())
+	{
+		xml_attribute<char>* idAtt = element->first_attribute("id");
+		if (idAtt == nullptr) {
+			printf("ID attribute is nullptr (skipping deletion)\n");
+			continue;
+		}
+
+		int64_t id;
+		try { id = parse<int64_t>(string(idAtt->value(), idAtt->value_size())); }
+		catch (runtime_error&) {
+			printf("Could not convert deletion ID to integer argument\n");
+			continue;
+		}
+
+		char *name = element->name();
+		if (strncmp(name, "node", 4) == 0) change.deletedNodes.push_back(id);
+		else if (strncmp(name, "way", 3) == 0) change.deletedWays.push_back(id);
+		else if (strncmp(name, "relation", 8) == 0) change.deletedRelations.push_back(id);
+		else {
+			printf("Unknown deletion element: %.*s\n",
+				(int)element->name_size(), name);
+		}
+	}
+}
+
+OSMChange traffic::parseOSMChange(const std::string& file)
+{
+	vector<char> buffer;
+	if (readFile(buffer, file) != 0)
+		throw runtime_error("Could not read file into memory!");
+
+	xml_document<char> doc;
+	try {
+		doc.parse<parse_fastest>(buffer.data());
+	} catch (const parse_error&) {
+		throw runtime_error("Could not parse XML file!");
+	}
+
+	xml_node<char>* root = doc.first_node("osmChange");
+	if (root == nullptr)
+		throw runtime_error("Could not find root node 'osmChange'\n");
+
+	OSMChange change;
+	for (xml_node<char>* block = root->first_node();
+		block; block = block->next_sibling())
+	{
+		char *name = block->name();
+		if (strncmp(name, "create", 6) == 0) {
+			readChangeBlock(block, change.createdNodes,
+				change.createdWays, change.createdRelations);
+		}
+		else if (strncmp(name, "modify", 6) == 0) {
+			readChangeBlock(block, change.modifiedNodes,
+				change.modifiedWays, change.modifiedRelations);
+		}
+		else if (strncmp(name, "delete", 6) == 0) {
+			readDeleteBlock(block, change);
+		}
+		else {
+			printf("Unknown change block: %.*s\n",
+				(int)block->name_size(), name);
+		}
+	}
+	return change;
+}
+
 void traffic::ParseTimings::summary()
 {
 	string f1 = fmt::format("Read file into memory. Took {}ms total {}ms",
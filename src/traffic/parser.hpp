@@ -104,6 +104,14 @@ namespace traffic
 
 	std::vector<unsigned char> writeXOSMMap(const OSMSegment &map, const std::string &file);
 	OSMSegment parseXMLMap(const ParseArguments &args);
+
+	/// <summary>
+	/// Parses an OSM change file (osmChange, .osc). The file consists of create,
+	/// modify and delete blocks. Deleted objects only need to define their ID.
+	/// </summary>
+	/// <param name="file">The path of the change file</param>
+	/// <returns>The parsed change</returns>
+	OSMChange parseOSMChange(const std::string& file);
 } // namespace traffic
 
 #endif
@@ -0,0 +1,433 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "partition.h"
+#include "demand.h"
+
+#include <queue>
+#include <chrono>
+#include <limits>
+#include <cstdio>
+#include <numeric>
+#include <algorithm>
+
+using namespace traffic;
+using namespace std;
+
+// ---- GraphPartition ---- //
+
+void traffic::GraphPartition::evaluate(const FastGraph& graph)
+{
+	nodes.assign(parts, 0);
+	edges.assign(parts, 0);
+	cutEdges = 0;
+	for (size_t i = 0; i < graph.countNodes() && i < nodeParts.size(); i++) {
+		uint32_t part = nodeParts[i];
+		const FastGraphNode& node = graph.getNode(i);
+		nodes[part]++;
+		edges[part] += node.connections.size();
+		for (const FastGraphEdge& edge : node.connections)
+			if (nodeParts[edge.goal] != part) cutEdges++;
+	}
+
+	size_t total = std::accumulate(edges.begin(), edges.end(), size_t(0));
+	size_t largest = edges.empty() ? 0 : *std::max_element(edges.begin(), edges.end());
+	imbalance = total == 0 ? 1.0 : static_cast<double>(largest) * parts / total;
+}
+
+void traffic::GraphPartition::summary(const char* name) const
+{
+	size_t total = std::accumulate(edges.begin(), edges.end(), size_t(0));
+	printf("%s partition: %zu parts, %zu cut edges (%.2f%%), imbalance %.3f\n",
+		name, parts, cutEdges, total == 0 ? 0.0 : 100.0 * cutEdges / total, imbalance);
+	for (size_t p = 0; p < parts; p++)
+		printf("    Part %zu: %zu nodes %zu edges\n", p, nodes[p], edges[p]);
+}
+
+// ---- GraphPartitioner ---- //
+
+traffic::GraphPartitioner::GraphPartitioner(const FastGraph& graph)
+	: m_graph(graph) { }
+
+void traffic::GraphPartitioner::setImbalanceTolerance(double tolerance) noexcept { m_tolerance = tolerance; }
+void traffic::GraphPartitioner::setRefinementPasses(size_t passes) noexcept { m_passes = passes; }
+void traffic::GraphPartitioner::setSeed(uint64_t seed) noexcept { m_seed = seed; }
+
+GraphPartition traffic::GraphPartitioner::partition(size_t parts) const
+{
+	GraphPartition result;
+	result.parts = std::max<size_t>(parts, 1);
+	result.nodeParts.assign(m_graph.countNodes(), 0);
+	if (result.parts == 1 || m_graph.countNodes() == 0) {
+		result.evaluate(m_graph);
+		return result;
+	}
+
+	// (1) Coarsens the graph until it is small enough to be split directly
+	std::vector<Level> levels(1);
+	buildFinestLevel(levels[0]);
+	size_t totalWeight = std::accumulate(levels[0].nodeWeights.begin(),
+		levels[0].nodeWeights.end(), size_t(0));
+	size_t targetNodes = std::max<size_t>(result.parts * 20, 100);
+	// Prevents single coarse nodes from outweighing a partition
+	uint32_t maxNodeWeight = static_cast<uint32_t>(std::max<size_t>(
+		totalWeight / (result.parts * 8), 1));
+	while (levels.back().countNodes() > targetNodes) {
+		Level coarse;
+		if (!coarsen(levels.back(), coarse, maxNodeWeight, m_seed + levels.size()))
+			break;
+		levels.push_back(std::move(coarse));
+	}
+
+	// (2) Splits the coarsest graph
+	std::vector<uint32_t> labels(levels.back().countNodes());
+	initialPartition(levels.back(), result.parts, labels);
+	refine(levels.back(), result.parts, labels, m_seed);
+
+	// (3) Projects the partition back to the finer levels and refines it
+	for (size_t l = levels.size() - 1; l > 0; l--) {
+		const Level& fine = levels[l - 1];
+		std::vector<uint32_t> fineParts(fine.countNodes());
+		for (size_t v = 0; v < fine.countNodes(); v++)
+			fineParts[v] = labels[fine.coarseMap[v]];
+		labels.swap(fineParts);
+		refine(fine, result.parts, labels, m_seed + l);
+	}
+
+	result.nodeParts = std::move(labels);
+	result.evaluate(m_graph);
+	return result;
+}
+
+void traffic::GraphPartitioner::buildAdjacency(Level& level,
+	std::vector<uint64_t>& keys, std::vector<uint32_t>& weights, size_t nodes)
+{
+	// Sorts the (source, goal) keys and merges parallel edges
+	std::vector<size_t> order(keys.size());
+	std::iota(order.begin(), order.end(), size_t(0));
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+	level.offsets.assign(nodes + 1, 0);
+	level.adjacency.clear();
+	level.edgeWeights.clear();
+	for (size_t i = 0; i < order.size(); i++) {
+		uint64_t key = keys[order[i]];
+		if (!level.adjacency.empty() && i > 0 && keys[order[i - 1]] == key) {
+			level.edgeWeights.back() += weights[order[i]];
+			continue;
+		}
+		level.offsets[(key >> 32) + 1]++;
+		level.adjacency.push_back(static_cast<uint32_t>(key & 0xFFFFFFFFull));
+		level.edgeWeights.push_back(weights[order[i]]);
+	}
+	for (size_t v = 0; v < nodes; v++)
+		level.offsets[v + 1] += level.offsets[v];
+}
+
+void traffic::GraphPartitioner::buildFinestLevel(Level& level) const
+{
+	size_t nodes = m_graph.countNodes();
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> weights;
+	keys.reserve(m_graph.countEdges() * 2);
+	weights.reserve(m_graph.countEdges() * 2);
+
+	level.nodeWeights.resize(nodes);
+	for (size_t v = 0; v < nodes; v++) {
+		const FastGraphNode& node = m_graph.getNode(v);
+		// Every edge is simulated by the partition of its source node
+		level.nodeWeights[v] = static_cast<uint32_t>(1 + node.connections.size());
+		for (const FastGraphEdge& edge : node.connections) {
+			if (edge.goal == v) continue;
+			keys.push_back((static_cast<uint64_t>(v) << 32) | edge.goal);
+			keys.push_back((static_cast<uint64_t>(edge.goal) << 32) | v);
+			weights.push_back(1);
+			weights.push_back(1);
+		}
+	}
+	buildAdjacency(level, keys, weights, nodes);
+}
+
+bool traffic::GraphPartitioner::coarsen(Level& fine, Level& coarse,
+	uint32_t maxNodeWeight, uint64_t seed) const
+{
+	size_t nodes = fine.countNodes();
+	std::vector<uint32_t> order(nodes);
+	std::iota(order.begin(), order.end(), 0u);
+	SplitMix64 rng(seed);
+	for (size_t i = nodes; i > 1; i--)
+		std::swap(order[i - 1], order[rng.index(i)]);
+
+	// Heavy edge matching, every node is merged with the unmatched
+	// neighbor it shares the heaviest edge with.
+	const uint32_t unmatched = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> match(nodes, unmatched);
+	fine.coarseMap.assign(nodes, 0);
+	uint32_t coarseNodes = 0;
+	for (uint32_t v : order) {
+		if (match[v] != unmatched) continue;
+		uint32_t best = v;
+		uint32_t bestWeight = 0;
+		for (size_t e = fine.offsets[v]; e < fine.offsets[v + 1]; e++) {
+			uint32_t u = fine.adjacency[e];
+			if (match[u] != unmatched || u == v) continue;
+			if (fine.nodeWeights[v] + fine.nodeWeights[u] > maxNodeWeight) continue;
+			if (fine.edgeWeights[e] > bestWeight || (fine.edgeWeights[e] == bestWeight &&
+				best != v && fine.nodeWeights[u] < fine.nodeWeights[best])) {
+				best = u;
+				bestWeight = fine.edgeWeights[e];
+			}
+		}
+		match[v] = best;
+		match[best] = v;
+		fine.coarseMap[v] = coarseNodes;
+		fine.coarseMap[best] = coarseNodes;
+		coarseNodes++;
+	}
+
+	// Stops if the graph barely shrinks any more
+	if (coarseNodes > nodes * 95 / 100)
+		return false;
+
+	coarse.nodeWeights.assign(coarseNodes, 0);
+	for (size_t v = 0; v < nodes; v++)
+		coarse.nodeWeights[fine.coarseMap[v]] += fine.nodeWeights[v];
+
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> weights;
+	keys.reserve(fine.adjacency.size());
+	weights.reserve(fine.adjacency.size());
+	for (size_t v = 0; v < nodes; v++) {
+		uint64_t cv = fine.coarseMap[v];
+		for (size_t e = fine.offsets[v]; e < fine.offsets[v + 1]; e++) {
+			uint64_t cu = fine.coarseMap[fine.adjacency[e]];
+			if (cu == cv) continue;
+			keys.push_back((cv << 32) | cu);
+			weights.push_back(fine.edgeWeights[e]);
+		}
+	}
+	buildAdjacency(coarse, keys, weights, coarseNodes);
+	return true;
+}
+
+void traffic::GraphPartitioner::initialPartition(const Level& level,
+	size_t parts, std::vector<uint32_t>& nodeParts) const
+{
+	size_t nodes = level.countNodes();
+	const uint32_t unassigned = std::numeric_limits<uint32_t>::max();
+	nodeParts.assign(nodes, unassigned);
+
+	// Chooses seeds that are far apart from each other using breadth first
+	// searches from all previous seeds. Unreachable nodes are the farthest.
+	std::vector<uint32_t> seeds;
+	std::vector<uint32_t> distance(nodes);
+	std::vector<uint32_t> queue;
+	seeds.push_back(0);
+	while (seeds.size() < parts) {
+		std::fill(distance.begin(), distance.end(), unassigned);
+		queue.assign(seeds.begin(), seeds.end());
+		for (uint32_t s : seeds) distance[s] = 0;
+		for (size_t head = 0; head < queue.size(); head++) {
+			uint32_t v = queue[head];
+			for (size_t e = level.offsets[v]; e < level.offsets[v + 1]; e++) {
+				uint32_t u = level.adjacency[e];
+				if (distance[u] == unassigned) {
+					distance[u] = distance[v] + 1;
+					queue.push_back(u);
+				}
+			}
+		}
+		uint32_t farthest = static_cast<uint32_t>(std::max_element(
+			distance.begin(), distance.end()) - distance.begin());
+		if (std::find(seeds.begin(), seeds.end(), farthest) != seeds.end())
+			break; // There are fewer nodes than parts
+		seeds.push_back(farthest);
+	}
+
+	// Grows all regions at the same time, the lightest region takes the
+	// frontier node it is most strongly connected to.
+	using Candidate = std::pair<uint32_t, uint32_t>; // connection, node
+	std::vector<std::priority_queue<Candidate>> frontier(parts);
+	std::vector<size_t> weight(parts, 0);
+	size_t assigned = 0;
+	auto assign = [&](uint32_t v, uint32_t part) {
+		nodeParts[v] = part;
+		weight[part] += level.nodeWeights[v];
+		assigned++;
+		for (size_t e = level.offsets[v]; e < level.offsets[v + 1]; e++)
+			if (nodeParts[level.adjacency[e]] == unassigned)
+				frontier[part].push({ level.edgeWeights[e], level.adjacency[e] });
+	};
+	for (uint32_t p = 0; p < seeds.size(); p++)
+		assign(seeds[p], p);
+
+	size_t nextFree = 0;
+	while (assigned < nodes) {
+		uint32_t part = 0;
+		bool grown = false;
+		// Visits the regions from light to heavy until one can grow
+		std::vector<uint32_t> byWeight(parts);
+		std::iota(byWeight.begin(), byWeight.end(), 0u);
+		std::sort(byWeight.begin(), byWeight.end(), [&](uint32_t a, uint32_t b) {
+			return weight[a] < weight[b];
+		});
+		for (uint32_t p : byWeight) {
+			while (!frontier[p].empty() && nodeParts[frontier[p].top().second] != unassigned)
+				frontier[p].pop();
+			if (!frontier[p].empty()) {
+				uint32_t v = frontier[p].top().second;
+				frontier[p].pop();
+				assign(v, p);
+				grown = true;
+				break;
+			}
+		}
+		if (grown) continue;
+
+		// Starts a new region in a disconnected component
+		while (nodeParts[nextFree] != unassigned) nextFree++;
+		part = byWeight.front();
+		assign(static_cast<uint32_t>(nextFree), part);
+	}
+}
+
+void traffic::GraphPartitioner::refine(const Level& level, size_t parts,
+	std::vector<uint32_t>& nodeParts, uint64_t seed) const
+{
+	size_t nodes = level.countNodes();
+	std::vector<int64_t> weight(parts, 0);
+	for (size_t v = 0; v < nodes; v++)
+		weight[nodeParts[v]] += level.nodeWeights[v];
+	int64_t total = std::accumulate(weight.begin(), weight.end(), int64_t(0));
+	uint32_t heaviest = *std::max_element(level.nodeWeights.begin(), level.nodeWeights.end());
+	// Coarse levels can not be balanced better than their heaviest node
+	int64_t limit = std::max<int64_t>(
+		static_cast<int64_t>(total * (1.0 + m_tolerance) / parts),
+		total / static_cast<int64_t>(parts) + heaviest);
+
+	std::vector<uint32_t> order(nodes);
+	std::iota(order.begin(), order.end(), 0u);
+	SplitMix64 rng(seed ^ 0x5bd1e995ull);
+	std::vector<int64_t> connection(parts, 0);
+	std::vector<uint32_t> touched;
+
+	for (size_t pass = 0; pass < m_passes; pass++) {
+		for (size_t i = nodes; i > 1; i--)
+			std::swap(order[i - 1], order[rng.index(i)]);
+
+		size_t moves = 0;
+		for (uint32_t v : order) {
+			uint32_t source = nodeParts[v];
+			// Sums the edge weights to all adjacent partitions
+			touched.clear();
+			bool boundary = false;
+			for (size_t e = level.offsets[v]; e < level.offsets[v + 1]; e++) {
+				uint32_t p = nodeParts[level.adjacency[e]];
+				if (connection[p] == 0) touched.push_back(p);
+				connection[p] += level.edgeWeights[e];
+				boundary |= p != source;
+			}
+
+			if (boundary) {
+				int64_t internal = connection[source];
+				int64_t nodeWeight = level.nodeWeights[v];
+				uint32_t best = source;
+				int64_t bestGain = std::numeric_limits<int64_t>::min();
+				for (uint32_t p : touched) {
+					if (p == source || weight[p] + nodeWeight > limit) continue;
+					int64_t gain = connection[p] - internal;
+					// Prefers lighter partitions if the gain is equal
+					if (gain > bestGain || (gain == bestGain && weight[p] < weight[best])) {
+						best = p;
+						bestGain = gain;
+					}
+				}
+
+				// Moves that reduce the cut, balance equal cuts or relieve an
+				// overweight partition are accepted
+				bool move = best != source && (bestGain > 0 ||
+					(bestGain == 0 && weight[best] + nodeWeight < weight[source]) ||
+					weight[source] > limit);
+				if (move) {
+					nodeParts[v] = best;
+					weight[source] -= nodeWeight;
+					weight[best] += nodeWeight;
+					moves++;
+				}
+			}
+
+			for (uint32_t p : touched) connection[p] = 0;
+		}
+		if (moves == 0) break;
+	}
+}
+
+GraphPartition traffic::GraphPartitioner::partitionByGrid(const FastGraph& graph,
+	const OSMMap& chunks, size_t parts)
+{
+	GraphPartition result;
+	result.parts = std::max<size_t>(parts, 1);
+	result.nodeParts.assign(graph.countNodes(), 0);
+
+	// Counts the graph nodes in every chunk
+	std::vector<size_t> nodeChunk(graph.countNodes());
+	std::vector<size_t> chunkNodes(chunks.getChunks().size(), 0);
+	for (size_t i = 0; i < graph.countNodes(); i++) {
+		const FastGraphNode& node = graph.getNode(i);
+		nodeChunk[i] = chunks.getSegmentIndex(node.lat, node.lon);
+		if (nodeChunk[i] < chunkNodes.size())
+			chunkNodes[nodeChunk[i]]++;
+	}
+
+	// Cuts the Hilbert order into ranges with the same number of nodes
+	std::vector<uint32_t> chunkParts(chunkNodes.size(), 0);
+	size_t total = graph.countNodes();
+	size_t prefix = 0;
+	for (size_t chunk : chunks.getCurveOrder()) {
+		chunkParts[chunk] = total == 0 ? 0 : static_cast<uint32_t>(std::min(
+			result.parts - 1, prefix * result.parts / total));
+		prefix += chunkNodes[chunk];
+	}
+	for (size_t i = 0; i < graph.countNodes(); i++)
+		if (nodeChunk[i] < chunkParts.size())
+			result.nodeParts[i] = chunkParts[nodeChunk[i]];
+
+	result.evaluate(graph);
+	return result;
+}
+
+void traffic::GraphPartitioner::compare(const FastGraph& graph, const OSMMap& chunks, size_t parts)
+{
+	auto begin = std::chrono::steady_clock::now();
+	GraphPartition multilevel = GraphPartitioner(graph).partition(parts);
+	auto end = std::chrono::steady_clock::now();
+	GraphPartition grid = partitionByGrid(graph, chunks, parts);
+
+	printf("Partitioned %zu nodes in %.3fs\n", graph.countNodes(),
+		std::chrono::duration<double>(end - begin).count());
+	multilevel.summary("Multilevel");
+	grid.summary("Grid");
+}
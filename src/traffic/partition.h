@@ -0,0 +1,114 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "engine.h"
+
+#include <vector>
+#include <cstdint>
+
+#include "osm.h"
+#include "osm_graph.h"
+
+namespace traffic
+{
+	/// <summary>Assignment of every FastGraph node to a partition</summary>
+	struct GraphPartition
+	{
+		size_t parts = 0;
+		std::vector<uint32_t> nodeParts;
+
+		// ---- Statistics, see evaluate ---- //
+		size_t cutEdges = 0;			// Directed edges between two partitions
+		std::vector<size_t> nodes;		// Nodes in each partition
+		std::vector<size_t> edges;		// Outgoing edges of each partition
+		double imbalance = 1.0;			// Maximum divided by mean edge count
+
+		/// <summary>Recomputes the statistics of the partition</summary>
+		void evaluate(const FastGraph& graph);
+		void summary(const char* name) const;
+	};
+
+	/// <summary>
+	/// Multilevel graph partitioner. The road graph is coarsened by heavy
+	/// edge matching until it is small, the coarsest graph is split by greedy
+	/// region growing and the partition is projected back level by level while
+	/// boundary nodes are moved to the partitions they are most connected to.
+	/// Nodes are weighted by their number of outgoing edges, so partitions
+	/// with dense downtown areas cover a smaller region than rural ones.
+	/// </summary>
+	class GraphPartitioner
+	{
+	public:
+		GraphPartitioner(const FastGraph& graph);
+
+		/// <summary>Splits the graph into balanced partitions with few cut edges</summary>
+		GraphPartition partition(size_t parts) const;
+
+		/// <summary>Allowed relative overweight of a partition, default 0.03</summary>
+		void setImbalanceTolerance(double tolerance) noexcept;
+		void setRefinementPasses(size_t passes) noexcept;
+		void setSeed(uint64_t seed) noexcept;
+
+		/// <summary>Splits the graph by assigning contiguous ranges of OSMMap
+		/// chunks along the Hilbert curve with a similar number of nodes</summary>
+		static GraphPartition partitionByGrid(const FastGraph& graph,
+			const OSMMap& chunks, size_t parts);
+
+		/// <summary>Prints the cut size and load of the multilevel and the grid partition</summary>
+		static void compare(const FastGraph& graph, const OSMMap& chunks, size_t parts);
+
+	protected:
+		/// <summary>Undirected graph of a single coarsening level in CSR format</summary>
+		struct Level {
+			std::vector<size_t> offsets;
+			std::vector<uint32_t> adjacency;
+			std::vector<uint32_t> edgeWeights;
+			std::vector<uint32_t> nodeWeights;
+			std::vector<uint32_t> coarseMap; // Node in the next coarser level
+
+			size_t countNodes() const noexcept { return nodeWeights.size(); }
+		};
+
+		void buildFinestLevel(Level& level) const;
+		bool coarsen(Level& fine, Level& coarse, uint32_t maxNodeWeight, uint64_t seed) const;
+		void initialPartition(const Level& level, size_t parts, std::vector<uint32_t>& nodeParts) const;
+		void refine(const Level& level, size_t parts, std::vector<uint32_t>& nodeParts, uint64_t seed) const;
+
+		static void buildAdjacency(Level& level, std::vector<uint64_t>& keys,
+			std::vector<uint32_t>& weights, size_t nodes);
+
+		const FastGraph& m_graph;
+		double m_tolerance = 0.03;
+		size_t m_passes = 8;
+		uint64_t m_seed = 1;
+	};
+}
+
+#endif
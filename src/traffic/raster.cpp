@@ -0,0 +1,510 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+
+#include "raster.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "agent.h"
+#include "demand.h"
+
+using namespace traffic;
+using namespace glm;
+
+// ---- Layer ---- //
+
+void FrameRaster::Layer::clear(size_t tiles)
+{
+	segments.clear();
+	dots.clear();
+	segmentBins.resize(tiles);
+	dotBins.resize(tiles);
+	for (auto& bin : segmentBins) bin.clear();
+	for (auto& bin : dotBins) bin.clear();
+}
+
+// ---- FrameRaster ---- //
+
+FrameRaster::FrameRaster(size_t width, size_t height,
+	const RenderParams& params, ConcurrencyManager* manager)
+	: m_width(width), m_height(height),
+	m_tilesX((width + TILE_SIZE - 1) / TILE_SIZE),
+	m_tilesY((height + TILE_SIZE - 1) / TILE_SIZE),
+	m_params(params), m_manager(manager)
+{
+	if (width == 0 || height == 0)
+		throw std::runtime_error("The raster must not be empty");
+	m_static.clear(m_tilesX * m_tilesY);
+	m_overlay.clear(m_tilesX * m_tilesY);
+	m_base.resize(width * height * 3);
+	m_frame.resize(width * height * 3);
+}
+
+void FrameRaster::setLineStyle(LineStyle style) noexcept
+{
+	m_style = style;
+	m_staticDirty = true;
+}
+
+void FrameRaster::setBackground(RasterColor color) noexcept
+{
+	m_background = color;
+	m_staticDirty = true;
+}
+
+vec2 FrameRaster::toPixel(prec_t lat, prec_t lon) const noexcept
+{
+	// the latitude grows to the top of the image
+	return vec2(
+		static_cast<float>((lon - m_params.lowerLon) * m_params.ratioLon),
+		static_cast<float>(m_height) - 1.0f -
+			static_cast<float>((lat - m_params.lowerLat) * m_params.ratioLat));
+}
+
+void FrameRaster::addMap(const OSMSegment& map, RasterColor color)
+{
+	if (!map.hasNodes()) return;
+	for (const OSMWay& way : *map.getWays())
+		addNodeList(map, way.getNodes(), color, m_static);
+	m_staticDirty = true;
+}
+
+void FrameRaster::clearMap()
+{
+	m_static.clear(m_tilesX * m_tilesY);
+	m_staticDirty = true;
+}
+
+void FrameRaster::addRoute(const OSMSegment& map, const Route& route, RasterColor color)
+{
+	addNodeList(map, route.nodes, color, m_overlay);
+}
+
+void FrameRaster::addAgents(const World& world, float radius)
+{
+	const auto& graph = world.getGraph();
+	if (!graph || !graph->getFastGraph()) return;
+	const FastGraph& fastGraph = *graph->getFastGraph();
+	double freeFlow = world.getFreeFlowSpeed();
+
+	for (const Agent* agent : world.getAgents()) {
+		RouteHandle edge = agent->getPosition();
+		if (agent->getState() != AgentState::Driving ||
+			edge == InvalidRoute || edge >= fastGraph.countEdges())
+			continue;
+
+		const FastGraphNode& source = fastGraph.getNode(fastGraph.getEdgeSource(edge));
+		const FastGraphNode& goal = fastGraph.getNode(fastGraph.getEdgeGoal(edge));
+		prec_t t = static_cast<prec_t>(std::min(
+			agent->getEdgeProgress() / world.getEdgeLength(edge), 1.0));
+		vec2 position = toPixel(
+			source.lat + (goal.lat - source.lat) * t,
+			source.lon + (goal.lon - source.lon) * t);
+
+		// red for standing traffic, yellow to green up to the free flow speed
+		float speed = static_cast<float>(std::clamp(world.getEdgeSpeed(edge) / freeFlow, 0.0, 1.0));
+		vec3 color = speed < 0.5f ?
+			mix(vec3(255.0f, 0.0f, 0.0f), vec3(255.0f, 255.0f, 0.0f), speed * 2.0f) :
+			mix(vec3(255.0f, 255.0f, 0.0f), vec3(0.0f, 255.0f, 0.0f), speed * 2.0f - 1.0f);
+		addDot(position, radius, { static_cast<uint8_t>(color.r),
+			static_cast<uint8_t>(color.g), static_cast<uint8_t>(color.b) }, m_overlay);
+	}
+}
+
+void FrameRaster::clearOverlay() { m_overlay.clear(m_tilesX * m_tilesY); }
+
+void FrameRaster::addNodeList(const OSMSegment& map, const std::vector<int64_t>& nds,
+	RasterColor color, Layer& layer)
+{
+	const std::vector<OSMNode>& nodes = *map.getNodes();
+	size_t last = std::numeric_limits<size_t>::max();
+	for (int64_t id : nds) {
+		size_t current = map.getNodeIndex(id);
+		if (current == std::numeric_limits<size_t>::max()) continue;
+		if (last != std::numeric_limits<size_t>::max()) {
+			addSegment(
+				toPixel(nodes[last].getLat(), nodes[last].getLon()),
+				toPixel(nodes[current].getLat(), nodes[current].getLon()),
+				color, layer);
+		}
+		last = current;
+	}
+}
+
+void FrameRaster::addSegment(vec2 a, vec2 b, RasterColor color, Layer& layer)
+{
+	// The antialiased lines reach one pixel beyond their end points
+	vec2 lower = min(a, b) - 1.0f, upper = max(a, b) + 1.0f;
+	if (upper.x < 0.0f || upper.y < 0.0f ||
+		lower.x >= static_cast<float>(m_width) || lower.y >= static_cast<float>(m_height))
+		return;
+
+	float tile = static_cast<float>(TILE_SIZE);
+	size_t tx0 = static_cast<size_t>(std::max(lower.x, 0.0f) / tile);
+	size_t ty0 = static_cast<size_t>(std::max(lower.y, 0.0f) / tile);
+	size_t tx1 = std::min(static_cast<size_t>(upper.x / tile), m_tilesX - 1);
+	size_t ty1 = std::min(static_cast<size_t>(upper.y / tile), m_tilesY - 1);
+
+	uint32_t index = static_cast<uint32_t>(layer.segments.size());
+	layer.segments.push_back({ a, b, color });
+	vec2 normal(a.y - b.y, b.x - a.x);
+	float half = tile * 0.5f + 1.5f;
+	for (size_t ty = ty0; ty <= ty1; ty++) {
+		for (size_t tx = tx0; tx <= tx1; tx++) {
+			// Skips tiles that lie completely on one side of the line
+			vec2 center = vec2(tx + 0.5f, ty + 0.5f) * tile - 0.5f;
+			float distance = dot(center - a, normal);
+			float extent = (std::abs(normal.x) + std::abs(normal.y)) * half;
+			if (std::abs(distance) > extent) continue;
+			layer.segmentBins[ty * m_tilesX + tx].push_back(index);
+		}
+	}
+}
+
+void FrameRaster::addDot(vec2 position, float radius, RasterColor color, Layer& layer)
+{
+	vec2 lower = position - radius - 1.0f, upper = position + radius + 1.0f;
+	if (upper.x < 0.0f || upper.y < 0.0f ||
+		lower.x >= static_cast<float>(m_width) || lower.y >= static_cast<float>(m_height))
+		return;
+
+	float tile = static_cast<float>(TILE_SIZE);
+	size_t tx0 = static_cast<size_t>(std::max(lower.x, 0.0f) / tile);
+	size_t ty0 = static_cast<size_t>(std::max(lower.y, 0.0f) / tile);
+	size_t tx1 = std::min(static_cast<size_t>(upper.x / tile), m_tilesX - 1);
+	size_t ty1 = std::min(static_cast<size_t>(upper.y / tile), m_tilesY - 1);
+
+	uint32_t index = static_cast<uint32_t>(layer.dots.size());
+	layer.dots.push_back({ position, radius, color });
+	for (size_t ty = ty0; ty <= ty1; ty++)
+		for (size_t tx = tx0; tx <= tx1; tx++)
+			layer.dotBins[ty * m_tilesX + tx].push_back(index);
+}
+
+void FrameRaster::forTiles(const std::function<void(size_t)>& func)
+{
+	size_t tiles = m_tilesX * m_tilesY;
+	if (!m_manager) {
+		for (size_t tile = 0; tile < tiles; tile++) func(tile);
+		return;
+	}
+	// Tiles own their pixels, no synchronization is needed
+	m_manager->parallelFor(tiles, 8, [&func](int, size_t begin, size_t end) {
+		for (size_t tile = begin; tile < end; tile++) func(tile);
+	});
+}
+
+void FrameRaster::render()
+{
+	if (m_staticDirty) {
+		forTiles([this](size_t tile) {
+			size_t x0 = (tile % m_tilesX) * TILE_SIZE, y0 = (tile / m_tilesX) * TILE_SIZE;
+			size_t x1 = std::min(x0 + TILE_SIZE, m_width), y1 = std::min(y0 + TILE_SIZE, m_height);
+			for (size_t y = y0; y < y1; y++) {
+				for (size_t x = x0; x < x1; x++) {
+					uint8_t* pixel = &m_base[(y * m_width + x) * 3];
+					pixel[0] = m_background.r;
+					pixel[1] = m_background.g;
+					pixel[2] = m_background.b;
+				}
+			}
+			drawTile(tile, m_static, m_base);
+		});
+		m_staticDirty = false;
+	}
+
+	forTiles([this](size_t tile) {
+		size_t x0 = (tile % m_tilesX) * TILE_SIZE, y0 = (tile / m_tilesX) * TILE_SIZE;
+		size_t x1 = std::min(x0 + TILE_SIZE, m_width), y1 = std::min(y0 + TILE_SIZE, m_height);
+		for (size_t y = y0; y < y1; y++) {
+			size_t offset = (y * m_width + x0) * 3;
+			std::copy(m_base.begin() + offset, m_base.begin() + offset + (x1 - x0) * 3,
+				m_frame.begin() + offset);
+		}
+		drawTile(tile, m_overlay, m_frame);
+	});
+}
+
+void FrameRaster::drawTile(size_t tile, const Layer& layer, std::vector<uint8_t>& pixels) const
+{
+	int x0 = static_cast<int>((tile % m_tilesX) * TILE_SIZE);
+	int y0 = static_cast<int>((tile / m_tilesX) * TILE_SIZE);
+	int x1 = std::min(x0 + static_cast<int>(TILE_SIZE), static_cast<int>(m_width));
+	int y1 = std::min(y0 + static_cast<int>(TILE_SIZE), static_cast<int>(m_height));
+	for (uint32_t index : layer.segmentBins[tile])
+		drawSegment(layer.segments[index], x0, y0, x1, y1, pixels);
+	for (uint32_t index : layer.dotBins[tile])
+		drawDot(layer.dots[index], x0, y0, x1, y1, pixels);
+}
+
+/// <summary>Blends a color into the pixel with the given coverage</summary>
+static void blend(uint8_t* pixel, RasterColor color, float alpha)
+{
+	pixel[0] = static_cast<uint8_t>(pixel[0] + (color.r - pixel[0]) * alpha + 0.5f);
+	pixel[1] = static_cast<uint8_t>(pixel[1] + (color.g - pixel[1]) * alpha + 0.5f);
+	pixel[2] = static_cast<uint8_t>(pixel[2] + (color.b - pixel[2]) * alpha + 0.5f);
+}
+
+void FrameRaster::drawSegment(const Segment& segment, int x0, int y0, int x1, int y1,
+	std::vector<uint8_t>& pixels) const
+{
+	// Steep lines are drawn along the y axis by swapping both coordinates
+	vec2 a = segment.a, b = segment.b;
+	bool steep = std::abs(b.y - a.y) > std::abs(b.x - a.x);
+	if (steep) {
+		std::swap(a.x, a.y);
+		std::swap(b.x, b.y);
+		std::swap(x0, y0);
+		std::swap(x1, y1);
+	}
+	if (a.x > b.x) std::swap(a, b);
+
+	auto plot = [&](int u, int v, float alpha) {
+		if (v < y0 || v >= y1 || alpha <= 0.0f) return;
+		size_t x = steep ? v : u, y = steep ? u : v;
+		blend(&pixels[(y * m_width + x) * 3], segment.color, alpha);
+	};
+
+	// Every column is computed from the end points only, the columns of
+	// a line are the same no matter which tile draws them
+	float gradient = b.x == a.x ? 0.0f : (b.y - a.y) / (b.x - a.x);
+	int begin = std::max(static_cast<int>(std::lround(a.x)), x0);
+	int end = std::min(static_cast<int>(std::lround(b.x)), x1 - 1);
+	for (int x = begin; x <= end; x++) {
+		float y = a.y + (x - a.x) * gradient;
+		if (m_style == LineStyle::Aliased) {
+			plot(x, static_cast<int>(std::floor(y + 0.5f)), 1.0f);
+		}
+		else {
+			float floor = std::floor(y);
+			plot(x, static_cast<int>(floor), 1.0f - (y - floor));
+			plot(x, static_cast<int>(floor) + 1, y - floor);
+		}
+	}
+}
+
+void FrameRaster::drawDot(const Dot& dot, int x0, int y0, int x1, int y1,
+	std::vector<uint8_t>& pixels) const
+{
+	int bx0 = std::max(x0, static_cast<int>(std::floor(dot.position.x - dot.radius - 1.0f)));
+	int by0 = std::max(y0, static_cast<int>(std::floor(dot.position.y - dot.radius - 1.0f)));
+	int bx1 = std::min(x1 - 1, static_cast<int>(std::ceil(dot.position.x + dot.radius + 1.0f)));
+	int by1 = std::min(y1 - 1, static_cast<int>(std::ceil(dot.position.y + dot.radius + 1.0f)));
+	for (int y = by0; y <= by1; y++) {
+		for (int x = bx0; x <= bx1; x++) {
+			float distance = glm::distance(vec2(x, y), dot.position);
+			float alpha = m_style == LineStyle::Aliased ?
+				(distance <= dot.radius ? 1.0f : 0.0f) :
+				std::clamp(dot.radius + 0.5f - distance, 0.0f, 1.0f);
+			if (alpha > 0.0f)
+				blend(&pixels[(y * m_width + x) * 3], dot.color, alpha);
+		}
+	}
+}
+
+size_t FrameRaster::getWidth() const noexcept { return m_width; }
+size_t FrameRaster::getHeight() const noexcept { return m_height; }
+const std::vector<uint8_t>& FrameRaster::getPixels() const noexcept { return m_frame; }
+
+// ---- Output ---- //
+
+void FrameRaster::writePPM(std::ostream& stream) const
+{
+	stream << "P6\n" << m_width << " " << m_height << "\n255\n";
+	stream.write(reinterpret_cast<const char*>(m_frame.data()), m_frame.size());
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc)
+{
+	static const std::vector<uint32_t> table = []() {
+		std::vector<uint32_t> values(256);
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			values[i] = c;
+		}
+		return values;
+	}();
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void putBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+	out.push_back(static_cast<uint8_t>(value >> 24));
+	out.push_back(static_cast<uint8_t>(value >> 16));
+	out.push_back(static_cast<uint8_t>(value >> 8));
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+static void writeChunk(std::ostream& stream, const char* type, const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> chunk;
+	chunk.reserve(data.size() + 12);
+	putBigEndian(chunk, static_cast<uint32_t>(data.size()));
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	// the checksum covers the type and the data
+	putBigEndian(chunk, crc32(chunk.data() + 4, data.size() + 4, 0));
+	stream.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+void FrameRaster::writePNG(std::ostream& stream) const
+{
+	static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	stream.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+	std::vector<uint8_t> header;
+	putBigEndian(header, static_cast<uint32_t>(m_width));
+	putBigEndian(header, static_cast<uint32_t>(m_height));
+	header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bit RGB
+	writeChunk(stream, "IHDR", header);
+
+	// Every row starts with filter type 0, the rows are stored in
+	// uncompressed deflate blocks of at most 65535 bytes
+	size_t rowSize = m_width * 3 + 1;
+	std::vector<uint8_t> raw(rowSize * m_height);
+	for (size_t y = 0; y < m_height; y++) {
+		raw[y * rowSize] = 0;
+		std::copy(m_frame.begin() + y * m_width * 3, m_frame.begin() + (y + 1) * m_width * 3,
+			raw.begin() + y * rowSize + 1);
+	}
+	std::vector<uint8_t> data = { 0x78, 0x01 };
+	data.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	for (size_t offset = 0; offset < raw.size() || offset == 0; offset += 65535) {
+		uint16_t size = static_cast<uint16_t>(std::min<size_t>(raw.size() - offset, 65535));
+		data.push_back(offset + size >= raw.size() ? 1 : 0);
+		data.insert(data.end(), { static_cast<uint8_t>(size), static_cast<uint8_t>(size >> 8),
+			static_cast<uint8_t>(~size), static_cast<uint8_t>(~size >> 8) });
+		data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+	}
+	uint32_t s1 = 1, s2 = 0;
+	for (uint8_t value : raw) {
+		s1 = (s1 + value) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+	putBigEndian(data, (s2 << 16) | s1);
+	writeChunk(stream, "IDAT", data);
+	writeChunk(stream, "IEND", {});
+}
+
+void FrameRaster::save(const std::string& file) const
+{
+	std::ofstream stream(file, std::ios::binary);
+	if (!stream) throw std::runtime_error("Could not open file " + file);
+	bool ppm = file.size() >= 4 && file.compare(file.size() - 4, 4, ".ppm") == 0;
+	if (ppm) writePPM(stream);
+	else writePNG(stream);
+}
+
+// ---- Headless rendering ---- //
+
+/// <summary>Checks that the pattern contains exactly one integer
+/// conversion with an optional zero flag and width, like %05d</summary>
+static bool isFramePattern(const std::string& pattern)
+{
+	size_t conversions = 0;
+	for (size_t i = 0; i < pattern.size(); i++) {
+		if (pattern[i] != '%') continue;
+		if (++i < pattern.size() && pattern[i] == '%') continue;
+		if (i < pattern.size() && pattern[i] == '0') i++;
+		size_t digits = 0;
+		for (; i < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[i])); i++)
+			digits++;
+		if (digits > 2 || i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i'))
+			return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+double traffic::renderHeadless(const HeadlessOptions& options, ConcurrencyManager* manager)
+{
+	// The pattern is used as a format string
+	if (!options.benchmark && !isFramePattern(options.output))
+		throw std::runtime_error("The output pattern needs exactly one integer conversion like %05d: "
+			+ options.output);
+
+	World world(manager);
+	world.loadMap(options.map);
+	if (!world.hasMap() || !world.getGraph() || !world.getGraph()->getFastGraph())
+		throw std::runtime_error("Could not load map " + options.map);
+
+	// The whole map is fitted into the image without distortion
+	Rect box = world.getMap()->getBoundingBox();
+	double mapAspect = box.lonDistance() / box.latDistance();
+	double imageAspect = static_cast<double>(options.width) / options.height;
+	RenderParams params(box, mapAspect > imageAspect ? FIT_WIDTH : FIT_HEIGHT,
+		options.width, options.height);
+
+	FrameRaster raster(options.width, options.height, params, manager);
+	raster.addMap(*world.getMap(), { 90, 90, 90 });
+	if (world.getHighwayMap())
+		raster.addMap(*world.getHighwayMap(), { 200, 200, 200 });
+
+	const FastGraph& graph = *world.getGraph()->getFastGraph();
+	SplitMix64 random(options.seed);
+	for (size_t i = 0; i < options.agents && graph.countNodes() > 1; i++) {
+		world.spawnAgent(
+			graph.getNode(random.index(graph.countNodes())).nodeID,
+			graph.getNode(random.index(graph.countNodes())).nodeID);
+	}
+
+	// The static layer is drawn before the measurement starts
+	raster.render();
+	double renderTime = 0.0;
+	std::vector<char> name(options.output.size() + 128);
+	for (size_t frame = 0; frame < options.frames; frame++) {
+		world.update(options.timeStep);
+		raster.clearOverlay();
+		raster.addAgents(world, std::max(1.5f, options.width / 1280.0f));
+
+		auto begin = std::chrono::steady_clock::now();
+		raster.render();
+		renderTime += std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - begin).count();
+
+		if (!options.benchmark) {
+			std::snprintf(name.data(), name.size(), options.output.c_str(), static_cast<int>(frame));
+			raster.save(name.data());
+		}
+	}
+
+	double fps = renderTime > 0.0 ? options.frames / renderTime : 0.0;
+	printf("Rendered %zu frames at %zux%zu with %zu agents: %.1f frames/s\n",
+		options.frames, options.width, options.height, world.getAgents().size(), fps);
+	return fps;
+}
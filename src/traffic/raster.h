@@ -0,0 +1,179 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef TRAFFIC_RASTER_H
+#define TRAFFIC_RASTER_H
+
+#include "engine.h"
+
+#include <vector>
+#include <functional>
+#include <string>
+#include <cstdint>
+#include <ostream>
+#include <glm/glm.hpp>
+
+#include "render.hpp"
+
+namespace traffic
+{
+	class World;
+	class ConcurrencyManager;
+
+	/// <summary>The way lines are rasterized by the FrameRaster</summary>
+	enum class LineStyle {
+		Aliased,	// one pixel per column (Bresenham style)
+		Antialiased	// two blended pixels per column (Xiaolin Wu style)
+	};
+
+	struct RasterColor {
+		uint8_t r, g, b;
+	};
+
+	/// <summary>
+	/// Renders map, route and agent layers on the CPU without a display or an OpenGL
+	/// context. The image is split into square tiles that are drawn in parallel. Every
+	/// line is binned into the tiles it crosses and a tile only rasterizes the columns
+	/// of a line that lie inside it, which gives the same result for any tile size.
+	/// The static map layer is drawn once, every frame starts from a copy of it.
+	/// </summary>
+	class FrameRaster
+	{
+	public:
+		/// <summary>The edge length of a tile in pixels</summary>
+		static constexpr size_t TILE_SIZE = 64;
+
+		/// <summary>Creates a raster of the given size</summary>
+		/// <param name="params">Maps latitude and longitude to pixels</param>
+		/// <param name="manager">The thread pool that draws the tiles, may be nullptr</param>
+		FrameRaster(size_t width, size_t height, const RenderParams& params,
+			ConcurrencyManager* manager = nullptr);
+
+		void setLineStyle(LineStyle style) noexcept;
+		void setBackground(RasterColor color) noexcept;
+
+		// ---- Static layer ---- //
+
+		/// <summary>Adds all ways of the map to the static layer</summary>
+		void addMap(const OSMSegment& map, RasterColor color);
+		void clearMap();
+
+		// ---- Overlay, cleared every frame ---- //
+
+		void addRoute(const OSMSegment& map, const Route& route, RasterColor color);
+		/// <summary>Adds a dot for every driving agent that is colored from red
+		/// (standing) to green (free flow speed)</summary>
+		/// <param name="radius">The radius of a dot in pixels</param>
+		void addAgents(const World& world, float radius);
+		void clearOverlay();
+
+		/// <summary>Draws the current frame, the static layer is only drawn again
+		/// if it changed</summary>
+		void render();
+
+		// ---- Output ---- //
+
+		size_t getWidth() const noexcept;
+		size_t getHeight() const noexcept;
+		/// <summary>The RGB pixels of the last frame, the top row comes first</summary>
+		const std::vector<uint8_t>& getPixels() const noexcept;
+
+		/// <summary>Writes a binary PPM image, frames can be concatenated to a stream</summary>
+		void writePPM(std::ostream& stream) const;
+		/// <summary>Writes an uncompressed PNG image</summary>
+		void writePNG(std::ostream& stream) const;
+		/// <summary>Saves the frame, the format is chosen by the extension (.png or .ppm)</summary>
+		void save(const std::string& file) const;
+
+	protected:
+		struct Segment {
+			glm::vec2 a, b;
+			RasterColor color;
+		};
+		struct Dot {
+			glm::vec2 position;
+			float radius;
+			RasterColor color;
+		};
+		/// <summary>Primitives and the indices of the primitives per tile</summary>
+		struct Layer {
+			std::vector<Segment> segments;
+			std::vector<Dot> dots;
+			std::vector<std::vector<uint32_t>> segmentBins, dotBins;
+
+			void clear(size_t tiles);
+		};
+
+		glm::vec2 toPixel(prec_t lat, prec_t lon) const noexcept;
+		void addNodeList(const OSMSegment& map, const std::vector<int64_t>& nds,
+			RasterColor color, Layer& layer);
+		void addSegment(glm::vec2 a, glm::vec2 b, RasterColor color, Layer& layer);
+		void addDot(glm::vec2 position, float radius, RasterColor color, Layer& layer);
+
+		void forTiles(const std::function<void(size_t)>& func);
+		void drawTile(size_t tile, const Layer& layer, std::vector<uint8_t>& pixels) const;
+		void drawSegment(const Segment& segment, int x0, int y0, int x1, int y1,
+			std::vector<uint8_t>& pixels) const;
+		void drawDot(const Dot& dot, int x0, int y0, int x1, int y1,
+			std::vector<uint8_t>& pixels) const;
+
+		size_t m_width, m_height;
+		size_t m_tilesX, m_tilesY;
+		RenderParams m_params;
+		ConcurrencyManager* m_manager;
+		LineStyle m_style = LineStyle::Antialiased;
+		RasterColor m_background = { 40, 40, 40 };
+
+		Layer m_static, m_overlay;
+		bool m_staticDirty = true;
+		std::vector<uint8_t> m_base, m_frame;
+	};
+
+	/// <summary>Settings of a headless rendering run</summary>
+	struct HeadlessOptions {
+		std::string map;
+		/// <summary>The pattern of the frame files, e.g. frames/%05d.png. It must contain
+		/// exactly one integer conversion, literal percent signs are written as %%.</summary>
+		std::string output = "frame_%05d.png";
+		size_t width = 1920, height = 1080;
+		size_t frames = 100;
+		size_t agents = 0;
+		double timeStep = 1.0;
+		uint64_t seed = 1;
+		/// <summary>Only measures the frames per second, no files are written</summary>
+		bool benchmark = false;
+	};
+
+	/// <summary>
+	/// Loads a map, spawns agents between random nodes and renders one frame per
+	/// simulation step. Reports the frames per second of the rasterizer.
+	/// </summary>
+	/// <returns>The measured frames per second</returns>
+	double renderHeadless(const HeadlessOptions& options, ConcurrencyManager* manager);
+}
+
+#endif
@@ -0,0 +1,276 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "route_cache.h"
+
+#include <mutex>
+#include <cstdio>
+
+using namespace traffic;
+using namespace std;
+
+// ---- RouteCacheStats ---- //
+
+double traffic::RouteCacheStats::hitRate() const
+{
+	size_t total = hits + misses;
+	return total == 0 ? 0.0 : static_cast<double>(hits) / total;
+}
+
+void traffic::RouteCacheStats::summary() const
+{
+	printf("RouteCache: %zu hits %zu misses (%.1f%% hit rate) %zu evictions\n",
+		hits, misses, hitRate() * 100.0, evictions);
+	printf("RouteCache: %zu routes %zu references %zu trie nodes, %zu bytes instead of %zu bytes (%zu saved)\n",
+		cachedRoutes, liveReferences, trieNodes, trieBytes, naiveBytes,
+		naiveBytes > trieBytes ? naiveBytes - trieBytes : 0);
+}
+
+// ---- RouteCache ---- //
+
+bool traffic::RouteCache::RouteKey::operator==(const RouteKey& other) const noexcept
+{
+	return start == other.start && goal == other.goal && version == other.version;
+}
+
+size_t traffic::RouteCache::RouteKeyHash::operator()(const RouteKey& key) const noexcept
+{
+	size_t hash = robin_hood::hash_int(key.start);
+	hash ^= robin_hood::hash_int(key.goal) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+	hash ^= robin_hood::hash_int(key.version) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+	return hash;
+}
+
+traffic::RouteCache::RouteCache(FastGraph* graph, size_t capacity)
+	: m_graph(graph), m_capacity(capacity) { }
+
+RouteHandle traffic::RouteCache::findRoute(size_t start, size_t goal, const RoutingBuffers& buffers)
+{
+	RouteKey key{ start, goal, m_graph->getWeightVersion() };
+	{
+		std::lock_guard<AtomicLock> guard(m_lock);
+		auto it = m_entries.find(key);
+		if (it != m_entries.end()) {
+			// Moves the entry to the front of the LRU list
+			m_lru.splice(m_lru.begin(), m_lru, it->second.lruIt);
+			m_hits++;
+			RouteHandle handle = it->second.handle;
+			if (handle != InvalidRoute)
+				acquireUnlocked(handle);
+			return handle;
+		}
+	}
+
+	// The search is done without holding the lock. Multiple threads may
+	// compute the same route, only the first result is inserted.
+	std::vector<size_t> edges;
+	bool found = m_graph->findEdgePath(start, goal, edges, buffers);
+
+	std::lock_guard<AtomicLock> guard(m_lock);
+	m_misses++;
+	auto it = m_entries.find(key);
+	if (it == m_entries.end()) {
+		if (m_entries.size() >= m_capacity)
+			evictUnlocked();
+		// Unreachable goals are cached as well to avoid repeated searches
+		RouteHandle handle = found ? insertPath(goal, edges) : InvalidRoute;
+		m_lru.push_front(key);
+		it = m_entries.insert({ key, CacheEntry{ handle, m_lru.begin() } }).first;
+	}
+
+	RouteHandle handle = it->second.handle;
+	if (handle != InvalidRoute)
+		acquireUnlocked(handle);
+	return handle;
+}
+
+RouteHandle traffic::RouteCache::insertPath(size_t goal, const std::vector<size_t>& edges)
+{
+	RouteHandle current;
+	auto rootIt = m_roots.find(goal);
+	if (rootIt == m_roots.end()) {
+		current = createNode(InvalidRoute, 0, goal);
+		m_roots[goal] = current;
+	}
+	else {
+		current = rootIt->second;
+	}
+
+	// Walks the path backwards from the target, shared suffixes are reused
+	for (size_t i = edges.size(); i > 0; i--) {
+		size_t edge = edges[i - 1];
+		uint64_t childKey = (static_cast<uint64_t>(current) << 32) | static_cast<uint32_t>(edge);
+		auto childIt = m_children.find(childKey);
+		if (childIt == m_children.end()) {
+			RouteHandle child = createNode(current, m_nodes[current].depth + 1, edge);
+			m_nodes[current].refCount++;
+			m_children[childKey] = child;
+			current = child;
+		}
+		else {
+			current = childIt->second;
+		}
+	}
+
+	// The reference of the cache entry
+	acquireUnlocked(current);
+	return current;
+}
+
+RouteHandle traffic::RouteCache::createNode(RouteHandle parent, uint32_t depth, size_t edge)
+{
+	RouteHandle handle;
+	if (m_freeNodes.empty()) {
+		handle = static_cast<RouteHandle>(m_nodes.size());
+		m_nodes.push_back(TrieNode());
+	}
+	else {
+		handle = m_freeNodes.back();
+		m_freeNodes.pop_back();
+	}
+	m_nodes[handle] = TrieNode{ parent, 0, depth, edge };
+	return handle;
+}
+
+void traffic::RouteCache::acquire(RouteHandle handle)
+{
+	if (handle == InvalidRoute) return;
+	std::lock_guard<AtomicLock> guard(m_lock);
+	acquireUnlocked(handle);
+}
+
+void traffic::RouteCache::release(RouteHandle handle)
+{
+	if (handle == InvalidRoute) return;
+	std::lock_guard<AtomicLock> guard(m_lock);
+	releaseUnlocked(handle);
+}
+
+void traffic::RouteCache::acquireUnlocked(RouteHandle handle)
+{
+	m_nodes[handle].refCount++;
+	m_references++;
+	m_referencedEdges += m_nodes[handle].depth;
+}
+
+void traffic::RouteCache::releaseUnlocked(RouteHandle handle)
+{
+	m_references--;
+	m_referencedEdges -= m_nodes[handle].depth;
+
+	// Frees all trie nodes that are not referenced anymore
+	while (handle != InvalidRoute && --m_nodes[handle].refCount == 0) {
+		TrieNode& node = m_nodes[handle];
+		RouteHandle parent = node.parent;
+		if (node.depth == 0) {
+			m_roots.erase(node.edge);
+		}
+		else {
+			m_children.erase((static_cast<uint64_t>(parent) << 32)
+				| static_cast<uint32_t>(node.edge));
+		}
+		m_freeNodes.push_back(handle);
+		handle = parent;
+	}
+}
+
+void traffic::RouteCache::evictUnlocked()
+{
+	if (m_lru.empty()) return;
+	auto it = m_entries.find(m_lru.back());
+	if (it->second.handle != InvalidRoute)
+		releaseUnlocked(it->second.handle);
+	m_entries.erase(it);
+	m_lru.pop_back();
+	m_evictions++;
+}
+
+bool traffic::RouteCache::isFinished(RouteHandle handle) const
+{
+	return handle == InvalidRoute || m_nodes[handle].depth == 0;
+}
+
+size_t traffic::RouteCache::getEdge(RouteHandle handle) const { return m_nodes[handle].edge; }
+RouteHandle traffic::RouteCache::getNext(RouteHandle handle) const { return m_nodes[handle].parent; }
+size_t traffic::RouteCache::getRemaining(RouteHandle handle) const { return m_nodes[handle].depth; }
+
+size_t traffic::RouteCache::getTarget(RouteHandle handle) const
+{
+	while (m_nodes[handle].depth != 0)
+		handle = m_nodes[handle].parent;
+	return m_nodes[handle].edge;
+}
+
+Route traffic::RouteCache::toRoute(RouteHandle handle) const
+{
+	// Routes store the node IDs in reverse order starting at the goal
+	Route route;
+	if (handle == InvalidRoute) return route;
+	route.nodes.resize(m_nodes[handle].depth);
+	size_t index = route.nodes.size();
+	for (; m_nodes[handle].depth != 0; handle = m_nodes[handle].parent)
+		route.nodes[--index] = m_graph->getNode(m_graph->getEdgeGoal(m_nodes[handle].edge)).nodeID;
+	return route;
+}
+
+void traffic::RouteCache::clear()
+{
+	std::lock_guard<AtomicLock> guard(m_lock);
+	for (auto& entry : m_entries) {
+		if (entry.second.handle != InvalidRoute)
+			releaseUnlocked(entry.second.handle);
+	}
+	m_entries.clear();
+	m_lru.clear();
+}
+
+const FastGraph* traffic::RouteCache::getGraph() const { return m_graph; }
+
+RouteCacheStats traffic::RouteCache::getStats() const
+{
+	std::lock_guard<AtomicLock> guard(m_lock);
+	RouteCacheStats stats;
+	stats.hits = m_hits;
+	stats.misses = m_misses;
+	stats.evictions = m_evictions;
+	stats.cachedRoutes = m_entries.size();
+	stats.liveReferences = m_references;
+	stats.trieNodes = m_nodes.size() - m_freeNodes.size();
+	// Every trie node is referenced by one entry in the child or root map
+	stats.trieBytes = stats.trieNodes * (sizeof(TrieNode)
+		+ sizeof(uint64_t) + sizeof(RouteHandle));
+	stats.naiveBytes = m_references * sizeof(std::vector<int64_t>)
+		+ m_referencedEdges * sizeof(int64_t);
+	return stats;
+}
+
+void traffic::RouteCache::resetStats()
+{
+	std::lock_guard<AtomicLock> guard(m_lock);
+	m_hits = 0;
+	m_misses = 0;
+	m_evictions = 0;
+}
@@ -0,0 +1,192 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef ROUTE_CACHE_H
+#define ROUTE_CACHE_H
+
+#include "engine.h"
+
+#include <list>
+#include <vector>
+#include <cstdint>
+
+#include "osm_graph.h"
+
+namespace traffic
+{
+	/// <summary>
+	/// Lightweight reference to a route that is stored inside of a RouteCache.
+	/// A handle points to the trie node of the next edge that needs to be taken.
+	/// </summary>
+	using RouteHandle = uint32_t;
+	constexpr RouteHandle InvalidRoute = 0xFFFFFFFF;
+
+	/// <summary>
+	/// Statistics about the usage of a RouteCache. The naive size is the memory
+	/// that would be needed if every referenced route was stored in its own
+	/// node vector.
+	/// </summary>
+	struct RouteCacheStats
+	{
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t evictions = 0;
+		size_t cachedRoutes = 0;
+		size_t liveReferences = 0;
+		size_t trieNodes = 0;
+		size_t trieBytes = 0;
+		size_t naiveBytes = 0;
+
+		double hitRate() const;
+		void summary() const;
+	};
+
+	/// <summary>
+	/// Caches routes that were found on a FastGraph. Entries are keyed by source,
+	/// target and the weight version of the graph so that routes that were
+	/// computed with outdated weights are never returned. The number of entries
+	/// is bounded, the least recently used entry is evicted first.
+	/// 
+	/// Routes are stored as sequences of edge indices in a shared trie. Each trie
+	/// node links to the next edge on the way to the target, the roots of the
+	/// trie are the targets itself. Routes that lead to the same target share
+	/// their common suffix which is very common for shortest paths. A handle to
+	/// a trie node is therefore enough to follow the route from start to end.
+	/// Trie nodes are reference counted and are freed as soon as neither the
+	/// cache nor any agent holds a handle that leads through them.
+	/// 
+	/// Lookups may be executed concurrently by multiple threads, the searches
+	/// run outside of the internal lock. Handles must not be read while other
+	/// threads insert routes.
+	/// </summary>
+	class RouteCache
+	{
+	public:
+		/// <summary>Creates an empty route cache</summary>
+		/// <param name="graph">The graph that is used to compute missing routes</param>
+		/// <param name="capacity">The maximum number of cached routes</param>
+		RouteCache(FastGraph *graph, size_t capacity = 1 << 16);
+
+		RouteCache(const RouteCache&) = delete;
+		RouteCache& operator=(const RouteCache&) = delete;
+
+		/// <summary>Returns the route between two node indices. The route is
+		/// computed and inserted if it is not part of the cache yet.</summary>
+		/// <param name="start">The start node index in the FastGraph</param>
+		/// <param name="goal">The goal node index in the FastGraph</param>
+		/// <param name="buffers">Memory resources used for missing routes</param>
+		/// <returns>An acquired handle that must be released by the caller or
+		/// InvalidRoute if the goal is unreachable</returns>
+		RouteHandle findRoute(size_t start, size_t goal,
+			const RoutingBuffers &buffers = RoutingBuffers());
+
+		/// <summary>Adds an additional reference to a handle</summary>
+		void acquire(RouteHandle handle);
+		/// <summary>Releases a reference. The route storage is freed if no
+		/// other reference remains.</summary>
+		void release(RouteHandle handle);
+
+		// ---- Route traversal ---- //
+
+		/// <summary>Whether the handle points to the end of a route</summary>
+		bool isFinished(RouteHandle handle) const;
+		/// <summary>The global edge index of the next edge</summary>
+		size_t getEdge(RouteHandle handle) const;
+		/// <summary>The handle of the route after the next edge. The reference
+		/// count is not changed by this function.</summary>
+		RouteHandle getNext(RouteHandle handle) const;
+		/// <summary>The number of edges until the target is reached</summary>
+		size_t getRemaining(RouteHandle handle) const;
+		/// <summary>The node index of the target of the route</summary>
+		size_t getTarget(RouteHandle handle) const;
+
+		/// <summary>Converts a cached route to a regular route</summary>
+		Route toRoute(RouteHandle handle) const;
+
+		/// <summary>Removes all cached routes. Handles held outside of the
+		/// cache stay valid.</summary>
+		void clear();
+
+		const FastGraph* getGraph() const;
+		RouteCacheStats getStats() const;
+		void resetStats();
+
+	protected:
+		struct TrieNode
+		{
+			RouteHandle parent; // Next trie node towards the target
+			uint32_t refCount; // Children and external references
+			uint32_t depth; // Number of remaining edges, 0 for roots
+			size_t edge; // Edge index, the target node index for roots
+		};
+
+		struct RouteKey
+		{
+			size_t start, goal;
+			uint64_t version;
+
+			bool operator==(const RouteKey &other) const noexcept;
+		};
+
+		struct RouteKeyHash
+		{
+			size_t operator()(const RouteKey &key) const noexcept;
+		};
+
+		struct CacheEntry
+		{
+			RouteHandle handle;
+			std::list<RouteKey>::iterator lruIt;
+		};
+
+		RouteHandle insertPath(size_t goal, const std::vector<size_t> &edges);
+		RouteHandle createNode(RouteHandle parent, uint32_t depth, size_t edge);
+		void acquireUnlocked(RouteHandle handle);
+		void releaseUnlocked(RouteHandle handle);
+		void evictUnlocked();
+
+		FastGraph *m_graph;
+		size_t m_capacity;
+
+		std::vector<TrieNode> m_nodes;
+		std::vector<RouteHandle> m_freeNodes;
+		robin_hood::unordered_flat_map<uint64_t, RouteHandle> m_children;
+		robin_hood::unordered_flat_map<size_t, RouteHandle> m_roots;
+
+		robin_hood::unordered_flat_map<RouteKey, CacheEntry, RouteKeyHash> m_entries;
+		std::list<RouteKey> m_lru;
+
+		mutable AtomicLock m_lock;
+		size_t m_hits = 0;
+		size_t m_misses = 0;
+		size_t m_evictions = 0;
+		size_t m_references = 0;
+		size_t m_referencedEdges = 0;
+	};
+}
+
+#endif
@@ -0,0 +1,416 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "spatial_index.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace traffic;
+using namespace std;
+
+namespace
+{
+	/// <summary>Returns whether two rects share at least one point</summary>
+	inline bool intersects(const Rect& a, const Rect& b)
+	{
+		return a.lowerLatBorder() <= b.upperLatBorder() && b.lowerLatBorder() <= a.upperLatBorder() &&
+			a.lowerLonBorder() <= b.upperLonBorder() && b.lowerLonBorder() <= a.upperLonBorder();
+	}
+
+	/// <summary>Sorts a list of candidates and removes all duplicates</summary>
+	inline void makeUnique(vector<size_t>& values)
+	{
+		sort(values.begin(), values.end());
+		values.erase(unique(values.begin(), values.end()), values.end());
+	}
+
+	/// <summary>Objects that span more cells than this are stored in the large list</summary>
+	constexpr size_t LARGE_CELL_COUNT = 64;
+}
+
+traffic::SpatialIndex::SpatialIndex(const OSMSegment& segment, size_t nodesPerCell)
+	: m_nodes(segment.getNodes()), m_ways(segment.getWays()),
+	m_relations(segment.getRelations()), m_nodeMap(segment.getNodeMap()),
+	m_wayMap(segment.getWayMap()), m_relationMap(segment.getRelationMap())
+{
+	const vector<OSMNode>& nodes = *m_nodes;
+	if (nodes.size() >= numeric_limits<uint32_t>::max() ||
+		m_ways->size() >= numeric_limits<uint32_t>::max() ||
+		m_relations->size() >= numeric_limits<uint32_t>::max())
+		throw runtime_error("SpatialIndex: Segment is too large to be indexed");
+	nodesPerCell = std::max<size_t>(nodesPerCell, 1);
+
+	// ---- Grid dimensions ---- //
+	prec_t upperLat = 0.0f, upperLon = 0.0f;
+	m_lowerLat = 0.0f;
+	m_lowerLon = 0.0f;
+	if (!nodes.empty()) {
+		m_lowerLat = m_lowerLon = numeric_limits<prec_t>::max();
+		upperLat = upperLon = numeric_limits<prec_t>::lowest();
+		for (const OSMNode& nd : nodes) {
+			m_lowerLat = std::min(m_lowerLat, nd.getLat());
+			m_lowerLon = std::min(m_lowerLon, nd.getLon());
+			upperLat = std::max(upperLat, nd.getLat());
+			upperLon = std::max(upperLon, nd.getLon());
+		}
+	}
+	const prec_t minSpan = 1e-6f;
+	prec_t latSpan = std::max(upperLat - m_lowerLat, minSpan);
+	prec_t lonSpan = std::max(upperLon - m_lowerLon, minSpan);
+	size_t targetCells = nodes.size() / nodesPerCell + 1;
+	m_cellSize = std::sqrt(latSpan * lonSpan / targetCells);
+	// Thin segments would create far more cells than intended
+	for (;;) {
+		m_latCells = static_cast<size_t>(latSpan / m_cellSize) + 1;
+		m_lonCells = static_cast<size_t>(lonSpan / m_cellSize) + 1;
+		if (m_latCells * m_lonCells <= 4 * targetCells) break;
+		m_cellSize *= 2.0f;
+	}
+	size_t cellCount = m_latCells * m_lonCells;
+
+	// ---- Nodes sorted by cell ---- //
+	vector<uint32_t> nodeCells(nodes.size());
+	m_nodeOffsets.assign(cellCount + 1, 0);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		CellRange range = getCells(Rect::fromBorders(
+			nodes[i].getLat(), nodes[i].getLat(), nodes[i].getLon(), nodes[i].getLon()));
+		nodeCells[i] = static_cast<uint32_t>(toCell(range.latBegin, range.lonBegin));
+		m_nodeOffsets[nodeCells[i] + 1]++;
+	}
+	for (size_t i = 0; i < cellCount; i++)
+		m_nodeOffsets[i + 1] += m_nodeOffsets[i];
+
+	m_nodeEntries.resize(nodes.size());
+	m_nodePositions.resize(nodes.size());
+	vector<size_t> fill(m_nodeOffsets.begin(), m_nodeOffsets.end() - 1);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		size_t slot = fill[nodeCells[i]]++;
+		m_nodeEntries[slot] = static_cast<uint32_t>(i);
+		m_nodePositions[slot] = glm::vec2(nodes[i].getLat(), nodes[i].getLon());
+	}
+
+	// ---- Way bounds ---- //
+	const prec_t maxPrec = numeric_limits<prec_t>::max();
+	const prec_t minPrec = numeric_limits<prec_t>::lowest();
+	m_wayBounds.resize(m_ways->size());
+	for (size_t i = 0; i < m_ways->size(); i++) {
+		prec_t lLat = maxPrec, uLat = minPrec, lLon = maxPrec, uLon = minPrec;
+		for (int64_t id : (*m_ways)[i].getNodes()) {
+			auto it = m_nodeMap->find(id);
+			if (it == m_nodeMap->end()) continue;
+			const OSMNode& nd = nodes[it->second];
+			lLat = std::min(lLat, nd.getLat()); uLat = std::max(uLat, nd.getLat());
+			lLon = std::min(lLon, nd.getLon()); uLon = std::max(uLon, nd.getLon());
+		}
+		// Ways without any known node get an inverted rect that never intersects
+		m_wayBounds[i] = lLat <= uLat ?
+			Rect::fromBorders(lLat, uLat, lLon, uLon) :
+			Rect::fromBorders(1.0f, -1.0f, 1.0f, -1.0f);
+	}
+	buildBounds(m_wayBounds, m_wayOffsets, m_wayEntries, m_largeWays);
+
+	// ---- Relation bounds ---- //
+	m_relationBounds.resize(m_relations->size());
+	for (size_t i = 0; i < m_relations->size(); i++) {
+		const OSMRelation& rl = (*m_relations)[i];
+		prec_t lLat = maxPrec, uLat = minPrec, lLon = maxPrec, uLon = minPrec;
+		for (const RelationMember& member : *rl.getNodes()) {
+			auto it = m_nodeMap->find(member.getIndex());
+			if (it == m_nodeMap->end()) continue;
+			const OSMNode& nd = nodes[it->second];
+			lLat = std::min(lLat, nd.getLat()); uLat = std::max(uLat, nd.getLat());
+			lLon = std::min(lLon, nd.getLon()); uLon = std::max(uLon, nd.getLon());
+		}
+		for (const RelationMember& member : *rl.getWays()) {
+			auto it = m_wayMap->find(member.getIndex());
+			if (it == m_wayMap->end()) continue;
+			for (size_t wayIndex : it->second) {
+				const Rect& b = m_wayBounds[wayIndex];
+				if (b.lowerLatBorder() > b.upperLatBorder()) continue;
+				lLat = std::min(lLat, b.lowerLatBorder()); uLat = std::max(uLat, b.upperLatBorder());
+				lLon = std::min(lLon, b.lowerLonBorder()); uLon = std::max(uLon, b.upperLonBorder());
+			}
+		}
+		m_relationBounds[i] = lLat <= uLat ?
+			Rect::fromBorders(lLat, uLat, lLon, uLon) :
+			Rect::fromBorders(1.0f, -1.0f, 1.0f, -1.0f);
+	}
+	buildBounds(m_relationBounds, m_relationOffsets, m_relationEntries, m_largeRelations);
+}
+
+traffic::SpatialIndex::CellRange traffic::SpatialIndex::getCells(const Rect& rect) const
+{
+	CellRange range{ 0, 0, 0, 0, true };
+	if (m_latCells == 0 || m_lonCells == 0 ||
+		rect.lowerLatBorder() > rect.upperLatBorder() ||
+		rect.lowerLonBorder() > rect.upperLonBorder())
+		return range;
+
+	prec_t gridUpperLat = m_lowerLat + m_latCells * m_cellSize;
+	prec_t gridUpperLon = m_lowerLon + m_lonCells * m_cellSize;
+	if (rect.upperLatBorder() < m_lowerLat || rect.lowerLatBorder() > gridUpperLat ||
+		rect.upperLonBorder() < m_lowerLon || rect.lowerLonBorder() > gridUpperLon)
+		return range;
+
+	auto clampCell = [this](prec_t value, size_t cells) {
+		if (value <= 0.0f) return size_t(0);
+		size_t cell = static_cast<size_t>(value / m_cellSize);
+		return std::min(cell, cells - 1);
+	};
+	range.latBegin = clampCell(rect.lowerLatBorder() - m_lowerLat, m_latCells);
+	range.latEnd = clampCell(rect.upperLatBorder() - m_lowerLat, m_latCells);
+	range.lonBegin = clampCell(rect.lowerLonBorder() - m_lowerLon, m_lonCells);
+	range.lonEnd = clampCell(rect.upperLonBorder() - m_lowerLon, m_lonCells);
+	range.empty = false;
+	return range;
+}
+
+size_t traffic::SpatialIndex::toCell(size_t lat, size_t lon) const noexcept
+{
+	return lat * m_lonCells + lon;
+}
+
+void traffic::SpatialIndex::buildBounds(const vector<Rect>& bounds, vector<size_t>& offsets,
+	vector<uint32_t>& entries, vector<uint32_t>& large) const
+{
+	// Two passes, the first one counts the entries per cell and the
+	// second one writes them to their final position.
+	size_t cellCount = m_latCells * m_lonCells;
+	offsets.assign(cellCount + 1, 0);
+	for (size_t pass = 0; pass < 2; pass++) {
+		vector<size_t> fill;
+		if (pass == 1) {
+			for (size_t i = 0; i < cellCount; i++)
+				offsets[i + 1] += offsets[i];
+			entries.resize(offsets[cellCount]);
+			fill.assign(offsets.begin(), offsets.end() - 1);
+		}
+
+		for (size_t i = 0; i < bounds.size(); i++) {
+			CellRange range = getCells(bounds[i]);
+			if (range.empty) continue;
+			size_t spanned = (range.latEnd - range.latBegin + 1) * (range.lonEnd - range.lonBegin + 1);
+			if (spanned > LARGE_CELL_COUNT) {
+				if (pass == 0) large.push_back(static_cast<uint32_t>(i));
+				continue;
+			}
+			for (size_t lat = range.latBegin; lat <= range.latEnd; lat++) {
+				for (size_t lon = range.lonBegin; lon <= range.lonEnd; lon++) {
+					size_t cell = toCell(lat, lon);
+					if (pass == 0) offsets[cell + 1]++;
+					else entries[fill[cell]++] = static_cast<uint32_t>(i);
+				}
+			}
+		}
+	}
+}
+
+void traffic::SpatialIndex::queryBounds(const Rect& rect, const vector<Rect>& bounds,
+	const vector<size_t>& offsets, const vector<uint32_t>& entries,
+	const vector<uint32_t>& large, vector<size_t>& result) const
+{
+	CellRange range = getCells(rect);
+	if (!range.empty) {
+		for (size_t lat = range.latBegin; lat <= range.latEnd; lat++) {
+			size_t begin = offsets[toCell(lat, range.lonBegin)];
+			size_t end = offsets[toCell(lat, range.lonEnd) + 1];
+			for (size_t i = begin; i < end; i++)
+				if (intersects(bounds[entries[i]], rect))
+					result.push_back(entries[i]);
+		}
+	}
+	for (uint32_t index : large)
+		if (intersects(bounds[index], rect))
+			result.push_back(index);
+	makeUnique(result);
+}
+
+vector<size_t> traffic::SpatialIndex::queryNodes(const Rect& rect) const
+{
+	vector<size_t> result;
+	CellRange range = getCells(rect);
+	if (range.empty) return result;
+
+	for (size_t lat = range.latBegin; lat <= range.latEnd; lat++) {
+		// Cells of the same latitude row are stored next to each other
+		size_t begin = m_nodeOffsets[toCell(lat, range.lonBegin)];
+		size_t end = m_nodeOffsets[toCell(lat, range.lonEnd) + 1];
+		for (size_t i = begin; i < end; i++)
+			if (rect.contains(Point(m_nodePositions[i].x, m_nodePositions[i].y)))
+				result.push_back(m_nodeEntries[i]);
+	}
+	sort(result.begin(), result.end());
+	return result;
+}
+
+vector<size_t> traffic::SpatialIndex::queryWays(const Rect& rect) const
+{
+	vector<size_t> result;
+	queryBounds(rect, m_wayBounds, m_wayOffsets, m_wayEntries, m_largeWays, result);
+	return result;
+}
+
+vector<size_t> traffic::SpatialIndex::queryRelations(const Rect& rect) const
+{
+	vector<size_t> result;
+	queryBounds(rect, m_relationBounds, m_relationOffsets,
+		m_relationEntries, m_largeRelations, result);
+	return result;
+}
+
+template<typename Contains>
+OSMSegment traffic::SpatialIndex::extractRegion(const Rect& bounds, Contains&& contains) const
+{
+	// ---- Nodes ---- //
+	// Cells that are completely inside of the region are taken as a whole,
+	// only the nodes of the border cells are tested one by one. This is
+	// valid for every convex region.
+	vector<size_t> nodeIndices;
+	CellRange range = getCells(bounds);
+	if (!range.empty) {
+		for (size_t lat = range.latBegin; lat <= range.latEnd; lat++) {
+			for (size_t lon = range.lonBegin; lon <= range.lonEnd; lon++) {
+				size_t cell = toCell(lat, lon);
+				size_t begin = m_nodeOffsets[cell], end = m_nodeOffsets[cell + 1];
+				if (begin == end) continue;
+
+				prec_t lLat = m_lowerLat + lat * m_cellSize, uLat = lLat + m_cellSize;
+				prec_t lLon = m_lowerLon + lon * m_cellSize, uLon = lLon + m_cellSize;
+				if (contains(Point(lLat, lLon)) && contains(Point(lLat, uLon)) &&
+					contains(Point(uLat, lLon)) && contains(Point(uLat, uLon))) {
+					nodeIndices.insert(nodeIndices.end(),
+						m_nodeEntries.begin() + begin, m_nodeEntries.begin() + end);
+					continue;
+				}
+				for (size_t i = begin; i < end; i++)
+					if (contains(Point(m_nodePositions[i].x, m_nodePositions[i].y)))
+						nodeIndices.push_back(m_nodeEntries[i]);
+			}
+		}
+	}
+	// Restores the order of the source segment
+	sort(nodeIndices.begin(), nodeIndices.end());
+
+	auto nodes = make_shared<vector<OSMNode>>();
+	auto nodeMap = make_shared<map_t>();
+	nodes->reserve(nodeIndices.size());
+	nodeMap->reserve(nodeIndices.size());
+	for (size_t index : nodeIndices) {
+		(*nodeMap)[(*m_nodes)[index].getID()] = nodes->size();
+		nodes->push_back((*m_nodes)[index]);
+	}
+
+	// ---- Ways ---- //
+	vector<size_t> wayIndices;
+	queryBounds(bounds, m_wayBounds, m_wayOffsets, m_wayEntries, m_largeWays, wayIndices);
+
+	auto ways = make_shared<vector<OSMWay>>();
+	auto wayMap = make_shared<mapid_t<vector<size_t>>>();
+	ways->reserve(wayIndices.size());
+	wayMap->reserve(wayIndices.size());
+	for (size_t index : wayIndices) {
+		const OSMWay& wd = (*m_ways)[index];
+		auto wayNodes = make_shared<vector<int64_t>>();
+		wayNodes->reserve(wd.getNodes().size());
+		for (int64_t id : wd.getNodes())
+			if (nodeMap->find(id) != nodeMap->end())
+				wayNodes->push_back(id);
+		if (wayNodes->empty()) continue;
+
+		(*wayMap)[wd.getID()].push_back(ways->size());
+		ways->push_back(OSMWay(wd.getID(), wd.getVer(), move(wayNodes), wd.getData()));
+		ways->back().setSubIndex(wd.getSubIndex());
+	}
+
+	// ---- Relations ---- //
+	// The first pass keeps all relations that have node or way members in
+	// the region, the second one restores the references between them.
+	vector<size_t> relationIndices;
+	queryBounds(bounds, m_relationBounds, m_relationOffsets,
+		m_relationEntries, m_largeRelations, relationIndices);
+
+	auto relations = make_shared<vector<OSMRelation>>();
+	auto relationMap = make_shared<mapid_t<vector<size_t>>>();
+	relations->reserve(relationIndices.size());
+	relationMap->reserve(relationIndices.size());
+	vector<size_t> relationSources;
+	for (size_t index : relationIndices) {
+		const OSMRelation& rl = (*m_relations)[index];
+		auto nodeRefs = make_shared<vector<RelationMember>>();
+		auto wayRefs = make_shared<vector<RelationMember>>();
+		for (const RelationMember& member : *rl.getNodes())
+			if (nodeMap->find(member.getIndex()) != nodeMap->end())
+				nodeRefs->push_back(member);
+		for (const RelationMember& member : *rl.getWays())
+			if (wayMap->find(member.getIndex()) != wayMap->end())
+				wayRefs->push_back(member);
+		if (nodeRefs->empty() && wayRefs->empty()) continue;
+
+		(*relationMap)[rl.getID()].push_back(relations->size());
+		relations->push_back(OSMRelation(rl.getID(), rl.getVer(), rl.getData(),
+			move(nodeRefs), move(wayRefs), make_shared<vector<RelationMember>>()));
+		relations->back().setSubIndex(rl.getSubIndex());
+		relationSources.push_back(index);
+	}
+	for (size_t i = 0; i < relations->size(); i++) {
+		const OSMRelation& source = (*m_relations)[relationSources[i]];
+		vector<RelationMember>& relationRefs = *(*relations)[i].getRelations();
+		for (const RelationMember& member : *source.getRelations())
+			if (relationMap->find(member.getIndex()) != relationMap->end())
+				relationRefs.push_back(member);
+	}
+
+	return OSMSegment(nodes, ways, relations, nodeMap, wayMap, relationMap);
+}
+
+OSMSegment traffic::SpatialIndex::extract(const Rect& rect) const
+{
+	return extractRegion(rect, [&rect](const Point& p) { return rect.contains(p); });
+}
+
+OSMSegment traffic::SpatialIndex::extract(const Circle& circle) const
+{
+	return extractRegion(Rect::fromCircle(circle),
+		[&circle](const Point& p) { return circle.contains(p); });
+}
+
+size_t traffic::SpatialIndex::getManagedSize() const
+{
+	size_t size = 0;
+	size += m_nodeOffsets.capacity() * sizeof(size_t);
+	size += m_nodeEntries.capacity() * sizeof(uint32_t);
+	size += m_nodePositions.capacity() * sizeof(glm::vec2);
+	size += m_wayBounds.capacity() * sizeof(Rect);
+	size += m_wayOffsets.capacity() * sizeof(size_t);
+	size += (m_wayEntries.capacity() + m_largeWays.capacity()) * sizeof(uint32_t);
+	size += m_relationBounds.capacity() * sizeof(Rect);
+	size += m_relationOffsets.capacity() * sizeof(size_t);
+	size += (m_relationEntries.capacity() + m_largeRelations.capacity()) * sizeof(uint32_t);
+	return size;
+}
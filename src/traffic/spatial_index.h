@@ -0,0 +1,123 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "engine.h"
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "geom.h"
+#include "osm.h"
+
+namespace traffic
+{
+	/// <summary>
+	/// Uniform grid index over the nodes, ways and relations of an OSMSegment.
+	/// Nodes are sorted by their cell, ways and relations are registered in
+	/// every cell their bounding box overlaps. Objects whose bounding box
+	/// covers too many cells are kept in a separate list that every query
+	/// checks. Region extraction only visits the cells that overlap the
+	/// region, so its cost is proportional to the size of the output.
+	/// </summary>
+	class SpatialIndex
+	{
+	public:
+		/// <summary>Builds the index of a segment</summary>
+		/// <param name="segment">The indexed segment. The index shares its lists.</param>
+		/// <param name="nodesPerCell">The average number of nodes in a cell</param>
+		explicit SpatialIndex(const OSMSegment& segment, size_t nodesPerCell = 16);
+
+		/// (1) Returns the indices of all nodes in the rect
+		/// (2) Returns the indices of all ways whose bounding box intersects the rect
+		/// (3) Returns the indices of all relations whose bounding box intersects the rect
+		std::vector<size_t> queryNodes(const Rect& rect) const;
+		std::vector<size_t> queryWays(const Rect& rect) const;
+		std::vector<size_t> queryRelations(const Rect& rect) const;
+
+		/// <summary>
+		/// (1) Extracts all nodes in the rect
+		/// (2) Extracts all nodes in the circle
+		/// Ways are cut down to the extracted nodes, relations keep the members
+		/// that are part of the output. Objects without any remaining node or
+		/// member are dropped.
+		/// </summary>
+		OSMSegment extract(const Rect& rect) const;
+		OSMSegment extract(const Circle& circle) const;
+
+		size_t getManagedSize() const;
+
+	protected:
+		struct CellRange {
+			size_t latBegin, latEnd, lonBegin, lonEnd; // Inclusive cell bounds
+			bool empty;
+		};
+
+		CellRange getCells(const Rect& rect) const;
+		size_t toCell(size_t lat, size_t lon) const noexcept;
+
+		void buildBounds(const std::vector<Rect>& bounds, std::vector<size_t>& offsets,
+			std::vector<uint32_t>& entries, std::vector<uint32_t>& large) const;
+		void queryBounds(const Rect& rect, const std::vector<Rect>& bounds,
+			const std::vector<size_t>& offsets, const std::vector<uint32_t>& entries,
+			const std::vector<uint32_t>& large, std::vector<size_t>& result) const;
+
+		template<typename Contains>
+		OSMSegment extractRegion(const Rect& bounds, Contains&& contains) const;
+
+		std::shared_ptr<std::vector<OSMNode>> m_nodes;
+		std::shared_ptr<std::vector<OSMWay>> m_ways;
+		std::shared_ptr<std::vector<OSMRelation>> m_relations;
+		std::shared_ptr<map_t> m_nodeMap;
+		std::shared_ptr<mapid_t<std::vector<size_t>>> m_wayMap;
+		std::shared_ptr<mapid_t<std::vector<size_t>>> m_relationMap;
+
+		prec_t m_lowerLat, m_lowerLon;
+		prec_t m_cellSize;
+		size_t m_latCells, m_lonCells;
+
+		// Nodes sorted by cell, the coordinates are stored in the same order
+		std::vector<size_t> m_nodeOffsets;
+		std::vector<uint32_t> m_nodeEntries;
+		std::vector<glm::vec2> m_nodePositions;
+
+		std::vector<Rect> m_wayBounds;
+		std::vector<size_t> m_wayOffsets;
+		std::vector<uint32_t> m_wayEntries;
+		std::vector<uint32_t> m_largeWays;
+
+		std::vector<Rect> m_relationBounds;
+		std::vector<size_t> m_relationOffsets;
+		std::vector<uint32_t> m_relationEntries;
+		std::vector<uint32_t> m_largeRelations;
+	};
+}
+
+#endif
@@ -0,0 +1,366 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+
+#include "tiles.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "agent.h"
+#include "osm_mesh.h"
+
+using namespace traffic;
+using namespace glm;
+
+constexpr double Pi = 3.141592653589793238462643383279502;
+
+static void putVarint(std::vector<uint8_t>& data, uint64_t value)
+{
+	while (value >= 0x80) {
+		data.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	data.push_back(static_cast<uint8_t>(value));
+}
+
+static void putZigZag(std::vector<uint8_t>& data, int64_t value)
+{
+	putVarint(data, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+static void putLittleEndian(std::vector<uint8_t>& data, uint64_t value, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; i++)
+		data.push_back(static_cast<uint8_t>(value >> (i * 8)));
+}
+
+// ---- TileWriter ---- //
+
+void TileWriter::finish() { }
+
+TileDirectoryWriter::TileDirectoryWriter(const std::string& directory)
+	: m_directory(directory) { }
+
+void TileDirectoryWriter::write(const TileID& tile, const std::vector<uint8_t>& data)
+{
+	std::filesystem::path path = std::filesystem::path(m_directory) /
+		std::to_string(tile.z) / std::to_string(tile.x);
+	std::filesystem::create_directories(path);
+	path /= std::to_string(tile.y) + ".tile";
+
+	std::ofstream stream(path, std::ios::binary);
+	if (!stream) throw std::runtime_error("Could not open file " + path.string());
+	stream.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+TileArchiveWriter::TileArchiveWriter(const std::string& file)
+	: m_stream(file, std::ios::binary)
+{
+	if (!m_stream) throw std::runtime_error("Could not open file " + file);
+	const char header[] = { 'T', 'S', 'V', 'A', static_cast<char>(TileGenerator::VERSION) };
+	m_stream.write(header, sizeof(header));
+	m_offset = sizeof(header);
+}
+
+TileArchiveWriter::~TileArchiveWriter()
+{
+	// the index is required to read the archive
+	try { finish(); }
+	catch (const std::exception&) { }
+}
+
+void TileArchiveWriter::write(const TileID& tile, const std::vector<uint8_t>& data)
+{
+	if (m_finished) throw std::runtime_error("The archive is already finished");
+	m_stream.write(reinterpret_cast<const char*>(data.data()), data.size());
+	m_entries.push_back({ tile, m_offset, static_cast<uint32_t>(data.size()) });
+	m_offset += data.size();
+}
+
+void TileArchiveWriter::finish()
+{
+	if (m_finished) return;
+	m_finished = true;
+
+	std::vector<uint8_t> index;
+	index.reserve(m_entries.size() * 21 + 12);
+	for (const Entry& entry : m_entries) {
+		putLittleEndian(index, entry.tile.z, 1);
+		putLittleEndian(index, entry.tile.x, 4);
+		putLittleEndian(index, entry.tile.y, 4);
+		putLittleEndian(index, entry.offset, 8);
+		putLittleEndian(index, entry.size, 4);
+	}
+	putLittleEndian(index, m_offset, 8);
+	index.insert(index.end(), { 'T', 'S', 'V', 'A' });
+	m_stream.write(reinterpret_cast<const char*>(index.data()), index.size());
+	m_stream.flush();
+	if (!m_stream) throw std::runtime_error("Could not write the tile archive");
+}
+
+// ---- TileGenerator ---- //
+
+TileGenerator::TileGenerator(const TileOptions& options, ConcurrencyManager* manager)
+	: m_options(options), m_manager(manager)
+{
+	if (options.minZoom > options.maxZoom || options.maxZoom > 24)
+		throw std::runtime_error("Invalid zoom range");
+	if (options.extent == 0 || options.chunkSize == 0)
+		throw std::runtime_error("Invalid tile options");
+}
+
+dvec2 TileGenerator::project(prec_t lat, prec_t lon) noexcept
+{
+	// web mercator is undefined at the poles
+	double latRad = std::clamp(static_cast<double>(lat), -85.0511, 85.0511) * Pi / 180.0;
+	return dvec2(
+		(static_cast<double>(lon) + 180.0) / 360.0,
+		(1.0 - std::log(std::tan(latRad) + 1.0 / std::cos(latRad)) / Pi) * 0.5);
+}
+
+void TileGenerator::addLayer(const std::string& name, const OSMSegment& map)
+{
+	Layer layer{ name, {} };
+	if (map.hasNodes()) {
+		const std::vector<OSMNode>& nodes = *map.getNodes();
+		for (const OSMWay& way : *map.getWays()) {
+			Line line{ way.getID(), {}, dvec2(1.0), dvec2(0.0) };
+			for (int64_t id : way.getNodes()) {
+				size_t index = map.getNodeIndex(id);
+				if (index == std::numeric_limits<size_t>::max()) continue;
+				dvec2 point = project(nodes[index].getLat(), nodes[index].getLon());
+				line.points.push_back(point);
+				line.lower = min(line.lower, point);
+				line.upper = max(line.upper, point);
+			}
+			if (line.points.size() >= 2)
+				layer.lines.push_back(std::move(line));
+		}
+	}
+	m_layers.push_back(std::move(layer));
+}
+
+std::vector<std::pair<TileID, TileGenerator::Bin>> TileGenerator::binLines(uint32_t zoom) const
+{
+	std::vector<std::pair<TileID, Bin>> bins;
+	std::unordered_map<uint64_t, size_t> binIndex;
+	double tiles = static_cast<double>(1u << zoom);
+	double buffer = static_cast<double>(m_options.buffer) / m_options.extent;
+	int64_t last = static_cast<int64_t>(1u << zoom) - 1;
+	auto toTile = [last](double value) {
+		return std::clamp<int64_t>(static_cast<int64_t>(std::floor(value)), 0, last);
+	};
+
+	for (size_t l = 0; l < m_layers.size(); l++) {
+		const std::vector<Line>& lines = m_layers[l].lines;
+		for (size_t i = 0; i < lines.size(); i++) {
+			const std::vector<dvec2>& points = lines[i].points;
+			for (size_t s = 0; s + 1 < points.size(); s++) {
+				// Visits the columns of the segment and in each column
+				// the rows that the part of the segment inside of it covers
+				dvec2 a = points[s] * tiles, d = points[s + 1] * tiles - a;
+				int64_t x0 = toTile(std::min(a.x, a.x + d.x) - buffer);
+				int64_t x1 = toTile(std::max(a.x, a.x + d.x) + buffer);
+				for (int64_t x = x0; x <= x1; x++) {
+					double t0 = 0.0, t1 = 1.0;
+					if (d.x != 0.0) {
+						t0 = std::clamp((x - buffer - a.x) / d.x, 0.0, 1.0);
+						t1 = std::clamp((x + 1.0 + buffer - a.x) / d.x, 0.0, 1.0);
+					}
+					double ya = a.y + d.y * t0, yb = a.y + d.y * t1;
+					int64_t y0 = toTile(std::min(ya, yb) - buffer);
+					int64_t y1 = toTile(std::max(ya, yb) + buffer);
+					for (int64_t y = y0; y <= y1; y++) {
+						uint64_t key = (static_cast<uint64_t>(y) << 32) | static_cast<uint64_t>(x);
+						auto [it, inserted] = binIndex.try_emplace(key, bins.size());
+						if (inserted) {
+							TileID tile{ zoom, static_cast<uint32_t>(x), static_cast<uint32_t>(y) };
+							bins.emplace_back(tile, Bin(m_layers.size()));
+						}
+						// Consecutive segments in the same tile extend its last span
+						std::vector<Span>& spans = bins[it->second].second[l];
+						if (!spans.empty() && spans.back().line == i && spans.back().end == s)
+							spans.back().end = static_cast<uint32_t>(s + 1);
+						else
+							spans.push_back({ static_cast<uint32_t>(i),
+								static_cast<uint32_t>(s), static_cast<uint32_t>(s + 1) });
+					}
+				}
+			}
+		}
+	}
+
+	// Ordered by row and column to keep the output deterministic
+	std::sort(bins.begin(), bins.end(), [](const auto& a, const auto& b) {
+		return a.first.y != b.first.y ? a.first.y < b.first.y : a.first.x < b.first.x;
+	});
+	return bins;
+}
+
+size_t TileGenerator::generate(TileWriter& writer)
+{
+	size_t written = 0;
+	std::vector<std::vector<uint8_t>> encoded;
+	for (uint32_t zoom = m_options.minZoom; zoom <= m_options.maxZoom; zoom++) {
+		auto bins = binLines(zoom);
+		for (size_t begin = 0; begin < bins.size(); begin += m_options.chunkSize) {
+			size_t count = std::min(m_options.chunkSize, bins.size() - begin);
+			encoded.assign(count, {});
+			auto encode = [&](int, size_t first, size_t last) {
+				for (size_t i = first; i < last; i++)
+					encoded[i] = encodeTile(bins[begin + i].first, bins[begin + i].second);
+			};
+			if (m_manager) m_manager->parallelFor(count, 4, encode);
+			else encode(0, 0, count);
+
+			// The chunk is written before the next one is encoded
+			for (size_t i = 0; i < count; i++) {
+				if (encoded[i].empty()) continue;
+				writer.write(bins[begin + i].first, encoded[i]);
+				written++;
+			}
+		}
+	}
+	writer.finish();
+	return written;
+}
+
+std::vector<uint8_t> TileGenerator::encodeTile(const TileID& tile) const
+{
+	if (tile.z > 24 || tile.x >= (1u << tile.z) || tile.y >= (1u << tile.z))
+		throw std::runtime_error("Invalid tile");
+	double tiles = static_cast<double>(1u << tile.z);
+	double buffer = static_cast<double>(m_options.buffer) / m_options.extent;
+	dvec2 lower = (dvec2(tile.x, tile.y) - buffer) / tiles;
+	dvec2 upper = (dvec2(tile.x + 1, tile.y + 1) + buffer) / tiles;
+
+	Bin bin(m_layers.size());
+	for (size_t l = 0; l < m_layers.size(); l++) {
+		const std::vector<Line>& lines = m_layers[l].lines;
+		for (size_t i = 0; i < lines.size(); i++) {
+			if (all(lessThanEqual(lines[i].lower, upper)) &&
+				all(greaterThanEqual(lines[i].upper, lower)))
+				bin[l].push_back({ static_cast<uint32_t>(i), 0,
+					static_cast<uint32_t>(lines[i].points.size() - 1) });
+		}
+	}
+	return encodeTile(tile, bin);
+}
+
+std::vector<uint8_t> TileGenerator::encodeTile(const TileID& tile, const Bin& bin) const
+{
+	std::vector<uint8_t> data = { 'T', 'S', 'V', 'T', VERSION };
+	putVarint(data, m_layers.size());
+
+	bool empty = true;
+	std::vector<std::vector<ivec2>> features;
+	std::vector<int64_t> ids;
+	for (size_t l = 0; l < m_layers.size(); l++) {
+		features.clear();
+		ids.clear();
+		for (const Span& span : bin[l]) {
+			const Line& line = m_layers[l].lines[span.line];
+			encodeLine(line, span.begin, span.end, tile, features);
+			ids.resize(features.size(), line.id);
+		}
+		empty = empty && features.empty();
+
+		const std::string& name = m_layers[l].name;
+		putVarint(data, name.size());
+		data.insert(data.end(), name.begin(), name.end());
+		putVarint(data, m_options.extent);
+		putVarint(data, features.size());
+		for (size_t f = 0; f < features.size(); f++) {
+			putZigZag(data, ids[f]);
+			putVarint(data, features[f].size());
+			ivec2 cursor(0);
+			for (ivec2 point : features[f]) {
+				putZigZag(data, point.x - cursor.x);
+				putZigZag(data, point.y - cursor.y);
+				cursor = point;
+			}
+		}
+	}
+	if (empty) data.clear();
+	return data;
+}
+
+void TileGenerator::encodeLine(const Line& line, size_t begin, size_t end,
+	const TileID& tile, std::vector<std::vector<ivec2>>& features) const
+{
+	double scale = static_cast<double>(m_options.extent) * (1u << tile.z);
+	dvec2 origin = dvec2(tile.x, tile.y) * static_cast<double>(m_options.extent);
+	double lowerBound = -static_cast<double>(m_options.buffer);
+	double upperBound = static_cast<double>(m_options.extent) + m_options.buffer;
+
+	// Every part of the line inside the buffered tile becomes a feature
+	std::vector<vec2> piece;
+	std::vector<size_t> kept;
+	auto flush = [&]() {
+		if (piece.size() >= 2) {
+			kept.clear();
+			simplifyLine(piece, m_options.tolerance, kept);
+			std::vector<ivec2> feature;
+			for (size_t index : kept) {
+				ivec2 point(std::lround(piece[index].x), std::lround(piece[index].y));
+				if (feature.empty() || feature.back() != point)
+					feature.push_back(point);
+			}
+			if (feature.size() >= 2)
+				features.push_back(std::move(feature));
+		}
+		piece.clear();
+	};
+
+	for (size_t i = begin + 1; i <= end; i++) {
+		// Liang-Barsky clipping of the segment against the buffered tile
+		dvec2 a = line.points[i - 1] * scale - origin;
+		dvec2 d = line.points[i] * scale - origin - a;
+		double t0 = 0.0, t1 = 1.0;
+		const double p[4] = { -d.x, d.x, -d.y, d.y };
+		const double q[4] = { a.x - lowerBound, upperBound - a.x, a.y - lowerBound, upperBound - a.y };
+		bool inside = true;
+		for (int k = 0; k < 4 && inside; k++) {
+			if (p[k] == 0.0) inside = q[k] >= 0.0;
+			else if (p[k] < 0.0) t0 = std::max(t0, q[k] / p[k]);
+			else t1 = std::min(t1, q[k] / p[k]);
+			inside = inside && t0 <= t1;
+		}
+		if (!inside) {
+			flush();
+			continue;
+		}
+
+		if (piece.empty()) piece.push_back(vec2(a + d * t0));
+		piece.push_back(vec2(a + d * t1));
+		if (t1 < 1.0) flush();
+	}
+	flush();
+}
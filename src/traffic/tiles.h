@@ -0,0 +1,182 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef TRAFFIC_TILES_H
+#define TRAFFIC_TILES_H
+
+#include "engine.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <fstream>
+#include <glm/glm.hpp>
+
+#include "osm.h"
+
+namespace traffic
+{
+	class ConcurrencyManager;
+
+	/// <summary>Address of a tile in the XYZ scheme, y grows to the south</summary>
+	struct TileID {
+		uint32_t z, x, y;
+	};
+
+	struct TileOptions {
+		uint32_t minZoom = 10, maxZoom = 16;
+		uint32_t extent = 4096;		// Coordinates per tile side
+		uint32_t buffer = 64;		// Coordinates kept outside of the tile
+		prec_t tolerance = 1.0f;	// Simplification tolerance in tile coordinates
+		size_t chunkSize = 256;		// Tiles that are encoded before they are written
+	};
+
+	/// <summary>
+	/// Receives the encoded tiles in the order they are generated
+	/// </summary>
+	class TileWriter
+	{
+	public:
+		virtual ~TileWriter() = default;
+		virtual void write(const TileID& tile, const std::vector<uint8_t>& data) = 0;
+		virtual void finish();
+	};
+
+	/// <summary>
+	/// Writes every tile to its own file at directory/z/x/y.tile
+	/// </summary>
+	class TileDirectoryWriter : public TileWriter
+	{
+	public:
+		explicit TileDirectoryWriter(const std::string& directory);
+		virtual void write(const TileID& tile, const std::vector<uint8_t>& data) override;
+
+	protected:
+		std::string m_directory;
+	};
+
+	/// <summary>
+	/// Writes all tiles to a single archive file. The file starts with the
+	/// magic "TSVA" and a version byte followed by the tile data in the order
+	/// it was written. finish appends the index with one entry per tile
+	/// (u8 z, u32 x, u32 y, u64 offset, u32 size) and a footer with the
+	/// u64 index offset and the magic. All numbers are little endian.
+	/// </summary>
+	class TileArchiveWriter : public TileWriter
+	{
+	public:
+		explicit TileArchiveWriter(const std::string& file);
+		virtual ~TileArchiveWriter();
+
+		virtual void write(const TileID& tile, const std::vector<uint8_t>& data) override;
+		virtual void finish() override;
+
+	protected:
+		struct Entry {
+			TileID tile;
+			uint64_t offset;
+			uint32_t size;
+		};
+
+		std::ofstream m_stream;
+		std::vector<Entry> m_entries;
+		uint64_t m_offset = 0;
+		bool m_finished = false;
+	};
+
+	/// <summary>
+	/// Cuts the ways of one or more segments into vector tiles. Every segment
+	/// becomes a layer of the tiles. Ways are projected to web mercator,
+	/// clipped to the buffered tile and simplified with a tolerance in tile
+	/// coordinates, lower zoom levels are therefore simplified more. Every
+	/// segment is binned into the tiles it crosses, a tile only clips the
+	/// ranges of points that touch it. The tiles of a zoom level are encoded
+	/// in parallel in chunks of chunkSize tiles, each chunk is written before
+	/// the next one is encoded. Tiles without any feature are skipped.
+	/// 
+	/// Tile format, varints are LEB128, zigzag encodes signed values:
+	///	tile    := "TSVT" u8 version, varint layerCount, layer*
+	///	layer   := varint nameLength, name, varint extent, varint featureCount, feature*
+	///	feature := zigzag wayID, varint pointCount, (zigzag dx, zigzag dy)*
+	/// The point deltas start at (0, 0) for every feature.
+	/// </summary>
+	class TileGenerator
+	{
+	public:
+		static constexpr uint8_t VERSION = 1;
+
+		explicit TileGenerator(const TileOptions& options = TileOptions(),
+			ConcurrencyManager* manager = nullptr);
+
+		void addLayer(const std::string& name, const OSMSegment& map);
+
+		/// <summary>Generates all tiles of all zoom levels</summary>
+		/// <returns>The number of written tiles</returns>
+		size_t generate(TileWriter& writer);
+
+		/// <summary>Encodes a single tile</summary>
+		/// <returns>The tile data, empty if the tile has no features</returns>
+		std::vector<uint8_t> encodeTile(const TileID& tile) const;
+
+		/// <summary>Projects a position to web mercator in the range [0, 1]</summary>
+		static glm::dvec2 project(prec_t lat, prec_t lon) noexcept;
+
+	protected:
+		struct Line {
+			int64_t id;
+			std::vector<glm::dvec2> points;
+			glm::dvec2 lower, upper;
+		};
+
+		struct Layer {
+			std::string name;
+			std::vector<Line> lines;
+		};
+
+		/// <summary>Consecutive segments of a line that touch a tile, they
+		/// connect the points from begin to end</summary>
+		struct Span {
+			uint32_t line;
+			uint32_t begin, end;
+		};
+		/// <summary>The spans of every layer in a tile</summary>
+		using Bin = std::vector<std::vector<Span>>;
+
+		/// <summary>Finds the tiles of a zoom level that the segments of the
+		/// lines cross. Only the tiles along every segment are visited.</summary>
+		std::vector<std::pair<TileID, Bin>> binLines(uint32_t zoom) const;
+		std::vector<uint8_t> encodeTile(const TileID& tile, const Bin& bin) const;
+		void encodeLine(const Line& line, size_t begin, size_t end, const TileID& tile,
+			std::vector<std::vector<glm::ivec2>>& features) const;
+
+		TileOptions m_options;
+		ConcurrencyManager* m_manager;
+		std::vector<Layer> m_layers;
+	};
+}
+
+#endif
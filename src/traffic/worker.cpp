@@ -0,0 +1,868 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#include "engine.h"
+#include "worker.h"
+#include "agent.h"
+#include "partition.h"
+#include "balancer.h"
+#include "parser.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#if !defined(_WIN32)
+#	include <unistd.h>
+#	include <sys/types.h>
+#	include <sys/socket.h>
+#	include <sys/wait.h>
+#endif
+
+using namespace traffic;
+using namespace std;
+
+// ---- MessageBuffer ---- //
+
+void traffic::MessageBuffer::clear() noexcept
+{
+	m_data.clear();
+	m_position = 0;
+}
+
+void traffic::MessageBuffer::rewind() noexcept { m_position = 0; }
+bool traffic::MessageBuffer::finished() const noexcept { return m_position >= m_data.size(); }
+
+std::vector<uint8_t>& traffic::MessageBuffer::getData() noexcept { return m_data; }
+const std::vector<uint8_t>& traffic::MessageBuffer::getData() const noexcept { return m_data; }
+
+void traffic::MessageBuffer::checkRead(size_t bytes) const
+{
+	if (bytes > m_data.size() - m_position)
+		throw runtime_error("Message is shorter than expected");
+}
+
+// ---- Socket functions ---- //
+
+struct MessageHeader {
+	uint32_t type;
+	uint32_t length;
+};
+
+#if !defined(_WIN32)
+
+static void writeAll(int socket, const uint8_t* data, size_t length)
+{
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL; // A closed peer must not kill this process
+#else
+	const int flags = 0;
+#endif
+	while (length > 0) {
+		ssize_t written = ::send(socket, data, length, flags);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			throw runtime_error("Could not send message");
+		}
+		data += written;
+		length -= static_cast<size_t>(written);
+	}
+}
+
+/// <summary>Returns false if the connection was closed before the first byte</summary>
+static bool readAll(int socket, uint8_t* data, size_t length)
+{
+	size_t total = length;
+	while (length > 0) {
+		ssize_t received = ::recv(socket, data, length, 0);
+		if (received < 0) {
+			if (errno == EINTR) continue;
+			throw runtime_error("Could not receive message");
+		}
+		if (received == 0) {
+			if (length == total) return false;
+			throw runtime_error("Connection closed in the middle of a message");
+		}
+		data += received;
+		length -= static_cast<size_t>(received);
+	}
+	return true;
+}
+
+void traffic::sendMessage(int socket, MessageType type, const MessageBuffer& buffer)
+{
+	MessageHeader header{ static_cast<uint32_t>(type), static_cast<uint32_t>(buffer.getData().size()) };
+	writeAll(socket, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+	writeAll(socket, buffer.getData().data(), buffer.getData().size());
+}
+
+bool traffic::receiveMessage(int socket, MessageType& type, MessageBuffer& buffer)
+{
+	MessageHeader header;
+	if (!readAll(socket, reinterpret_cast<uint8_t*>(&header), sizeof(header)))
+		return false;
+	type = static_cast<MessageType>(header.type);
+	buffer.clear();
+	buffer.getData().resize(header.length);
+	if (header.length > 0 && !readAll(socket, buffer.getData().data(), header.length))
+		throw runtime_error("Connection closed in the middle of a message");
+	return true;
+}
+
+#else
+
+void traffic::sendMessage(int, MessageType, const MessageBuffer&)
+{
+	throw runtime_error("Distributed simulation requires a POSIX system");
+}
+
+bool traffic::receiveMessage(int, MessageType&, MessageBuffer&)
+{
+	throw runtime_error("Distributed simulation requires a POSIX system");
+}
+
+#endif
+
+// ---- Messages ---- //
+
+void traffic::StatusRequest::write(MessageBuffer& buffer) const { buffer.write(tick); }
+void traffic::StatusRequest::read(MessageBuffer& buffer) { tick = buffer.read<uint64_t>(); }
+
+void traffic::WorkerStatus::write(MessageBuffer& buffer) const { buffer.write(*this); }
+void traffic::WorkerStatus::read(MessageBuffer& buffer) { *this = buffer.read<WorkerStatus>(); }
+
+void traffic::AgentTransfer::write(MessageBuffer& buffer) const
+{
+	buffer.write(source);
+	buffer.write(target);
+	buffer.writeVector(agents);
+}
+
+void traffic::AgentTransfer::read(MessageBuffer& buffer)
+{
+	source = buffer.read<uint32_t>();
+	target = buffer.read<uint32_t>();
+	buffer.readVector(agents);
+}
+
+void traffic::BorderChange::write(MessageBuffer& buffer) const
+{
+	buffer.write(chunk);
+	buffer.write(worker);
+}
+
+void traffic::BorderChange::read(MessageBuffer& buffer)
+{
+	chunk = buffer.read<uint32_t>();
+	worker = buffer.read<uint32_t>();
+}
+
+void traffic::DataTransfer::write(MessageBuffer& buffer) const
+{
+	buffer.write(tag);
+	buffer.writeVector(data);
+}
+
+void traffic::DataTransfer::read(MessageBuffer& buffer)
+{
+	tag = buffer.read<uint32_t>();
+	buffer.readVector(data);
+}
+
+void traffic::LoadReport::write(MessageBuffer& buffer) const
+{
+	buffer.write(worker);
+	buffer.write(ticks);
+	buffer.write(busySeconds);
+	buffer.writeVector(chunks);
+}
+
+void traffic::LoadReport::read(MessageBuffer& buffer)
+{
+	worker = buffer.read<uint32_t>();
+	ticks = buffer.read<uint64_t>();
+	busySeconds = buffer.read<double>();
+	buffer.readVector(chunks);
+}
+
+// ---- Worker ---- //
+
+traffic::Worker::Worker(uint32_t id, int socket,
+	const std::shared_ptr<OSMSegment>& map, const OSMMap& chunks,
+	const std::vector<uint32_t>& owners, const std::vector<Trip>& trips,
+	const DistributedSettings& settings)
+	: m_id(id), m_socket(socket), m_settings(settings), m_chunks(chunks),
+	m_chunkOwners(owners), m_trips(trips)
+{
+	std::stable_sort(m_trips.begin(), m_trips.end(), [](const Trip& a, const Trip& b) {
+		return a.departure < b.departure;
+	});
+	m_manager = std::make_unique<ConcurrencyManager>(m_settings.threadsPerWorker);
+	m_world = std::make_unique<World>(m_manager.get(), map);
+	m_status.worker = id;
+	updateOwners();
+}
+
+traffic::Worker::~Worker() { }
+
+void traffic::Worker::setDataHandler(const std::function<void(uint32_t, const DataTransfer&)>& handler)
+{
+	m_dataHandler = handler;
+}
+
+void traffic::Worker::run()
+{
+	MessageBuffer buffer;
+	MessageType type;
+	while (receiveMessage(m_socket, type, buffer)) {
+		switch (type) {
+		case MessageType::StatusRequest: {
+			StatusRequest request;
+			request.read(buffer);
+			MessageBuffer answer;
+			getStatus().write(answer);
+			sendMessage(m_socket, MessageType::Status, answer);
+			break;
+		}
+		case MessageType::LoadRequest: {
+			MessageBuffer answer;
+			createLoadReport().write(answer);
+			sendMessage(m_socket, MessageType::LoadReport, answer);
+			break;
+		}
+		case MessageType::AgentTransfer: {
+			AgentTransfer transfer;
+			transfer.read(buffer);
+			receiveAgents(transfer);
+			break;
+		}
+		case MessageType::BorderChange: {
+			BorderChange change;
+			change.read(buffer);
+			if (change.chunk < m_chunkOwners.size()) {
+				m_chunkOwners[change.chunk] = change.worker;
+				m_ownersChanged = true;
+			}
+			break;
+		}
+		case MessageType::DataTransfer: {
+			DataTransfer data;
+			data.read(buffer);
+			if (m_dataHandler)
+				m_dataHandler(m_id, data);
+			break;
+		}
+		case MessageType::Tick: {
+			uint64_t tickIndex = buffer.read<uint64_t>();
+			double dt = buffer.read<double>();
+			tick(tickIndex, dt);
+			break;
+		}
+		case MessageType::Shutdown:
+			return;
+		default:
+			throw runtime_error("Worker received an unknown message");
+		}
+	}
+}
+
+void traffic::Worker::tick(uint64_t tick, double dt)
+{
+	if (m_ownersChanged)
+		updateOwners();
+
+	spawnTrips();
+	auto begin = std::chrono::steady_clock::now();
+	m_world->update(dt);
+	auto end = std::chrono::steady_clock::now();
+	m_status.updateSeconds = std::chrono::duration<double>(end - begin).count();
+	m_status.tick = tick;
+	m_busySeconds += m_status.updateSeconds;
+	measureLoad();
+
+	// Border crossings are sent before the status that finishes the tick
+	sendAgents();
+	MessageBuffer buffer;
+	getStatus().write(buffer);
+	sendMessage(m_socket, MessageType::Status, buffer);
+}
+
+void traffic::Worker::spawnTrips()
+{
+	// Trips belong to the worker that owns their start node at the departure time
+	const std::shared_ptr<Graph>& graph = m_world->getGraph();
+	for (; m_nextTrip < m_trips.size() &&
+		m_trips[m_nextTrip].departure <= m_world->getTime(); m_nextTrip++) {
+		const Trip& trip = m_trips[m_nextTrip];
+		int64_t index = graph->findNodeIndex(trip.startID);
+		if (index < 0 || m_nodeOwners[index] != m_id) continue;
+
+		Agent* agent = m_world->spawnAgent(trip.startID, trip.goalID);
+		agent->setTag(static_cast<int64_t>(m_nextTrip));
+		m_status.spawned++;
+	}
+}
+
+void traffic::Worker::receiveAgents(const AgentTransfer& transfer)
+{
+	for (const TransferredAgent& state : transfer.agents) {
+		Agent* agent = m_world->spawnAgent(state.nodeID, state.goalID);
+		agent->setDepartureTime(state.departureTime);
+		agent->setTag(state.tag);
+	}
+	m_status.received += transfer.agents.size();
+}
+
+void traffic::Worker::sendAgents()
+{
+	RouteCache* cache = m_world->getRouteCache();
+	const FastGraph* fastGraph = m_world->getGraph()->getFastGraph();
+	if (!cache || !fastGraph) return;
+
+	// Agents belong to the owner of the node at the start of their edge
+	std::vector<AgentTransfer> transfers;
+	std::vector<Agent*> leaving;
+	for (Agent* agent : m_world->getAgents()) {
+		if (agent->getState() != AgentState::Driving ||
+			cache->isFinished(agent->getPosition())) continue;
+
+		size_t node = fastGraph->getEdgeSource(cache->getEdge(agent->getPosition()));
+		uint32_t owner = m_nodeOwners[node];
+		if (owner == m_id) continue;
+
+		if (owner >= transfers.size())
+			transfers.resize(owner + 1);
+		transfers[owner].agents.push_back({ agent->getGoal(),
+			fastGraph->getNode(node).nodeID, agent->getDepartureTime(), agent->getTag() });
+		leaving.push_back(agent);
+	}
+
+	for (Agent* agent : leaving)
+		m_world->despawnAgent(agent);
+
+	MessageBuffer buffer;
+	for (uint32_t target = 0; target < transfers.size(); target++) {
+		AgentTransfer& transfer = transfers[target];
+		if (transfer.agents.empty()) continue;
+		transfer.source = m_id;
+		transfer.target = target;
+		buffer.clear();
+		transfer.write(buffer);
+		sendMessage(m_socket, MessageType::AgentTransfer, buffer);
+		m_status.sent += transfer.agents.size();
+	}
+}
+
+void traffic::Worker::updateOwners()
+{
+	const FastGraph* fastGraph = m_world->getGraph()->getFastGraph();
+	size_t nodes = fastGraph ? fastGraph->countNodes() : 0;
+	if (m_nodeChunks.size() != nodes) {
+		m_nodeChunks.resize(nodes);
+		for (size_t i = 0; i < nodes; i++) {
+			const FastGraphNode& node = fastGraph->getNode(i);
+			size_t chunk = m_chunks.getSegmentIndex(node.lat, node.lon);
+			m_nodeChunks[i] = chunk < m_chunkOwners.size() ?
+				static_cast<uint32_t>(chunk) : std::numeric_limits<uint32_t>::max();
+		}
+		m_chunkLoad.assign(m_chunkOwners.size(), 0);
+	}
+
+	if (m_settings.domains == DomainSplit::Graph) {
+		// The partition is deterministic, all workers compute the same domains
+		if (m_nodeOwners.size() != nodes)
+			m_nodeOwners = GraphPartitioner(*fastGraph).partition(m_settings.workers).nodeParts;
+	}
+	else {
+		m_nodeOwners.assign(nodes, 0);
+		for (size_t i = 0; i < nodes; i++) {
+			if (m_nodeChunks[i] != std::numeric_limits<uint32_t>::max())
+				m_nodeOwners[i] = m_chunkOwners[m_nodeChunks[i]];
+		}
+	}
+	m_status.chunks = std::count(m_chunkOwners.begin(), m_chunkOwners.end(), m_id);
+	m_status.nodes = std::count(m_nodeOwners.begin(), m_nodeOwners.end(), m_id);
+	m_ownersChanged = false;
+}
+
+void traffic::Worker::measureLoad()
+{
+	// Counts the agents in each chunk, agents waiting for their
+	// route are counted in the chunk of their start node.
+	RouteCache* cache = m_world->getRouteCache();
+	const std::shared_ptr<Graph>& graph = m_world->getGraph();
+	const FastGraph* fastGraph = graph->getFastGraph();
+	if (!cache || !fastGraph) return;
+
+	for (const Agent* agent : m_world->getAgents()) {
+		int64_t node = -1;
+		if (agent->getState() == AgentState::Driving && !cache->isFinished(agent->getPosition()))
+			node = static_cast<int64_t>(fastGraph->getEdgeSource(cache->getEdge(agent->getPosition())));
+		else if (agent->getState() == AgentState::Waiting)
+			node = graph->findNodeIndex(agent->getStart());
+		if (node >= 0 && m_nodeChunks[node] != std::numeric_limits<uint32_t>::max())
+			m_chunkLoad[m_nodeChunks[node]]++;
+	}
+	m_loadTicks++;
+}
+
+LoadReport traffic::Worker::createLoadReport()
+{
+	LoadReport report;
+	report.worker = m_id;
+	report.ticks = m_loadTicks;
+	report.busySeconds = m_busySeconds;
+	for (size_t c = 0; c < m_chunkLoad.size(); c++) {
+		if (m_chunkOwners[c] == m_id || m_chunkLoad[c] > 0)
+			report.chunks.push_back({ static_cast<uint32_t>(c), m_chunkLoad[c] });
+	}
+
+	std::fill(m_chunkLoad.begin(), m_chunkLoad.end(), 0);
+	m_loadTicks = 0;
+	m_busySeconds = 0.0;
+	return report;
+}
+
+WorkerStatus traffic::Worker::getStatus() const
+{
+	WorkerStatus status = m_status;
+	status.time = m_world->getTime();
+	status.agents = m_world->getAgents().size();
+	status.arrived = m_world->getArrivedCount();
+	return status;
+}
+
+// ---- RemoteWorker ---- //
+
+traffic::RemoteWorker::RemoteWorker(uint32_t id, int pid, int socket)
+	: m_id(id), m_pid(pid), m_socket(socket)
+{
+	m_status.worker = id;
+}
+
+traffic::RemoteWorker::~RemoteWorker()
+{
+	shutdown();
+}
+
+bool traffic::RemoteWorker::send(MessageType type)
+{
+	try {
+		sendMessage(m_socket, type, m_buffer);
+		return true;
+	}
+	catch (const std::runtime_error&) {
+		return false;
+	}
+}
+
+bool traffic::RemoteWorker::requestStatus(const StatusRequest& req)
+{
+	m_buffer.clear();
+	req.write(m_buffer);
+	if (!send(MessageType::StatusRequest)) return false;
+
+	MessageType type;
+	if (!receiveMessage(m_socket, type, m_buffer) || type != MessageType::Status)
+		return false;
+	m_status.read(m_buffer);
+	return true;
+}
+
+bool traffic::RemoteWorker::requestAgentTransfer(const AgentTransfer& req)
+{
+	m_buffer.clear();
+	req.write(m_buffer);
+	return send(MessageType::AgentTransfer);
+}
+
+bool traffic::RemoteWorker::requestBorderChange(const BorderChange& req)
+{
+	m_buffer.clear();
+	req.write(m_buffer);
+	return send(MessageType::BorderChange);
+}
+
+bool traffic::RemoteWorker::requestDataTransfer(const DataTransfer& req)
+{
+	m_buffer.clear();
+	req.write(m_buffer);
+	return send(MessageType::DataTransfer);
+}
+
+bool traffic::RemoteWorker::requestLoad(LoadReport& report)
+{
+	m_buffer.clear();
+	if (!send(MessageType::LoadRequest)) return false;
+
+	MessageType type;
+	if (!receiveMessage(m_socket, type, m_buffer) || type != MessageType::LoadReport)
+		return false;
+	report.read(m_buffer);
+	return true;
+}
+
+bool traffic::RemoteWorker::startTick(uint64_t tick, double dt)
+{
+	m_buffer.clear();
+	m_buffer.write(tick);
+	m_buffer.write(dt);
+	return send(MessageType::Tick);
+}
+
+bool traffic::RemoteWorker::finishTick(std::vector<AgentTransfer>& transfers)
+{
+	MessageType type;
+	while (receiveMessage(m_socket, type, m_buffer)) {
+		if (type == MessageType::AgentTransfer) {
+			transfers.emplace_back();
+			transfers.back().read(m_buffer);
+		}
+		else if (type == MessageType::Status) {
+			m_status.read(m_buffer);
+			return true;
+		}
+		else {
+			throw runtime_error("Coordinator received an unexpected message");
+		}
+	}
+	return false;
+}
+
+void traffic::RemoteWorker::shutdown()
+{
+#if !defined(_WIN32)
+	if (m_socket < 0) return;
+	m_buffer.clear();
+	send(MessageType::Shutdown);
+	::close(m_socket);
+	m_socket = -1;
+	if (m_pid > 0) {
+		int status;
+		::waitpid(m_pid, &status, 0);
+		m_pid = -1;
+	}
+#endif
+}
+
+const WorkerStatus& traffic::RemoteWorker::getStatus() const { return m_status; }
+uint32_t traffic::RemoteWorker::getID() const { return m_id; }
+int traffic::RemoteWorker::getSocket() const { return m_socket; }
+
+// ---- Coordinator ---- //
+
+traffic::Coordinator::Coordinator(const std::shared_ptr<OSMSegment>& map,
+	const std::vector<Trip>& trips, const DistributedSettings& settings)
+	: m_map(map), m_trips(trips), m_settings(settings)
+{
+	if (m_settings.workers == 0)
+		throw runtime_error("At least one worker is required");
+	m_chunks = std::make_unique<OSMMap>(m_map, m_settings.chunkSize);
+	assignChunks();
+}
+
+traffic::Coordinator::~Coordinator()
+{
+	stop();
+}
+
+void traffic::Coordinator::assignChunks()
+{
+	// Splits the chunks along the Hilbert curve into ranges with a
+	// similar number of nodes. Every range forms a compact region.
+	const std::vector<OSMSegment>& chunks = m_chunks->getChunks();
+	size_t total = 0;
+	for (const OSMSegment& chunk : chunks)
+		total += chunk.getNodeCount();
+
+	m_chunkOwners.resize(chunks.size());
+	size_t prefix = 0;
+	for (size_t chunk : m_chunks->getCurveOrder()) {
+		m_chunkOwners[chunk] = total == 0 ? 0 : static_cast<uint32_t>(std::min(
+			m_settings.workers - 1, prefix * m_settings.workers / total));
+		prefix += chunks[chunk].getNodeCount();
+	}
+}
+
+void traffic::Coordinator::start()
+{
+#if defined(_WIN32)
+	throw runtime_error("Distributed simulation requires a POSIX system");
+#else
+	if (!m_workers.empty()) return;
+	for (uint32_t id = 0; id < m_settings.workers; id++) {
+		int sockets[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+			throw runtime_error("Could not create socket pair");
+
+		// Flushes the output so it is not written twice by the child
+		fflush(stdout);
+		pid_t pid = ::fork();
+		if (pid < 0)
+			throw runtime_error("Could not fork worker process");
+
+		if (pid == 0) {
+			// The worker does not use the connections of its siblings
+			::close(sockets[0]);
+			for (const auto& worker : m_workers)
+				::close(worker->getSocket());
+
+			int code = 0;
+			try {
+				Worker worker(id, sockets[1], m_map, *m_chunks,
+					m_chunkOwners, m_trips, m_settings);
+				worker.setDataHandler(m_dataHandler);
+				worker.run();
+			}
+			catch (const std::exception& e) {
+				fprintf(stderr, "Worker %u failed: %s\n", id, e.what());
+				code = 1;
+			}
+			::close(sockets[1]);
+			fflush(stdout);
+			::_exit(code);
+		}
+
+		::close(sockets[1]);
+		m_workers.push_back(std::make_unique<RemoteWorker>(id, pid, sockets[0]));
+	}
+#endif
+}
+
+void traffic::Coordinator::step()
+{
+	auto begin = std::chrono::steady_clock::now();
+	for (auto& worker : m_workers) {
+		if (!worker->startTick(m_tick, m_settings.timeStep))
+			throw runtime_error("Lost connection to worker");
+	}
+
+	// All workers finish their tick before any agent is forwarded. Forwarding
+	// while a worker still writes its results could block both sides.
+	std::vector<AgentTransfer> transfers;
+	for (auto& worker : m_workers) {
+		if (!worker->finishTick(transfers))
+			throw runtime_error("Lost connection to worker");
+	}
+	for (const AgentTransfer& transfer : transfers) {
+		if (transfer.target >= m_workers.size()) continue;
+		m_workers[transfer.target]->requestAgentTransfer(transfer);
+		m_transfers += transfer.agents.size();
+	}
+
+	m_tick++;
+	m_tickSeconds += std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - begin).count();
+}
+
+void traffic::Coordinator::run(double duration)
+{
+	if (m_workers.empty()) start();
+	size_t steps = static_cast<size_t>(std::ceil(duration / m_settings.timeStep));
+	for (size_t i = 0; i < steps; i++)
+		step();
+}
+
+void traffic::Coordinator::stop()
+{
+	for (auto& worker : m_workers)
+		worker->shutdown();
+	m_workers.clear();
+}
+
+void traffic::Coordinator::moveChunk(size_t chunk, uint32_t worker)
+{
+	if (chunk >= m_chunkOwners.size() || worker >= m_settings.workers)
+		throw runtime_error("Invalid chunk or worker");
+	m_chunkOwners[chunk] = worker;
+
+	BorderChange change;
+	change.chunk = static_cast<uint32_t>(chunk);
+	change.worker = worker;
+	for (auto& remote : m_workers)
+		remote->requestBorderChange(change);
+}
+
+size_t traffic::Coordinator::assignOwners(const std::vector<uint32_t>& owners)
+{
+	if (owners.size() != m_chunkOwners.size())
+		throw runtime_error("Owner list does not match the chunk count");
+	size_t moved = 0;
+	for (size_t chunk = 0; chunk < owners.size(); chunk++) {
+		if (owners[chunk] != m_chunkOwners[chunk]) {
+			moveChunk(chunk, owners[chunk]);
+			moved++;
+		}
+	}
+	return moved;
+}
+
+void traffic::Coordinator::broadcast(const DataTransfer& data)
+{
+	for (auto& worker : m_workers)
+		worker->requestDataTransfer(data);
+}
+
+void traffic::Coordinator::setDataHandler(const std::function<void(uint32_t, const DataTransfer&)>& handler)
+{
+	m_dataHandler = handler;
+}
+
+std::vector<WorkerStatus> traffic::Coordinator::requestStatus()
+{
+	std::vector<WorkerStatus> status;
+	StatusRequest request;
+	request.tick = m_tick;
+	for (auto& worker : m_workers) {
+		if (!worker->requestStatus(request))
+			throw runtime_error("Lost connection to worker");
+		status.push_back(worker->getStatus());
+	}
+	return status;
+}
+
+std::vector<LoadReport> traffic::Coordinator::requestLoad()
+{
+	std::vector<LoadReport> reports(m_workers.size());
+	for (size_t i = 0; i < m_workers.size(); i++) {
+		if (!m_workers[i]->requestLoad(reports[i]))
+			throw runtime_error("Lost connection to worker");
+	}
+	return reports;
+}
+
+const OSMMap& traffic::Coordinator::getChunks() const { return *m_chunks; }
+size_t traffic::Coordinator::getWorkerCount() const noexcept { return m_settings.workers; }
+const std::vector<uint32_t>& traffic::Coordinator::getChunkOwners() const { return m_chunkOwners; }
+uint64_t traffic::Coordinator::getTick() const noexcept { return m_tick; }
+uint64_t traffic::Coordinator::getTransferCount() const noexcept { return m_transfers; }
+
+void traffic::Coordinator::summary() const
+{
+	printf("Coordinator: %zu workers, %llu ticks, %llu agent transfers, %.3fms per tick\n",
+		m_workers.size(), (unsigned long long)m_tick, (unsigned long long)m_transfers,
+		m_tick == 0 ? 0.0 : m_tickSeconds * 1000.0 / m_tick);
+	for (const auto& worker : m_workers) {
+		const WorkerStatus& status = worker->getStatus();
+		printf("    Worker %u: %llu chunks, %llu nodes, %llu agents, %llu spawned, %llu arrived, %llu sent, %llu received, update %.3fms\n",
+			status.worker, (unsigned long long)status.chunks, (unsigned long long)status.nodes,
+			(unsigned long long)status.agents,
+			(unsigned long long)status.spawned, (unsigned long long)status.arrived,
+			(unsigned long long)status.sent, (unsigned long long)status.received,
+			status.updateSeconds * 1000.0);
+	}
+}
+
+// ---- Distributed run ---- //
+
+void traffic::runDistributed(const DistributedRun& run)
+{
+	// The parser joins its own thread pool before the workers are forked
+	ParseArguments args;
+	args.file = run.map;
+	auto map = std::make_shared<OSMSegment>(parseXMLMap(args));
+
+	// Trips connect random nodes of the road network and depart
+	// during the first half of the run
+	vector<int64_t> roadNodes;
+	for (const OSMWay& way : *map->getWays()) {
+		if (way.hasTag("highway"))
+			roadNodes.insert(roadNodes.end(), way.getNodes().begin(), way.getNodes().end());
+	}
+	if (roadNodes.empty())
+		throw runtime_error("The map does not contain any roads");
+
+	SplitMix64 random(run.seed);
+	double duration = run.ticks * run.settings.timeStep;
+	vector<Trip> trips(run.trips);
+	for (Trip& trip : trips) {
+		trip.startID = roadNodes[random.index(roadNodes.size())];
+		trip.goalID = roadNodes[random.index(roadNodes.size())];
+		trip.departure = random.uniform() * duration * 0.5;
+	}
+
+	Coordinator coordinator(map, trips, run.settings);
+	if (run.settings.domains == DomainSplit::Graph) {
+		// The pool of the comparison is joined before the workers are forked
+		ConcurrencyManager manager(1);
+		World world(&manager, map);
+		const FastGraph* graph = world.getGraph() ? world.getGraph()->getFastGraph() : nullptr;
+		if (graph)
+			GraphPartitioner::compare(*graph, coordinator.getChunks(), coordinator.getWorkerCount());
+	}
+	coordinator.start();
+
+	std::unique_ptr<LoadBalancer> balancer;
+	if (run.balanceInterval > 0 && run.settings.domains == DomainSplit::Grid)
+		balancer = std::make_unique<LoadBalancer>(coordinator);
+
+	size_t workers = coordinator.getWorkerCount();
+	vector<double> totalSeconds(workers, 0.0), maxSeconds(workers, 0.0);
+	vector<WorkerStatus> status;
+	size_t measureTick = 0;
+	double predicted = 1.0;
+	for (size_t tick = 1; tick <= run.ticks; tick++) {
+		coordinator.step();
+		status = coordinator.requestStatus();
+		vector<double> seconds(workers, 0.0);
+		for (const WorkerStatus& worker : status) {
+			seconds[worker.worker] = worker.updateSeconds;
+			totalSeconds[worker.worker] += worker.updateSeconds;
+			maxSeconds[worker.worker] = std::max(maxSeconds[worker.worker], worker.updateSeconds);
+		}
+		if (!balancer) continue;
+
+		if (tick == measureTick) {
+			double mean = 0.0;
+			for (double value : seconds) mean += value / workers;
+			printf("LoadBalancer: tick %zu after migration, max %.3fms, mean %.3fms, imbalance %.3f (predicted %.3f)\n",
+				tick, *std::max_element(seconds.begin(), seconds.end()) * 1000.0, mean * 1000.0,
+				LoadBalancer::imbalance(seconds), predicted);
+		}
+		if (tick % run.balanceInterval == 0) {
+			BalanceReport report = balancer->balance();
+			report.summary();
+			// The agents of moved chunks are handed over during the next
+			// tick, the tick after that runs on the new partition
+			if (report.rebalanced) {
+				measureTick = tick + 2;
+				predicted = report.imbalanceAfter;
+			}
+		}
+	}
+
+	printf("Distributed run: %zu workers, %zu ticks, %zu trips, %llu agent transfers\n",
+		workers, run.ticks, trips.size(), (unsigned long long)coordinator.getTransferCount());
+	for (const WorkerStatus& worker : status) {
+		printf("    Worker %u: %.3fms mean, %.3fms max tick time, %llu agents, %llu sent, %llu received\n",
+			worker.worker, totalSeconds[worker.worker] * 1000.0 / run.ticks,
+			maxSeconds[worker.worker] * 1000.0, (unsigned long long)worker.agents,
+			(unsigned long long)worker.sent, (unsigned long long)worker.received);
+	}
+	coordinator.stop();
+}
@@ -0,0 +1,454 @@
+/// MIT License
+/// 
+/// Copyright (c) 2020 Konstantin Rolf
+/// 
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+/// 
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+/// 
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+/// 
+/// Written by Konstantin Rolf (konstantin.rolf@gmail.com)
+/// July 2020
+
+#pragma once
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "engine.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+
+#include "osm.h"
+#include "demand.h"
+
+namespace traffic
+{
+	class World;
+	class ConcurrencyManager;
+
+	/// <summary>Types of the messages exchanged between the coordinator and its workers</summary>
+	enum class MessageType : uint32_t {
+		StatusRequest = 1,	// Coordinator asks for a WorkerStatus
+		Status,				// Worker answers a StatusRequest or finishes a tick
+		AgentTransfer,		// Agents that cross the border between two workers
+		BorderChange,		// A chunk is assigned to another worker
+		DataTransfer,		// Arbitrary user data
+		Tick,				// Coordinator advances the simulation by one step
+		Shutdown,			// Worker leaves its message loop
+		LoadRequest,		// Coordinator asks for a LoadReport
+		LoadReport			// Worker answers a LoadRequest
+	};
+
+	/// <summary>
+	/// Binary buffer that stores the payload of a single message. Values are
+	/// copied in native byte order because all processes run on the same
+	/// machine. Only trivially copyable types can be written.
+	/// </summary>
+	class MessageBuffer
+	{
+	public:
+		void clear() noexcept;
+		void rewind() noexcept;
+		bool finished() const noexcept;
+
+		template<typename T>
+		void write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Type must be trivially copyable");
+			size_t offset = m_data.size();
+			m_data.resize(offset + sizeof(T));
+			std::memcpy(m_data.data() + offset, &value, sizeof(T));
+		}
+
+		template<typename T>
+		void writeVector(const std::vector<T>& values)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Type must be trivially copyable");
+			write<uint64_t>(values.size());
+			size_t offset = m_data.size();
+			m_data.resize(offset + values.size() * sizeof(T));
+			if (!values.empty())
+				std::memcpy(m_data.data() + offset, values.data(), values.size() * sizeof(T));
+		}
+
+		template<typename T>
+		T read()
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Type must be trivially copyable");
+			T value;
+			checkRead(sizeof(T));
+			std::memcpy(&value, m_data.data() + m_position, sizeof(T));
+			m_position += sizeof(T);
+			return value;
+		}
+
+		template<typename T>
+		void readVector(std::vector<T>& values)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Type must be trivially copyable");
+			uint64_t count = read<uint64_t>();
+			checkRead(count * sizeof(T));
+			values.resize(count);
+			if (count > 0)
+				std::memcpy(values.data(), m_data.data() + m_position, count * sizeof(T));
+			m_position += count * sizeof(T);
+		}
+
+		std::vector<uint8_t>& getData() noexcept;
+		const std::vector<uint8_t>& getData() const noexcept;
+
+	protected:
+		void checkRead(size_t bytes) const;
+
+		std::vector<uint8_t> m_data;
+		size_t m_position = 0;
+	};
+
+	/// <summary>Sends a message over a stream socket. Every message is prefixed by
+	/// its type and payload length. Throws a std::runtime_error on failure.</summary>
+	void sendMessage(int socket, MessageType type, const MessageBuffer& buffer);
+	/// <summary>Receives the next message from a stream socket</summary>
+	/// <returns>False if the other side closed the connection</returns>
+	bool receiveMessage(int socket, MessageType& type, MessageBuffer& buffer);
+
+	// ---- Messages ---- //
+
+	struct StatusRequest {
+		uint64_t tick = 0;
+
+		void write(MessageBuffer& buffer) const;
+		void read(MessageBuffer& buffer);
+	};
+
+	struct WorkerStatus {
+		uint32_t worker = 0;
+		uint64_t tick = 0;
+		double time = 0.0;
+		uint64_t agents = 0;	// Agents currently simulated by the worker
+		uint64_t spawned = 0;	// Agents spawned from trips
+		uint64_t arrived = 0;	// Agents that reached their goal
+		uint64_t sent = 0;		// Agents transferred to other workers
+		uint64_t received = 0;	// Agents transferred from other workers
+		uint64_t chunks = 0;	// Number of owned chunks
+		uint64_t nodes = 0;		// Number of owned graph nodes
+		double updateSeconds = 0.0; // Wall time of the last world update
+
+		void write(MessageBuffer& buffer) const;
+		void read(MessageBuffer& buffer);
+	};
+
+	/// <summary>State of an agent that continues its trip on another worker.
+	/// The receiving worker plans a new route from nodeID to goalID.</summary>
+	struct TransferredAgent {
+		int64_t goalID;
+		int64_t nodeID;
+		double departureTime;
+		int64_t tag;
+	};
+
+	struct AgentTransfer {
+		uint32_t source = 0;
+		uint32_t target = 0;
+		std::vector<TransferredAgent> agents;
+
+		void write(MessageBuffer& buffer) const;
+		void read(MessageBuffer& buffer);
+	};
+
+	/// <summary>Assigns a chunk of the OSMMap to another worker</summary>
+	struct BorderChange {
+		uint32_t chunk = 0;
+		uint32_t worker = 0;
+
+		void write(MessageBuffer& buffer) const;
+		void read(MessageBuffer& buffer);
+	};
+
+	struct DataTransfer {
+		uint32_t tag = 0;
+		std::vector<uint8_t> data;
+
+		void write(MessageBuffer& buffer) const;
+		void read(MessageBuffer& buffer);
+	};
+
+	struct ChunkLoad {
+		uint32_t chunk;
+		uint64_t agentTicks; // Sum of the agents in the chunk over all ticks
+	};
+
+	/// <summary>Load measured by a worker since its last LoadReport</summary>
+	struct LoadReport {
+		uint32_t worker = 0;
+		uint64_t ticks = 0;
+		double busySeconds = 0.0; // Wall time spent in world updates
+		std::vector<ChunkLoad> chunks;
+
+		void write(MessageBuffer& buffer) const;
+		void read(MessageBuffer& buffer);
+	};
+
+	class WorkerInterface {
+	public:
+		virtual ~WorkerInterface() = default;
+
+		/// Checks the status of the Worker. The function will return
+		/// true if this worker is active and successfully connected to
+		/// the network. Returns false otherwise.
+		virtual bool requestStatus(const StatusRequest& req) = 0;
+
+		/// Requests to transfer an agent from the current worker to
+		/// this worker. Returns true if the transfer was successfully.
+		/// Returns false if the transfer failed.
+		virtual bool requestAgentTransfer(const AgentTransfer& req) = 0;
+
+		/// Requests to change the position of a border node. This cannot
+		/// be done by the worker on its own because the coordination of
+		/// both workers is needed to change it. Returns true if the change
+		/// was successfully. Returns false otherwise.
+		virtual bool requestBorderChange(const BorderChange& req) = 0;
+
+		/// Requests to transfer data to this worker. This function may
+		/// be used to transfer arbitrary data between the workers.
+		virtual bool requestDataTransfer(const DataTransfer& rqeq) = 0;
+	};
+
+	/// <summary>How the simulation domains of the workers are formed</summary>
+	enum class DomainSplit {
+		Grid,	// Ranges of OSMMap chunks, can be rebalanced by moving chunks
+		Graph	// Multilevel graph partition with balanced edges and a minimal cut
+	};
+
+	struct DistributedSettings {
+		/// <summary>Number of worker processes</summary>
+		size_t workers = 4;
+		/// <summary>Thread pool size of each worker</summary>
+		size_t threadsPerWorker = 1;
+		/// <summary>Side length of the OSMMap chunks in degrees</summary>
+		prec_t chunkSize = 0.01f;
+		/// <summary>Simulation time step in seconds</summary>
+		double timeStep = 1.0;
+		/// <summary>Graph domains are computed by every worker with the same
+		/// seed and ignore chunk border changes</summary>
+		DomainSplit domains = DomainSplit::Grid;
+	};
+
+	// ---- Worker process ---- //
+
+	/// <summary>
+	/// Simulates the part of the world that lies in the domain of this worker,
+	/// either its chunks or its graph partition. Every worker holds the complete
+	/// road graph, agents are only simulated by the worker that owns the start
+	/// node of their current edge. Agents that enter a foreign domain are sent
+	/// to its owner after the tick.
+	/// </summary>
+	class Worker
+	{
+	public:
+		/// <summary>Creates the world of a worker. Must be called in the worker process.</summary>
+		/// <param name="id">The index of the worker</param>
+		/// <param name="socket">The connection to the coordinator</param>
+		/// <param name="map">The complete map</param>
+		/// <param name="chunks">The chunk partition of the map</param>
+		/// <param name="owners">The owning worker of every chunk</param>
+		/// <param name="trips">All trips, only the trips starting in owned chunks are spawned</param>
+		/// <param name="settings">The thread count and domain split of the simulation</param>
+		Worker(uint32_t id, int socket,
+			const std::shared_ptr<OSMSegment>& map, const OSMMap& chunks,
+			const std::vector<uint32_t>& owners, const std::vector<Trip>& trips,
+			const DistributedSettings& settings);
+		~Worker();
+
+		/// <summary>Handles messages until the coordinator sends a shutdown</summary>
+		void run();
+
+		/// <summary>Sets the function that receives DataTransfer messages</summary>
+		void setDataHandler(const std::function<void(uint32_t, const DataTransfer&)>& handler);
+
+	protected:
+		void tick(uint64_t tick, double dt);
+		void spawnTrips();
+		void receiveAgents(const AgentTransfer& transfer);
+		void sendAgents();
+		void updateOwners();
+		void measureLoad();
+		LoadReport createLoadReport();
+		WorkerStatus getStatus() const;
+
+		uint32_t m_id;
+		int m_socket;
+		DistributedSettings m_settings;
+		const OSMMap& m_chunks;
+		std::vector<uint32_t> m_chunkOwners;
+		std::vector<uint32_t> m_nodeOwners; // Owner of every FastGraph node
+		std::vector<uint32_t> m_nodeChunks; // Chunk of every FastGraph node
+		std::vector<uint64_t> m_chunkLoad; // Agent ticks since the last report
+		uint64_t m_loadTicks = 0;
+		double m_busySeconds = 0.0;
+		std::vector<Trip> m_trips;
+		size_t m_nextTrip = 0;
+
+		std::unique_ptr<ConcurrencyManager> m_manager;
+		std::unique_ptr<World> m_world;
+		std::function<void(uint32_t, const DataTransfer&)> m_dataHandler;
+		WorkerStatus m_status;
+		bool m_ownersChanged = false;
+	};
+
+	// ---- Coordinator process ---- //
+
+	/// <summary>Proxy of a worker process on the side of the coordinator</summary>
+	class RemoteWorker : public WorkerInterface
+	{
+	public:
+		RemoteWorker(uint32_t id, int pid, int socket);
+		virtual ~RemoteWorker();
+
+		RemoteWorker(const RemoteWorker&) = delete;
+		RemoteWorker& operator=(const RemoteWorker&) = delete;
+
+		virtual bool requestStatus(const StatusRequest& req) override;
+		virtual bool requestAgentTransfer(const AgentTransfer& req) override;
+		virtual bool requestBorderChange(const BorderChange& req) override;
+		virtual bool requestDataTransfer(const DataTransfer& req) override;
+		/// <summary>Requests the load the worker measured since the last request</summary>
+		bool requestLoad(LoadReport& report);
+
+		/// <summary>Starts a tick on the worker</summary>
+		bool startTick(uint64_t tick, double dt);
+		/// <summary>Waits until the worker finished its tick and collects
+		/// the agents it sends to other workers</summary>
+		bool finishTick(std::vector<AgentTransfer>& transfers);
+
+		/// <summary>Stops the worker and waits for the process to exit</summary>
+		void shutdown();
+
+		const WorkerStatus& getStatus() const;
+		uint32_t getID() const;
+		int getSocket() const;
+
+	protected:
+		bool send(MessageType type);
+
+		uint32_t m_id;
+		int m_pid;
+		int m_socket;
+		MessageBuffer m_buffer;
+		WorkerStatus m_status;
+	};
+
+	/// <summary>
+	/// Runs a simulation distributed over several worker processes on this
+	/// machine. The map is partitioned into OSMMap chunks which are assigned
+	/// to the workers. Every worker is forked from the coordinator and
+	/// connected through a Unix socket pair. The workers advance in lockstep,
+	/// agents that cross a border are relayed by the coordinator and continue
+	/// on their new worker during the next tick.
+	/// </summary>
+	class Coordinator
+	{
+	public:
+		Coordinator(const std::shared_ptr<OSMSegment>& map,
+			const std::vector<Trip>& trips, const DistributedSettings& settings);
+		~Coordinator();
+
+		Coordinator(const Coordinator&) = delete;
+		Coordinator& operator=(const Coordinator&) = delete;
+
+		/// <summary>Forks the worker processes. Should be called before any
+		/// thread pool is created in this process.</summary>
+		void start();
+		/// <summary>Advances all workers by a single time step</summary>
+		void step();
+		/// <summary>Advances all workers by the given simulation time</summary>
+		void run(double duration);
+		/// <summary>Stops all workers</summary>
+		void stop();
+
+		/// <summary>Assigns a chunk to another worker. Agents in the chunk
+		/// are handed over at the end of the next tick.</summary>
+		void moveChunk(size_t chunk, uint32_t worker);
+
+		/// <summary>Sends user data to all workers</summary>
+		void broadcast(const DataTransfer& data);
+		/// <summary>Sets the function that handles DataTransfer messages. It
+		/// is called inside the worker processes with the worker index.
+		/// Must be set before the workers are started.</summary>
+		void setDataHandler(const std::function<void(uint32_t, const DataTransfer&)>& handler);
+
+		/// <summary>Assigns all chunks at once. Only changed chunks are sent.</summary>
+		/// <returns>The number of chunks that changed their owner</returns>
+		size_t assignOwners(const std::vector<uint32_t>& owners);
+
+		/// <summary>Requests the current status of all workers</summary>
+		std::vector<WorkerStatus> requestStatus();
+		/// <summary>Requests the load of all workers since the last request</summary>
+		std::vector<LoadReport> requestLoad();
+
+		const OSMMap& getChunks() const;
+		const std::vector<uint32_t>& getChunkOwners() const;
+		size_t getWorkerCount() const noexcept;
+		uint64_t getTick() const noexcept;
+		uint64_t getTransferCount() const noexcept;
+
+		void summary() const;
+
+	protected:
+		void assignChunks();
+
+		std::shared_ptr<OSMSegment> m_map;
+		std::vector<Trip> m_trips;
+		DistributedSettings m_settings;
+		std::unique_ptr<OSMMap> m_chunks;
+		std::vector<uint32_t> m_chunkOwners;
+		std::vector<std::unique_ptr<RemoteWorker>> m_workers;
+		std::function<void(uint32_t, const DataTransfer&)> m_dataHandler;
+		uint64_t m_tick = 0;
+		uint64_t m_transfers = 0;
+		double m_tickSeconds = 0.0;
+	};
+
+	/// <summary>Options of a distributed run that is started from the command line</summary>
+	struct DistributedRun {
+		std::string map;
+		size_t ticks = 100;
+		size_t trips = 1000;	// Random trips between the nodes of the road network
+		uint64_t seed = 1;
+		size_t balanceInterval = 0;	// Ticks between LoadBalancer runs, 0 disables balancing
+		DistributedSettings settings;
+	};
+
+	/// <summary>
+	/// Loads a map, generates random trips and simulates them on forked
+	/// workers. Prints the mean and maximum tick time and the transferred
+	/// agents of every worker. Grid domains are rebalanced every
+	/// balanceInterval ticks, the imbalance that is measured in the tick
+	/// after the chunks migrated is printed next to the predicted one.
+	/// Graph domains are compared against the grid split before the run.
+	/// Must be called before any thread pool is created in this process.
+	/// </summary>
+	void runDistributed(const DistributedRun& run);
+}
+
+#endif